@@ -32,6 +32,12 @@ class OwncloudDolphinPlugin : public KOverlayIconPlugin
 
     using StatusMap = QHash<QByteArray, QByteArray>;
     StatusMap m_status;
+    // Most recently shown last, the oldest ones get unsubscribed
+    QList<QByteArray> m_subscribedDirectories;
+    static const int maxSubscribedDirectories = 16;
+    // Directories whose RETRIEVE_DIRECTORY_STATUS reply hasn't ended yet,
+    // with the files that were shown meanwhile
+    QHash<QByteArray, QList<QByteArray>> m_pendingDirectories;
 
 public:
 
@@ -50,7 +56,27 @@ public:
         QDir localPath(url.toLocalFile());
         const QByteArray localFile = localPath.canonicalPath().toUtf8();
 
-        helper->sendCommand(QByteArray("RETRIEVE_FILE_STATUS:" + localFile + "\n"));
+        // Newer clients send the statuses of a whole directory at once and
+        // its status changes in batches
+        const QByteArray directory = localFile.left(localFile.lastIndexOf('/'));
+        const bool directorySubscribed = helper->isVersionAtLeast(1, 2);
+        if (directorySubscribed) {
+            const int index = m_subscribedDirectories.lastIndexOf(directory);
+            if (index == -1) {
+                subscribe(directory);
+            } else if (index != m_subscribedDirectories.size() - 1) {
+                m_subscribedDirectories.move(index, m_subscribedDirectories.size() - 1);
+            }
+        }
+        // The pending directory reply should include this file, it's asked for
+        // at the end if it didn't
+        auto pending = m_pendingDirectories.find(directory);
+        if (directorySubscribed && pending != m_pendingDirectories.end()) {
+            if (!pending->contains(localFile))
+                pending->append(localFile);
+        } else if (!directorySubscribed || !m_status.contains(localFile)) {
+            helper->sendCommand(QByteArray("RETRIEVE_FILE_STATUS:" + localFile + "\n"));
+        }
 
         StatusMap::iterator it = m_status.find(localFile);
         if (it != m_status.constEnd()) {
@@ -60,6 +86,31 @@ public:
     }
 
 private:
+    void subscribe(const QByteArray &directory) {
+        auto helper = OwncloudDolphinPluginHelper::instance();
+        // Dolphin doesn't tell when a directory isn't shown anymore
+        if (m_subscribedDirectories.size() >= maxSubscribedDirectories) {
+            const QByteArray oldest = m_subscribedDirectories.takeFirst();
+            requestUncoveredFiles(oldest);
+            helper->sendCommand(QByteArray("UNSUBSCRIBE_STATUS:" + oldest + "\n"));
+        }
+        m_subscribedDirectories.append(directory);
+        m_pendingDirectories.insert(directory, {});
+        helper->sendCommand(QByteArray("SUBSCRIBE_STATUS:" + directory + "\n"));
+        helper->sendCommand(QByteArray("RETRIEVE_DIRECTORY_STATUS:" + directory + "\n"));
+    }
+
+    // The reply has no entries for directories outside of the sync folders,
+    // such as the one containing a sync folder
+    void requestUncoveredFiles(const QByteArray &directory) {
+        auto helper = OwncloudDolphinPluginHelper::instance();
+        const auto files = m_pendingDirectories.take(directory);
+        for (const auto &file : files) {
+            if (!m_status.contains(file))
+                helper->sendCommand(QByteArray("RETRIEVE_FILE_STATUS:" + file + "\n"));
+        }
+    }
+
     QStringList overlaysForString(const QByteArray &status) {
         QStringList r;
         if (status.startsWith("NOP"))
@@ -81,6 +132,17 @@ private:
     }
 
     void slotCommandRecieved(const QByteArray &line) {
+        // Sent after (re)connecting, the subscriptions were lost with the old connection
+        if (line.startsWith("VERSION:")) {
+            m_subscribedDirectories.clear();
+            m_pendingDirectories.clear();
+            return;
+        }
+        const QByteArray directoryEnd = "RETRIEVE_DIRECTORY_STATUS:END:";
+        if (line.startsWith(directoryEnd)) {
+            requestUncoveredFiles(line.mid(directoryEnd.size()));
+            return;
+        }
 
         QList<QByteArray> tokens = line.split(':');
         if (tokens.count() < 3)
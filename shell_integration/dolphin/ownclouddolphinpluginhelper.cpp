@@ -51,6 +51,14 @@ bool OwncloudDolphinPluginHelper::isConnected() const
     return _socket.state() == QLocalSocket::ConnectedState;
 }
 
+bool OwncloudDolphinPluginHelper::isVersionAtLeast(int major, int minor) const
+{
+    const auto parts = _version.split('.');
+    const int versionMajor = parts.value(0).toInt();
+    const int versionMinor = parts.value(1).toInt();
+    return versionMajor > major || (versionMajor == major && versionMinor >= minor);
+}
+
 void OwncloudDolphinPluginHelper::sendCommand(const char* data)
 {
     _socket.write(data);
@@ -51,6 +51,8 @@ public:
     QString emailPrivateLinkTitle() const { return _strings["EMAIL_PRIVATE_LINK_MENU_TITLE"]; }
 
     QByteArray version() { return _version; }
+    /// Compares the socket API version numerically, "1.10" is newer than "1.2"
+    bool isVersionAtLeast(int major, int minor) const;
 
 signals:
     void commandRecieved(const QByteArray &cmd);
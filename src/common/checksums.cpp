@@ -23,6 +23,7 @@
 #include <QLoggingCategory>
 #include <qtconcurrentrun.h>
 #include <QCryptographicHash>
+#include <QThreadPool>
 
 #ifdef ZLIB_FOUND
 #include <zlib.h>
@@ -249,7 +250,7 @@ void ComputeChecksum::startImpl(std::unique_ptr<QIODevice> device)
 
     // Bug: The thread will keep running even if ComputeChecksum is deleted.
     auto type = checksumType();
-    _watcher.setFuture(QtConcurrent::run([sharedDevice, type]() {
+    _watcher.setFuture(QtConcurrent::run(threadPool(), [sharedDevice, type]() {
         if (!sharedDevice->open(QIODevice::ReadOnly)) {
             if (auto file = qobject_cast<QFile *>(sharedDevice.data())) {
                 qCWarning(lcChecksums) << "Could not open file" << file->fileName()
@@ -266,6 +267,12 @@ void ComputeChecksum::startImpl(std::unique_ptr<QIODevice> device)
     }));
 }
 
+QThreadPool *ComputeChecksum::threadPool()
+{
+    static QThreadPool pool;
+    return &pool;
+}
+
 QByteArray ComputeChecksum::computeNowOnFile(const QString &filePath, const QByteArray &checksumType)
 {
     QFile file(filePath);
@@ -28,6 +28,7 @@
 #include <memory>
 
 class QFile;
+class QThreadPool;
 
 namespace OCC {
 
@@ -117,6 +118,13 @@ public:
      */
     static QByteArray computeNowOnFile(const QString &filePath, const QByteArray &checksumType);
 
+    /**
+     * The threads computing checksums for start(), shared by all syncs.
+     *
+     * Its maximum thread count limits how many files are hashed at once.
+     */
+    static QThreadPool *threadPool();
+
 signals:
     void done(const QByteArray &checksumType, const QByteArray &checksum);
 
@@ -18,6 +18,7 @@
 
 #include <QCryptographicHash>
 #include <QFile>
+#include <QFileInfo>
 #include <QLoggingCategory>
 #include <QStringList>
 #include <QElapsedTimer>
@@ -47,7 +48,7 @@ Q_LOGGING_CATEGORY(lcDb, "nextcloud.sync.database", QtInfoMsg)
 
 #define GET_FILE_RECORD_QUERY \
         "SELECT path, inode, modtime, type, md5, fileid, remotePerm, filesize," \
-        "  ignoredChildrenRemote, contentchecksumtype.name || ':' || contentChecksum, e2eMangledName, isE2eEncrypted " \
+        "  ignoredChildrenRemote, contentchecksumtype.name || ':' || contentChecksum, e2eMangledName, isE2eEncrypted, localDirModtime " \
         " FROM metadata" \
         "  LEFT JOIN checksumtype as contentchecksumtype ON metadata.contentChecksumTypeId == contentchecksumtype.id"
 
@@ -65,6 +66,7 @@ static void fillFileRecordFromGetQuery(SyncJournalFileRecord &rec, SqlQuery &que
     rec._checksumHeader = query.baValue(9);
     rec._e2eMangledName = query.baValue(10);
     rec._isE2eEncrypted = query.intValue(11) > 0;
+    rec._localDirModtime = query.int64Value(12);
 }
 
 static QByteArray defaultJournalMode(const QString &dbPath)
@@ -221,6 +223,12 @@ void SyncJournalDb::walCheckpoint()
     }
 }
 
+void SyncJournalDb::setCacheLimits(const CacheLimits &limits)
+{
+    QMutexLocker locker(&_mutex);
+    _cacheLimits = limits;
+}
+
 void SyncJournalDb::startTransaction()
 {
     if (_transaction == 0) {
@@ -314,6 +322,16 @@ bool SyncJournalDb::checkConnect()
         qCInfo(lcDb) << "sqlite3 locking_mode=" << pragma1.stringValue(0);
     }
 
+    // The page size can only be chosen before the first table is created
+    const qint64 dbFileSize = QFileInfo(_dbFile).size();
+    if (_cacheLimits.pageSize > 0 && dbFileSize == 0) {
+        pragma1.prepare("PRAGMA page_size = " + QByteArray::number(_cacheLimits.pageSize) + ";");
+        if (!pragma1.exec()) {
+            return sqlFail(QStringLiteral("Set PRAGMA page_size"), pragma1);
+        }
+        qCInfo(lcDb) << "sqlite3 page_size=" << _cacheLimits.pageSize;
+    }
+
     pragma1.prepare("PRAGMA journal_mode=" + _journalMode + ";");
     if (!pragma1.exec()) {
         return sqlFail(QStringLiteral("Set PRAGMA journal_mode"), pragma1);
@@ -344,6 +362,29 @@ bool SyncJournalDb::checkConnect()
         qCInfo(lcDb) << "sqlite3 synchronous=" << synchronousMode;
     }
 
+    // Map the whole journal, leaving room for it to grow during the sync.
+    // Large journals are otherwise dominated by page cache misses during discovery.
+    if (_cacheLimits.mmapSize > 0) {
+        const qint64 mmapSize = qMin(_cacheLimits.mmapSize, dbFileSize + dbFileSize / 4 + 16 * 1024 * 1024);
+        pragma1.prepare("PRAGMA mmap_size = " + QByteArray::number(mmapSize) + ";");
+        if (!pragma1.exec()) {
+            return sqlFail(QStringLiteral("Set PRAGMA mmap_size"), pragma1);
+        } else {
+            pragma1.next();
+            qCInfo(lcDb) << "sqlite3 mmap_size=" << pragma1.int64Value(0);
+        }
+    }
+
+    // A negative cache_size is in KiB instead of pages
+    if (_cacheLimits.cacheSize > 0) {
+        const qint64 cacheSize = qMax<qint64>(qMin(_cacheLimits.cacheSize, dbFileSize), 2 * 1024 * 1024);
+        pragma1.prepare("PRAGMA cache_size = -" + QByteArray::number(cacheSize / 1024) + ";");
+        if (!pragma1.exec()) {
+            return sqlFail(QStringLiteral("Set PRAGMA cache_size"), pragma1);
+        }
+        qCInfo(lcDb) << "sqlite3 cache_size=" << cacheSize / 1024 << "KiB";
+    }
+
     pragma1.prepare("PRAGMA case_sensitive_like = ON;");
     if (!pragma1.exec()) {
         return sqlFail(QStringLiteral("Set PRAGMA case_sensitivity"), pragma1);
@@ -508,6 +549,24 @@ bool SyncJournalDb::checkConnect()
         return sqlFail(QStringLiteral("Create table conflicts"), createQuery);
     }
 
+    // create the remote subtree tracking table.
+    createQuery.prepare("CREATE TABLE IF NOT EXISTS remotesubtrees("
+                        "path TEXT PRIMARY KEY,"
+                        "scheduled INTEGER(8),"
+                        "verified INTEGER(8)"
+                        ");");
+    if (!createQuery.exec()) {
+        return sqlFail(QStringLiteral("Create table remotesubtrees"), createQuery);
+    }
+
+    // create the persisted local change table.
+    createQuery.prepare("CREATE TABLE IF NOT EXISTS localchanges("
+                        "path TEXT PRIMARY KEY"
+                        ");");
+    if (!createQuery.exec()) {
+        return sqlFail(QStringLiteral("Create table localchanges"), createQuery);
+    }
+
     createQuery.prepare("CREATE TABLE IF NOT EXISTS version("
                         "major INTEGER(8),"
                         "minor INTEGER(8),"
@@ -636,6 +695,10 @@ void SyncJournalDb::close()
     _db.close();
     clearEtagStorageFilter();
     _metadataTableIsEmpty = false;
+    _errorBlacklistCache.clear();
+    _errorBlacklistCacheLoaded = false;
+    _pinStateCache.clear();
+    _pinStateCacheLoaded = false;
 }
 
 
@@ -772,6 +835,16 @@ bool SyncJournalDb::updateMetadataTableStructure()
         commitInternal(QStringLiteral("update database structure: add isE2eEncrypted col"));
     }
 
+    if (!columns.contains("localDirModtime")) {
+        SqlQuery query(_db);
+        query.prepare("ALTER TABLE metadata ADD COLUMN localDirModtime INTEGER(8);");
+        if (!query.exec()) {
+            sqlFail(QStringLiteral("updateMetadataTableStructure: add localDirModtime column"), query);
+            re = false;
+        }
+        commitInternal(QStringLiteral("update database structure: add localDirModtime col"));
+    }
+
     auto uploadInfoColumns = tableColumns("uploadinfo");
     if (uploadInfoColumns.isEmpty())
         return false;
@@ -938,8 +1011,10 @@ Result<void, QString> SyncJournalDb::setFileRecord(const SyncJournalFileRecord &
         int contentChecksumTypeId = mapChecksumType(checksumType);
 
         const PreparedSqlQueryRAII query(&_setFileRecordQuery, QByteArrayLiteral("INSERT OR REPLACE INTO metadata "
-            "(phash, pathlen, path, inode, uid, gid, mode, modtime, type, md5, fileid, remotePerm, filesize, ignoredChildrenRemote, contentChecksum, contentChecksumTypeId, e2eMangledName, isE2eEncrypted) "
-            "VALUES (?1 , ?2, ?3 , ?4 , ?5 , ?6 , ?7,  ?8 , ?9 , ?10, ?11, ?12, ?13, ?14, ?15, ?16, ?17, ?18);"),
+            "(phash, pathlen, path, inode, uid, gid, mode, modtime, type, md5, fileid, remotePerm, filesize, ignoredChildrenRemote, contentChecksum, contentChecksumTypeId, e2eMangledName, isE2eEncrypted, localDirModtime) "
+            "VALUES (?1 , ?2, ?3 , ?4 , ?5 , ?6 , ?7,  ?8 , ?9 , ?10, ?11, ?12, ?13, ?14, ?15, ?16, ?17, ?18, "
+            // Records built from sync items don't know the listed local mtime, keep it
+            "CASE WHEN ?19 != 0 THEN ?19 ELSE (SELECT localDirModtime FROM metadata WHERE phash == ?1 AND type == ?9) END);"),
                                          _db);
         if (!query) {
             return query->error();
@@ -963,6 +1038,7 @@ Result<void, QString> SyncJournalDb::setFileRecord(const SyncJournalFileRecord &
         query->bindValue(16, contentChecksumTypeId);
         query->bindValue(17, record._e2eMangledName);
         query->bindValue(18, record._isE2eEncrypted);
+        query->bindValue(19, record._localDirModtime);
 
         if (!query->exec()) {
             return query->error();
@@ -1246,6 +1322,72 @@ bool SyncJournalDb::getFileRecordsByFileId(const QByteArray &fileId, const std::
     return true;
 }
 
+bool SyncJournalDb::getFileRecordsByNumericFileId(qint64 numericFileId, const std::function<void(const SyncJournalFileRecord &)> &rowCallback)
+{
+    QMutexLocker locker(&_mutex);
+
+    if (numericFileId <= 0 || _metadataTableIsEmpty)
+        return true; // no error, yet nothing found
+
+    if (!checkConnect())
+        return false;
+
+    // Ids are the number padded to eight digits followed by the instance id.
+    // The GLOB prefix can use the fileid index.
+    const PreparedSqlQueryRAII query(&_getFileRecordQueryByNumericFileId, QByteArrayLiteral(GET_FILE_RECORD_QUERY " WHERE fileid GLOB ?1"), _db);
+    if (!query) {
+        return false;
+    }
+
+    query->bindValue(1, QByteArray::number(numericFileId).rightJustified(8, '0') + "[!0-9]*");
+
+    if (!query->exec())
+        return false;
+
+    forever {
+        auto next = query->next();
+        if (!next.ok)
+            return false;
+        if (!next.hasData)
+            break;
+
+        SyncJournalFileRecord rec;
+        fillFileRecordFromGetQuery(rec, *query);
+        rowCallback(rec);
+    }
+
+    return true;
+}
+
+bool SyncJournalDb::getFileRecordKeys(const std::function<void(const QByteArray &path, quint64 inode, const QByteArray &fileId)> &rowCallback)
+{
+    QMutexLocker locker(&_mutex);
+
+    if (_metadataTableIsEmpty)
+        return true; // no error, yet nothing found
+
+    if (!checkConnect())
+        return false;
+
+    const PreparedSqlQueryRAII query(&_getFileRecordKeysQuery, QByteArrayLiteral("SELECT path, inode, fileid FROM metadata"), _db);
+    if (!query)
+        return false;
+
+    if (!query->exec())
+        return false;
+
+    forever {
+        auto next = query->next();
+        if (!next.ok)
+            return false;
+        if (!next.hasData)
+            break;
+        rowCallback(query->baValue(0), query->int64Value(1), query->baValue(2));
+    }
+
+    return true;
+}
+
 bool SyncJournalDb::getFilesBelowPath(const QByteArray &path, const std::function<void(const SyncJournalFileRecord&)> &rowCallback)
 {
     QMutexLocker locker(&_mutex);
@@ -1393,6 +1535,25 @@ bool SyncJournalDb::updateFileRecordChecksum(const QString &filename,
     return query->exec();
 }
 
+bool SyncJournalDb::setLocalDirModtime(const QByteArray &path, qint64 modtime)
+{
+    QMutexLocker locker(&_mutex);
+    if (!checkConnect()) {
+        qCWarning(lcDb) << "Failed to connect database.";
+        return false;
+    }
+
+    const PreparedSqlQueryRAII query(&_setLocalDirModtimeQuery, QByteArrayLiteral("UPDATE metadata SET localDirModtime=?2 WHERE phash == ?1 AND type == ?3;"), _db);
+    if (!query) {
+        return false;
+    }
+
+    query->bindValue(1, getPHash(path));
+    query->bindValue(2, modtime);
+    query->bindValue(3, ItemTypeDirectory);
+    return query->exec();
+}
+
 bool SyncJournalDb::updateLocalMetadata(const QString &filename,
     qint64 modtime, qint64 size, quint64 inode)
 
@@ -1697,6 +1858,12 @@ QVector<uint> SyncJournalDb::deleteStaleUploadInfos(const QSet<QString> &keep)
     return ids;
 }
 
+// Matches the COLLATE NOCASE of _getErrorBlacklistQuery
+static QString errorBlacklistCacheKey(const QString &file)
+{
+    return Utility::fsCasePreserving() ? file.toCaseFolded() : file;
+}
+
 SyncJournalErrorBlacklistRecord SyncJournalDb::errorBlacklistEntry(const QString &file)
 {
     QMutexLocker locker(&_mutex);
@@ -1705,6 +1872,15 @@ SyncJournalErrorBlacklistRecord SyncJournalDb::errorBlacklistEntry(const QString
     if (file.isEmpty())
         return entry;
 
+    if (_errorBlacklistCacheLoaded) {
+        auto it = _errorBlacklistCache.constFind(errorBlacklistCacheKey(file));
+        if (it != _errorBlacklistCache.constEnd()) {
+            entry = *it;
+            entry._file = file;
+        }
+        return entry;
+    }
+
     if (checkConnect()) {
         const PreparedSqlQueryRAII query(&_getErrorBlacklistQuery);
         query->bindValue(1, file);
@@ -1736,19 +1912,32 @@ bool SyncJournalDb::deleteStaleErrorBlacklistEntries(const QSet<QString> &keep)
         return false;
     }
 
-    SqlQuery query(_db);
-    query.prepare("SELECT path FROM blacklist");
+    QStringList superfluousPaths;
 
-    if (!query.exec()) {
-        return false;
-    }
+    if (_errorBlacklistCacheLoaded) {
+        for (auto it = _errorBlacklistCache.begin(); it != _errorBlacklistCache.end();) {
+            if (!keep.contains(it->_file)) {
+                superfluousPaths.append(it->_file);
+                it = _errorBlacklistCache.erase(it);
+            } else {
+                ++it;
+            }
+        }
+        if (superfluousPaths.isEmpty())
+            return true;
+    } else {
+        SqlQuery query(_db);
+        query.prepare("SELECT path FROM blacklist");
 
-    QStringList superfluousPaths;
+        if (!query.exec()) {
+            return false;
+        }
 
-    while (query.next().hasData) {
-        const QString file = query.stringValue(0);
-        if (!keep.contains(file)) {
-            superfluousPaths.append(file);
+        while (query.next().hasData) {
+            const QString file = query.stringValue(0);
+            if (!keep.contains(file)) {
+                superfluousPaths.append(file);
+            }
         }
     }
 
@@ -1765,6 +1954,7 @@ void SyncJournalDb::deleteStaleFlagsEntries()
 
     SqlQuery delQuery("DELETE FROM flags WHERE path != '' AND path NOT IN (SELECT path from metadata);", _db);
     delQuery.exec();
+    _pinStateCacheLoaded = false;
 }
 
 int SyncJournalDb::errorBlackListEntryCount()
@@ -1797,6 +1987,7 @@ int SyncJournalDb::wipeErrorBlacklist()
             sqlFail(QStringLiteral("Deletion of whole blacklist failed"), query);
             return -1;
         }
+        _errorBlacklistCache.clear();
         return query.numRowsAffected();
     }
     return -1;
@@ -1816,7 +2007,11 @@ void SyncJournalDb::wipeErrorBlacklistEntry(const QString &file)
         query.bindValue(1, file);
         if (!query.exec()) {
             sqlFail(QStringLiteral("Deletion of blacklist item failed."), query);
+            return;
         }
+        auto it = _errorBlacklistCache.find(errorBlacklistCacheKey(file));
+        if (it != _errorBlacklistCache.end() && it->_file == file)
+            _errorBlacklistCache.erase(it);
     }
 }
 
@@ -1830,6 +2025,13 @@ void SyncJournalDb::wipeErrorBlacklistCategory(SyncJournalErrorBlacklistRecord::
         query.bindValue(1, category);
         if (!query.exec()) {
             sqlFail(QStringLiteral("Deletion of blacklist category failed."), query);
+            return;
+        }
+        for (auto it = _errorBlacklistCache.begin(); it != _errorBlacklistCache.end();) {
+            if (it->_errorCategory == category)
+                it = _errorBlacklistCache.erase(it);
+            else
+                ++it;
         }
     }
 }
@@ -1865,7 +2067,54 @@ void SyncJournalDb::setErrorBlacklistEntry(const SyncJournalErrorBlacklistRecord
     query->bindValue(8, item._renameTarget);
     query->bindValue(9, item._errorCategory);
     query->bindValue(10, item._requestId);
-    query->exec();
+    if (!query->exec())
+        return;
+
+    if (_errorBlacklistCacheLoaded)
+        _errorBlacklistCache.insert(errorBlacklistCacheKey(item._file), item);
+}
+
+void SyncJournalDb::loadErrorBlacklistCache()
+{
+    QMutexLocker locker(&_mutex);
+    _errorBlacklistCache.clear();
+    _errorBlacklistCacheLoaded = false;
+
+    if (!checkConnect())
+        return;
+
+    SqlQuery query(_db);
+    query.prepare("SELECT path, lastTryEtag, lastTryModtime, retrycount, errorstring, lastTryTime, ignoreDuration, renameTarget, errorCategory, requestId "
+                  "FROM blacklist");
+    if (!query.exec()) {
+        sqlFail(QStringLiteral("Reading the blacklist failed"), query);
+        return;
+    }
+
+    while (query.next().hasData) {
+        SyncJournalErrorBlacklistRecord entry;
+        entry._file = query.stringValue(0);
+        entry._lastTryEtag = query.baValue(1);
+        entry._lastTryModtime = query.int64Value(2);
+        entry._retryCount = query.intValue(3);
+        entry._errorString = query.stringValue(4);
+        entry._lastTryTime = query.int64Value(5);
+        entry._ignoreDuration = query.int64Value(6);
+        entry._renameTarget = query.stringValue(7);
+        entry._errorCategory = static_cast<SyncJournalErrorBlacklistRecord::Category>(
+            query.intValue(8));
+        entry._requestId = query.baValue(9);
+        _errorBlacklistCache.insert(errorBlacklistCacheKey(entry._file), entry);
+    }
+    _errorBlacklistCacheLoaded = true;
+    qCInfo(lcDb) << "Loaded" << _errorBlacklistCache.size() << "blacklist entries";
+}
+
+void SyncJournalDb::dropErrorBlacklistCache()
+{
+    QMutexLocker locker(&_mutex);
+    _errorBlacklistCache.clear();
+    _errorBlacklistCacheLoaded = false;
 }
 
 QVector<SyncJournalDb::PollInfo> SyncJournalDb::getPollInfos()
@@ -2025,6 +2274,9 @@ void SyncJournalDb::schedulePathForRemoteDiscovery(const QByteArray &fileName)
     query.bindValue(1, argument);
     query.exec();
 
+    // Make sure restricted remote discoveries reach it too
+    scheduleRemoteSubtreeDiscovery(argument);
+
     // Prevent future overwrite of the etags of this folder and all
     // parent folders for this sync
     argument.append('/');
@@ -2053,6 +2305,151 @@ void SyncJournalDb::forceRemoteDiscoveryNextSyncLocked()
     SqlQuery deleteRemoteFolderEtagsQuery(_db);
     deleteRemoteFolderEtagsQuery.prepare("UPDATE metadata SET md5='_invalid_' WHERE type=2;");
     deleteRemoteFolderEtagsQuery.exec();
+
+    // Restricted remote discoveries would only look at the scheduled subtrees
+    SqlQuery scheduleRootQuery(_db);
+    scheduleRootQuery.prepare("INSERT OR REPLACE INTO remotesubtrees (path, scheduled, verified) "
+                              "VALUES ('', ?1, (SELECT verified FROM remotesubtrees WHERE path=''));");
+    scheduleRootQuery.bindValue(1, QDateTime::currentMSecsSinceEpoch());
+    scheduleRootQuery.exec();
+}
+
+void SyncJournalDb::scheduleRemoteSubtreeDiscovery(const QByteArray &path)
+{
+    QMutexLocker locker(&_mutex);
+    if (!checkConnect())
+        return;
+
+    const PreparedSqlQueryRAII query(&_scheduleRemoteSubtreeQuery, QByteArrayLiteral("INSERT OR REPLACE INTO remotesubtrees (path, scheduled, verified) "
+                                                                                     "VALUES (?1, ?2, (SELECT verified FROM remotesubtrees WHERE path=?1));"),
+        _db);
+    if (!query)
+        return;
+    query->bindValue(1, path);
+    query->bindValue(2, QDateTime::currentMSecsSinceEpoch());
+    if (!query->exec()) {
+        qCWarning(lcDb) << "Could not schedule remote subtree" << path << query->error();
+    }
+}
+
+QByteArrayList SyncJournalDb::scheduledRemoteSubtrees()
+{
+    QMutexLocker locker(&_mutex);
+    if (!checkConnect())
+        return {};
+
+    SqlQuery query(_db);
+    query.prepare("SELECT path FROM remotesubtrees WHERE scheduled > 0;");
+    if (!query.exec())
+        return {};
+
+    QByteArrayList paths;
+    while (query.next().hasData)
+        paths.append(query.baValue(0));
+    return paths;
+}
+
+void SyncJournalDb::setRemoteSubtreesVerified(const QByteArrayList &paths, qint64 syncStartTime)
+{
+    QMutexLocker locker(&_mutex);
+    if (!checkConnect())
+        return;
+
+    if (paths.contains(QByteArray())) {
+        // Everything was verified, only keep what got scheduled during the sync
+        SqlQuery query(_db);
+        query.prepare("DELETE FROM remotesubtrees WHERE path != '' AND scheduled <= ?1;");
+        query.bindValue(1, syncStartTime);
+        query.exec();
+    }
+
+    const PreparedSqlQueryRAII query(&_setRemoteSubtreeVerifiedQuery, QByteArrayLiteral("INSERT OR REPLACE INTO remotesubtrees (path, scheduled, verified) "
+                                                                                         "VALUES (?1, (SELECT scheduled FROM remotesubtrees WHERE path=?1 AND scheduled > ?2), ?2);"),
+        _db);
+    if (!query)
+        return;
+    for (const auto &path : paths) {
+        query->reset_and_clear_bindings();
+        query->bindValue(1, path);
+        query->bindValue(2, syncStartTime);
+        if (!query->exec()) {
+            qCWarning(lcDb) << "Could not mark remote subtree as verified" << path << query->error();
+            return;
+        }
+    }
+}
+
+qint64 SyncJournalDb::lastFullRemoteDiscoveryTime()
+{
+    QMutexLocker locker(&_mutex);
+    if (!checkConnect())
+        return 0;
+
+    SqlQuery query(_db);
+    query.prepare("SELECT verified FROM remotesubtrees WHERE path='';");
+    if (!query.exec() || !query.next().hasData)
+        return 0;
+    return query.int64Value(0);
+}
+
+void SyncJournalDb::addLocalChanges(const QByteArrayList &paths)
+{
+    QMutexLocker locker(&_mutex);
+    if (!checkConnect())
+        return;
+
+    const PreparedSqlQueryRAII query(&_addLocalChangeQuery, QByteArrayLiteral("INSERT OR IGNORE INTO localchanges (path) VALUES (?1);"), _db);
+    if (!query)
+        return;
+    for (const auto &path : paths) {
+        query->reset_and_clear_bindings();
+        query->bindValue(1, path);
+        if (!query->exec()) {
+            qCWarning(lcDb) << "Could not add local change" << path << query->error();
+            return;
+        }
+    }
+}
+
+void SyncJournalDb::setLocalChanges(const QByteArrayList &paths)
+{
+    QMutexLocker locker(&_mutex);
+    if (!checkConnect())
+        return;
+
+    SqlQuery query(_db);
+    query.prepare("DELETE FROM localchanges;");
+    if (!query.exec()) {
+        qCWarning(lcDb) << "Could not clear local changes" << query.error();
+        return;
+    }
+
+    query.prepare("INSERT OR IGNORE INTO localchanges (path) VALUES (?1);");
+    for (const auto &path : paths) {
+        query.reset_and_clear_bindings();
+        query.bindValue(1, path);
+        if (!query.exec()) {
+            qCWarning(lcDb) << "Could not add local change" << path << query.error();
+            return;
+        }
+    }
+}
+
+QByteArrayList SyncJournalDb::localChanges()
+{
+    QMutexLocker locker(&_mutex);
+    if (!checkConnect())
+        return {};
+
+    SqlQuery query(_db);
+    query.prepare("SELECT path FROM localchanges;");
+    if (!query.exec())
+        return {};
+
+    QByteArrayList paths;
+    while (query.next().hasData)
+        paths.append(query.baValue(0));
+    return paths;
 }
 
 
@@ -2266,20 +2663,37 @@ void SyncJournalDb::markVirtualFileForDownloadRecursively(const QByteArray &path
     if (!checkConnect())
         return;
 
+    const bool ownTransaction = _transaction == 0;
+    if (ownTransaction)
+        startTransaction();
+
+    // The root is special cased so the other ranges can use the metadata_path index
     static_assert(ItemTypeVirtualFile == 4 && ItemTypeVirtualFileDownload == 5, "");
-    SqlQuery query("UPDATE metadata SET type=5 WHERE "
-                   "(" IS_PREFIX_PATH_OF("?1", "path") " OR ?1 == '') "
-                   "AND type=4;", _db);
-    query.bindValue(1, path);
+    SqlQuery query(_db);
+    if (path.isEmpty()) {
+        query.prepare("UPDATE metadata SET type=5 WHERE type=4;");
+    } else {
+        query.prepare("UPDATE metadata SET type=5 WHERE " IS_PREFIX_PATH_OF("?1", "path") " AND type=4;");
+        query.bindValue(1, path);
+    }
     query.exec();
 
     // We also must make sure we do not read the files from the database (same logic as in schedulePathForRemoteDiscovery)
     // This includes all the parents up to the root, but also all the directory within the selected dir.
     static_assert(ItemTypeDirectory == 2, "");
-    query.prepare("UPDATE metadata SET md5='_invalid_' WHERE "
-                  "(" IS_PREFIX_PATH_OF("?1", "path") " OR ?1 == '' OR " IS_PREFIX_PATH_OR_EQUAL("path", "?1") ") AND type == 2;");
+    if (path.isEmpty()) {
+        query.prepare("UPDATE metadata SET md5='_invalid_' WHERE type == 2;");
+    } else {
+        query.prepare("UPDATE metadata SET md5='_invalid_' WHERE " IS_PREFIX_PATH_OF("?1", "path") " AND type == 2;");
+        query.bindValue(1, path);
+    }
+    query.exec();
+    query.prepare("UPDATE metadata SET md5='_invalid_' WHERE " IS_PREFIX_PATH_OR_EQUAL("path", "?1") " AND type == 2;");
     query.bindValue(1, path);
     query.exec();
+
+    if (ownTransaction)
+        commitTransaction();
 }
 
 Optional<PinState> SyncJournalDb::PinStateInterface::rawForPath(const QByteArray &path)
@@ -2306,29 +2720,63 @@ Optional<PinState> SyncJournalDb::PinStateInterface::rawForPath(const QByteArray
 Optional<PinState> SyncJournalDb::PinStateInterface::effectiveForPath(const QByteArray &path)
 {
     QMutexLocker lock(&_db->_mutex);
-    if (!_db->checkConnect())
+    if (!_db->loadPinStateCacheLocked())
         return {};
 
-    const PreparedSqlQueryRAII query(&_db->_getEffectivePinStateQuery, QByteArrayLiteral(
-                                         "SELECT pinState FROM flags WHERE"
-                                         // explicitly allow "" to represent the root path
-                                         // (it'd be great if paths started with a / and "/" could be the root)
-                                         " (" IS_PREFIX_PATH_OR_EQUAL("path", "?1") " OR path == '')"
-                                         " AND pinState is not null AND pinState != 0"
-                                         " ORDER BY length(path) DESC LIMIT 1;"),
-                                     _db->_db);
-    ASSERT(query)
-    query->bindValue(1, path);
-    query->exec();
-
-    auto next = query->next();
-    if (!next.ok)
-        return {};
+    // The closest entry of the path and its parents, "" being the root
+    auto prefix = path;
+    forever {
+        const auto it = _db->_pinStateCache.constFind(prefix);
+        if (it != _db->_pinStateCache.constEnd())
+            return *it;
+        if (prefix.isEmpty())
+            break;
+        prefix.truncate(qMax(prefix.lastIndexOf('/'), 0));
+    }
     // If the root path has no setting, assume AlwaysLocal
-    if (!next.hasData)
-        return PinState::AlwaysLocal;
+    return PinState::AlwaysLocal;
+}
 
-    return static_cast<PinState>(query->intValue(0));
+bool SyncJournalDb::loadPinStateCacheLocked()
+{
+    if (!checkConnect())
+        return false;
+    if (_pinStateCacheLoaded)
+        return true;
+
+    SqlQuery query("SELECT path, pinState FROM flags WHERE pinState is not null AND pinState != 0;", _db);
+    if (!query.exec())
+        return false;
+    _pinStateCache.clear();
+    forever {
+        auto next = query.next();
+        if (!next.ok)
+            return false;
+        if (!next.hasData)
+            break;
+        _pinStateCache.insert(query.baValue(0), static_cast<PinState>(query.intValue(1)));
+    }
+    _pinStateCacheLoaded = true;
+    return true;
+}
+
+void SyncJournalDb::wipePinStateCacheBelowLocked(const QByteArray &path)
+{
+    if (path.isEmpty()) {
+        const auto root = _pinStateCache.value(QByteArray(), PinState::Inherited);
+        _pinStateCache.clear();
+        if (root != PinState::Inherited)
+            _pinStateCache.insert(QByteArray(), root);
+        return;
+    }
+    const auto prefix = path + '/';
+    for (auto it = _pinStateCache.begin(); it != _pinStateCache.end();) {
+        if (it.key().startsWith(prefix)) {
+            it = _pinStateCache.erase(it);
+        } else {
+            ++it;
+        }
+    }
 }
 
 Optional<PinState> SyncJournalDb::PinStateInterface::effectiveForPathRecursive(const QByteArray &path)
@@ -2385,6 +2833,11 @@ void SyncJournalDb::PinStateInterface::setForPath(const QByteArray &path, PinSta
     query->bindValue(1, path);
     query->bindValue(2, state);
     query->exec();
+    if (state == PinState::Inherited) {
+        _db->_pinStateCache.remove(path);
+    } else {
+        _db->_pinStateCache.insert(path, state);
+    }
 }
 
 void SyncJournalDb::PinStateInterface::wipeForPathAndBelow(const QByteArray &path)
@@ -2393,10 +2846,56 @@ void SyncJournalDb::PinStateInterface::wipeForPathAndBelow(const QByteArray &pat
     if (!_db->checkConnect())
         return;
 
-    const PreparedSqlQueryRAII query(&_db->_wipePinStateQuery, QByteArrayLiteral("DELETE FROM flags WHERE "
-                                                                                 // Allow "" to delete everything
-                                                                                 " (" IS_PREFIX_PATH_OR_EQUAL("?1", "path") " OR ?1 == '');"),
-                                     _db->_db);
+    _db->wipePinStatesBelowLocked(path);
+    SqlQuery query("DELETE FROM flags WHERE path == ?1;", _db->_db);
+    query.bindValue(1, path);
+    query.exec();
+    _db->_pinStateCache.remove(path);
+}
+
+void SyncJournalDb::PinStateInterface::setForPathAndBelow(const QByteArray &path, PinState state)
+{
+    QMutexLocker lock(&_db->_mutex);
+    if (!_db->checkConnect())
+        return;
+
+    // One transaction instead of a commit per statement, unless a sync has one open already
+    const bool ownTransaction = _db->_transaction == 0;
+    if (ownTransaction)
+        _db->startTransaction();
+
+    _db->wipePinStatesBelowLocked(path);
+    if (state == PinState::Inherited) {
+        SqlQuery query("DELETE FROM flags WHERE path == ?1;", _db->_db);
+        query.bindValue(1, path);
+        query.exec();
+    } else {
+        const PreparedSqlQueryRAII query(&_db->_setPinStateQuery, QByteArrayLiteral("INSERT OR REPLACE INTO flags(path, pinState) VALUES(?1, ?2);"), _db->_db);
+        ASSERT(query)
+        query->bindValue(1, path);
+        query->bindValue(2, state);
+        query->exec();
+    }
+    if (state == PinState::Inherited) {
+        _db->_pinStateCache.remove(path);
+    } else {
+        _db->_pinStateCache.insert(path, state);
+    }
+
+    if (ownTransaction)
+        _db->commitTransaction();
+}
+
+void SyncJournalDb::wipePinStatesBelowLocked(const QByteArray &path)
+{
+    wipePinStateCacheBelowLocked(path);
+    // Without the "OR ?1 == ''" of other queries, so the range uses the primary key index
+    if (path.isEmpty()) {
+        SqlQuery query("DELETE FROM flags WHERE path != '';", _db);
+        query.exec();
+        return;
+    }
+    const PreparedSqlQueryRAII query(&_wipePinStateQuery, QByteArrayLiteral("DELETE FROM flags WHERE " IS_PREFIX_PATH_OF("?1", "path") ";"), _db);
     ASSERT(query)
     query->bindValue(1, path);
     query->exec();
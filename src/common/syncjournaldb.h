@@ -63,7 +63,20 @@ public:
     bool getFileRecordByE2eMangledName(const QString &mangledName, SyncJournalFileRecord *rec);
     bool getFileRecordByInode(quint64 inode, SyncJournalFileRecord *rec);
     bool getFileRecordsByFileId(const QByteArray &fileId, const std::function<void(const SyncJournalFileRecord &)> &rowCallback);
+    /**
+     * Like getFileRecordsByFileId() for the numeric part of the id, see
+     * SyncJournalFileRecord::numericFileId(). Push notifications refer to
+     * files that way.
+     */
+    bool getFileRecordsByNumericFileId(qint64 numericFileId, const std::function<void(const SyncJournalFileRecord &)> &rowCallback);
     bool getFilesBelowPath(const QByteArray &path, const std::function<void(const SyncJournalFileRecord&)> &rowCallback);
+    /**
+     * Calls rowCallback with path, inode and file id of every record.
+     *
+     * Much cheaper than getFilesBelowPath("") as it does not sort or join,
+     * used for building in-memory lookup tables.
+     */
+    bool getFileRecordKeys(const std::function<void(const QByteArray &path, quint64 inode, const QByteArray &fileId)> &rowCallback);
     bool listFilesInPath(const QByteArray &path, const std::function<void(const SyncJournalFileRecord&)> &rowCallback);
     Result<void, QString> setFileRecord(const SyncJournalFileRecord &record);
 
@@ -78,6 +91,8 @@ public:
         const QByteArray &contentChecksumType);
     bool updateLocalMetadata(const QString &filename,
         qint64 modtime, qint64 size, quint64 inode);
+    /** Sets SyncJournalFileRecord::_localDirModtime of a directory record */
+    bool setLocalDirModtime(const QByteArray &path, qint64 modtime);
 
     /// Return value for hasHydratedOrDehydratedFiles()
     struct HasHydratedDehydrated
@@ -92,6 +107,24 @@ public:
     bool exists();
     void walCheckpoint();
 
+    /**
+     * Upper bounds for sqlite's memory mapped I/O and page cache, in bytes.
+     *
+     * The values actually used are derived from the size of the database file
+     * when it is opened, so small journals don't reserve memory they can't use.
+     * Zero keeps the sqlite default. The page size only affects newly created
+     * databases.
+     */
+    struct CacheLimits
+    {
+        qint64 mmapSize = 0;
+        qint64 cacheSize = 0;
+        int pageSize = 0;
+    };
+
+    /** Set the cache limits, takes effect the next time the db is opened. */
+    void setCacheLimits(const CacheLimits &limits);
+
     QString databaseFilePath() const;
 
     static qint64 getPHash(const QByteArray &);
@@ -147,6 +180,16 @@ public:
     SyncJournalErrorBlacklistRecord errorBlacklistEntry(const QString &);
     bool deleteStaleErrorBlacklistEntries(const QSet<QString> &keep);
 
+    /**
+     * Reads the whole error blacklist into memory.
+     *
+     * Until dropErrorBlacklistCache() is called, errorBlacklistEntry() is
+     * answered from memory and changes to the blacklist are written through
+     * row by row. Used during sync runs, which look up every item.
+     */
+    void loadErrorBlacklistCache();
+    void dropErrorBlacklistCache();
+
     /// Delete flags table entries that have no metadata correspondent
     void deleteStaleFlagsEntries();
 
@@ -205,6 +248,43 @@ public:
      */
     void forceRemoteDiscoveryNextSync();
 
+    /**
+     * Schedules a remote subtree for discovery on the next sync.
+     *
+     * Used when remote discovery is restricted to changed subtrees, see
+     * SyncEngine::setRemoteDiscoveryOptions(). The path "" asks for a discovery
+     * of the whole tree that follows the etags from the root.
+     *
+     * The schedule is kept until a sync that started afterwards verified the subtree.
+     */
+    void scheduleRemoteSubtreeDiscovery(const QByteArray &path);
+
+    /** Returns the subtrees that were scheduled with scheduleRemoteSubtreeDiscovery() */
+    QByteArrayList scheduledRemoteSubtrees();
+
+    /**
+     * Records that the subtrees were discovered by a sync that started at syncStartTime.
+     *
+     * Drops schedules that were made before the sync started. The path "" records
+     * a full remote discovery, which verifies every subtree.
+     * Times are in milliseconds since the epoch.
+     */
+    void setRemoteSubtreesVerified(const QByteArrayList &paths, qint64 syncStartTime);
+
+    /** Start time of the last sync with a full remote discovery, 0 if there was none */
+    qint64 lastFullRemoteDiscoveryTime();
+
+    /**
+     * Persists paths that must be locally rediscovered, see LocalDiscoveryTracker.
+     *
+     * The list survives restarts, so watcher notifications that weren't
+     * synced yet aren't lost.
+     */
+    void addLocalChanges(const QByteArrayList &paths);
+    /** Replaces the whole list of persisted local changes */
+    void setLocalChanges(const QByteArrayList &paths);
+    QByteArrayList localChanges();
+
     /* Because sqlite transactions are really slow, we encapsulate everything in big transactions
      * Commit will actually commit the transaction and create a new one.
      */
@@ -308,6 +388,9 @@ public:
          * Never returns PinState::Inherited. If the root is "Inherited"
          * or there's an error, "AlwaysLocal" is returned.
          *
+         * Answered from a copy of the pin states kept in memory, local
+         * discovery asks this for every file.
+         *
          * Returns none on db error.
          */
         Optional<PinState> effectiveForPath(const QByteArray &path);
@@ -344,6 +427,15 @@ public:
          */
         void wipeForPathAndBelow(const QByteArray &path);
 
+        /**
+         * Sets a path's pin state and wipes the ones below it.
+         *
+         * Like wipeForPathAndBelow() followed by setForPath(), but as one
+         * transaction with a single range deletion for the subtree.
+         * Inherited removes the path's own entry.
+         */
+        void setForPathAndBelow(const QByteArray &path, PinState state);
+
         /**
          * Returns list of all paths with their pin state as in the db.
          *
@@ -397,12 +489,29 @@ private:
     int _transaction;
     bool _metadataTableIsEmpty;
 
+    /** The blacklist while loaded, keyed by errorBlacklistCacheKey() */
+    QHash<QString, SyncJournalErrorBlacklistRecord> _errorBlacklistCache;
+    bool _errorBlacklistCacheLoaded = false;
+
+    void wipePinStatesBelowLocked(const QByteArray &path);
+
+    /** The non-inherited pin states while loaded, see PinStateInterface::effectiveForPath()
+     *
+     * Writes update it in place rather than reloading it.
+     */
+    bool loadPinStateCacheLocked();
+    void wipePinStateCacheBelowLocked(const QByteArray &path);
+    QHash<QByteArray, PinState> _pinStateCache;
+    bool _pinStateCacheLoaded = false;
+
     SqlQuery _getFileRecordQuery;
     SqlQuery _getFileRecordQueryByMangledName;
     SqlQuery _getFileRecordQueryByInode;
     SqlQuery _getFileRecordQueryByFileId;
+    SqlQuery _getFileRecordQueryByNumericFileId;
     SqlQuery _getFilesBelowPathQuery;
     SqlQuery _getAllFilesQuery;
+    SqlQuery _getFileRecordKeysQuery;
     SqlQuery _listFilesInPathQuery;
     SqlQuery _setFileRecordQuery;
     SqlQuery _setFileRecordChecksumQuery;
@@ -431,11 +540,14 @@ private:
     SqlQuery _setConflictRecordQuery;
     SqlQuery _deleteConflictRecordQuery;
     SqlQuery _getRawPinStateQuery;
-    SqlQuery _getEffectivePinStateQuery;
     SqlQuery _getSubPinsQuery;
     SqlQuery _countDehydratedFilesQuery;
     SqlQuery _setPinStateQuery;
     SqlQuery _wipePinStateQuery;
+    SqlQuery _scheduleRemoteSubtreeQuery;
+    SqlQuery _setRemoteSubtreeVerifiedQuery;
+    SqlQuery _addLocalChangeQuery;
+    SqlQuery _setLocalDirModtimeQuery;
 
     /* Storing etags to these folders, or their parent folders, is filtered out.
      *
@@ -458,6 +570,8 @@ private:
      * variable, for specific filesystems, or when WAL fails in a particular way.
      */
     QByteArray _journalMode;
+
+    CacheLimits _cacheLimits;
 };
 
 bool OCSYNC_EXPORT
@@ -70,6 +70,11 @@ public:
     QByteArray _checksumHeader;
     QByteArray _e2eMangledName;
     bool _isE2eEncrypted = false;
+
+    /** For directories: the local mtime at which the directory's listing was
+     * last fully synced, 0 if unknown. See SyncOptions::_pruneUnchangedLocalDirectories.
+     */
+    qint64 _localDirModtime = 0;
 };
 
 bool OCSYNC_EXPORT
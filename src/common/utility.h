@@ -83,6 +83,13 @@ namespace Utility {
      */
     OCSYNC_EXPORT qint64 freeDiskSpace(const QString &path);
 
+    /**
+     * Return the amount of physical memory installed, in bytes.
+     *
+     * Returns -1 if it can't be determined.
+     */
+    OCSYNC_EXPORT qint64 physicalMemorySize();
+
     /**
      * @brief compactFormatDouble - formats a double value human readable.
      *
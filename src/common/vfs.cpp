@@ -89,10 +89,7 @@ void Vfs::start(const VfsSetupParams &params)
 
 bool Vfs::setPinStateInDb(const QString &folderPath, PinState state)
 {
-    auto path = folderPath.toUtf8();
-    _setupParams.journal->internalPinStates().wipeForPathAndBelow(path);
-    if (state != PinState::Inherited)
-        _setupParams.journal->internalPinStates().setForPath(path, state);
+    _setupParams.journal->internalPinStates().setForPathAndBelow(folderPath.toUtf8(), state);
     return true;
 }
 
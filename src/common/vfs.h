@@ -170,7 +170,11 @@ public:
      */
     virtual Q_REQUIRED_RESULT Result<void, QString> updateMetadata(const QString &filePath, time_t modtime, qint64 size, const QByteArray &fileId) = 0;
 
-    /// Create a new dehydrated placeholder. Called from PropagateDownload.
+    /** Create a new dehydrated placeholder. Called from PropagateDownload.
+     *
+     * PropagatePlaceholders calls this and convertToPlaceholder() for new
+     * placeholders on a worker thread, concurrently with the sync's other jobs.
+     */
     virtual Q_REQUIRED_RESULT Result<void, QString> createPlaceholder(const SyncFileItem &item) = 0;
 
     /** Convert a hydrated placeholder to a dehydrated one. Called from PropagateDownlaod.
@@ -262,6 +266,10 @@ signals:
     void beginHydrating();
     /// Emitted when the hydration ends
     void doneHydrating();
+    /// Emitted when an application opened the file, for backends that can tell
+    void fileAccessed(const QString &folderPath);
+    /// Emitted when an application needs the contents of a virtual file
+    void hydrationRequested(const QString &folderPath);
 
 protected:
     /** Setup the plugin for the folder.
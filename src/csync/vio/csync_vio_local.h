@@ -28,6 +28,17 @@ namespace OCC {
 class Vfs;
 }
 
+/**
+ * The stat_data OCC::Vfs::statTypeVirtualFile() gets on Unix
+ *
+ * dirfd is the open directory being read on Linux, for *at() calls
+ * relative to it, and -1 elsewhere.
+ */
+struct csync_vio_local_parent_t {
+    const QByteArray *path;
+    int dirfd;
+};
+
 csync_vio_handle_t OCSYNC_EXPORT *csync_vio_local_opendir(const QString &name);
 int OCSYNC_EXPORT csync_vio_local_closedir(csync_vio_handle_t *dhandle);
 std::unique_ptr<csync_file_stat_t> OCSYNC_EXPORT csync_vio_local_readdir(csync_vio_handle_t *dhandle, OCC::Vfs *vfs);
@@ -26,6 +26,7 @@
 #include <dirent.h>
 #include <cstdio>
 
+#include <atomic>
 #include <memory>
 
 #include "c_private.h"
@@ -38,19 +39,184 @@
 #include <QtCore/QLoggingCategory>
 #include <QtCore/QFile>
 
+#ifdef Q_OS_LINUX
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
 Q_LOGGING_CATEGORY(lcCSyncVIOLocal, "nextcloud.sync.csync.vio_local", QtInfoMsg)
 
 /*
  * directory functions
  */
 
+#ifdef Q_OS_LINUX
+/* Bigger than readdir()'s 32 KiB to need fewer syscalls on large directories */
+static const int getdents_buffer_size = 256 * 1024;
+#endif
+
 struct csync_vio_handle_t {
-  DIR *dh;
+#ifdef Q_OS_LINUX
+  int fd = -1;
+  /* getdents64() results, bufferPos is the next entry to return */
+  QByteArray buffer;
+  int bufferPos = 0;
+  int bufferEnd = 0;
+#else
+  DIR *dh = nullptr;
+#endif
   QByteArray path;
 };
 
 static int _csync_vio_local_stat_mb(const mbchar_t *wuri, csync_file_stat_t *buf);
 
+static ItemType _csync_vio_local_item_type(mode_t mode)
+{
+    switch (mode & S_IFMT) {
+    case S_IFDIR:
+        return ItemTypeDirectory;
+    case S_IFREG:
+        return ItemTypeFile;
+    case S_IFLNK:
+    case S_IFSOCK:
+        return ItemTypeSoftLink;
+    default:
+        return ItemTypeSkip;
+    }
+}
+
+#ifdef Q_OS_LINUX
+
+/*
+ * Like lstat() on the entry of an open directory. Only asks statx() for the
+ * fields that are needed and doesn't need to resolve the whole path again.
+ */
+static int _csync_vio_local_statat(int dirfd, const char *name, csync_file_stat_t *buf)
+{
+#ifdef STATX_BASIC_STATS
+    static std::atomic<bool> statxUnavailable(false);
+    if (!statxUnavailable) {
+        struct statx sx;
+        if (statx(dirfd, name, AT_SYMLINK_NOFOLLOW, STATX_TYPE | STATX_INO | STATX_MTIME | STATX_SIZE, &sx) == 0) {
+            buf->type = _csync_vio_local_item_type(sx.stx_mode);
+            buf->inode = sx.stx_ino;
+            buf->modtime = sx.stx_mtime.tv_sec;
+            buf->size = sx.stx_size;
+            return 0;
+        }
+        if (errno != ENOSYS)
+            return -1;
+        statxUnavailable = true; // kernel older than 4.11
+    }
+#endif
+
+    csync_stat_t sb;
+    if (fstatat(dirfd, name, &sb, AT_SYMLINK_NOFOLLOW) < 0) {
+        return -1;
+    }
+    buf->type = _csync_vio_local_item_type(sb.st_mode);
+    buf->inode = sb.st_ino;
+    buf->modtime = sb.st_mtime;
+    buf->size = sb.st_size;
+    return 0;
+}
+
+csync_vio_handle_t *csync_vio_local_opendir(const QString &name) {
+    QScopedPointer<csync_vio_handle_t> handle(new csync_vio_handle_t{});
+
+    auto dirname = QFile::encodeName(name);
+
+    handle->fd = _topen(dirname.constData(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (handle->fd == -1) {
+        return nullptr;
+    }
+
+    handle->buffer.resize(getdents_buffer_size);
+    handle->path = dirname;
+    return handle.take();
+}
+
+int csync_vio_local_closedir(csync_vio_handle_t *dhandle) {
+    Q_ASSERT(dhandle);
+    auto rc = close(dhandle->fd);
+    delete dhandle;
+    return rc;
+}
+
+std::unique_ptr<csync_file_stat_t> csync_vio_local_readdir(csync_vio_handle_t *handle, OCC::Vfs *vfs) {
+
+  /* The kernel's linux_dirent64 has the layout of glibc's dirent64 */
+  const struct dirent64 *dirent = nullptr;
+  std::unique_ptr<csync_file_stat_t> file_stat;
+
+  do {
+      if (handle->bufferPos >= handle->bufferEnd) {
+          const auto read = syscall(SYS_getdents64, handle->fd, handle->buffer.data(), handle->buffer.size());
+          if (read <= 0) {
+              // end of the directory, or an error with errno set like for readdir()
+              return {};
+          }
+          handle->bufferPos = 0;
+          handle->bufferEnd = static_cast<int>(read);
+      }
+      dirent = reinterpret_cast<const struct dirent64 *>(handle->buffer.constData() + handle->bufferPos);
+      handle->bufferPos += dirent->d_reclen;
+  } while (qstrcmp(dirent->d_name, ".") == 0 || qstrcmp(dirent->d_name, "..") == 0);
+
+  file_stat = std::make_unique<csync_file_stat_t>();
+  file_stat->path = QFile::decodeName(dirent->d_name).toUtf8();
+  if (file_stat->path.isNull()) {
+      file_stat->original_path = handle->path % '/' % QByteArray() % static_cast<const char *>(dirent->d_name);
+      qCWarning(lcCSyncVIOLocal) << "Invalid characters in file/directory name, please rename:" << dirent->d_name << handle->path;
+  }
+
+  switch (dirent->d_type) {
+  case DT_FIFO:
+  case DT_CHR:
+  case DT_BLK:
+      // Never synced, no need to stat
+      file_stat->type = ItemTypeSkip;
+      return file_stat;
+  case DT_LNK:
+  case DT_SOCK:
+      // Ignored in discovery, the name and type are all that's needed
+      file_stat->type = ItemTypeSoftLink;
+      file_stat->inode = dirent->d_ino;
+      return file_stat;
+  case DT_DIR:
+      file_stat->type = ItemTypeDirectory;
+      break;
+  case DT_REG:
+      file_stat->type = ItemTypeFile;
+      break;
+  default:
+      // DT_UNKNOWN: the file system doesn't fill in d_type, stat tells
+      break;
+  }
+
+  if (file_stat->path.isNull())
+      return file_stat;
+
+  // Size and mtime are needed for files and directories
+  if (_csync_vio_local_statat(handle->fd, dirent->d_name, file_stat.get()) < 0) {
+      // Will get excluded by _csync_detect_update.
+      file_stat->type = ItemTypeSkip;
+  }
+
+  // Override type for virtual files if desired
+  if (vfs) {
+      // Directly modifies file_stat->type.
+      // We can ignore the return value since we're done here anyway.
+      csync_vio_local_parent_t parent{ &handle->path, handle->fd };
+      const auto result = vfs->statTypeVirtualFile(file_stat.get(), &parent);
+      Q_UNUSED(result)
+  }
+
+  return file_stat;
+}
+
+#else
+
 csync_vio_handle_t *csync_vio_local_opendir(const QString &name) {
     QScopedPointer<csync_vio_handle_t> handle(new csync_vio_handle_t{});
 
@@ -124,7 +290,8 @@ std::unique_ptr<csync_file_stat_t> csync_vio_local_readdir(csync_vio_handle_t *h
   if (vfs) {
       // Directly modifies file_stat->type.
       // We can ignore the return value since we're done here anyway.
-      const auto result = vfs->statTypeVirtualFile(file_stat.get(), &handle->path);
+      csync_vio_local_parent_t parent{ &handle->path, -1 };
+      const auto result = vfs->statTypeVirtualFile(file_stat.get(), &parent);
       Q_UNUSED(result)
   }
 
@@ -132,6 +299,8 @@ std::unique_ptr<csync_file_stat_t> csync_vio_local_readdir(csync_vio_handle_t *h
 }
 
 
+#endif
+
 int csync_vio_local_stat(const QString &uri, csync_file_stat_t *buf)
 {
     return _csync_vio_local_stat_mb(QFile::encodeName(uri).constData(), buf);
@@ -145,21 +314,7 @@ static int _csync_vio_local_stat_mb(const mbchar_t *wuri, csync_file_stat_t *buf
         return -1;
     }
 
-    switch (sb.st_mode & S_IFMT) {
-    case S_IFDIR:
-      buf->type = ItemTypeDirectory;
-      break;
-    case S_IFREG:
-      buf->type = ItemTypeFile;
-      break;
-    case S_IFLNK:
-    case S_IFSOCK:
-      buf->type = ItemTypeSoftLink;
-      break;
-    default:
-      buf->type = ItemTypeSkip;
-      break;
-  }
+    buf->type = _csync_vio_local_item_type(sb.st_mode);
 
 #ifdef __APPLE__
   if (sb.st_flags & UF_HIDDEN) {
@@ -933,14 +933,8 @@ void AccountSettings::slotSetSubFolderAvailability(Folder *folder, const QString
     Q_ASSERT(folder && folder->virtualFilesEnabled());
     Q_ASSERT(!path.endsWith('/'));
 
-    // Update the pin state on all items
-    if (!folder->vfs().setPinState(path, state)) {
-        qCWarning(lcAccountSettings) << "Could not set pin state of" << path << "to" << state;
-    }
-
-    // Trigger sync
-    folder->schedulePathForLocalDiscovery(path);
-    folder->scheduleThisFolderSoon();
+    // Update the pin state on all items and sync just them
+    folder->setSubtreePinState(path, state);
 }
 
 void AccountSettings::showConnectionLabel(const QString &message, QStringList errors)
@@ -1044,6 +1038,8 @@ void AccountSettings::slotForceSyncCurrentFolder()
         }
 
         selectedFolder->slotWipeErrorBlacklist(); // issue #6757
+        // A forced sync looks at the whole remote tree
+        selectedFolder->journalDb()->scheduleRemoteSubtreeDiscovery(QByteArray());
 
         // Insert the selected folder at the front of the queue
         folderMan->scheduleFolderNext(selectedFolder);
@@ -32,6 +32,9 @@
 #include "theme.h"
 #include "filesystem.h"
 #include "localdiscoverytracker.h"
+#include "filestabilitytracker.h"
+#include "dehydrationpolicy.h"
+#include "vfs/hydrationprefetcher.h"
 #include "csync_exclude.h"
 #include "common/vfs.h"
 #include "creds/abstractcredentials.h"
@@ -40,6 +43,7 @@
 #include <QTimer>
 #include <QUrl>
 #include <QDir>
+#include <QFileInfo>
 #include <QSettings>
 
 #include <QMessageBox>
@@ -79,6 +83,15 @@ Folder::Folder(const FolderDefinition &definition,
 
     _syncResult.setFolder(_definition.alias);
 
+    {
+        ConfigFile cfg;
+        SyncJournalDb::CacheLimits cacheLimits;
+        cacheLimits.mmapSize = cfg.journalMmapSizeLimit();
+        cacheLimits.cacheSize = cfg.journalCacheSizeLimit();
+        cacheLimits.pageSize = cfg.journalPageSize();
+        _journal.setCacheLimits(cacheLimits);
+    }
+
     _engine.reset(new SyncEngine(_accountState->account(), path(), remotePath(), &_journal));
     // pass the setting if hidden files are to be ignored, will be read in csync_update
     _engine->setIgnoreHiddenFiles(_definition.ignoreHiddenFiles);
@@ -116,11 +129,41 @@ Folder::Folder(const FolderDefinition &definition,
         this, &Folder::slotFolderConflicts);
 
     _localDiscoveryTracker.reset(new LocalDiscoveryTracker);
+    _localDiscoveryTracker->setJournal(&_journal);
+    connect(_localDiscoveryTracker.data(), &LocalDiscoveryTracker::localChangesFound,
+        this, &Folder::slotLocalChangesFound);
     connect(_engine.data(), &SyncEngine::finished,
         _localDiscoveryTracker.data(), &LocalDiscoveryTracker::slotSyncFinished);
     connect(_engine.data(), &SyncEngine::itemCompleted,
         _localDiscoveryTracker.data(), &LocalDiscoveryTracker::slotItemCompleted);
 
+    _fileStabilityTracker.reset(new FileStabilityTracker(path()));
+    connect(_fileStabilityTracker.data(), &FileStabilityTracker::pathsStabilized, this, [this](const QStringList &paths) {
+        // The syncs in between left these files alone
+        for (const auto &path : paths)
+            _localDiscoveryTracker->addTouchedPath(path);
+        scheduleThisFolderSoon();
+    });
+    connect(_fileStabilityTracker.data(), &FileStabilityTracker::stabilizingCountChanged, this, &Folder::syncStateChange);
+
+    _dehydrationPolicy.reset(new DehydrationPolicy(path(), &_journal));
+    _dehydrationPolicy->setQuota(_definition.hydratedSizeQuota);
+    connect(_engine.data(), &SyncEngine::itemCompleted,
+        _dehydrationPolicy.data(), &DehydrationPolicy::itemCompleted);
+    connect(_dehydrationPolicy.data(), &DehydrationPolicy::quotaChecked, this, [this](const QStringList &paths) {
+        if (paths.isEmpty())
+            return;
+        qCInfo(lcFolder) << "Dehydrating" << paths.size() << "least recently used files to stay within the quota";
+        for (const auto &path : paths)
+            schedulePathForLocalDiscovery(path);
+        scheduleThisFolderSoon();
+    });
+
+    _hydrationPrefetcher.reset(new HydrationPrefetcher(path(), &_journal));
+    _hydrationPrefetcher->setBudget(ConfigFile().hydrationPrefetchBudget());
+    connect(_engine.data(), &SyncEngine::itemCompleted,
+        _hydrationPrefetcher.data(), &HydrationPrefetcher::itemCompleted);
+
     // Potentially upgrade suffix vfs to windows vfs
     ENFORCE(_vfs);
     if (_definition.virtualFilesMode == Vfs::WithSuffix
@@ -150,6 +193,10 @@ Folder::~Folder()
 
     // Reset then engine first as it will abort and try to access members of the Folder
     _engine.reset();
+
+    // Closed if the folder was wiped
+    if (_journal.isOpen())
+        saveLocalChangeCoverage();
 }
 
 void Folder::checkLocalPath()
@@ -361,6 +408,8 @@ void Folder::etagRetrieved(const QString &etag, const QDateTime &tp)
     if (_lastEtag != etag) {
         qCInfo(lcFolder) << "Compare etag with previous etag: last:" << _lastEtag << ", received:" << etag << "-> CHANGED";
         _lastEtag = etag;
+        // Nothing tells where the change is, look everywhere
+        _journal.scheduleRemoteSubtreeDiscovery(QByteArray());
         slotScheduleThisFolder();
     }
 
@@ -507,6 +556,11 @@ void Folder::startVfs()
 
     connect(_vfs.data(), &Vfs::beginHydrating, this, &Folder::slotHydrationStarts);
     connect(_vfs.data(), &Vfs::doneHydrating, this, &Folder::slotHydrationDone);
+    connect(_vfs.data(), &Vfs::fileAccessed, _dehydrationPolicy.data(), &DehydrationPolicy::fileAccessed);
+    connect(_vfs.data(), &Vfs::hydrationRequested, _dehydrationPolicy.data(), &DehydrationPolicy::hydrationRequested);
+    connect(_vfs.data(), &Vfs::fileAccessed, _hydrationPrefetcher.data(), &HydrationPrefetcher::fileAccessed);
+    connect(_vfs.data(), &Vfs::hydrationRequested, this, &Folder::prefetchAlongWith);
+    _hydrationPrefetcher->setVirtualFileSuffix(_vfs->fileSuffix());
 
     connect(&_engine->syncFileStatusTracker(), &SyncFileStatusTracker::fileStatusChanged,
             _vfs.data(), &Vfs::fileStatusChanged);
@@ -552,10 +606,31 @@ int Folder::slotWipeErrorBlacklist()
 }
 
 void Folder::slotWatchedPathChanged(const QString &path, ChangeReason reason)
+{
+    if (!watchedPathChanged(path, reason))
+        return;
+
+    // Also schedule this folder for a sync, but only after some delay:
+    // The sync will not upload files that were changed too recently.
+    scheduleThisFolderSoon();
+}
+
+void Folder::slotWatchedPathsChanged(const QStringList &paths, ChangeReason reason)
+{
+    bool relevant = false;
+    for (const auto &path : paths) {
+        if (watchedPathChanged(path, reason))
+            relevant = true;
+    }
+    if (relevant)
+        scheduleThisFolderSoon();
+}
+
+bool Folder::watchedPathChanged(const QString &path, ChangeReason reason)
 {
     if (!path.startsWith(this->path())) {
         qCDebug(lcFolder) << "Changed path is not contained in folder, ignoring:" << path;
-        return;
+        return false;
     }
 
     auto relativePath = path.midRef(this->path().size());
@@ -578,7 +653,7 @@ void Folder::slotWatchedPathChanged(const QString &path, ChangeReason reason)
     // Use the path to figure out whether it was our own change
     if (_engine->wasFileTouched(path)) {
         qCDebug(lcFolder) << "Changed path was touched by SyncEngine, ignoring:" << path;
-        return;
+        return false;
     }
 #endif
 
@@ -602,16 +677,53 @@ void Folder::slotWatchedPathChanged(const QString &path, ChangeReason reason)
         }
         if (spurious) {
             qCInfo(lcFolder) << "Ignoring spurious notification for file" << relativePath;
-            return; // probably a spurious notification
+            return false; // probably a spurious notification
         }
     }
     warnOnNewExcludedItem(record, relativePath);
 
+    _fileStabilityTracker->fileChanged(relativePath.toString());
+    _timeSinceLastLocalChange.start();
+    _pendingLocalChangeSizeAge.invalidate();
     emit watchedFileChangedExternally(path);
+    return true;
+}
 
-    // Also schedule this folder for a sync, but only after some delay:
-    // The sync will not upload files that were changed too recently.
-    scheduleThisFolderSoon();
+qint64 Folder::pendingLocalChangeSize() const
+{
+    if (!_folderWatcher || !_folderWatcher->isReliable() || _lastFullLocalDiscoveryTime <= 0)
+        return -1;
+    if (_pendingLocalChangeSizeAge.isValid() && !_pendingLocalChangeSizeAge.hasExpired(1000))
+        return _pendingLocalChangeSize;
+
+    _pendingLocalChangeSize = [this]() -> qint64 {
+        // Not worth stat'ing that many files, these changes aren't small anyway
+        const auto &paths = _localDiscoveryTracker->localDiscoveryPaths();
+        if (paths.size() > 100)
+            return -1;
+
+        qint64 size = 0;
+        for (const auto &relativePath : paths) {
+            const QFileInfo info(path() + relativePath);
+            if (info.isDir())
+                return -1; // could have been moved in with any amount of content
+            if (info.exists())
+                size += info.size();
+        }
+        return size;
+    }();
+    _pendingLocalChangeSizeAge.start();
+    return _pendingLocalChangeSize;
+}
+
+int Folder::stabilizingFileCount() const
+{
+    return _fileStabilityTracker->stabilizingCount();
+}
+
+std::chrono::milliseconds Folder::msecSinceLastLocalChange() const
+{
+    return std::chrono::milliseconds(_timeSinceLastLocalChange.isValid() ? _timeSinceLastLocalChange.elapsed() : -1);
 }
 
 void Folder::implicitlyHydrateFile(const QString &relativepath)
@@ -644,6 +756,58 @@ void Folder::implicitlyHydrateFile(const QString &relativepath)
     // Add to local discovery
     schedulePathForLocalDiscovery(relativepath);
     slotScheduleThisFolder();
+
+    prefetchAlongWith(relativepath);
+}
+
+void Folder::prefetchAlongWith(const QString &relativepath)
+{
+    if (_definition.virtualFilesMode == Vfs::Off)
+        return;
+
+    const auto paths = _hydrationPrefetcher->hydrationRequested(relativepath);
+    bool scheduled = false;
+    for (const auto &path : paths) {
+        SyncJournalFileRecord record;
+        if (!_journal.getFileRecord(path.toUtf8(), &record) || !record.isVirtualFile())
+            continue;
+        // Suffix virtual files have their pin state at the hydrated path
+        auto pinPath = path;
+        const auto suffix = _vfs->fileSuffix();
+        if (!suffix.isEmpty() && pinPath.endsWith(suffix))
+            pinPath.chop(suffix.size());
+
+        // Unlike implicitlyHydrateFile() an online-only pin set by the user
+        // wins. The root's one is the default of virtual files folders.
+        bool explicitlyOnlineOnly = false;
+        for (auto pinPathUtf8 = pinPath.toUtf8(); !pinPathUtf8.isEmpty();) {
+            const auto raw = _journal.internalPinStates().rawForPath(pinPathUtf8);
+            if (raw && *raw != PinState::Inherited) {
+                explicitlyOnlineOnly = *raw == PinState::OnlineOnly;
+                break;
+            }
+            const int slash = pinPathUtf8.lastIndexOf('/');
+            pinPathUtf8.truncate(qMax(slash, 0));
+        }
+        if (explicitlyOnlineOnly)
+            continue;
+
+        record._type = ItemTypeVirtualFileDownload;
+        _journal.setFileRecord(record);
+
+        // Like implicitlyHydrateFile(), or the next sync would dehydrate it again
+        const auto pin = _vfs->pinState(pinPath);
+        if (pin && *pin == PinState::OnlineOnly) {
+            if (!_vfs->setPinState(pinPath, PinState::Unspecified)) {
+                qCWarning(lcFolder) << "Could not set pin state of" << pinPath << "to unspecified";
+            }
+        }
+        schedulePathForLocalDiscovery(path);
+        scheduled = true;
+    }
+    // Not urgent, the requested file is hydrated on its own
+    if (scheduled)
+        scheduleThisFolderSoon();
 }
 
 void Folder::setVirtualFilesEnabled(bool enabled)
@@ -686,6 +850,23 @@ void Folder::setRootPinState(PinState state)
     slotNextSyncFullLocalDiscovery();
 }
 
+void Folder::setSubtreePinState(const QString &relativePath, PinState state)
+{
+    if (relativePath.isEmpty()) {
+        setRootPinState(state);
+        scheduleThisFolderSoon();
+        return;
+    }
+
+    if (!_vfs->setPinState(relativePath, state)) {
+        qCWarning(lcFolder) << "Could not set pin state of" << relativePath << "to" << state;
+    }
+
+    schedulePathForLocalDiscovery(relativePath);
+    _subtreePinStateSyncPending = true;
+    scheduleThisFolderSoon();
+}
+
 bool Folder::supportsSelectiveSync() const
 {
     return !virtualFilesEnabled() && !isVfsOnOffSwitchPending();
@@ -765,6 +946,16 @@ void Folder::slotTerminateSync()
     }
 }
 
+void Folder::preemptSync()
+{
+    if (!_engine->isSyncRunning())
+        return;
+
+    qCInfo(lcFolder) << "folder" << alias() << "preempted by other folders";
+    _syncPreempted = true;
+    slotTerminateSync();
+}
+
 void Folder::wipeForRemoval()
 {
     // Delete files that have been partially downloaded.
@@ -804,6 +995,18 @@ bool Folder::reloadExcludes()
     return _engine->excludedFiles().reloadExcludeFiles();
 }
 
+Folder::LocalDiscoveryMode Folder::localDiscoveryMode(bool watcherReliable, bool hasDoneFullLocalDiscovery,
+    bool periodicFullDiscoveryDue, bool subtreePinStateSync, bool pruneUnchangedDirectories)
+{
+    // Without the watcher, only a full discovery sees every change
+    if (!watcherReliable || !hasDoneFullLocalDiscovery)
+        return LocalDiscoveryMode::Full;
+    // Pin state changes only affect their subtree, the next sync catches up on the rest
+    if (subtreePinStateSync || !periodicFullDiscoveryDue)
+        return LocalDiscoveryMode::Partial;
+    return pruneUnchangedDirectories ? LocalDiscoveryMode::Pruned : LocalDiscoveryMode::Full;
+}
+
 void Folder::startSync(const QStringList &pathList)
 {
     Q_UNUSED(pathList)
@@ -839,24 +1042,73 @@ void Folder::startSync(const QStringList &pathList)
         }
         return interval;
     }();
-    bool hasDoneFullLocalDiscovery = _timeSinceLastFullLocalDiscovery.isValid();
+    if (_reconcilingLocalChanges) {
+        // Too early, this sync does a full local discovery instead
+        qCInfo(lcFolder) << "Local changes since the last run aren't known yet";
+        _reconcilingLocalChanges = false;
+    }
+    // Marking files for dehydration races with the sync
+    _dehydrationPolicy->cancelCheck();
+    bool hasDoneFullLocalDiscovery = _lastFullLocalDiscoveryTime > 0;
     bool periodicFullLocalDiscoveryNow =
         fullLocalDiscoveryInterval.count() >= 0 // negative means we don't require periodic full runs
-        && _timeSinceLastFullLocalDiscovery.hasExpired(fullLocalDiscoveryInterval.count());
-    if (_folderWatcher && _folderWatcher->isReliable()
-        && hasDoneFullLocalDiscovery
-        && !periodicFullLocalDiscoveryNow) {
-        qCInfo(lcFolder) << "Allowing local discovery to read from the database";
+        && QDateTime::currentMSecsSinceEpoch() - _lastFullLocalDiscoveryTime > fullLocalDiscoveryInterval.count();
+    const bool subtreePinStateSync = _subtreePinStateSyncPending;
+    _subtreePinStateSyncPending = false;
+    const auto mode = localDiscoveryMode(_folderWatcher && _folderWatcher->isReliable(),
+        hasDoneFullLocalDiscovery, periodicFullLocalDiscoveryNow, subtreePinStateSync,
+        ConfigFile().pruneUnchangedLocalDirectories());
+    if (mode == LocalDiscoveryMode::Partial) {
+        if (subtreePinStateSync)
+            qCInfo(lcFolder) << "Restricting local discovery to the subtrees with changed pin states";
+        else
+            qCInfo(lcFolder) << "Allowing local discovery to read from the database";
         _engine->setLocalDiscoveryOptions(
             LocalDiscoveryStyle::DatabaseAndFilesystem,
             _localDiscoveryTracker->localDiscoveryPaths());
         _localDiscoveryTracker->startSyncPartialDiscovery();
+    } else if (mode == LocalDiscoveryMode::Pruned) {
+        // The touched paths tell where files were edited in place
+        qCInfo(lcFolder) << "Forbidding local discovery to read from the database, except for unchanged directories";
+        auto options = _engine->syncOptions();
+        options._pruneUnchangedLocalDirectories = true;
+        _engine->setSyncOptions(options);
+        _engine->setLocalDiscoveryOptions(
+            LocalDiscoveryStyle::FilesystemOnly,
+            _localDiscoveryTracker->localDiscoveryPaths());
+        _localDiscoveryTracker->startSyncPartialDiscovery();
     } else {
         qCInfo(lcFolder) << "Forbidding local discovery to read from the database";
         _engine->setLocalDiscoveryOptions(LocalDiscoveryStyle::FilesystemOnly);
         _localDiscoveryTracker->startSyncFullDiscovery();
     }
 
+    auto stabilizingPaths = _fileStabilityTracker->stabilizingPaths();
+    if (!stabilizingPaths.empty())
+        qCInfo(lcFolder) << "Postponing" << stabilizingPaths.size() << "files that are still changing";
+    _engine->setStabilizingLocalPaths(std::move(stabilizingPaths));
+
+    // With push notifications telling which subtrees changed, the remote
+    // side doesn't need to be walked by etag. Still do it regularly in case
+    // a notification got lost, and when no subtree was scheduled, as for a
+    // sync started by local changes only.
+    const auto subtrees = _journal.scheduledRemoteSubtrees();
+    const auto lastFullRemoteDiscovery = _journal.lastFullRemoteDiscoveryTime();
+    const bool fullRemoteDiscoveryExpired = lastFullRemoteDiscovery <= 0
+        || QDateTime::currentMSecsSinceEpoch() - lastFullRemoteDiscovery > ConfigFile().forceSyncInterval().count();
+    if (FolderMan::instance()->pushNotificationsFilesReady(_accountState->account().data())
+        && !fullRemoteDiscoveryExpired
+        && !subtrees.isEmpty()
+        && !subtrees.contains(QByteArray())) {
+        std::set<QString> paths;
+        for (const auto &subtree : subtrees)
+            paths.insert(QString::fromUtf8(subtree));
+        qCInfo(lcFolder) << "Restricting remote discovery to" << paths.size() << "subtrees";
+        _engine->setRemoteDiscoveryOptions(RemoteDiscoveryStyle::DatabaseAndServer, std::move(paths));
+    } else {
+        _engine->setRemoteDiscoveryOptions(RemoteDiscoveryStyle::FollowEtags);
+    }
+
     _engine->setIgnoreHiddenFiles(_definition.ignoreHiddenFiles);
 
     QMetaObject::invokeMethod(_engine.data(), "startSync", Qt::QueuedConnection);
@@ -894,8 +1146,7 @@ void Folder::setSyncOptions()
         opt._maxChunkSize = cfgFile.maxChunkSize();
     }
 
-    int maxParallel = qgetenv("OWNCLOUD_MAX_PARALLEL").toUInt();
-    opt._parallelNetworkJobs = maxParallel ? maxParallel : _accountState->account()->isHttp2Supported() ? 20 : 6;
+    opt._parallelNetworkJobs = parallelNetworkJobs();
 
     // Previously min/max chunk size values didn't exist, so users might
     // have setups where the chunk size exceeds the new min/max default
@@ -914,6 +1165,30 @@ void Folder::setSyncOptions()
     _engine->setSyncOptions(opt);
 }
 
+int Folder::parallelNetworkJobs() const
+{
+    int maxParallel = qgetenv("OWNCLOUD_MAX_PARALLEL").toUInt();
+    if (!maxParallel)
+        maxParallel = ConfigFile().maxParallelNetworkJobs();
+    if (!maxParallel)
+        maxParallel = _accountState->account()->isHttp2Supported() ? 20 : 6;
+    return qMax(1, maxParallel / _syncBudgetShare);
+}
+
+void Folder::setSyncBudgetShare(int share)
+{
+    share = qMax(1, share);
+    if (share == _syncBudgetShare)
+        return;
+    _syncBudgetShare = share;
+    if (!isSyncRunning())
+        return;
+
+    qCInfo(lcFolder) << "Sharing the network budget of" << alias() << "with" << share - 1 << "other folders";
+    setDirtyNetworkLimits();
+    _engine->setParallelNetworkJobs(parallelNetworkJobs());
+}
+
 void Folder::setDirtyNetworkLimits()
 {
     ConfigFile cfg;
@@ -933,6 +1208,12 @@ void Folder::setDirtyNetworkLimits()
         uploadLimit = 0;
     }
 
+    // Absolute limits are for all folders together, the automatic ones adapt by themselves
+    if (downloadLimit > 0)
+        downloadLimit = qMax(1, downloadLimit / _syncBudgetShare);
+    if (uploadLimit > 0)
+        uploadLimit = qMax(1, uploadLimit / _syncBudgetShare);
+
     _engine->setNetworkLimits(uploadLimit, downloadLimit);
 }
 
@@ -968,7 +1249,10 @@ void Folder::slotSyncFinished(bool success)
         qCInfo(lcFolder) << "SyncEngine finished without problem.";
     }
     _fileLog->finish();
-    showSyncResultPopup();
+    // The tracker forgets the paths that were synced
+    _pendingLocalChangeSizeAge.invalidate();
+    if (!_syncPreempted)
+        showSyncResultPopup();
 
     auto anotherSyncNeeded = _engine->isAnotherSyncNeeded();
 
@@ -987,10 +1271,13 @@ void Folder::slotSyncFinished(bool success)
     if (_syncResult.status() == SyncResult::Success
         || _syncResult.status() == SyncResult::Problem) {
         _consecutiveFailingSyncs = 0;
+    } else if (_syncPreempted) {
+        qCInfo(lcFolder) << "the sync was preempted, it continues later";
     } else {
         _consecutiveFailingSyncs++;
         qCInfo(lcFolder) << "the last" << _consecutiveFailingSyncs << "syncs failed";
     }
+    _syncPreempted = false;
 
     if (_syncResult.status() == SyncResult::Success && success) {
         // Clear the white list as all the folders that should be on that list are sync-ed
@@ -1000,11 +1287,20 @@ void Folder::slotSyncFinished(bool success)
     if ((_syncResult.status() == SyncResult::Success
             || _syncResult.status() == SyncResult::Problem)
         && success) {
-        if (_engine->lastLocalDiscoveryStyle() == LocalDiscoveryStyle::FilesystemOnly) {
-            _timeSinceLastFullLocalDiscovery.start();
+        // Pruned runs only miss what the watcher reports, while it stays reliable
+        if (_engine->lastLocalDiscoveryStyle() == LocalDiscoveryStyle::FilesystemOnly
+            && (!_engine->lastLocalDiscoveryPruned() || (_folderWatcher && _folderWatcher->isReliable()))) {
+            _lastFullLocalDiscoveryTime = QDateTime::currentMSecsSinceEpoch() - _timeSinceLastSyncStart.elapsed();
         }
     }
+    saveLocalChangeCoverage();
 
+    // The sync may have hydrated files, check the quota while nothing else runs
+    if ((_syncResult.status() == SyncResult::Success
+            || _syncResult.status() == SyncResult::Problem)
+        && success) {
+        applyDehydrationPolicy();
+    }
 
     emit syncStateChange();
 
@@ -1124,7 +1420,44 @@ void Folder::slotScheduleThisFolder()
 
 void Folder::slotNextSyncFullLocalDiscovery()
 {
-    _timeSinceLastFullLocalDiscovery.invalidate();
+    _lastFullLocalDiscoveryTime = 0;
+    _reconcilingLocalChanges = false;
+    saveLocalChangeCoverage();
+}
+
+void Folder::saveLocalChangeCoverage()
+{
+    const bool covered = _lastFullLocalDiscoveryTime > 0 && _folderWatcher && _folderWatcher->isReliable();
+    _journal.keyValueStoreSet(QStringLiteral("local_changes_full_discovery"), covered ? _lastFullLocalDiscoveryTime : 0);
+    _journal.keyValueStoreSet(QStringLiteral("local_changes_covered_until"), covered ? QDateTime::currentMSecsSinceEpoch() : 0);
+}
+
+void Folder::reconcileLocalChanges()
+{
+    const auto fullDiscoveryTime = _journal.keyValueStoreGetInt(QStringLiteral("local_changes_full_discovery"), 0);
+    const auto coveredUntil = _journal.keyValueStoreGetInt(QStringLiteral("local_changes_covered_until"), 0);
+    if (fullDiscoveryTime <= 0 || coveredUntil <= 0 || !_folderWatcher || !_folderWatcher->isReliable())
+        return;
+
+    // The watcher runs already, it sees what changes while looking
+    qCInfo(lcFolder) << "Looking for local changes since" << QDateTime::fromMSecsSinceEpoch(coveredUntil);
+    _reconcilingLocalChanges = true;
+    _reconciledFullLocalDiscoveryTime = fullDiscoveryTime;
+    _localDiscoveryTracker->findLocalChanges(path(), coveredUntil);
+}
+
+void Folder::slotLocalChangesFound(const QStringList &paths)
+{
+    if (!_reconcilingLocalChanges)
+        return;
+    _reconcilingLocalChanges = false;
+    if (!_folderWatcher || !_folderWatcher->isReliable())
+        return;
+
+    _localDiscoveryTracker->addTouchedPaths(paths);
+    _lastFullLocalDiscoveryTime = _reconciledFullLocalDiscoveryTime;
+    if (!paths.isEmpty())
+        scheduleThisFolderSoon();
 }
 
 void Folder::schedulePathForLocalDiscovery(const QString &relativePath)
@@ -1211,6 +1544,17 @@ void Folder::slotHydrationDone()
     _syncResult.setStatus(SyncResult::Success);
     emit syncFinished(_syncResult);
     emit syncStateChange();
+
+    _dehydrationPolicy->hydrationsDone();
+    applyDehydrationPolicy();
+}
+
+void Folder::applyDehydrationPolicy()
+{
+    if (_definition.virtualFilesMode == Vfs::Off || _dehydrationPolicy->quota() <= 0 || isSyncRunning())
+        return;
+
+    _dehydrationPolicy->checkQuota(_vfs.data());
 }
 
 void Folder::scheduleThisFolderSoon()
@@ -1233,14 +1577,21 @@ void Folder::registerFolderWatcher()
         return;
 
     _folderWatcher.reset(new FolderWatcher(this));
-    connect(_folderWatcher.data(), &FolderWatcher::pathChanged,
-        this, [this](const QString &path) { slotWatchedPathChanged(path, Folder::ChangeReason::Other); });
-    connect(_folderWatcher.data(), &FolderWatcher::lostChanges,
-        this, &Folder::slotNextSyncFullLocalDiscovery);
+    connect(_folderWatcher.data(), &FolderWatcher::pathsChanged,
+        this, [this](const QStringList &paths) { slotWatchedPathsChanged(paths, Folder::ChangeReason::Other); });
+    connect(_folderWatcher.data(), &FolderWatcher::lostChanges, this, [this] {
+        slotNextSyncFullLocalDiscovery();
+        scheduleThisFolderSoon();
+    });
     connect(_folderWatcher.data(), &FolderWatcher::becameUnreliable,
         this, &Folder::slotWatcherUnreliable);
     _folderWatcher->init(path());
     _folderWatcher->startNotificatonTest(path() + QLatin1String(".owncloudsync.log"));
+
+    if (!_localChangesReconciled) {
+        _localChangesReconciled = true;
+        reconcileLocalChanges();
+    }
 }
 
 bool Folder::virtualFilesEnabled() const
@@ -1305,6 +1656,11 @@ void FolderDefinition::save(QSettings &settings, const FolderDefinition &folder)
         settings.setValue(QLatin1String(versionC), 2);
     }
 
+    if (folder.hydratedSizeQuota > 0)
+        settings.setValue(QLatin1String("hydratedSizeQuota"), folder.hydratedSizeQuota);
+    else
+        settings.remove(QLatin1String("hydratedSizeQuota"));
+
     // Happens only on Windows when the explorer integration is enabled.
     if (!folder.navigationPaneClsid.isNull())
         settings.setValue(QLatin1String("navigationPaneClsid"), folder.navigationPaneClsid);
@@ -1322,6 +1678,7 @@ bool FolderDefinition::load(QSettings &settings, const QString &alias,
     folder->paused = settings.value(QLatin1String("paused")).toBool();
     folder->ignoreHiddenFiles = settings.value(QLatin1String("ignoreHiddenFiles"), QVariant(true)).toBool();
     folder->navigationPaneClsid = settings.value(QLatin1String("navigationPaneClsid")).toUuid();
+    folder->hydratedSizeQuota = settings.value(QLatin1String("hydratedSizeQuota"), 0).toLongLong();
 
     folder->virtualFilesMode = Vfs::Off;
     QString vfsModeString = settings.value(QStringLiteral("virtualFilesMode")).toString();
@@ -41,6 +41,9 @@ class AccountState;
 class SyncRunFileLog;
 class FolderWatcher;
 class LocalDiscoveryTracker;
+class FileStabilityTracker;
+class DehydrationPolicy;
+class HydrationPrefetcher;
 
 /**
  * @brief The FolderDefinition class
@@ -69,6 +72,9 @@ public:
     /// Whether the vfs mode shall silently be updated if possible
     bool upgradeVfsMode = false;
 
+    /// Bytes the hydrated virtual files may use before old ones are dehydrated, 0 for no limit
+    qint64 hydratedSizeQuota = 0;
+
     /// Saves the folder definition into the current settings group.
     static void save(QSettings &settings, const FolderDefinition &folder);
 
@@ -228,8 +234,51 @@ public:
     std::chrono::milliseconds msecSinceLastSync() const { return std::chrono::milliseconds(_timeSinceLastSyncDone.elapsed()); }
     std::chrono::milliseconds msecLastSyncDuration() const { return _lastSyncDuration; }
     int consecutiveFollowUpSyncs() const { return _consecutiveFollowUpSyncs; }
+
+    /// Number of local files that wait for their writes to finish before they're synced
+    int stabilizingFileCount() const;
     int consecutiveFailingSyncs() const { return _consecutiveFailingSyncs; }
 
+    /** Rough size in bytes of the local changes waiting to be synced, -1 if unknown
+     *
+     * Only known while the file watcher saw every change since the last full
+     * local discovery, and only for a limited number of changed files. The
+     * value is reused for a second unless the watcher reports a change.
+     */
+    qint64 pendingLocalChangeSize() const;
+
+    /// Time since the file watcher reported the last local change, -1 if none was seen
+    std::chrono::milliseconds msecSinceLastLocalChange() const;
+
+    /// How startSync() discovers local changes
+    enum class LocalDiscoveryMode {
+        Partial, ///< the touched paths only, everything else comes from the database
+        Pruned, ///< everything, except for the entries of unchanged directories
+        Full,
+    };
+
+    /** Picks the LocalDiscoveryMode of the next sync
+     *
+     * Pruned discoveries rely on the watcher to report files edited in place,
+     * so they replace the full ones only while the watcher is reliable and
+     * saw everything since an unpruned full discovery.
+     */
+    static LocalDiscoveryMode localDiscoveryMode(bool watcherReliable, bool hasDoneFullLocalDiscovery,
+        bool periodicFullDiscoveryDue, bool subtreePinStateSync, bool pruneUnchangedDirectories);
+
+    /** Aborts the running sync to let another folder sync first.
+     *
+     * Unlike slotTerminateSync() the aborted run isn't counted as a failing sync.
+     */
+    void preemptSync();
+
+    /** Shares the network budget with other folders that sync at the same time.
+     *
+     * The parallel network jobs and absolute bandwidth limits are divided by
+     * \a share; a running sync picks up the new values right away.
+     */
+    void setSyncBudgetShare(int share);
+
     /// Saves the folder data in the account's settings.
     void saveToSettings() const;
     /// Removes the folder from the account's settings.
@@ -283,6 +332,14 @@ public:
 
     void setRootPinState(PinState state);
 
+    /** Sets the pin state of relativePath and everything below it
+     *
+     * Schedules a sync that discovers just that subtree locally and reads
+     * everything else from the database, even if a full local discovery is
+     * due: that one is left to the sync after it.
+     */
+    void setSubtreePinState(const QString &relativePath, PinState state);
+
     /** Whether user desires a switch that couldn't be executed yet, see member */
     bool isVfsOnOffSwitchPending() const { return _vfsOnOffPending; }
     void setVfsOnOffSwitchPending(bool pending) { _vfsOnOffPending = pending; }
@@ -306,6 +363,8 @@ signals:
     void watchedFileChangedExternally(const QString &path);
 
 public slots:
+    /// The remote etag of the folder, schedules a sync if it changed
+    void etagRetrieved(const QString &, const QDateTime &tp);
 
     /**
        * terminate the current sync run
@@ -334,6 +393,9 @@ public slots:
        */
     void slotWatchedPathChanged(const QString &path, ChangeReason reason);
 
+    /// Like slotWatchedPathChanged() for a batch, schedules at most one sync
+    void slotWatchedPathsChanged(const QStringList &paths, ChangeReason reason);
+
     /**
      * Mark a virtual file as being requested for download, and start a sync.
      *
@@ -351,6 +413,20 @@ public slots:
      */
     void implicitlyHydrateFile(const QString &relativepath);
 
+    /** Marks least recently used files for dehydration if the hydrated files exceed the quota
+     *
+     * See FolderDefinition::hydratedSizeQuota. A sync is scheduled to dehydrate them.
+     */
+    void applyDehydrationPolicy();
+
+    /** Hydrates the virtual files that will likely be opened after relativepath
+     *
+     * Called for every hydration request, see HydrationPrefetcher. The files
+     * are marked like in implicitlyHydrateFile() and downloaded by a sync
+     * scheduled soon.
+     */
+    void prefetchAlongWith(const QString &relativepath);
+
     /** Adds the path to the local discovery list
      *
      * A weaker version of slotNextSyncFullLocalDiscovery() that just
@@ -376,7 +452,6 @@ private slots:
     void slotItemCompleted(const SyncFileItemPtr &);
 
     void slotRunEtagJob();
-    void etagRetrieved(const QString &, const QDateTime &tp);
     void etagRetrievedFromSyncEngine(const QString &, const QDateTime &time);
 
     void slotEmitFinishedDelayed();
@@ -397,6 +472,9 @@ private slots:
      */
     void slotFolderConflicts(const QString &folder, const QStringList &conflictPaths);
 
+    /// The network jobs this folder may run in parallel given its budget share
+    int parallelNetworkJobs() const;
+
     /** Warn users if they create a file or folder that is selective-sync excluded */
     void warnOnNewExcludedItem(const SyncJournalFileRecord &record, const QStringRef &path);
 
@@ -416,6 +494,26 @@ private slots:
 private:
     void connectSyncRoot();
 
+    /** Records a watched change, returns whether it warrants a sync run */
+    bool watchedPathChanged(const QString &path, ChangeReason reason);
+
+    /**
+     * Stores in the journal up to when the watcher saw every local change.
+     *
+     * That's the case if it was reliable since the last full local discovery.
+     */
+    void saveLocalChangeCoverage();
+
+    /**
+     * After a restart, starts looking for what changed since the stored
+     * coverage ended, so local discovery may keep reading from the database.
+     * See slotLocalChangesFound().
+     */
+    void reconcileLocalChanges();
+
+    /** Adds the changes found by reconcileLocalChanges(), unless a sync started meanwhile */
+    void slotLocalChangesFound(const QStringList &paths);
+
     bool reloadExcludes();
 
     void showSyncResultPopup();
@@ -450,8 +548,22 @@ private:
     QString _lastEtag;
     QElapsedTimer _timeSinceLastSyncDone;
     QElapsedTimer _timeSinceLastSyncStart;
-    QElapsedTimer _timeSinceLastFullLocalDiscovery;
+    /// Start of the last successful full local discovery in msecs since epoch, 0 if none
+    qint64 _lastFullLocalDiscoveryTime = 0;
+    /// Whether changes made while the client wasn't running were looked for
+    bool _localChangesReconciled = false;
+    /// Set while they are looked for, the stored full local discovery time becomes valid after
+    bool _reconcilingLocalChanges = false;
+    qint64 _reconciledFullLocalDiscoveryTime = 0;
     std::chrono::milliseconds _lastSyncDuration;
+    QElapsedTimer _timeSinceLastLocalChange;
+    /// Cache of pendingLocalChangeSize(), it's asked for whenever FolderMan picks a folder
+    mutable qint64 _pendingLocalChangeSize = -1;
+    mutable QElapsedTimer _pendingLocalChangeSizeAge;
+    /// Whether the running sync was aborted by preemptSync()
+    bool _syncPreempted = false;
+    /// Number of folders syncing at the same time, see setSyncBudgetShare()
+    int _syncBudgetShare = 1;
 
     /// The number of syncs that failed in a row.
     /// Reset when a sync is successful.
@@ -494,6 +606,9 @@ private:
      */
     bool _vfsOnOffPending = false;
 
+    /** Whether the next sync only needs to apply setSubtreePinState() changes */
+    bool _subtreePinStateSyncPending = false;
+
     /**
      * Watches this folder's local directory for changes.
      *
@@ -506,6 +621,21 @@ private:
      */
     QScopedPointer<LocalDiscoveryTracker> _localDiscoveryTracker;
 
+    /**
+     * Keeps files that are still being written out of syncs.
+     */
+    QScopedPointer<FileStabilityTracker> _fileStabilityTracker;
+
+    /**
+     * Picks the files to dehydrate when the hydrated ones exceed the folder's quota.
+     */
+    QScopedPointer<DehydrationPolicy> _dehydrationPolicy;
+
+    /**
+     * Picks the virtual files to hydrate ahead of use.
+     */
+    QScopedPointer<HydrationPrefetcher> _hydrationPrefetcher;
+
     /**
      * The vfs mode instance (created by plugin) to use. Never null.
      */
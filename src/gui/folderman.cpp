@@ -23,6 +23,7 @@
 #include "accountmanager.h"
 #include "filesystem.h"
 #include "lockwatcher.h"
+#include "common/checksums.h"
 #include "common/asserts.h"
 #include <pushnotifications.h>
 #include <syncengine.h>
@@ -40,8 +41,14 @@
 static const char versionC[] = "version";
 static const int maxFoldersVersion = 1;
 
+// Local changes up to this size are synced ahead of other folders
+static const qint64 smallLocalChangeSize = 10 * 1000 * 1000;
 namespace OCC {
 
+std::chrono::seconds FolderMan::syncPreemptionDelay(5 * 60);
+int FolderMan::maxEtagBatchListingEntries = 200;
+qint64 FolderMan::maxEtagBatchListingBytes = 256 * 1024;
+
 Q_LOGGING_CATEGORY(lcFolderMan, "nextcloud.gui.folder.manager", QtInfoMsg)
 
 FolderMan *FolderMan::_instance = nullptr;
@@ -73,6 +80,9 @@ FolderMan::FolderMan(QObject *parent)
         this, &FolderMan::slotScheduleFolderByTime);
     _timeScheduler.start();
 
+    if (cfg.maxChecksumThreads() > 0)
+        ComputeChecksum::threadPool()->setMaxThreadCount(cfg.maxChecksumThreads());
+
     connect(AccountManager::instance(), &AccountManager::removeAccountFolders,
         this, &FolderMan::slotRemoveFoldersForAccount);
 
@@ -123,6 +133,10 @@ void FolderMan::unloadFolder(Folder *f)
         _socketApi.data(), &SocketApi::broadcastStatusPushMessage);
     disconnect(f, &Folder::watchedFileChangedExternally,
         &f->syncEngine().syncFileStatusTracker(), &SyncFileStatusTracker::slotPathTouched);
+
+    _userRequestedFolders.remove(f);
+    _currentSyncs.remove(f);
+    _etagBatchFolders.remove(f);
 }
 
 int FolderMan::unloadAndDeleteAllFolders()
@@ -141,8 +155,9 @@ int FolderMan::unloadAndDeleteAllFolders()
     ASSERT(_folderMap.isEmpty());
 
     _lastSyncFolder = nullptr;
-    _currentSyncFolder = nullptr;
+    _currentSyncs.clear();
     _scheduledFolders.clear();
+    _userRequestedFolders.clear();
     emit folderListChanged(_folderMap);
     emit scheduleQueueChanged();
 
@@ -624,6 +639,7 @@ void FolderMan::scheduleFolder(Folder *f)
         qCInfo(lcFolderMan) << "Sync for folder " << alias << " already scheduled, do not enqueue!";
     }
 
+    preemptLongRunningSync();
     startScheduledSyncSoon();
 }
 
@@ -642,8 +658,10 @@ void FolderMan::scheduleFolderNext(Folder *f)
     f->prepareToSync();
     emit folderSyncStateChange(f);
     _scheduledFolders.prepend(f);
+    _userRequestedFolders.insert(f);
     emit scheduleQueueChanged();
 
+    preemptLongRunningSync();
     startScheduledSyncSoon();
 }
 
@@ -721,6 +739,7 @@ void FolderMan::slotAccountStateChanged()
         while (it.hasNext()) {
             Folder *f = it.next();
             if (f->accountState() == accountState) {
+                _userRequestedFolders.remove(f);
                 it.remove();
             }
         }
@@ -743,13 +762,10 @@ void FolderMan::setSyncEnabled(bool enabled)
 
 void FolderMan::startScheduledSyncSoon()
 {
-    if (_startScheduledSyncTimer.isActive()) {
-        return;
-    }
     if (_scheduledFolders.empty()) {
         return;
     }
-    if (isAnySyncRunning()) {
+    if (_currentSyncs.size() >= ConfigFile().maxConcurrentSyncs()) {
         return;
     }
 
@@ -766,6 +782,12 @@ void FolderMan::startScheduledSyncSoon()
         //  1h   -> 90s pause
         qint64 pause = qSqrt(lastFolder->msecLastSyncDuration().count()) / 20.0 * 1000.0;
         msDelay = qMax(msDelay, pause);
+
+        // The pause is against the last folder's own follow-up changes, urgent
+        // folders don't need to wait for it
+        Folder *next = nextScheduledFolder();
+        if (next && next != lastFolder && std::get<0>(schedulePriority(next)) < 2)
+            msDelay = 100;
     }
 
     // Delays beyond one minute seem too big, particularly since there
@@ -776,6 +798,11 @@ void FolderMan::startScheduledSyncSoon()
     // Time since the last sync run counts against the delay
     msDelay = qMax(1ll, msDelay - msSinceLastSync);
 
+    // An urgent folder may bring the start forward, never postpone it
+    if (_startScheduledSyncTimer.isActive() && _startScheduledSyncTimer.remainingTime() <= msDelay) {
+        return;
+    }
+
     qCInfo(lcFolderMan) << "Starting the next scheduled sync in" << (msDelay / 1000) << "seconds";
     _startScheduledSyncTimer.start(msDelay);
 }
@@ -787,11 +814,10 @@ void FolderMan::startScheduledSyncSoon()
   */
 void FolderMan::slotStartScheduledFolderSync()
 {
-    if (isAnySyncRunning()) {
-        for (auto f : _folderMap) {
-            if (f->isSyncRunning())
-                qCInfo(lcFolderMan) << "Currently folder " << f->remoteUrl().toString() << " is running, wait for finish!";
-        }
+    const int maxConcurrentSyncs = ConfigFile().maxConcurrentSyncs();
+    if (_currentSyncs.size() >= maxConcurrentSyncs) {
+        for (auto f : _currentSyncs.keys())
+            qCInfo(lcFolderMan) << "Currently folder " << f->remoteUrl().toString() << " is running, wait for finish!";
         return;
     }
 
@@ -805,30 +831,125 @@ void FolderMan::slotStartScheduledFolderSync()
         return;
     }
 
-    // Find the first folder in the queue that can be synced.
-    Folder *folder = nullptr;
-    while (!_scheduledFolders.isEmpty()) {
-        Folder *g = _scheduledFolders.dequeue();
-        if (g->canSync()) {
-            folder = g;
+    // Take the most urgent folders that can be synced, drop the ones that can't
+    QList<Folder *> folders;
+    while (_currentSyncs.size() + folders.size() < maxConcurrentSyncs) {
+        Folder *folder = nextScheduledFolder();
+        if (!folder)
             break;
+        _scheduledFolders.removeAll(folder);
+        _userRequestedFolders.remove(folder);
+        folders.append(folder);
+    }
+    QMutableListIterator<Folder *> it(_scheduledFolders);
+    while (it.hasNext()) {
+        Folder *g = it.next();
+        if (!g->canSync()) {
+            _userRequestedFolders.remove(g);
+            it.remove();
         }
     }
 
     emit scheduleQueueChanged();
 
-    // Start syncing this folder!
-    if (folder) {
+    for (auto folder : folders) {
+        RunningSync &run = _currentSyncs[folder];
+        run.timer.start();
+        run.preemptible = folder != _preemptedFolder;
+        if (folder == _preemptedFolder)
+            _preemptedFolder = nullptr;
+    }
+    distributeSyncBudgets();
+
+    // Start syncing these folders!
+    for (auto folder : folders) {
         // Safe to call several times, and necessary to try again if
         // the folder path didn't exist previously.
         folder->registerFolderWatcher();
         registerFolderWithSocketApi(folder);
 
-        _currentSyncFolder = folder;
         folder->startSync(QStringList());
     }
 }
 
+void FolderMan::distributeSyncBudgets()
+{
+    for (auto f : _currentSyncs.keys())
+        f->setSyncBudgetShare(_currentSyncs.size());
+}
+
+std::tuple<int, qint64, qint64> FolderMan::schedulePriority(Folder *f) const
+{
+    return schedulePriority(_userRequestedFolders.contains(f), f->pendingLocalChangeSize(),
+        f->msecSinceLastLocalChange().count(), f->msecSinceLastSync().count());
+}
+
+std::tuple<int, qint64, qint64> FolderMan::schedulePriority(bool userRequested, qint64 changeSize, qint64 sinceChange, qint64 sinceSync)
+{
+    const auto unknown = std::numeric_limits<qint64>::max();
+
+    int urgency = 2;
+    if (userRequested) {
+        urgency = 0;
+    } else if (changeSize >= 0 && changeSize <= smallLocalChangeSize
+        && sinceChange >= 0 && sinceChange < sinceSync) {
+        // Edited since the last sync, and not much
+        urgency = 1;
+    }
+    return std::make_tuple(urgency, changeSize < 0 ? unknown : changeSize, sinceChange < 0 ? unknown : sinceChange);
+}
+
+Folder *FolderMan::nextScheduledFolder() const
+{
+    Folder *next = nullptr;
+    std::tuple<int, qint64, qint64> nextPriority;
+    for (auto f : _scheduledFolders) {
+        if (!f->canSync() || f->isSyncRunning())
+            continue;
+        // Folders of the same priority keep the queue order
+        const auto priority = schedulePriority(f);
+        if (!next || priority < nextPriority) {
+            next = f;
+            nextPriority = priority;
+        }
+    }
+    return next;
+}
+
+void FolderMan::preemptLongRunningSync()
+{
+    // A free slot starts the urgent folder without aborting anything
+    if (_currentSyncs.size() < ConfigFile().maxConcurrentSyncs())
+        return;
+
+    Folder *current = longestPreemptibleSync(_currentSyncs);
+    if (!current || !current->isSyncRunning())
+        return;
+
+    Folder *next = nextScheduledFolder();
+    if (!next || std::get<0>(schedulePriority(next)) >= 2)
+        return;
+
+    qCInfo(lcFolderMan) << "Preempting the sync of" << current->alias() << "after"
+                        << _currentSyncs[current].timer.elapsed() / 1000 << "s to sync" << next->alias();
+    _currentSyncs[current].preemptible = false;
+    _preemptedFolder = current;
+    current->preemptSync();
+}
+
+Folder *FolderMan::longestPreemptibleSync(const QHash<Folder *, RunningSync> &syncs)
+{
+    Folder *longest = nullptr;
+    qint64 longestElapsed = std::chrono::milliseconds(syncPreemptionDelay).count();
+    for (auto it = syncs.cbegin(); it != syncs.cend(); ++it) {
+        if (!it->preemptible || it->timer.elapsed() < longestElapsed)
+            continue;
+        longest = it.key();
+        longestElapsed = it->timer.elapsed();
+    }
+    return longest;
+}
+
 bool FolderMan::pushNotificationsFilesReady(Account *account)
 {
     const auto pushNotifications = account->pushNotifications();
@@ -858,14 +979,48 @@ void FolderMan::slotEtagPollTimerTimeout()
     runEtagJobsIfPossible(foldersToRun);
 }
 
-void FolderMan::runEtagJobsIfPossible(const QList<Folder *> &folderMap)
+void FolderMan::runEtagJobsIfPossible(const QList<Folder *> &folderMap, bool ignorePollTime)
 {
+    QList<Folder *> folders;
     for (auto folder : folderMap) {
-        runEtagJobIfPossible(folder);
+        if (canRunEtagJob(folder, ignorePollTime))
+            folders.append(folder);
+    }
+
+    const auto batches = etagBatches(folders);
+    for (auto it = batches.cbegin(); it != batches.cend(); ++it) {
+        if (it->size() == 1) {
+            // A listing of the parent isn't cheaper than the plain etag request
+            QMetaObject::invokeMethod(it->first(), "slotRunEtagJob", Qt::QueuedConnection);
+        } else {
+            runEtagBatchJob(it.key().second, *it);
+        }
     }
 }
 
-void FolderMan::runEtagJobIfPossible(Folder *folder)
+QHash<QPair<Account *, QString>, QList<Folder *>> FolderMan::etagBatches(const QList<Folder *> &folders) const
+{
+    // The root folder is the listing's own entry, other folders are entries of their parent
+    const auto batchPath = [](Folder *folder) {
+        QString path = folder->remotePath();
+        while (path.endsWith(QLatin1Char('/')))
+            path.chop(1);
+        const int slash = path.lastIndexOf(QLatin1Char('/'));
+        return slash <= 0 ? QStringLiteral("/") : path.left(slash);
+    };
+
+    QHash<QPair<Account *, QString>, QList<Folder *>> batches;
+    for (auto folder : folders) {
+        auto key = qMakePair(folder->accountState()->account().data(), batchPath(folder));
+        // Folders of a parent that's too big to list go on their own
+        if (_unbatchedEtagPaths.contains(key))
+            key.second = folder->remotePath();
+        batches[key].append(folder);
+    }
+    return batches;
+}
+
+bool FolderMan::canRunEtagJob(Folder *folder, bool ignorePollTime)
 {
     const ConfigFile cfg;
     const auto polltime = cfg.remotePollInterval();
@@ -873,33 +1028,91 @@ void FolderMan::runEtagJobIfPossible(Folder *folder)
     qCInfo(lcFolderMan) << "Run etag job on folder" << folder;
 
     if (!folder) {
-        return;
+        return false;
     }
     if (folder->isSyncRunning()) {
         qCInfo(lcFolderMan) << "Can not run etag job: Sync is running";
-        return;
+        return false;
     }
     if (_scheduledFolders.contains(folder)) {
         qCInfo(lcFolderMan) << "Can not run etag job: Folder is alreday scheduled";
-        return;
+        return false;
     }
     if (_disabledFolders.contains(folder)) {
         qCInfo(lcFolderMan) << "Can not run etag job: Folder is disabled";
-        return;
+        return false;
     }
-    if (folder->etagJob() || folder->isBusy() || !folder->canSync()) {
+    if (folder->etagJob() || _etagBatchFolders.contains(folder) || folder->isBusy() || !folder->canSync()) {
         qCInfo(lcFolderMan) << "Can not run etag job: Folder is busy";
-        return;
+        return false;
     }
     // When not using push notifications, make sure polltime is reached
-    if (!pushNotificationsFilesReady(folder->accountState()->account().data())) {
+    if (!ignorePollTime && !pushNotificationsFilesReady(folder->accountState()->account().data())) {
         if (folder->msecSinceLastSync() < polltime) {
             qCInfo(lcFolderMan) << "Can not run etag job: Polltime not reached";
-            return;
+            return false;
         }
     }
+    return true;
+}
+
+void FolderMan::runEtagBatchJob(const QString &path, const QList<Folder *> &folders)
+{
+    qCInfo(lcFolderMan) << "Checking the etags of" << folders.size() << "folders by listing" << path;
+
+    // Listing entries are reported with their path on the server
+    auto pending = QSharedPointer<QHash<QString, QPointer<Folder>>>::create();
+    for (auto folder : folders) {
+        QString urlPath = folder->remoteUrl().path();
+        if (urlPath.endsWith(QLatin1Char('/')))
+            urlPath.chop(1);
+        pending->insert(urlPath, folder);
+        _etagBatchFolders.insert(folder);
+    }
 
-    QMetaObject::invokeMethod(folder, "slotRunEtagJob", Qt::QueuedConnection);
+    // Parents with many entries are left alone from then on, see etagBatches()
+    const auto key = qMakePair(folders.first()->accountState()->account().data(), path);
+    const auto tooBig = [this, key, path]() {
+        if (_unbatchedEtagPaths.contains(key))
+            return;
+        qCInfo(lcFolderMan) << "The listing of" << path << "is too big, checking the etags of its folders one by one";
+        _unbatchedEtagPaths.insert(key);
+    };
+
+    auto job = new LsColJob(folders.first()->accountState()->account(), path, this);
+    job->setProperties({ "getetag" });
+    job->setTimeout(60 * 1000);
+    auto entries = QSharedPointer<int>::create(0);
+    connect(job, &LsColJob::directoryListingIterated, this, [job, pending, entries, tooBig](const QString &href, const QMap<QString, QString> &properties) {
+        if (++*entries > maxEtagBatchListingEntries)
+            tooBig();
+        const QPointer<Folder> folder = pending->take(href);
+        if (!folder || !properties.contains(QStringLiteral("getetag")))
+            return;
+        folder->etagRetrieved(QString::fromUtf8(parseEtag(properties.value(QStringLiteral("getetag")).toUtf8())),
+            QDateTime::fromString(QString::fromUtf8(job->responseTimestamp()), Qt::RFC2822Date));
+    });
+    const auto finish = [this, folders, pending]() {
+        for (auto folder : folders)
+            _etagBatchFolders.remove(folder);
+        for (const auto &folder : qAsConst(*pending)) {
+            if (folder)
+                QMetaObject::invokeMethod(folder, "slotRunEtagJob", Qt::QueuedConnection);
+        }
+        pending->clear();
+    };
+    connect(job, &LsColJob::finishedWithoutError, this, finish);
+    connect(job, &LsColJob::finishedWithError, this, finish);
+    job->start();
+
+    // Don't download a huge listing for a few etags, the folders that weren't
+    // listed yet get checked one by one
+    connect(job->reply(), &QNetworkReply::downloadProgress, this, [job, tooBig](qint64 received, qint64) {
+        if (received <= maxEtagBatchListingBytes)
+            return;
+        tooBig();
+        job->reply()->abort();
+    });
 }
 
 void FolderMan::slotAccountRemoved(AccountState *accountState)
@@ -1001,11 +1214,13 @@ void FolderMan::slotScheduleFolderByTime()
 
         // Do we want to retry failing syncs or another-sync-needed runs more often?
     }
+
+    preemptLongRunningSync();
 }
 
 bool FolderMan::isAnySyncRunning() const
 {
-    if (_currentSyncFolder)
+    if (!_currentSyncs.isEmpty())
         return true;
 
     for (auto f : _folderMap) {
@@ -1046,12 +1261,15 @@ void FolderMan::slotFolderSyncFinished(const SyncResult &)
         qPrintable(f->accountState()->account()->displayName()),
         qPrintable(f->remoteUrl().toString()));
 
-    if (f == _currentSyncFolder) {
-        _lastSyncFolder = _currentSyncFolder;
-        _currentSyncFolder = nullptr;
+    if (_currentSyncs.remove(f)) {
+        _lastSyncFolder = f;
+        distributeSyncBudgets();
     }
-    if (!isAnySyncRunning())
-        startScheduledSyncSoon();
+    if (f == _preemptedFolder) {
+        // Continues once the urgent folders are done
+        scheduleFolder(f);
+    }
+    startScheduledSyncSoon();
 }
 
 Folder *FolderMan::addFolder(AccountState *accountState, const FolderDefinition &folderDefinition)
@@ -1188,6 +1406,7 @@ void FolderMan::removeFolder(Folder *f)
         f->slotTerminateSync();
     }
 
+    _userRequestedFolders.remove(f);
     if (_scheduledFolders.removeAll(f) > 0) {
         emit scheduleQueueChanged();
     }
@@ -1307,12 +1526,13 @@ void FolderMan::slotWipeFolderForAccount(AccountState *accountState)
 
         qCInfo(lcFolderMan) << "Removing " << f->alias();
 
-        const bool currentlyRunning = (_currentSyncFolder == f);
+        const bool currentlyRunning = _currentSyncs.contains(f);
         if (currentlyRunning) {
             // abort the sync now
-            _currentSyncFolder->slotTerminateSync();
+            f->slotTerminateSync();
         }
 
+        _userRequestedFolders.remove(f);
         if (_scheduledFolders.removeAll(f) > 0) {
             emit scheduleQueueChanged();
         }
@@ -1671,9 +1891,9 @@ QQueue<Folder *> FolderMan::scheduleQueue() const
     return _scheduledFolders;
 }
 
-Folder *FolderMan::currentSyncFolder() const
+QList<Folder *> FolderMan::currentSyncFolders() const
 {
-    return _currentSyncFolder;
+    return _currentSyncs.keys();
 }
 
 void FolderMan::restartApplication()
@@ -1701,6 +1921,7 @@ void FolderMan::slotSetupPushNotifications(const Folder::Map &folderMap)
         // after the PushNotification object emitted the ready signal
         slotConnectToPushNotifications(account.data());
         connect(account.data(), &Account::pushNotificationsReady, this, &FolderMan::slotConnectToPushNotifications, Qt::UniqueConnection);
+        connect(account.data(), &Account::pushNotificationsDisabled, this, &FolderMan::slotPushNotificationsDisabled, Qt::UniqueConnection);
     }
 }
 
@@ -1714,11 +1935,71 @@ void FolderMan::slotProcessFilesPushNotification(Account *account)
             continue;
         }
 
+        // The notification doesn't say what changed
+        folder->journalDb()->scheduleRemoteSubtreeDiscovery(QByteArray());
+
         qCInfo(lcFolderMan) << "Schedule folder" << folder << "for sync";
         scheduleFolder(folder);
     }
 }
 
+void FolderMan::slotProcessFileIdsPushNotification(Account *account, const QVector<qint64> &fileIds)
+{
+    qCInfo(lcFolderMan) << "Got files push notification for" << fileIds.size() << "file ids of account" << account;
+
+    QList<Folder *> unmatchedFolders;
+    for (auto folder : qAsConst(_folderMap)) {
+        if (folder->accountState()->account() != account) {
+            continue;
+        }
+
+        // A changed file shows up in the listing of its parent directory. If
+        // it moved away from there, discovery falls back to a full one.
+        // A directory may have moved along with everything below it, which
+        // only a full discovery can follow.
+        QSet<QByteArray> subtrees;
+        for (auto fileId : fileIds) {
+            folder->journalDb()->getFileRecordsByNumericFileId(fileId, [&subtrees](const SyncJournalFileRecord &record) {
+                if (record.isDirectory()) {
+                    subtrees.insert(QByteArray());
+                } else {
+                    const int slash = record._path.lastIndexOf('/');
+                    subtrees.insert(slash == -1 ? QByteArray() : record._path.left(slash));
+                }
+            });
+        }
+
+        if (subtrees.isEmpty()) {
+            unmatchedFolders.append(folder);
+            continue;
+        }
+        for (const auto &subtree : qAsConst(subtrees))
+            folder->journalDb()->scheduleRemoteSubtreeDiscovery(subtree);
+
+        qCInfo(lcFolderMan) << "Schedule folder" << folder << "for sync of" << subtrees.size() << "subtrees";
+        scheduleFolder(folder);
+    }
+
+    // New files aren't known by id yet, the etags tell which of the other
+    // folders they are in
+    if (!unmatchedFolders.isEmpty()) {
+        runEtagJobsIfPossible(unmatchedFolders, true);
+    }
+}
+
+void FolderMan::slotPushNotificationsDisabled(Account *account)
+{
+    // Changes may have been missed while the connection went down, check
+    // now instead of waiting for the poll time; regular polling takes over
+    QList<Folder *> folders;
+    for (auto folder : qAsConst(_folderMap)) {
+        if (folder->accountState()->account() == account)
+            folders.append(folder);
+    }
+    qCInfo(lcFolderMan) << "Push notifications disabled for" << account << ", checking" << folders.size() << "folders";
+    runEtagJobsIfPossible(folders, true);
+}
+
 void FolderMan::slotConnectToPushNotifications(Account *account)
 {
     const auto pushNotifications = account->pushNotifications();
@@ -1726,6 +2007,7 @@ void FolderMan::slotConnectToPushNotifications(Account *account)
     if (pushNotificationsFilesReady(account)) {
         qCInfo(lcFolderMan) << "Push notifications ready";
         connect(pushNotifications, &PushNotifications::filesChanged, this, &FolderMan::slotProcessFilesPushNotification, Qt::UniqueConnection);
+        connect(pushNotifications, &PushNotifications::fileIdsChanged, this, &FolderMan::slotProcessFileIdsPushNotification, Qt::UniqueConnection);
     }
 }
 
@@ -19,6 +19,9 @@
 #include <QObject>
 #include <QQueue>
 #include <QList>
+#include <QElapsedTimer>
+
+#include <tuple>
 
 #include "folder.h"
 #include "folderwatcher.h"
@@ -49,7 +52,8 @@ class LockWatcher;
  *   (_folderWatchers and Folder::slotWatchedPathChanged())
  *
  * - The folder etag on the server has changed
- *   (_etagPollTimer)
+ *   (_etagPollTimer, or right away when an account loses its push
+ *   notifications and changes may have been missed)
  *
  * - The locks of a monitored file are released
  *   (_lockWatcher and slotWatchedFileUnlocked())
@@ -163,14 +167,15 @@ public:
     QQueue<Folder *> scheduleQueue() const;
 
     /**
-     * Access to the currently syncing folder.
+     * Access to the currently syncing folders.
      *
-     * Note: This is only the folder that's currently syncing *as-scheduled*. There
-     * may be externally-managed syncs such as from placeholder hydrations.
+     * Note: These are only the folders that are currently syncing *as-scheduled*.
+     * There may be externally-managed syncs such as from placeholder hydrations.
+     * Up to ConfigFile::maxConcurrentSyncs() folders sync at the same time.
      *
      * See also isAnySyncRunning()
      */
-    Folder *currentSyncFolder() const;
+    QList<Folder *> currentSyncFolders() const;
 
     /**
      * Returns true if any folder is currently syncing.
@@ -192,7 +197,11 @@ public:
     /** Queues a folder for syncing. */
     void scheduleFolder(Folder *);
 
-    /** Puts a folder in the very front of the queue. */
+    /** Puts a folder in the very front of the queue.
+     *
+     * For explicit user requests: the folder is synced before all others
+     * and may preempt a long running sync of another folder.
+     */
     void scheduleFolderNext(Folder *);
 
     /** Queues all folders for syncing. */
@@ -201,6 +210,9 @@ public:
     void setDirtyProxy();
     void setDirtyNetworkLimits();
 
+    /** Whether remote changes of the account are announced by push notifications */
+    bool pushNotificationsFilesReady(Account *account);
+
 signals:
     /**
       * signal to indicate a folder has changed its sync state.
@@ -292,7 +304,9 @@ private slots:
 
     void slotSetupPushNotifications(const Folder::Map &);
     void slotProcessFilesPushNotification(Account *account);
+    void slotProcessFileIdsPushNotification(Account *account, const QVector<qint64> &fileIds);
     void slotConnectToPushNotifications(Account *account);
+    void slotPushNotificationsDisabled(Account *account);
 
 private:
     /** Adds a new folder, does not add it to the account settings and
@@ -307,6 +321,45 @@ private:
     /** Will start a sync after a bit of delay. */
     void startScheduledSyncSoon();
 
+    /** Scheduling order of a queued folder, smaller goes first.
+     *
+     * The first element is the urgency: 0 for explicit user requests, 1 for
+     * small local changes, 2 for everything else. Then smaller local changes
+     * and more recent local edits go first.
+     */
+    std::tuple<int, qint64, qint64> schedulePriority(Folder *f) const;
+    static std::tuple<int, qint64, qint64> schedulePriority(bool userRequested, qint64 changeSize,
+        qint64 msecSinceChange, qint64 msecSinceSync);
+
+    /** The scheduled folder to sync next, nullptr if there is none */
+    Folder *nextScheduledFolder() const;
+
+    /** Aborts a long running sync if an urgent folder is waiting
+     *
+     * The aborted folder is scheduled again right away and can't be
+     * preempted in its next run.
+     */
+    void preemptLongRunningSync();
+
+    struct RunningSync
+    {
+        /// Started when the folder started syncing
+        QElapsedTimer timer;
+        /// Whether the sync may be preempted, see preemptLongRunningSync()
+        bool preemptible = false;
+    };
+
+    /** The sync running the longest, if that's longer than syncPreemptionDelay
+     * and it may be preempted
+     */
+    static Folder *longestPreemptibleSync(const QHash<Folder *, RunningSync> &syncs);
+
+    /// Syncs running longer than this may be aborted to let urgent folders go first
+    static std::chrono::seconds syncPreemptionDelay;
+
+    /// Splits the network budget evenly between the running syncs
+    void distributeSyncBudgets();
+
     // finds all folder configuration files
     // and create the folders
     QString getBackupName(QString fullPathName) const;
@@ -319,16 +372,40 @@ private:
 
     void setupFoldersHelper(QSettings &settings, AccountStatePtr account, const QStringList &ignoreKeys, bool backwardsCompatible, bool foldersWithPlaceholders);
 
-    void runEtagJobsIfPossible(const QList<Folder *> &folderMap);
-    void runEtagJobIfPossible(Folder *folder);
+    /** Checks the remote etags of the folders that can be checked.
+     *
+     * Folders of an account whose remote paths share a parent directory are
+     * checked together with runEtagBatchJob().
+     */
+    void runEtagJobsIfPossible(const QList<Folder *> &folderMap, bool ignorePollTime = false);
+    bool canRunEtagJob(Folder *folder, bool ignorePollTime);
 
-    bool pushNotificationsFilesReady(Account *account);
+    /** Groups the folders whose etags can be checked with one listing of
+     * their parent, keyed by account and parent path. Other folders are on
+     * their own.
+     */
+    QHash<QPair<Account *, QString>, QList<Folder *>> etagBatches(const QList<Folder *> &folders) const;
+
+    /** Gets the etags of several folders with one Depth 1 PROPFIND on their
+     * common parent \a path. Folders missing in the listing get checked one
+     * by one.
+     *
+     * A listing with more than maxEtagBatchListingEntries entries, or more
+     * than maxEtagBatchListingBytes of them, isn't used for \a path again.
+     * The second limit aborts the listing.
+     */
+    void runEtagBatchJob(const QString &path, const QList<Folder *> &folders);
+    static int maxEtagBatchListingEntries;
+    static qint64 maxEtagBatchListingBytes;
 
     QSet<Folder *> _disabledFolders;
     Folder::Map _folderMap;
     QString _folderConfigPath;
-    Folder *_currentSyncFolder = nullptr;
+    /// The folders syncing as-scheduled
+    QHash<Folder *, RunningSync> _currentSyncs;
     QPointer<Folder> _lastSyncFolder;
+    /// The last folder whose sync was preempted, until it synced again
+    QPointer<Folder> _preemptedFolder;
     bool _syncEnabled = true;
 
     /// Folder aliases from the settings that weren't read
@@ -338,6 +415,10 @@ private:
     QTimer _etagPollTimer;
     /// The currently running etag query
     QPointer<RequestEtagJob> _currentEtagJob;
+    /// Folders waiting for a running runEtagBatchJob()
+    QSet<Folder *> _etagBatchFolders;
+    /// Parents whose listing is too big for runEtagBatchJob()
+    QSet<QPair<Account *, QString>> _unbatchedEtagPaths;
 
     /// Watches files that couldn't be synced due to locks
     QScopedPointer<LockWatcher> _lockWatcher;
@@ -348,6 +429,9 @@ private:
     /// Scheduled folders that should be synced as soon as possible
     QQueue<Folder *> _scheduledFolders;
 
+    /// Scheduled folders the user explicitly asked to sync, see scheduleFolderNext()
+    QSet<Folder *> _userRequestedFolders;
+
     /// Picks the next scheduled folder and starts the sync
     QTimer _startScheduledSyncTimer;
 
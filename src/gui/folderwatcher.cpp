@@ -188,6 +188,7 @@ void FolderWatcher::changeDetected(const QStringList &paths)
     foreach (const QString &path, changedPaths) {
         emit pathChanged(path);
     }
+    emit pathsChanged(changedPaths.toList());
 }
 
 } // namespace OCC
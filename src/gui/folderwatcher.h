@@ -42,7 +42,8 @@ class Folder;
  *
  * Folder Watcher monitors a directory and its sub directories
  * for changes in the local file system. Changes are signalled
- * through the pathChanged() signal.
+ * through the pathChanged() signal, and once per batch through
+ * pathsChanged().
  *
  * @ingroup gui
  */
@@ -88,6 +89,10 @@ signals:
      *  of the contained files is changed. */
     void pathChanged(const QString &path);
 
+    /** Emitted after pathChanged() with all paths of one batch of
+     *  notifications. */
+    void pathsChanged(const QStringList &paths);
+
     /**
      * Emitted if some notifications were lost.
      *
@@ -0,0 +1,291 @@
+/*
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ * or FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License
+ * for more details.
+ */
+
+#include "config.h"
+
+#include <sys/fanotify.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "folderwatcher.h"
+#include "folderwatcher_fanotify.h"
+
+#include <cerrno>
+#include <cstring>
+#include <QDir>
+#include <QFile>
+#include <QHash>
+#include <QMutex>
+#include <QSocketNotifier>
+#include <QThread>
+#include <QVarLengthArray>
+#include <QVector>
+
+namespace OCC {
+
+#ifdef FAN_REPORT_DFID_NAME
+
+/**
+ * The fanotify group of one file system, shared by the watchers on it
+ *
+ * The events are read on a separate thread. Each path is resolved once and
+ * handed to the watchers it is below, in one batch per read().
+ */
+class FanotifyFileSystem
+{
+public:
+    /// The group of the file system of path, set up if needed. Null on failure.
+    static std::shared_ptr<FanotifyFileSystem> forPath(const QString &canonicalPath);
+
+    ~FanotifyFileSystem();
+
+    void addWatcher(FanotifyWatcher *watcher);
+    void removeWatcher(FanotifyWatcher *watcher);
+
+private:
+    FanotifyFileSystem(int fd, int mountFd);
+
+    void readEvents();
+    void dispatch(const QStringList &canonicalPaths, bool lost);
+
+    int _fd;
+    int _mountFd;
+    QThread _thread;
+    QObject *_reader;
+
+    QMutex _watchersMutex;
+    QVector<FanotifyWatcher *> _watchers;
+};
+
+// Groups by device, only while a watcher uses them
+static QMutex fileSystemsMutex;
+static QHash<quint64, std::weak_ptr<FanotifyFileSystem>> fileSystems;
+
+std::shared_ptr<FanotifyFileSystem> FanotifyFileSystem::forPath(const QString &canonicalPath)
+{
+    const auto encodedPath = QFile::encodeName(canonicalPath);
+    struct stat st;
+    if (stat(encodedPath.constData(), &st) == -1) {
+        qCInfo(lcFolderWatcher) << "fanotify: can't stat" << canonicalPath << strerror(errno);
+        return nullptr;
+    }
+
+    QMutexLocker lock(&fileSystemsMutex);
+    if (auto existing = fileSystems.value(st.st_dev).lock())
+        return existing;
+
+    // Any descriptor on the file system works for open_by_handle_at()
+    const int mountFd = open(encodedPath.constData(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (mountFd == -1) {
+        qCInfo(lcFolderWatcher) << "fanotify: can't open" << canonicalPath << strerror(errno);
+        return nullptr;
+    }
+
+    const int fd = fanotify_init(FAN_CLASS_NOTIF | FAN_CLOEXEC | FAN_NONBLOCK | FAN_REPORT_DFID_NAME, O_RDONLY | O_LARGEFILE);
+    if (fd == -1) {
+        qCInfo(lcFolderWatcher) << "fanotify_init() failed:" << strerror(errno);
+        close(mountFd);
+        return nullptr;
+    }
+
+    // Mount marks don't report directory entry events, it needs to be the file system
+    const uint64_t mask = FAN_CREATE | FAN_DELETE | FAN_MOVED_FROM | FAN_MOVED_TO
+        | FAN_CLOSE_WRITE | FAN_ATTRIB | FAN_ONDIR;
+    if (fanotify_mark(fd, FAN_MARK_ADD | FAN_MARK_FILESYSTEM, mask, AT_FDCWD, encodedPath.constData()) == -1) {
+        qCInfo(lcFolderWatcher) << "fanotify_mark() failed:" << strerror(errno);
+        close(fd);
+        close(mountFd);
+        return nullptr;
+    }
+
+    std::shared_ptr<FanotifyFileSystem> fileSystem(new FanotifyFileSystem(fd, mountFd));
+    fileSystems.insert(st.st_dev, fileSystem);
+    return fileSystem;
+}
+
+FanotifyFileSystem::FanotifyFileSystem(int fd, int mountFd)
+    : _fd(fd)
+    , _mountFd(mountFd)
+    , _reader(new QObject)
+{
+    _reader->moveToThread(&_thread);
+    QObject::connect(&_thread, &QThread::finished, _reader, &QObject::deleteLater);
+    _thread.setObjectName(QStringLiteral("FanotifyWatcher"));
+    _thread.start();
+
+    // The notifier has to be created in the thread it notifies in
+    QMetaObject::invokeMethod(_reader, [this] {
+        auto notifier = new QSocketNotifier(_fd, QSocketNotifier::Read, _reader);
+        QObject::connect(notifier, &QSocketNotifier::activated, _reader, [this] { readEvents(); });
+    }, Qt::QueuedConnection);
+}
+
+FanotifyFileSystem::~FanotifyFileSystem()
+{
+    _thread.quit();
+    _thread.wait();
+    close(_fd);
+    close(_mountFd);
+}
+
+void FanotifyFileSystem::addWatcher(FanotifyWatcher *watcher)
+{
+    QMutexLocker lock(&_watchersMutex);
+    _watchers.append(watcher);
+}
+
+void FanotifyFileSystem::removeWatcher(FanotifyWatcher *watcher)
+{
+    // Batches queued for the watcher before are dropped with the watcher
+    QMutexLocker lock(&_watchersMutex);
+    _watchers.removeOne(watcher);
+}
+
+void FanotifyFileSystem::dispatch(const QStringList &canonicalPaths, bool lost)
+{
+    QMutexLocker lock(&_watchersMutex);
+    for (const auto watcher : qAsConst(_watchers)) {
+        if (lost)
+            QMetaObject::invokeMethod(watcher, [watcher] { emit watcher->lostChanges(); }, Qt::QueuedConnection);
+
+        QStringList paths;
+        for (const auto &canonicalPath : canonicalPaths) {
+            auto path = watcher->mapToRoot(canonicalPath);
+            if (!path.isEmpty())
+                paths.append(std::move(path));
+        }
+        if (!paths.isEmpty())
+            QMetaObject::invokeMethod(watcher, [watcher, paths] { emit watcher->changesDetected(paths); }, Qt::QueuedConnection);
+    }
+}
+
+void FanotifyFileSystem::readEvents()
+{
+    alignas(fanotify_event_metadata) char buffer[8192];
+
+    forever {
+        const ssize_t len = read(_fd, buffer, sizeof(buffer));
+        if (len <= 0) {
+            if (len < 0 && errno != EAGAIN)
+                qCWarning(lcFolderWatcher) << "fanotify: read failed" << strerror(errno);
+            return;
+        }
+
+        QStringList paths;
+        bool lost = false;
+        auto metadata = reinterpret_cast<const fanotify_event_metadata *>(buffer);
+        auto remaining = len;
+        for (; FAN_EVENT_OK(metadata, remaining); metadata = FAN_EVENT_NEXT(metadata, remaining)) {
+            if (metadata->vers != FANOTIFY_METADATA_VERSION) {
+                qCWarning(lcFolderWatcher) << "fanotify: unexpected metadata version" << metadata->vers;
+                return;
+            }
+            if (metadata->fd >= 0)
+                close(metadata->fd);
+            if (metadata->mask & FAN_Q_OVERFLOW) {
+                qCWarning(lcFolderWatcher) << "fanotify: event queue overflow";
+                lost = true;
+                continue;
+            }
+
+            auto info = reinterpret_cast<const fanotify_event_info_fid *>(
+                reinterpret_cast<const char *>(metadata) + metadata->metadata_len);
+            if (metadata->event_len < metadata->metadata_len + sizeof(*info)
+                || info->hdr.info_type != FAN_EVENT_INFO_TYPE_DFID_NAME) {
+                continue;
+            }
+
+            // The info record is followed by the directory's handle and the entry name
+            auto handle = reinterpret_cast<file_handle *>(const_cast<unsigned char *>(info->handle));
+            const char *name = reinterpret_cast<const char *>(handle->f_handle + handle->handle_bytes);
+
+            // Filter out journal changes - redundant with filtering in
+            // FolderWatcher::pathIsIgnored.
+            if (std::strncmp(name, "._sync_", 7) == 0
+                || std::strncmp(name, ".csync_journal.db", 17) == 0
+                || std::strncmp(name, ".sync_", 6) == 0) {
+                continue;
+            }
+
+            const int dirFd = open_by_handle_at(_mountFd, handle, O_PATH | O_CLOEXEC);
+            if (dirFd == -1) {
+                // ESTALE: the directory is gone already, its deletion gets reported too
+                if (errno != ESTALE)
+                    qCDebug(lcFolderWatcher) << "fanotify: open_by_handle_at failed" << strerror(errno);
+                continue;
+            }
+            QVarLengthArray<char, 4096> dirPath(4096);
+            const auto procPath = QByteArray("/proc/self/fd/") + QByteArray::number(dirFd);
+            const ssize_t dirPathLen = readlink(procPath.constData(), dirPath.data(), dirPath.size());
+            close(dirFd);
+            if (dirPathLen <= 0 || dirPathLen >= dirPath.size())
+                continue;
+
+            QString path = QFile::decodeName(QByteArray(dirPath.constData(), dirPathLen));
+            if (std::strcmp(name, ".") != 0)
+                path += QLatin1Char('/') + QFile::decodeName(name);
+            paths.append(path);
+        }
+        dispatch(paths, lost);
+    }
+}
+
+FanotifyWatcher::FanotifyWatcher(const QString &root, QObject *parent)
+    : QObject(parent)
+    , _root(QDir(root).absolutePath())
+    , _canonicalRoot(QDir(root).canonicalPath())
+{
+    if (_canonicalRoot.isEmpty())
+        return;
+    _fileSystem = FanotifyFileSystem::forPath(_canonicalRoot);
+    if (_fileSystem)
+        _fileSystem->addWatcher(this);
+}
+
+FanotifyWatcher::~FanotifyWatcher()
+{
+    if (_fileSystem)
+        _fileSystem->removeWatcher(this);
+}
+
+QString FanotifyWatcher::mapToRoot(const QString &canonicalPath) const
+{
+    if (canonicalPath == _canonicalRoot)
+        return _root;
+    if (canonicalPath.size() > _canonicalRoot.size()
+        && canonicalPath.startsWith(_canonicalRoot)
+        && canonicalPath.at(_canonicalRoot.size()) == QLatin1Char('/')) {
+        return _root + canonicalPath.mid(_canonicalRoot.size());
+    }
+    return QString();
+}
+
+#else
+
+FanotifyWatcher::FanotifyWatcher(const QString &root, QObject *parent)
+    : QObject(parent)
+    , _root(root)
+{
+    qCInfo(lcFolderWatcher) << "fanotify with FAN_REPORT_DFID_NAME is not available in this build";
+}
+
+FanotifyWatcher::~FanotifyWatcher() = default;
+
+QString FanotifyWatcher::mapToRoot(const QString &) const
+{
+    return QString();
+}
+
+#endif
+
+} // namespace OCC
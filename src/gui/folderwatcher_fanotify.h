@@ -0,0 +1,84 @@
+/*
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ * or FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License
+ * for more details.
+ */
+
+#ifndef MIRALL_FOLDERWATCHER_FANOTIFY_H
+#define MIRALL_FOLDERWATCHER_FANOTIFY_H
+
+#include <QObject>
+#include <QString>
+#include <QStringList>
+
+#include <memory>
+
+namespace OCC {
+
+class FanotifyFileSystem;
+
+/**
+ * @brief Watches a folder through a fanotify mark on its whole file system
+ *
+ * A single mark covers every directory, so unlike inotify there is nothing
+ * to register per directory, no recursive walk on startup and no
+ * max_user_watches limit. Events carry the handle of the parent directory
+ * and the entry name (FAN_REPORT_DFID_NAME).
+ *
+ * All watchers on one file system share a fanotify group, whose events are
+ * read on a separate thread and handed to the watchers whose root they are
+ * below. Events outside of all watched folders are dropped there.
+ *
+ * Needs Linux 5.9 and the privileges for filesystem marks and for
+ * open_by_handle_at(), usually CAP_SYS_ADMIN and CAP_DAC_READ_SEARCH.
+ * Check isValid() and fall back to inotify when it's false.
+ *
+ * @ingroup gui
+ */
+class FanotifyWatcher : public QObject
+{
+    Q_OBJECT
+public:
+    explicit FanotifyWatcher(const QString &root, QObject *parent = nullptr);
+    ~FanotifyWatcher() override;
+
+    /// Whether the fanotify mark could be set up
+    bool isValid() const { return _fileSystem != nullptr; }
+
+    /// For tests: whether both watchers read the same fanotify group
+    bool testSharesGroupWith(const FanotifyWatcher &other) const
+    {
+        return _fileSystem && _fileSystem == other._fileSystem;
+    }
+
+signals:
+    /// Files or directories below the root changed, absolute paths
+    void changesDetected(const QStringList &paths);
+
+    /// The kernel event queue overflowed
+    void lostChanges();
+
+protected:
+    /** Maps a path as reported by the kernel to the root's spelling.
+     *
+     * Returns an empty string for paths outside of the root. Called from
+     * the reading thread.
+     */
+    QString mapToRoot(const QString &canonicalPath) const;
+
+private:
+    friend class FanotifyFileSystem;
+
+    QString _root;
+    QString _canonicalRoot;
+    std::shared_ptr<FanotifyFileSystem> _fileSystem;
+};
+}
+
+#endif
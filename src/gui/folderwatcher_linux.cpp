@@ -18,31 +18,100 @@
 
 #include "folder.h"
 #include "folderwatcher_linux.h"
+#include "folderwatcher_fanotify.h"
 
 #include <cerrno>
 #include <QStringList>
 #include <QObject>
+#include <QFileInfo>
 #include <QVarLengthArray>
+#include <unistd.h>
 
 namespace OCC {
 
+// Events are collected for this long before being delivered as one batch
+static const int changeBatchIntervalMs = 200;
+// Above this many pending paths, changes are dropped and reported as lost
+static const int maxPendingChanges = 10000;
+// Directories found while walking are handed over in chunks of this size
+static const int folderChunkSize = 1000;
+
 FolderWatcherPrivate::FolderWatcherPrivate(FolderWatcher *p, const QString &path)
     : QObject()
     , _parent(p)
     , _folder(path)
 {
-    _fd = inotify_init();
-    if (_fd != -1) {
-        _socket.reset(new QSocketNotifier(_fd, QSocketNotifier::Read));
-        connect(_socket.data(), &QSocketNotifier::activated, this, &FolderWatcherPrivate::slotReceivedNotification);
-    } else {
-        qCWarning(lcFolderWatcher) << "notify_init() failed: " << strerror(errno);
+    if (qgetenv("OWNCLOUD_FOLDERWATCHER_BACKEND") != "inotify") {
+        QScopedPointer<FanotifyWatcher> fanotify(new FanotifyWatcher(path));
+        if (fanotify->isValid()) {
+            qCInfo(lcFolderWatcher) << "Using fanotify to watch" << path;
+            connect(fanotify.data(), &FanotifyWatcher::changesDetected, this, &FolderWatcherPrivate::slotChangesDetected);
+            connect(fanotify.data(), &FanotifyWatcher::lostChanges, _parent, &FolderWatcher::lostChanges);
+            _fanotify.swap(fanotify);
+            return;
+        }
     }
 
-    QMetaObject::invokeMethod(this, "slotAddFolderRecursive", Q_ARG(QString, path));
+    _ready = false;
+    _worker = new InotifyWorker;
+    _worker->moveToThread(&_thread);
+    connect(&_thread, &QThread::finished, _worker, &QObject::deleteLater);
+    connect(_worker, &InotifyWorker::foldersFound, this, &FolderWatcherPrivate::slotFoldersFound);
+    connect(_worker, &InotifyWorker::initialWalkFinished, this, [this] {
+        // Queued behind the registerFolders() calls made for the walk
+        QMetaObject::invokeMethod(_worker, "finishInitialRegistration");
+    });
+    connect(_worker, &InotifyWorker::initialRegistrationFinished, this, [this] {
+        qCInfo(lcFolderWatcher) << "Watching" << _worker->watchCount() << "directories below" << _folder;
+        _ready = true;
+    });
+    connect(_worker, &InotifyWorker::changesDetected, this, &FolderWatcherPrivate::slotChangesDetected);
+    connect(_worker, &InotifyWorker::watchesExhausted, this, &FolderWatcherPrivate::slotWatchesExhausted);
+    connect(_worker, &InotifyWorker::lostChanges, _parent, &FolderWatcher::lostChanges);
+    _thread.setObjectName(QStringLiteral("FolderWatcher"));
+    _thread.start();
+
+    QMetaObject::invokeMethod(_worker, "start", Q_ARG(QString, path));
 }
 
-FolderWatcherPrivate::~FolderWatcherPrivate() = default;
+FolderWatcherPrivate::~FolderWatcherPrivate()
+{
+    _thread.quit();
+    _thread.wait();
+}
+
+void FolderWatcherPrivate::slotFoldersFound(const QStringList &paths)
+{
+    // The exclude checks need the folder's state, which lives in this thread
+    QStringList toRegister;
+    toRegister.reserve(paths.size());
+    for (const auto &path : paths) {
+        if (_parent->pathIsIgnored(path)) {
+            qCDebug(lcFolderWatcher) << "* Not adding" << path;
+            continue;
+        }
+        toRegister.append(path);
+    }
+    // Queued: the worker handles these before anything it is told later
+    QMetaObject::invokeMethod(_worker, "registerFolders", Q_ARG(QStringList, toRegister));
+}
+
+void FolderWatcherPrivate::slotChangesDetected(const QStringList &paths)
+{
+    _parent->changeDetected(paths);
+}
+
+void FolderWatcherPrivate::slotWatchesExhausted()
+{
+    // If we're running out of memory or inotify watches, become
+    // unreliable.
+    if (_parent->_isReliable) {
+        _parent->_isReliable = false;
+        emit _parent->becameUnreliable(
+            tr("This problem usually happens when the inotify watches are exhausted. "
+               "Check the FAQ for details."));
+    }
+}
 
 // attention: result list passed by reference!
 bool FolderWatcherPrivate::findFoldersBelow(const QDir &dir, QStringList &fullList)
@@ -69,65 +138,127 @@ bool FolderWatcherPrivate::findFoldersBelow(const QDir &dir, QStringList &fullLi
     return ok;
 }
 
-void FolderWatcherPrivate::inotifyRegisterPath(const QString &path)
+InotifyWorker::~InotifyWorker()
 {
-    if (path.isEmpty())
-        return;
+    _socket.reset();
+    if (_fd != -1)
+        close(_fd);
+}
 
-    int wd = inotify_add_watch(_fd, path.toUtf8().constData(),
-        IN_CLOSE_WRITE | IN_ATTRIB | IN_MOVE | IN_CREATE | IN_DELETE | IN_DELETE_SELF | IN_MOVE_SELF | IN_UNMOUNT | IN_ONLYDIR);
-    if (wd > -1) {
-        _watchToPath.insert(wd, path);
-        _pathToWatch.insert(path, wd);
+void InotifyWorker::start(const QString &path)
+{
+    _fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    if (_fd != -1) {
+        _socket.reset(new QSocketNotifier(_fd, QSocketNotifier::Read));
+        connect(_socket.data(), &QSocketNotifier::activated, this, &InotifyWorker::slotReceivedNotification);
     } else {
-        // If we're running out of memory or inotify watches, become
-        // unreliable.
-        if (_parent->_isReliable && (errno == ENOMEM || errno == ENOSPC)) {
-            _parent->_isReliable = false;
-            emit _parent->becameUnreliable(
-                tr("This problem usually happens when the inotify watches are exhausted. "
-                   "Check the FAQ for details."));
-        }
+        qCWarning(lcFolderWatcher) << "notify_init() failed: " << strerror(errno);
     }
+
+    _flushTimer.reset(new QTimer);
+    _flushTimer->setSingleShot(true);
+    _flushTimer->setInterval(changeBatchIntervalMs);
+    connect(_flushTimer.data(), &QTimer::timeout, this, &InotifyWorker::flushChanges);
+
+    walk(QDir(path).absolutePath(), nullptr);
+    emit initialWalkFinished();
+}
+
+void InotifyWorker::finishInitialRegistration()
+{
+    emit initialRegistrationFinished();
 }
 
-void FolderWatcherPrivate::slotAddFolderRecursive(const QString &path)
+void InotifyWorker::walk(const QString &path, QStringList *subPaths)
 {
     if (_pathToWatch.contains(path))
         return;
 
-    int subdirs = 0;
     qCDebug(lcFolderWatcher) << "(+) Watcher:" << path;
 
-    QDir inPath(path);
-    inotifyRegisterPath(inPath.absolutePath());
-
-    QStringList allSubfolders;
-    if (!findFoldersBelow(QDir(path), allSubfolders)) {
+    QStringList allFolders(path);
+    if (!FolderWatcherPrivate::findFoldersBelow(QDir(path), allFolders)) {
         qCWarning(lcFolderWatcher) << "Could not traverse all sub folders";
     }
-    QStringListIterator subfoldersIt(allSubfolders);
-    while (subfoldersIt.hasNext()) {
-        QString subfolder = subfoldersIt.next();
-        QDir folder(subfolder);
-        if (folder.exists() && !_pathToWatch.contains(folder.absolutePath())) {
-            subdirs++;
-            if (_parent->pathIsIgnored(subfolder)) {
-                qCDebug(lcFolderWatcher) << "* Not adding" << folder.path();
-                continue;
-            }
-            inotifyRegisterPath(folder.absolutePath());
-        } else {
-            qCDebug(lcFolderWatcher) << "    `-> discarded:" << folder.path();
+    if (allFolders.size() > 1) {
+        qCDebug(lcFolderWatcher) << "    `-> and" << allFolders.size() - 1 << "subdirectories";
+    }
+
+    for (int i = 0; i < allFolders.size(); i += folderChunkSize)
+        emit foldersFound(allFolders.mid(i, folderChunkSize));
+
+    if (subPaths) {
+        for (const auto &folder : qAsConst(allFolders)) {
+            const auto entries = QDir(folder).entryList(QDir::NoDotAndDotDot | QDir::Dirs | QDir::Files | QDir::Hidden);
+            for (const auto &entry : entries)
+                subPaths->append(folder + QLatin1Char('/') + entry);
         }
     }
+}
 
-    if (subdirs > 0) {
-        qCDebug(lcFolderWatcher) << "    `-> and" << subdirs << "subdirectories";
+void InotifyWorker::registerFolders(const QStringList &paths)
+{
+    for (const auto &path : paths) {
+        if (!_pathToWatch.contains(path) && QFileInfo(path).isDir())
+            inotifyRegisterPath(path);
     }
+    _watchCount.store(_pathToWatch.size());
 }
 
-void FolderWatcherPrivate::slotReceivedNotification(int fd)
+void InotifyWorker::inotifyRegisterPath(const QString &path)
+{
+    if (path.isEmpty())
+        return;
+
+    int wd = inotify_add_watch(_fd, path.toUtf8().constData(),
+        IN_CLOSE_WRITE | IN_ATTRIB | IN_MOVE | IN_CREATE | IN_DELETE | IN_DELETE_SELF | IN_MOVE_SELF | IN_UNMOUNT | IN_ONLYDIR);
+    if (wd > -1) {
+        _watchToPath.insert(wd, path);
+        _pathToWatch.insert(path, wd);
+    } else if (!_watchesExhausted && (errno == ENOMEM || errno == ENOSPC)) {
+        _watchesExhausted = true;
+        emit watchesExhausted();
+    }
+}
+
+void InotifyWorker::addChange(const QString &dir, const QString &name)
+{
+    if (_pendingCount < 0)
+        return; // overflowed, waiting for the flush
+
+    auto &names = _pendingChanges[dir];
+    if (names.contains(name))
+        return;
+    if (_pendingCount >= maxPendingChanges) {
+        qCWarning(lcFolderWatcher) << "Too many pending changes, dropping them";
+        _pendingChanges.clear();
+        _pendingCount = -1;
+        emit lostChanges();
+        return;
+    }
+    names.insert(name);
+    ++_pendingCount;
+
+    if (!_flushTimer->isActive())
+        _flushTimer->start();
+}
+
+void InotifyWorker::flushChanges()
+{
+    QStringList paths;
+    paths.reserve(qMax(_pendingCount, 0));
+    for (auto it = _pendingChanges.constBegin(); it != _pendingChanges.constEnd(); ++it) {
+        for (const auto &name : it.value())
+            paths.append(name.isEmpty() ? it.key() : it.key() + QLatin1Char('/') + name);
+    }
+    _pendingChanges.clear();
+    _pendingCount = 0;
+
+    if (!paths.isEmpty())
+        emit changesDetected(paths);
+}
+
+void InotifyWorker::slotReceivedNotification(int fd)
 {
     int len = 0;
     struct inotify_event *event = nullptr;
@@ -135,62 +266,82 @@ void FolderWatcherPrivate::slotReceivedNotification(int fd)
     int error = 0;
     QVarLengthArray<char, 2048> buffer(2048);
 
-    len = read(fd, buffer.data(), buffer.size());
-    error = errno;
-    /**
-      * From inotify documentation:
-      *
-      * The behavior when the buffer given to read(2) is too
-      * small to return information about the next event
-      * depends on the kernel version: in kernels  before 2.6.21,
-      * read(2) returns 0; since kernel 2.6.21, read(2) fails with
-      * the error EINVAL.
-      */
-    while (len < 0 && error == EINVAL) {
-        // double the buffer size
-        buffer.resize(buffer.size() * 2);
-
-        /* and try again ... */
+    forever {
         len = read(fd, buffer.data(), buffer.size());
         error = errno;
-    }
+        /**
+          * From inotify documentation:
+          *
+          * The behavior when the buffer given to read(2) is too
+          * small to return information about the next event
+          * depends on the kernel version: in kernels  before 2.6.21,
+          * read(2) returns 0; since kernel 2.6.21, read(2) fails with
+          * the error EINVAL.
+          */
+        while (len < 0 && error == EINVAL) {
+            // double the buffer size
+            buffer.resize(buffer.size() * 2);
 
-    // iterate events in buffer
-    unsigned int ulen = len;
-    for (i = 0; i + sizeof(inotify_event) < ulen; i += sizeof(inotify_event) + (event ? event->len : 0)) {
-        // cast an inotify_event
-        event = (struct inotify_event *)&buffer[i];
-        if (!event) {
-            qCDebug(lcFolderWatcher) << "NULL event";
-            continue;
+            /* and try again ... */
+            len = read(fd, buffer.data(), buffer.size());
+            error = errno;
         }
+        if (len <= 0)
+            break; // EAGAIN: all events read
 
-        // Fire event for the path that was changed.
-        if (event->len == 0 || event->wd <= -1)
-            continue;
-        QByteArray fileName(event->name);
-        // Filter out journal changes - redundant with filtering in
-        // FolderWatcher::pathIsIgnored.
-        if (fileName.startsWith("._sync_")
-            || fileName.startsWith(".csync_journal.db")
-            || fileName.startsWith(".sync_")) {
-            continue;
-        }
-        const QString p = _watchToPath[event->wd] + '/' + fileName;
-        _parent->changeDetected(p);
+        // iterate events in buffer
+        unsigned int ulen = len;
+        event = nullptr;
+        for (i = 0; i + sizeof(inotify_event) <= ulen; i += sizeof(inotify_event) + (event ? event->len : 0)) {
+            // cast an inotify_event
+            event = (struct inotify_event *)&buffer[i];
+            if (!event) {
+                qCDebug(lcFolderWatcher) << "NULL event";
+                continue;
+            }
 
-        if ((event->mask & (IN_MOVED_TO | IN_CREATE))
-            && QFileInfo(p).isDir()
-            && !_parent->pathIsIgnored(p)) {
-            slotAddFolderRecursive(p);
-        }
-        if (event->mask & (IN_MOVED_FROM | IN_DELETE)) {
-            removeFoldersBelow(p);
+            if (event->mask & IN_Q_OVERFLOW) {
+                qCWarning(lcFolderWatcher) << "inotify event queue overflow";
+                emit lostChanges();
+                continue;
+            }
+
+            // Fire event for the path that was changed.
+            if (event->len == 0 || event->wd <= -1)
+                continue;
+            QByteArray fileName(event->name);
+            // Filter out journal changes - redundant with filtering in
+            // FolderWatcher::pathIsIgnored.
+            if (fileName.startsWith("._sync_")
+                || fileName.startsWith(".csync_journal.db")
+                || fileName.startsWith(".sync_")) {
+                continue;
+            }
+            const QString dir = _watchToPath.value(event->wd);
+            if (dir.isEmpty())
+                continue;
+            const QString name = QString::fromUtf8(fileName);
+            const QString p = dir + '/' + name;
+            addChange(dir, name);
+
+            if ((event->mask & (IN_MOVED_TO | IN_CREATE))
+                && QFileInfo(p).isDir()) {
+                // Report the contents of moved in directories too
+                QStringList subPaths;
+                walk(p, &subPaths);
+                for (const auto &subPath : qAsConst(subPaths)) {
+                    const int slash = subPath.lastIndexOf('/');
+                    addChange(subPath.left(slash), subPath.mid(slash + 1));
+                }
+            }
+            if (event->mask & (IN_MOVED_FROM | IN_DELETE)) {
+                removeFoldersBelow(p);
+            }
         }
     }
 }
 
-void FolderWatcherPrivate::removeFoldersBelow(const QString &path)
+void InotifyWorker::removeFoldersBelow(const QString &path)
 {
     auto it = _pathToWatch.find(path);
     if (it == _pathToWatch.end())
@@ -215,6 +366,7 @@ void FolderWatcherPrivate::removeFoldersBelow(const QString &path)
         it = _pathToWatch.erase(it);
         qCDebug(lcFolderWatcher) << "Removed watch for" << itPath;
     }
+    _watchCount.store(_pathToWatch.size());
 }
 
 } // ns mirall
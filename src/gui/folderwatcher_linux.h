@@ -19,16 +19,90 @@
 #include <QString>
 #include <QSocketNotifier>
 #include <QHash>
+#include <QMap>
+#include <QScopedPointer>
+#include <QSet>
 #include <QDir>
+#include <QThread>
+#include <QTimer>
+#include <QAtomicInt>
 
 #include "folderwatcher.h"
 
-class QTimer;
-
 namespace OCC {
 
+class FanotifyWatcher;
+
 /**
- * @brief Linux (inotify) API implementation of FolderWatcher
+ * @brief Owns the inotify watches, lives in the watcher thread
+ *
+ * Walks new directory trees, registers the watches and reads the events,
+ * so none of it blocks the GUI thread. Which directories get a watch is
+ * decided by FolderWatcherPrivate on the GUI thread, see foldersFound().
+ *
+ * Events are coalesced per directory until flushed as one batch. If too
+ * many paths pile up, they are dropped and lostChanges() is emitted.
+ *
+ * @ingroup gui
+ */
+class InotifyWorker : public QObject
+{
+    Q_OBJECT
+public:
+    InotifyWorker() = default;
+    ~InotifyWorker();
+
+    /// Safe to call from any thread
+    int watchCount() const { return _watchCount.load(); }
+
+public slots:
+    /// Sets up inotify and walks the tree below path
+    void start(const QString &path);
+    void registerFolders(const QStringList &paths);
+    /// Emits initialRegistrationFinished() once the queued registrations are done
+    void finishInitialRegistration();
+
+signals:
+    /// Directories found while walking, to be passed back to registerFolders()
+    void foldersFound(const QStringList &paths);
+    void initialWalkFinished();
+    void initialRegistrationFinished();
+    /// A batch of changed paths
+    void changesDetected(const QStringList &paths);
+    void watchesExhausted();
+    void lostChanges();
+
+private slots:
+    void slotReceivedNotification(int fd);
+    void flushChanges();
+
+private:
+    void walk(const QString &path, QStringList *subPaths);
+    void inotifyRegisterPath(const QString &path);
+    void removeFoldersBelow(const QString &path);
+    void addChange(const QString &dir, const QString &name);
+
+    QHash<int, QString> _watchToPath;
+    QMap<QString, int> _pathToWatch;
+    QAtomicInt _watchCount;
+    QScopedPointer<QSocketNotifier> _socket;
+    int _fd = -1;
+    bool _watchesExhausted = false;
+
+    /// Changed entry names by directory, "" stands for the directory itself
+    QHash<QString, QSet<QString>> _pendingChanges;
+    int _pendingCount = 0;
+    QScopedPointer<QTimer> _flushTimer;
+};
+
+/**
+ * @brief Linux (fanotify or inotify) API implementation of FolderWatcher
+ *
+ * fanotify is used where the process may place a file system mark, see
+ * FanotifyWatcher. Otherwise, or when OWNCLOUD_FOLDERWATCHER_BACKEND is set
+ * to "inotify", every directory gets an inotify watch, maintained by an
+ * InotifyWorker in a separate thread.
+ *
  * @ingroup gui
  */
 class FolderWatcherPrivate : public QObject
@@ -39,28 +113,31 @@ public:
     FolderWatcherPrivate(FolderWatcher *p, const QString &path);
     ~FolderWatcherPrivate();
 
-    int testWatchCount() const { return _pathToWatch.size(); }
+    int testWatchCount() const { return _worker ? _worker->watchCount() : 0; }
+    bool testUsesFanotify() const { return _fanotify; }
 
-    /// On linux the watcher is ready when the ctor finished.
+    /// On linux the watcher is ready once the initial watches are registered.
     bool _ready = true;
 
 protected slots:
-    void slotReceivedNotification(int fd);
-    void slotAddFolderRecursive(const QString &path);
+    void slotFoldersFound(const QStringList &paths);
+    void slotChangesDetected(const QStringList &paths);
+    void slotWatchesExhausted();
 
 protected:
-    bool findFoldersBelow(const QDir &dir, QStringList &fullList);
-    void inotifyRegisterPath(const QString &path);
-    void removeFoldersBelow(const QString &path);
+    static bool findFoldersBelow(const QDir &dir, QStringList &fullList);
 
 private:
-    FolderWatcher *_parent;
+    FolderWatcher *_parent = nullptr;
 
     QString _folder;
-    QHash<int, QString> _watchToPath;
-    QMap<QString, int> _pathToWatch;
-    QScopedPointer<QSocketNotifier> _socket;
-    int _fd;
+    QThread _thread;
+    InotifyWorker *_worker = nullptr;
+
+    /// Set when fanotify is used instead of the inotify watches
+    QScopedPointer<FanotifyWatcher> _fanotify;
+
+    friend class InotifyWorker;
 };
 }
 
@@ -342,6 +342,10 @@ void ownCloudGui::slotComputeOverallSyncStatus()
                 folder->syncResult().status(),
                 folder->syncResult().hasUnresolvedConflicts(),
                 folder->syncPaused());
+            if (const int stabilizing = folder->stabilizingFileCount()) {
+                folderMessage += QLatin1Char('\n')
+                    + tr("Waiting for %n file(s) to finish changing", "", stabilizing);
+            }
             allStatusStrings += tr("Folder %1: %2").arg(folder->shortGuiLocalPath(), folderMessage);
         }
         trayMessage = allStatusStrings.join(QLatin1String("\n"));
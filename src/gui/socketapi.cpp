@@ -75,7 +75,7 @@
 // This is the version that is returned when the client asks for the VERSION.
 // The first number should be changed if there is an incompatible change that breaks old clients.
 // The second number should be changed when there are new features.
-#define MIRALL_SOCKET_API_VERSION "1.1"
+#define MIRALL_SOCKET_API_VERSION "1.2"
 
 namespace {
 #if GUI_TESTING
@@ -200,6 +200,45 @@ void SocketListener::sendMessage(const QString &message, bool doWait) const
     }
 }
 
+bool SocketListener::queueStatusIfSubscribed(const QString &systemPath, const QString &systemDirectory, const QString &status)
+{
+    if (!_subscribedDirectories.contains(systemDirectory))
+        return false;
+    auto it = _queuedStatuses.find(systemPath);
+    if (it == _queuedStatuses.end()) {
+        _queuedStatusPaths.append(systemPath);
+        _queuedStatuses.insert(systemPath, status);
+    } else {
+        *it = status;
+    }
+    return true;
+}
+
+bool SocketListener::flushQueuedStatuses()
+{
+    if (_queuedStatusPaths.isEmpty())
+        return false;
+    if (!socket) {
+        _queuedStatusPaths.clear();
+        _queuedStatuses.clear();
+        return false;
+    }
+    // Let a slow file manager catch up, it gets the newest statuses once it did
+    static const qint64 maxUnsentBytes = 64 * 1024;
+    if (socket->bytesToWrite() > maxUnsentBytes)
+        return true;
+
+    // One message per line, the macOS socket is message based
+    qCDebug(lcSocketApi) << "Sending" << _queuedStatusPaths.size() << "batched statuses to" << socket;
+    sendMessage(QStringLiteral("STATUS_BATCH:BEGIN"));
+    for (const auto &path : qAsConst(_queuedStatusPaths))
+        sendMessage(buildMessage(QStringLiteral("STATUS"), path, _queuedStatuses.value(path)));
+    sendMessage(QStringLiteral("STATUS_BATCH:END"));
+    _queuedStatusPaths.clear();
+    _queuedStatuses.clear();
+    return false;
+}
+
 struct ListenerHasSocketPred
 {
     QIODevice *socket;
@@ -279,6 +318,11 @@ SocketApi::SocketApi(QObject *parent)
 
     connect(&_localServer, &SocketApiServer::newConnection, this, &SocketApi::slotNewConnection);
 
+    // Status changes for subscribed directories are sent in batches
+    _statusPushTimer.setSingleShot(true);
+    _statusPushTimer.setInterval(100);
+    connect(&_statusPushTimer, &QTimer::timeout, this, &SocketApi::slotFlushStatusPushes);
+
     // folder watcher
     connect(FolderMan::instance(), &FolderMan::folderSyncStateChange, this, &SocketApi::slotUpdateFolderView);
 }
@@ -512,12 +556,47 @@ void SocketApi::processShareRequest(const QString &localFile, SocketListener *li
 
 void SocketApi::broadcastStatusPushMessage(const QString &systemPath, SyncFileStatus fileStatus)
 {
-    QString msg = buildMessage(QLatin1String("STATUS"), systemPath, fileStatus.toSocketAPIString());
+    const QString status = fileStatus.toSocketAPIString();
+    QString msg = buildMessage(QLatin1String("STATUS"), systemPath, status);
     Q_ASSERT(!systemPath.endsWith('/'));
-    uint directoryHash = qHash(systemPath.left(systemPath.lastIndexOf('/')));
-    foreach (auto &listener, _listeners) {
-        listener.sendMessageIfDirectoryMonitored(msg, directoryHash);
+    const QString directory = systemPath.left(systemPath.lastIndexOf('/'));
+    uint directoryHash = qHash(directory);
+    bool queued = false;
+    for (auto &listener : _listeners) {
+        // Directories that are monitored but not subscribed still get single lines
+        if (listener.queueStatusIfSubscribed(systemPath, directory, status)) {
+            queued = true;
+        } else {
+            listener.sendMessageIfDirectoryMonitored(msg, directoryHash);
+        }
     }
+    if (queued && !_statusPushTimer.isActive())
+        _statusPushTimer.start();
+}
+
+void SocketApi::slotFlushStatusPushes()
+{
+    bool pending = false;
+    for (auto &listener : _listeners)
+        pending |= listener.flushQueuedStatuses();
+    if (pending)
+        _statusPushTimer.start();
+}
+
+void SocketApi::command_SUBSCRIBE_STATUS(const QString &argument, SocketListener *listener)
+{
+    QString directory = QDir::fromNativeSeparators(argument);
+    if (directory.endsWith(QLatin1Char('/')))
+        directory.chop(1);
+    listener->subscribeDirectory(directory);
+}
+
+void SocketApi::command_UNSUBSCRIBE_STATUS(const QString &argument, SocketListener *listener)
+{
+    QString directory = QDir::fromNativeSeparators(argument);
+    if (directory.endsWith(QLatin1Char('/')))
+        directory.chop(1);
+    listener->unsubscribeDirectory(directory);
 }
 
 void SocketApi::command_RETRIEVE_FOLDER_STATUS(const QString &argument, SocketListener *listener)
@@ -548,6 +627,27 @@ void SocketApi::command_RETRIEVE_FILE_STATUS(const QString &argument, SocketList
     listener->sendMessage(message);
 }
 
+void SocketApi::command_RETRIEVE_DIRECTORY_STATUS(const QString &argument, SocketListener *listener)
+{
+    const QString nativeDirectory = QDir::toNativeSeparators(argument);
+    listener->sendMessage(QLatin1String("RETRIEVE_DIRECTORY_STATUS:BEGIN:") + nativeDirectory);
+
+    auto fileData = FileData::get(argument);
+    if (fileData.folder) {
+        // Status pushes for the entries are wanted from now on, as with RETRIEVE_FILE_STATUS
+        listener->registerMonitoredDirectory(qHash(fileData.localPath));
+
+        const QStringList names = QDir(fileData.localPath).entryList(QDir::AllEntries | QDir::NoDotAndDotDot | QDir::Hidden | QDir::System);
+        const auto statuses = fileData.folder->syncEngine().syncFileStatusTracker().directoryEntryStatuses(fileData.folderRelativePath, names);
+        for (int i = 0; i < names.size(); ++i) {
+            listener->sendMessage(QLatin1String("STATUS:") % statuses[i].toSocketAPIString() % QLatin1Char(':')
+                % QDir::toNativeSeparators(fileData.localPath + QLatin1Char('/') + names[i]));
+        }
+    }
+
+    listener->sendMessage(QLatin1String("RETRIEVE_DIRECTORY_STATUS:END:") + nativeDirectory);
+}
+
 void SocketApi::command_SHARE(const QString &localFile, SocketListener *listener)
 {
     processShareRequest(localFile, listener, ShareDialogStartPage::UsersAndGroups);
@@ -795,14 +895,8 @@ void SocketApi::command_MAKE_AVAILABLE_LOCALLY(const QString &filesArg, SocketLi
         if (!data.folder)
             continue;
 
-        // Update the pin state on all items
-        if (!data.folder->vfs().setPinState(data.folderRelativePath, PinState::AlwaysLocal)) {
-            qCWarning(lcSocketApi) << "Could not set pin state of" << data.folderRelativePath << "to always local";
-        }
-
-        // Trigger sync
-        data.folder->schedulePathForLocalDiscovery(data.folderRelativePath);
-        data.folder->scheduleThisFolderSoon();
+        // Update the pin state on all items and sync just them
+        data.folder->setSubtreePinState(data.folderRelativePath, PinState::AlwaysLocal);
     }
 }
 
@@ -816,14 +910,8 @@ void SocketApi::command_MAKE_ONLINE_ONLY(const QString &filesArg, SocketListener
         if (!data.folder)
             continue;
 
-        // Update the pin state on all items
-        if (!data.folder->vfs().setPinState(data.folderRelativePath, PinState::OnlineOnly)) {
-            qCWarning(lcSocketApi) << "Could not set pin state of" << data.folderRelativePath << "to online only";
-        }
-
-        // Trigger sync
-        data.folder->schedulePathForLocalDiscovery(data.folderRelativePath);
-        data.folder->scheduleThisFolderSoon();
+        // Update the pin state on all items and sync just them
+        data.folder->setSubtreePinState(data.folderRelativePath, PinState::OnlineOnly);
     }
 }
 
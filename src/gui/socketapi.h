@@ -22,6 +22,8 @@
 
 #include "config.h"
 
+#include <QTimer>
+
 #if defined(Q_OS_MAC)
 #include "socketapisocket_mac.h"
 #else
@@ -32,6 +34,7 @@ using SocketApiServer = QLocalServer;
 class QUrl;
 class QLocalSocket;
 class QStringList;
+class TestSocketApi;
 
 namespace OCC {
 
@@ -69,6 +72,7 @@ private slots:
     void onLostConnection();
     void slotSocketDestroyed(QObject *obj);
     void slotReadSocket();
+    void slotFlushStatusPushes();
 
     static void copyUrlToClipboard(const QString &link);
     static void emailPrivateLink(const QString &link);
@@ -105,6 +109,26 @@ private:
     Q_INVOKABLE void command_RETRIEVE_FOLDER_STATUS(const QString &argument, SocketListener *listener);
     Q_INVOKABLE void command_RETRIEVE_FILE_STATUS(const QString &argument, SocketListener *listener);
 
+    /** Send the statuses of all entries of a directory at once (added in version 1.2)
+     * argument is the directory.
+     * Reply with RETRIEVE_DIRECTORY_STATUS:BEGIN:[directory]
+     * followed by a STATUS:[status]:[path] for each entry
+     * and ends with RETRIEVE_DIRECTORY_STATUS:END:[directory]
+     * There are no entries for directories outside of the sync folders, even if
+     * they contain one. Clients ask for such entries with RETRIEVE_FILE_STATUS.
+     */
+    Q_INVOKABLE void command_RETRIEVE_DIRECTORY_STATUS(const QString &argument, SocketListener *listener);
+
+    /** Subscribe to batched status pushes for the files in a directory (added in version 1.2)
+     * argument is the directory the file manager shows.
+     * Status changes of files in subscribed directories are no longer pushed
+     * one by one. They are coalesced and sent every 100ms as STATUS_BATCH:BEGIN,
+     * several STATUS:[status]:[path] and STATUS_BATCH:END.
+     * Other monitored directories keep getting one STATUS line per change.
+     */
+    Q_INVOKABLE void command_SUBSCRIBE_STATUS(const QString &argument, SocketListener *listener);
+    Q_INVOKABLE void command_UNSUBSCRIBE_STATUS(const QString &argument, SocketListener *listener);
+
     Q_INVOKABLE void command_VERSION(const QString &argument, SocketListener *listener);
 
     Q_INVOKABLE void command_SHARE_MENU_TITLE(const QString &argument, SocketListener *listener);
@@ -166,6 +190,9 @@ private:
     QSet<QString> _registeredAliases;
     QList<SocketListener> _listeners;
     SocketApiServer _localServer;
+    QTimer _statusPushTimer;
+
+    friend class ::TestSocketApi;
 };
 }
 
@@ -19,7 +19,10 @@
 
 #include <functional>
 #include <QBitArray>
+#include <QHash>
 #include <QPointer>
+#include <QSet>
+#include <QStringList>
 
 #include <QJsonDocument>
 #include <QJsonObject>
@@ -80,8 +83,30 @@ public:
         _monitoredDirectoriesBloomFilter.storeHash(systemDirectoryHash);
     }
 
+    /// Subscribed directories get batched status pushes, see SocketApi::command_SUBSCRIBE_STATUS
+    void subscribeDirectory(const QString &systemDirectory) { _subscribedDirectories.insert(systemDirectory); }
+    void unsubscribeDirectory(const QString &systemDirectory) { _subscribedDirectories.remove(systemDirectory); }
+
+    /** Remembers the status of a file in a subscribed directory for the next batch.
+     *
+     * Only the last status of a file is sent. Returns whether anything was queued.
+     */
+    bool queueStatusIfSubscribed(const QString &systemPath, const QString &systemDirectory, const QString &status);
+
+    /** Sends the queued statuses as one STATUS_BATCH frame.
+     *
+     * Nothing is sent while the socket still has a lot of unsent data, the
+     * statuses keep being coalesced until it catches up. Returns whether
+     * statuses are still queued.
+     */
+    bool flushQueuedStatuses();
+
 private:
     BloomFilter _monitoredDirectoriesBloomFilter;
+
+    QSet<QString> _subscribedDirectories;
+    QStringList _queuedStatusPaths;
+    QHash<QString, QString> _queuedStatuses;
 };
 
 class ListenerClosure : public QObject
@@ -63,6 +63,11 @@ Q_LOGGING_CATEGORY(lcConfigFile, "nextcloud.sync.configfile", QtInfoMsg)
 static const char remotePollIntervalC[] = "remotePollInterval";
 static const char forceSyncIntervalC[] = "forceSyncInterval";
 static const char fullLocalDiscoveryIntervalC[] = "fullLocalDiscoveryInterval";
+static const char maxConcurrentSyncsC[] = "maxConcurrentSyncs";
+static const char maxParallelNetworkJobsC[] = "maxParallelNetworkJobs";
+static const char maxChecksumThreadsC[] = "maxChecksumThreads";
+static const char fuseMountDirectoryC[] = "fuseMountDirectory";
+static const char hydrationPrefetchBudgetC[] = "hydrationPrefetchBudget";
 static const char notificationRefreshIntervalC[] = "notificationRefreshInterval";
 static const char monoIconsC[] = "monoIcons";
 static const char promptDeleteC[] = "promptDeleteAllFiles";
@@ -80,6 +85,9 @@ static const char chunkSizeC[] = "chunkSize";
 static const char minChunkSizeC[] = "minChunkSize";
 static const char maxChunkSizeC[] = "maxChunkSize";
 static const char targetChunkUploadDurationC[] = "targetChunkUploadDuration";
+static const char journalMmapSizeLimitC[] = "journalMmapSizeLimit";
+static const char journalCacheSizeLimitC[] = "journalCacheSizeLimit";
+static const char journalPageSizeC[] = "journalPageSize";
 static const char automaticLogDirC[] = "logToTemporaryLogDir";
 static const char logDirC[] = "logDir";
 static const char logDebugC[] = "logDebug";
@@ -104,6 +112,7 @@ static const char newBigFolderSizeLimitC[] = "newBigFolderSizeLimit";
 static const char useNewBigFolderSizeLimitC[] = "useNewBigFolderSizeLimit";
 static const char confirmExternalStorageC[] = "confirmExternalStorage";
 static const char moveToTrashC[] = "moveToTrash";
+static const char pruneUnchangedLocalDirectoriesC[] = "pruneUnchangedLocalDirectories";
 
 const char certPath[] = "http_certificatePath";
 const char certPasswd[] = "http_certificatePasswd";
@@ -243,6 +252,36 @@ chrono::milliseconds ConfigFile::targetChunkUploadDuration() const
     return millisecondsValue(settings, targetChunkUploadDurationC, chrono::minutes(1));
 }
 
+qint64 ConfigFile::journalMmapSizeLimit() const
+{
+    // Up to an eighth of the physical memory, but no more than 1 GB
+    qint64 defaultLimit = 256 * 1024 * 1024;
+    const auto memory = Utility::physicalMemorySize();
+    if (memory > 0)
+        defaultLimit = qMin<qint64>(memory / 8, 1024 * 1024 * 1024);
+
+    QSettings settings(configFile(), QSettings::IniFormat);
+    return settings.value(QLatin1String(journalMmapSizeLimitC), defaultLimit).toLongLong();
+}
+
+qint64 ConfigFile::journalCacheSizeLimit() const
+{
+    // Up to a 64th of the physical memory, but no more than 128 MB
+    qint64 defaultLimit = 16 * 1024 * 1024;
+    const auto memory = Utility::physicalMemorySize();
+    if (memory > 0)
+        defaultLimit = qMin<qint64>(memory / 64, 128 * 1024 * 1024);
+
+    QSettings settings(configFile(), QSettings::IniFormat);
+    return settings.value(QLatin1String(journalCacheSizeLimitC), defaultLimit).toLongLong();
+}
+
+int ConfigFile::journalPageSize() const
+{
+    QSettings settings(configFile(), QSettings::IniFormat);
+    return settings.value(QLatin1String(journalPageSizeC), 0).toInt();
+}
+
 void ConfigFile::setOptionalServerNotifications(bool show)
 {
     QSettings settings(configFile(), QSettings::IniFormat);
@@ -549,6 +588,36 @@ chrono::milliseconds OCC::ConfigFile::fullLocalDiscoveryInterval() const
     return millisecondsValue(settings, fullLocalDiscoveryIntervalC, chrono::hours(1));
 }
 
+int ConfigFile::maxConcurrentSyncs() const
+{
+    QSettings settings(configFile(), QSettings::IniFormat);
+    return qMax(1, settings.value(QLatin1String(maxConcurrentSyncsC), 1).toInt());
+}
+
+int ConfigFile::maxParallelNetworkJobs() const
+{
+    QSettings settings(configFile(), QSettings::IniFormat);
+    return qMax(0, settings.value(QLatin1String(maxParallelNetworkJobsC), 0).toInt());
+}
+
+int ConfigFile::maxChecksumThreads() const
+{
+    QSettings settings(configFile(), QSettings::IniFormat);
+    return qMax(0, settings.value(QLatin1String(maxChecksumThreadsC), 0).toInt());
+}
+
+QString ConfigFile::fuseMountDirectory() const
+{
+    QSettings settings(configFile(), QSettings::IniFormat);
+    return settings.value(QLatin1String(fuseMountDirectoryC)).toString();
+}
+
+qint64 ConfigFile::hydrationPrefetchBudget() const
+{
+    QSettings settings(configFile(), QSettings::IniFormat);
+    return qMax<qint64>(0, settings.value(QLatin1String(hydrationPrefetchBudgetC), 0).toLongLong());
+}
+
 chrono::milliseconds ConfigFile::notificationRefreshInterval(const QString &connection) const
 {
     QString con(connection);
@@ -891,6 +960,11 @@ void ConfigFile::setMoveToTrash(bool isChecked)
     setValue(moveToTrashC, isChecked);
 }
 
+bool ConfigFile::pruneUnchangedLocalDirectories() const
+{
+    return getValue(pruneUnchangedLocalDirectoriesC, QString(), false).toBool();
+}
+
 bool ConfigFile::showMainDialogAsNormalWindow() const {
     return getValue(showMainDialogAsNormalWindowC, {}, false).toBool();
 }
@@ -83,6 +83,27 @@ public:
      */
     std::chrono::milliseconds fullLocalDiscoveryInterval() const;
 
+    /** How many folders may sync at the same time, at least 1, defaults to 1 */
+    int maxConcurrentSyncs() const;
+
+    /** Network jobs shared by all running syncs
+     *
+     * 0 means the default of the folder's account, also shared.
+     */
+    int maxParallelNetworkJobs() const;
+
+    /** Threads for computing checksums, shared by all folders. 0 for one per core. */
+    int maxChecksumThreads() const;
+
+    /** Where the xattr virtual files backend mounts the FUSE views of its folders
+     *
+     * Each folder gets a subdirectory named after its alias. Empty disables the mounts.
+     */
+    QString fuseMountDirectory() const;
+
+    /** Bytes per hour each folder may hydrate ahead of use, see HydrationPrefetcher. 0 disables it. */
+    qint64 hydrationPrefetchBudget() const;
+
     bool monoIcons() const;
     void setMonoIcons(bool);
 
@@ -145,6 +166,12 @@ public:
     bool moveToTrash() const;
     void setMoveToTrash(bool);
 
+    /** Whether local discovery may skip listing unchanged directories, see SyncOptions
+     *
+     * Only used while the folder watcher is reliable.
+     */
+    bool pruneUnchangedLocalDirectories() const;
+
     bool showMainDialogAsNormalWindow() const;
 
     static bool setConfDir(const QString &value);
@@ -155,6 +182,17 @@ public:
     bool showInExplorerNavigationPane() const;
     void setShowInExplorerNavigationPane(bool show);
 
+    /**
+     * Upper bounds for the sync journal's memory mapped I/O and page cache, in bytes.
+     *
+     * By default they are derived from the amount of physical memory. The journal
+     * only uses as much as its file size calls for. Zero disables the tuning.
+     */
+    qint64 journalMmapSizeLimit() const;
+    qint64 journalCacheSizeLimit() const;
+    /** Page size for newly created journals, zero for the sqlite default */
+    int journalPageSize() const;
+
     int timeout() const;
     qint64 chunkSize() const;
     qint64 maxChunkSize() const;
@@ -0,0 +1,260 @@
+/*
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ * or FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License
+ * for more details.
+ */
+
+#include "dehydrationpolicy.h"
+
+#include "filesystem.h"
+#include "common/syncjournaldb.h"
+#include "common/syncjournalfilerecord.h"
+#include "common/vfs.h"
+
+#include <QDateTime>
+#include <QFileInfo>
+#include <QLoggingCategory>
+#include <QtConcurrentRun>
+
+#include <algorithm>
+
+using namespace OCC;
+
+Q_LOGGING_CATEGORY(lcDehydrationPolicy, "nextcloud.sync.dehydrationpolicy", QtInfoMsg)
+
+DehydrationPolicy::DehydrationPolicy(const QString &localPath, SyncJournalDb *journal, QObject *parent)
+    : QObject(parent)
+    , _localPath(localPath)
+    , _journal(journal)
+{
+    connect(&_loadWatcher, &QFutureWatcherBase::finished, this, &DehydrationPolicy::slotHydratedFilesLoaded);
+    connect(&_rankWatcher, &QFutureWatcherBase::finished, this, &DehydrationPolicy::slotCandidatesRanked);
+}
+
+DehydrationPolicy::~DehydrationPolicy()
+{
+    _loadWatcher.waitForFinished();
+    _rankWatcher.waitForFinished();
+}
+
+void DehydrationPolicy::setQuota(qint64 bytes)
+{
+    _quota = bytes;
+    if (_quota <= 0) {
+        // Not kept up to date without a quota
+        _loaded = false;
+        _hydratedFiles.clear();
+        _uncheckedPaths.clear();
+        _hydratedSize = 0;
+    }
+}
+
+void DehydrationPolicy::fileAccessed(const QString &relativePath)
+{
+    _accesses[relativePath] = QDateTime::currentMSecsSinceEpoch();
+}
+
+void DehydrationPolicy::itemCompleted(const SyncFileItemPtr &item)
+{
+    if (_quota <= 0 || item->_instruction == CSYNC_INSTRUCTION_NONE
+        || item->_instruction == CSYNC_INSTRUCTION_IGNORE || item->_instruction == CSYNC_INSTRUCTION_ERROR)
+        return;
+    // Loading later reads the journal as the sync left it
+    if (!_loaded && !_loadWatcher.isRunning())
+        return;
+
+    // Look up whatever the item left in the journal
+    if (!_loaded || item->_status != SyncFileItem::Success) {
+        _uncheckedPaths.insert(item->_originalFile);
+        _uncheckedPaths.insert(item->destination());
+        return;
+    }
+
+    if (item->isDirectory()) {
+        if (item->_instruction == CSYNC_INSTRUCTION_REMOVE)
+            moveHydratedFilesBelow(item->_originalFile, QString());
+        else if (item->destination() != item->_originalFile)
+            moveHydratedFilesBelow(item->_originalFile, item->destination());
+        return;
+    }
+
+    forgetHydratedFile(item->_originalFile);
+    forgetHydratedFile(item->_file);
+    const bool hydrated = item->_instruction != CSYNC_INSTRUCTION_REMOVE
+        && (item->_type == ItemTypeFile || item->_type == ItemTypeVirtualFileDownload);
+    if (hydrated) {
+        _hydratedFiles.insert(item->destination(), item->_size);
+        _hydratedSize += item->_size;
+    }
+}
+
+void DehydrationPolicy::hydrationRequested(const QString &relativePath)
+{
+    if (_quota > 0)
+        _hydratingPaths.insert(relativePath);
+}
+
+void DehydrationPolicy::hydrationsDone()
+{
+    if (_loaded || _loadWatcher.isRunning())
+        _uncheckedPaths.unite(_hydratingPaths);
+    _hydratingPaths.clear();
+}
+
+void DehydrationPolicy::forgetHydratedFile(const QString &path)
+{
+    auto it = _hydratedFiles.find(path);
+    if (it == _hydratedFiles.end())
+        return;
+    _hydratedSize -= *it;
+    _hydratedFiles.erase(it);
+}
+
+void DehydrationPolicy::updateHydratedFile(const QString &path)
+{
+    forgetHydratedFile(path);
+    SyncJournalFileRecord record;
+    if (_journal->getFileRecord(path, &record) && record.isValid() && record._type == ItemTypeFile) {
+        _hydratedFiles.insert(path, record._fileSize);
+        _hydratedSize += record._fileSize;
+    }
+}
+
+void DehydrationPolicy::moveHydratedFilesBelow(const QString &directory, const QString &newDirectory)
+{
+    const QString prefix = directory + QLatin1Char('/');
+    QHash<QString, qint64> moved;
+    for (auto it = _hydratedFiles.begin(); it != _hydratedFiles.end();) {
+        if (!it.key().startsWith(prefix)) {
+            ++it;
+            continue;
+        }
+        if (newDirectory.isEmpty()) {
+            _hydratedSize -= *it;
+        } else {
+            moved.insert(newDirectory + it.key().mid(directory.size()), *it);
+        }
+        it = _hydratedFiles.erase(it);
+    }
+    for (auto it = moved.cbegin(); it != moved.cend(); ++it) {
+        forgetHydratedFile(it.key());
+        _hydratedFiles.insert(it.key(), it.value());
+    }
+}
+
+void DehydrationPolicy::checkQuota(Vfs *vfs)
+{
+    _vfs = vfs;
+    if (_quota <= 0)
+        return;
+    // The running check still applies
+    _checkCanceled = false;
+    if (_loadWatcher.isRunning() || _rankWatcher.isRunning())
+        return;
+
+    if (!_loaded) {
+        _loadWatcher.setFuture(QtConcurrent::run([journal = _journal] {
+            QHash<QString, qint64> hydratedFiles;
+            journal->getFilesBelowPath(QByteArray(), [&](const SyncJournalFileRecord &record) {
+                if (record._type == ItemTypeFile)
+                    hydratedFiles.insert(record.path(), record._fileSize);
+            });
+            return hydratedFiles;
+        }));
+        return;
+    }
+
+    for (const auto &path : qAsConst(_uncheckedPaths))
+        updateHydratedFile(path);
+    _uncheckedPaths.clear();
+
+    if (_hydratedSize <= _quota) {
+        emit quotaChecked({});
+        return;
+    }
+
+    // Only stat the files when over the quota, there may be many of them
+    _rankWatcher.setFuture(QtConcurrent::run([localPath = _localPath, hydratedFiles = _hydratedFiles, accesses = _accesses] {
+        struct Candidate
+        {
+            qint64 lastUse;
+            QString path;
+        };
+        std::vector<Candidate> candidates;
+        candidates.reserve(hydratedFiles.size());
+        for (auto it = hydratedFiles.cbegin(); it != hydratedFiles.cend(); ++it) {
+            const QFileInfo info(localPath + it.key());
+            if (!info.exists())
+                continue;
+            auto lastUse = qMax(info.lastRead().toMSecsSinceEpoch(), info.lastModified().toMSecsSinceEpoch());
+            lastUse = qMax(lastUse, accesses.value(it.key()));
+            candidates.push_back({ lastUse, it.key() });
+        }
+        // The path makes the order of files used at the same time predictable
+        std::sort(candidates.begin(), candidates.end(), [](const Candidate &a, const Candidate &b) {
+            return a.lastUse < b.lastUse || (a.lastUse == b.lastUse && a.path < b.path);
+        });
+
+        QStringList paths;
+        paths.reserve(int(candidates.size()));
+        for (const auto &candidate : candidates)
+            paths.append(candidate.path);
+        return paths;
+    }));
+}
+
+void DehydrationPolicy::slotHydratedFilesLoaded()
+{
+    _hydratedFiles = _loadWatcher.result();
+    _hydratedSize = 0;
+    for (const auto size : qAsConst(_hydratedFiles))
+        _hydratedSize += size;
+    _loaded = true;
+    qCInfo(lcDehydrationPolicy) << "Loaded" << _hydratedFiles.size() << "hydrated files using" << _hydratedSize << "bytes";
+
+    if (!_checkCanceled && _vfs)
+        checkQuota(_vfs);
+}
+
+void DehydrationPolicy::slotCandidatesRanked()
+{
+    const auto candidates = _rankWatcher.result();
+    if (_checkCanceled || !_vfs)
+        return;
+
+    QStringList marked;
+    auto size = _hydratedSize;
+    for (const auto &path : candidates) {
+        if (size <= _quota)
+            break;
+        // Things may have changed while the files were ranked
+        SyncJournalFileRecord record;
+        if (!_journal->getFileRecord(path, &record) || !record.isValid() || record._type != ItemTypeFile)
+            continue;
+        const auto pin = _vfs->pinState(path);
+        if (pin && *pin == PinState::AlwaysLocal)
+            continue;
+        // Not uploaded yet, the sync takes care of it first
+        if (FileSystem::fileChanged(_localPath + path, record._fileSize, record._modtime))
+            continue;
+
+        record._type = ItemTypeVirtualFileDehydration;
+        if (!_journal->setFileRecord(record)) {
+            qCWarning(lcDehydrationPolicy) << "Could not mark" << path << "for dehydration";
+            continue;
+        }
+        _accesses.remove(path);
+        size -= record._fileSize;
+        marked.append(path);
+    }
+
+    qCInfo(lcDehydrationPolicy) << "Hydrated files use" << _hydratedSize << "bytes of a quota of" << _quota
+                                << "- dehydrating" << marked.size() << "files, leaving" << size << "bytes";
+    emit quotaChecked(marked);
+}
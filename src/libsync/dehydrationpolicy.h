@@ -0,0 +1,128 @@
+/*
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ * or FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License
+ * for more details.
+ */
+
+#ifndef DEHYDRATIONPOLICY_H
+#define DEHYDRATIONPOLICY_H
+
+#include "owncloudlib.h"
+#include "syncfileitem.h"
+#include <QFutureWatcher>
+#include <QHash>
+#include <QObject>
+#include <QPointer>
+#include <QSet>
+#include <QStringList>
+
+namespace OCC {
+
+class SyncJournalDb;
+class Vfs;
+
+/**
+ * @brief Keeps the hydrated files of a virtual files folder under a quota
+ *
+ * When the files hydrated in the folder need more than quota() bytes, the
+ * least recently used ones are marked for dehydration in the journal, the
+ * same way an explicit "free up space" does. The next sync dehydrates them
+ * with Vfs::dehydratePlaceholder() after checking they weren't modified.
+ *
+ * The hydrated files are read from the journal once, in a worker thread.
+ * After that they are kept up to date from the completed sync items and the
+ * hydrations the backend reports. Their access times are only looked at
+ * when they are over the quota, again in a worker thread.
+ *
+ * A file's last use is the latest of its access time, its modification time
+ * and the accesses the VFS backend reported with fileAccessed(). The latter
+ * matters where the file system is mounted with noatime or relatime.
+ *
+ * Files pinned to AlwaysLocal and files with local changes are never picked.
+ *
+ * Paths are relative to the synced folder, without a starting slash.
+ *
+ * @ingroup libsync
+ */
+class OWNCLOUDSYNC_EXPORT DehydrationPolicy : public QObject
+{
+    Q_OBJECT
+public:
+    /// localPath is the synced folder's absolute path, ending with a slash
+    DehydrationPolicy(const QString &localPath, SyncJournalDb *journal, QObject *parent = nullptr);
+    ~DehydrationPolicy() override;
+
+    /// Bytes the hydrated files may use, 0 for no limit
+    void setQuota(qint64 bytes);
+    qint64 quota() const { return _quota; }
+
+    /// The size of the hydrated files as of the last checkQuota()
+    qint64 hydratedSize() const { return _hydratedSize; }
+
+    /** Marks the least recently used files for dehydration until the rest fits the quota
+     *
+     * Finishes with quotaChecked(), possibly right away. Must not be called
+     * while a sync runs.
+     */
+    void checkQuota(Vfs *vfs);
+
+    /// A sync is about to start, files must not be marked until the next checkQuota()
+    void cancelCheck() { _checkCanceled = true; }
+
+signals:
+    /** The marked paths, they need to be passed to the next sync's local discovery
+     *
+     * Empty when the hydrated files fit the quota.
+     */
+    void quotaChecked(const QStringList &markedPaths);
+
+public slots:
+    /// An application used the file
+    void fileAccessed(const QString &relativePath);
+
+    /// Tracks what the sync did to the hydrated files
+    void itemCompleted(const SyncFileItemPtr &item);
+
+    /// The backend hydrates a file outside of a sync
+    void hydrationRequested(const QString &relativePath);
+
+    /// The backend finished all hydrations that were requested
+    void hydrationsDone();
+
+private:
+    void slotHydratedFilesLoaded();
+    void slotCandidatesRanked();
+    void forgetHydratedFile(const QString &path);
+    void updateHydratedFile(const QString &path);
+    void moveHydratedFilesBelow(const QString &directory, const QString &newDirectory);
+
+    QString _localPath;
+    SyncJournalDb *_journal;
+    qint64 _quota = 0;
+    qint64 _hydratedSize = 0;
+
+    /// Size of each hydrated file, valid once _loaded
+    QHash<QString, qint64> _hydratedFiles;
+    bool _loaded = false;
+    /// Paths to look up in the journal before the next check
+    QSet<QString> _uncheckedPaths;
+    QSet<QString> _hydratingPaths;
+
+    QPointer<Vfs> _vfs;
+    bool _checkCanceled = false;
+    QFutureWatcher<QHash<QString, qint64>> _loadWatcher;
+    /// Hydrated files, least recently used first
+    QFutureWatcher<QStringList> _rankWatcher;
+
+    /// msecs since epoch of accesses reported by the VFS backend
+    QHash<QString, qint64> _accesses;
+};
+}
+
+#endif // DEHYDRATIONPOLICY_H
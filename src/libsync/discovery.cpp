@@ -52,7 +52,12 @@ void ProcessDirectoryJob::start()
     }
 
     if (_queryLocal == NormalQuery) {
-        startAsyncLocalQuery();
+        if (_pruneLocalListing && readPrunedLocalEntries()) {
+            qCDebug(lcDisco) << "Unchanged directory, local entries taken from the database" << _currentFolder._local;
+            _localQueryDone = true;
+        } else {
+            startAsyncLocalQuery();
+        }
     } else {
         _localQueryDone = true;
     }
@@ -341,6 +346,24 @@ void ProcessDirectoryJob::processFile(PathTuple path,
         return; // Ignore this.
     }
 
+    // Local files that are still being written wait for a later sync. Not if
+    // the server changed them too, the parent's new etag would hide that.
+    const bool serverUnchanged = _queryServer == ParentNotChanged
+        || (serverEntry.isValid() && dbEntry.isValid() && serverEntry.etag == dbEntry._etag);
+    if (localEntry.isValid() && !localEntry.isDirectory && serverUnchanged
+        && _discoveryData->_stabilizingLocalPaths.count(path._original)) {
+        // Not the destination of a local move though, its source would be
+        // taken for a deletion meanwhile
+        SyncJournalFileRecord base;
+        const bool maybeMoved = (!dbEntry.isValid() || dbEntry._inode != localEntry.inode)
+            && _discoveryData->getFileRecordByInode(localEntry.inode, &base) && base.isValid();
+        if (!maybeMoved) {
+            qCInfo(lcDisco) << "Postponing" << path._original << ", the local file is still changing";
+            return;
+        }
+        qCInfo(lcDisco) << "Not postponing" << path._original << ", it may have been moved from" << base._path;
+    }
+
     auto item = SyncFileItem::fromSyncJournalFileRecord(dbEntry);
     item->_file = path._target;
     item->_originalFile = path._original;
@@ -459,6 +482,30 @@ void ProcessDirectoryJob::processFileAnalyzeRemoteInfo(
 
     // The file is known in the db already
     if (dbEntry.isValid()) {
+        // When remote discovery is restricted to some subtrees, only go where
+        // they are, no matter what the etags say
+        bool forceServerQuery = false;
+        if (serverEntry.isDirectory && dbEntry.isDirectory() && _discoveryData->_remoteDiscoveryRelation) {
+            switch (_discoveryData->_remoteDiscoveryRelation(path._server)) {
+            case DiscoveryPathRelation::Unrelated:
+                // Keep the db etag so the next full discovery looks at it
+                if (item->_etag != dbEntry._etag)
+                    qCInfo(lcDisco) << "Not discovering" << path._server << "outside of the scheduled subtrees";
+                item->_etag = dbEntry._etag;
+                break;
+            case DiscoveryPathRelation::Parent:
+                // Listed, but the etag isn't stored as siblings aren't looked at
+                item->_etag = dbEntry._etag;
+                forceServerQuery = true;
+                break;
+            case DiscoveryPathRelation::Exact:
+                forceServerQuery = true;
+                break;
+            case DiscoveryPathRelation::Child:
+                break;
+            }
+        }
+
         if (serverEntry.isDirectory != dbEntry.isDirectory()) {
             // If the type of the entity changed, it's like NEW, but
             // needs to delete the other entity first.
@@ -473,7 +520,7 @@ void ProcessDirectoryJob::processFileAnalyzeRemoteInfo(
             item->_direction = SyncFileItem::Down;
             item->_instruction = CSYNC_INSTRUCTION_SYNC;
             item->_type = ItemTypeVirtualFileDownload;
-        } else if (dbEntry._etag != serverEntry.etag) {
+        } else if (dbEntry._etag != item->_etag) {
             item->_direction = SyncFileItem::Down;
             item->_modtime = serverEntry.modtime;
             item->_size = serverEntry.size;
@@ -490,7 +537,7 @@ void ProcessDirectoryJob::processFileAnalyzeRemoteInfo(
             item->_instruction = CSYNC_INSTRUCTION_UPDATE_METADATA;
             item->_direction = SyncFileItem::Down;
         } else {
-            processFileAnalyzeLocalInfo(item, path, localEntry, serverEntry, dbEntry, ParentNotChanged);
+            processFileAnalyzeLocalInfo(item, path, localEntry, serverEntry, dbEntry, forceServerQuery ? _queryServer : ParentNotChanged);
             return;
         }
 
@@ -675,7 +722,7 @@ void ProcessDirectoryJob::processFileAnalyzeRemoteInfo(
             async = true;
         }
     };
-    if (!_discoveryData->_statedb->getFileRecordsByFileId(serverEntry.fileId, renameCandidateProcessing)) {
+    if (!_discoveryData->getFileRecordsByFileId(serverEntry.fileId, renameCandidateProcessing)) {
         dbError();
         return;
     }
@@ -700,6 +747,15 @@ void ProcessDirectoryJob::processFileAnalyzeLocalInfo(
     if (noServerEntry)
         recurseQueryServer = ParentDontExist;
 
+    // A restricted remote discovery can't tell a removal on the server from a
+    // move into a directory that isn't listed: leave it to a full discovery.
+    if (noServerEntry && dbEntry.isValid() && _queryServer == NormalQuery && _discoveryData->_remoteDiscoveryRelation) {
+        qCInfo(lcDisco) << "Not on the server in a restricted remote discovery, scheduling a full one:" << path._server;
+        _discoveryData->_statedb->scheduleRemoteSubtreeDiscovery(QByteArray());
+        _discoveryData->_anotherSyncNeeded = true;
+        return;
+    }
+
     bool serverModified = item->_instruction == CSYNC_INSTRUCTION_NEW || item->_instruction == CSYNC_INSTRUCTION_SYNC
         || item->_instruction == CSYNC_INSTRUCTION_RENAME || item->_instruction == CSYNC_INSTRUCTION_TYPE_CHANGE;
 
@@ -728,7 +784,12 @@ void ProcessDirectoryJob::processFileAnalyzeLocalInfo(
             recurse = false;
 
         auto recurseQueryLocal = _queryLocal == ParentNotChanged ? ParentNotChanged : localEntry.isDirectory || item->_instruction == CSYNC_INSTRUCTION_RENAME ? NormalQuery : ParentDontExist;
-        processFileFinalize(item, path, recurse, recurseQueryLocal, recurseQueryServer);
+        if (auto job = processFileFinalize(item, path, recurse, recurseQueryLocal, recurseQueryServer)) {
+            if (recurseQueryLocal == NormalQuery && localEntry.isDirectory) {
+                job->_localDirModtime = localEntry.modtime;
+                job->_pruneLocalListing = canPruneLocalListing(item, path, localEntry, dbEntry);
+            }
+        }
     };
 
     if (!localEntry.isValid()) {
@@ -967,7 +1028,7 @@ void ProcessDirectoryJob::processFileAnalyzeLocalInfo(
 
     // Check if it is a move
     OCC::SyncJournalFileRecord base;
-    if (!_discoveryData->_statedb->getFileRecordByInode(localEntry.inode, &base)) {
+    if (!_discoveryData->getFileRecordByInode(localEntry.inode, &base)) {
         dbError();
         return;
     }
@@ -1197,7 +1258,7 @@ void ProcessDirectoryJob::processFileConflict(const SyncFileItemPtr &item, Proce
             rec._fileSize = serverEntry.size;
             rec._remotePerm = serverEntry.remotePerm;
             rec._checksumHeader = serverEntry.checksumHeader;
-            _discoveryData->_statedb->setFileRecord(rec);
+            _discoveryData->setFileRecord(rec);
         }
         return;
     }
@@ -1207,7 +1268,7 @@ void ProcessDirectoryJob::processFileConflict(const SyncFileItemPtr &item, Proce
     item->_direction = SyncFileItem::None;
 }
 
-void ProcessDirectoryJob::processFileFinalize(
+ProcessDirectoryJob *ProcessDirectoryJob::processFileFinalize(
     const SyncFileItemPtr &item, PathTuple path, bool recurse,
     QueryMode recurseQueryLocal, QueryMode recurseQueryServer)
 {
@@ -1260,6 +1321,7 @@ void ProcessDirectoryJob::processFileFinalize(
             connect(job, &ProcessDirectoryJob::finished, this, &ProcessDirectoryJob::subJobFinished);
             _queuedJobs.push_back(job);
         }
+        return job;
     } else {
         if (removed
             // For the purpose of rename deletion, restored deleted placeholder is as if it was deleted
@@ -1268,6 +1330,7 @@ void ProcessDirectoryJob::processFileFinalize(
         }
         emit _discoveryData->itemDiscovered(item);
     }
+    return nullptr;
 }
 
 void ProcessDirectoryJob::processBlacklisted(const PathTuple &path, const OCC::LocalInfo &localEntry,
@@ -1598,6 +1661,12 @@ void ProcessDirectoryJob::startAsyncLocalQuery()
         _localNormalQueryEntries = results;
         _localQueryDone = true;
 
+        // The listing is only trusted again once the sync went through without errors
+        if (_discoveryData->_syncOptions._pruneUnchangedLocalDirectories && _localDirModtime != 0
+            && _currentFolder._original == _currentFolder._local && _currentFolder._original == _currentFolder._target) {
+            _discoveryData->_listedLocalDirectories[_currentFolder._original] = _localDirModtime;
+        }
+
         if (_serverQueryDone)
             this->process();
     });
@@ -1606,6 +1675,69 @@ void ProcessDirectoryJob::startAsyncLocalQuery()
     pool->start(localJob); // QThreadPool takes ownership
 }
 
+bool ProcessDirectoryJob::canPruneLocalListing(const SyncFileItemPtr &item, const PathTuple &path,
+    const LocalInfo &localEntry, const SyncJournalFileRecord &dbEntry) const
+{
+    if (!_discoveryData->_syncOptions._pruneUnchangedLocalDirectories || isVfsWithSuffix())
+        return false;
+
+    // Moved, new or otherwise changed directories always get listed
+    if ((item->_instruction != CSYNC_INSTRUCTION_NONE && item->_instruction != CSYNC_INSTRUCTION_UPDATE_METADATA)
+        || path._original != path._local || path._original != path._target) {
+        return false;
+    }
+    if (!dbEntry.isDirectory() || !localEntry.isDirectory || localEntry.modtime == 0
+        || dbEntry._localDirModtime != localEntry.modtime || dbEntry._inode != localEntry.inode) {
+        return false;
+    }
+
+    // An unchanged directory mtime says nothing about the content of the files in it:
+    // anything the file watcher reported inside of it needs a real listing.
+    return !_discoveryData->_localDiscoveryRelation
+        || _discoveryData->_localDiscoveryRelation(path._original) == DiscoveryPathRelation::Unrelated;
+}
+
+bool ProcessDirectoryJob::readPrunedLocalEntries()
+{
+    const auto &folder = _currentFolder._original;
+    const int prefixSize = folder.isEmpty() ? 0 : folder.size() + 1;
+    QVector<LocalInfo> entries;
+    bool ok = true;
+    bool dbOk = _discoveryData->_statedb->listFilesInPath(folder.toUtf8(), [&](const SyncJournalFileRecord &rec) {
+        if (!ok)
+            return;
+        LocalInfo i;
+        i.name = rec.path().mid(prefixSize);
+        i.isHidden = i.name.startsWith(QLatin1Char('.'));
+        i.type = rec._type;
+        if (rec.isDirectory()) {
+            // The subdirectories decide for themselves whether they need a listing
+            csync_file_stat_t stat;
+            if (csync_vio_local_stat(_discoveryData->_localDir + rec.path(), &stat) != 0
+                || stat.type != ItemTypeDirectory) {
+                ok = false;
+                return;
+            }
+            i.modtime = stat.modtime;
+            i.inode = stat.inode;
+            i.isDirectory = true;
+        } else if (rec._type == ItemTypeFile || rec._type == ItemTypeVirtualFile) {
+            i.modtime = rec._modtime;
+            i.size = rec._fileSize;
+            i.inode = rec._inode;
+            i.isVirtualFile = rec._type == ItemTypeVirtualFile;
+        } else {
+            // Pending (de)hydrations and the like need to be seen as they are on disk
+            ok = false;
+            return;
+        }
+        entries.append(i);
+    });
+    if (!dbOk || !ok)
+        return false;
+    _localNormalQueryEntries = entries;
+    return true;
+}
 
 bool ProcessDirectoryJob::isVfsWithSuffix() const
 {
@@ -174,8 +174,14 @@ private:
     /// processFile helper for local/remote conflicts
     void processFileConflict(const SyncFileItemPtr &item, PathTuple, const LocalInfo &, const RemoteInfo &, const SyncJournalFileRecord &);
 
-    /// processFile helper for common final processing
-    void processFileFinalize(const SyncFileItemPtr &item, PathTuple, bool recurse, QueryMode recurseQueryLocal, QueryMode recurseQueryServer);
+    /// processFile helper for common final processing, returns the subdirectory job if one was queued
+    ProcessDirectoryJob *processFileFinalize(const SyncFileItemPtr &item, PathTuple, bool recurse, QueryMode recurseQueryLocal, QueryMode recurseQueryServer);
+
+    /** Whether the listing of the local directory can be taken from the database
+     *
+     * See SyncOptions::_pruneUnchangedLocalDirectories.
+     */
+    bool canPruneLocalListing(const SyncFileItemPtr &item, const PathTuple &, const LocalInfo &, const SyncJournalFileRecord &) const;
 
 
     /** Checks the permission for this item, if needed, change the item to a restoration item.
@@ -225,6 +231,12 @@ private:
       */
     void startAsyncLocalQuery();
 
+    /** Fills _localNormalQueryEntries from the database, stat'ing subdirectories only.
+     *
+     * Returns false if the database doesn't match what is on disk, a real listing is needed then.
+     */
+    bool readPrunedLocalEntries();
+
 
     /** Sets _pinState, the directory's pin state
      *
@@ -259,6 +271,11 @@ private:
     bool _serverQueryDone = false;
     bool _localQueryDone = false;
 
+    // Local mtime of this directory as seen in the parent's listing, 0 if unknown
+    time_t _localDirModtime = 0;
+    // Whether the local listing may be taken from the database, see readPrunedLocalEntries()
+    bool _pruneLocalListing = false;
+
     RemotePermissions _rootPermissions;
     QPointer<DiscoverySingleDirectoryJob> _serverJob;
 
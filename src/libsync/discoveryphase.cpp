@@ -65,6 +65,35 @@ static bool findPathInList(const QStringList &list, const QString &path)
     return pathSlash.startsWith(*it);
 }
 
+DiscoveryPathRelation discoveryPathRelation(const std::set<QString> &paths, const QString &path)
+{
+    auto it = paths.lower_bound(path);
+    if (it == paths.end() || !it->startsWith(path)) {
+        // Maybe a subfolder of something in the list?
+        if (it != paths.begin() && path.startsWith(*(--it))) {
+            if (it->endsWith('/') || (path.size() > it->size() && path.at(it->size()) <= '/'))
+                return DiscoveryPathRelation::Child;
+        }
+        return DiscoveryPathRelation::Unrelated;
+    }
+
+    // maybe an exact match or an empty path?
+    if (it->size() == path.size())
+        return DiscoveryPathRelation::Exact;
+    if (path.isEmpty())
+        return DiscoveryPathRelation::Parent;
+
+    // Maybe a parent folder of something in the list?
+    // check for a prefix + / match
+    forever {
+        if (it->size() > path.size() && it->at(path.size()) == '/')
+            return DiscoveryPathRelation::Parent;
+        ++it;
+        if (it == paths.end() || !it->startsWith(path))
+            return DiscoveryPathRelation::Unrelated;
+    }
+}
+
 bool DiscoveryPhase::isInSelectiveSyncBlackList(const QString &path) const
 {
     if (_selectiveSyncBlackList.isEmpty()) {
@@ -201,6 +230,88 @@ QPair<bool, QByteArray> DiscoveryPhase::findAndCancelDeletedJob(const QString &o
     return { result, oldEtag };
 }
 
+// Below this many move candidate lookups in one sync, querying the db directly is
+// cheaper than scanning the whole metadata table.
+static const int moveLookupIndexThreshold = 500;
+
+bool DiscoveryPhase::maybeBuildMoveLookupIndex()
+{
+    if (_moveLookupIndexBuilt || ++_moveLookupCount < moveLookupIndexThreshold)
+        return true;
+
+    QElapsedTimer timer;
+    timer.start();
+    _moveLookupIndexBuilt = true;
+    const bool ok = _statedb->getFileRecordKeys([this](const QByteArray &path, quint64 inode, const QByteArray &fileId) {
+        if (inode)
+            _inodeIndex.insert(inode, path);
+        if (!fileId.isEmpty())
+            _fileIdIndex.insert(fileId, path);
+    });
+    if (!ok) {
+        _inodeIndex.clear();
+        _fileIdIndex.clear();
+        return false;
+    }
+    qCInfo(lcDiscovery) << "Built move detection index with" << _inodeIndex.size() << "inodes and"
+                        << _fileIdIndex.size() << "file ids in" << timer.elapsed() << "ms";
+    return true;
+}
+
+bool DiscoveryPhase::getFileRecordByInode(quint64 inode, SyncJournalFileRecord *rec)
+{
+    if (!maybeBuildMoveLookupIndex())
+        return false;
+    if (!_moveLookupIndexBuilt)
+        return _statedb->getFileRecordByInode(inode, rec);
+
+    rec->_path.clear();
+    if (!inode)
+        return true; // no error, yet nothing found
+    // The record may have been deleted or changed since the index was built
+    const auto paths = _inodeIndex.values(inode);
+    for (const auto &path : paths) {
+        if (!_statedb->getFileRecord(path, rec))
+            return false;
+        if (rec->isValid() && rec->_inode == inode)
+            return true;
+    }
+    rec->_path.clear();
+    return true;
+}
+
+bool DiscoveryPhase::getFileRecordsByFileId(const QByteArray &fileId, const std::function<void(const SyncJournalFileRecord &)> &rowCallback)
+{
+    if (!maybeBuildMoveLookupIndex())
+        return false;
+    if (!_moveLookupIndexBuilt)
+        return _statedb->getFileRecordsByFileId(fileId, rowCallback);
+
+    // Copy, the callback may end up modifying the discovery state
+    const auto paths = _fileIdIndex.values(fileId);
+    for (const auto &path : paths) {
+        SyncJournalFileRecord rec;
+        if (!_statedb->getFileRecord(path, &rec))
+            return false;
+        if (rec.isValid() && rec._fileId == fileId)
+            rowCallback(rec);
+    }
+    return true;
+}
+
+Result<void, QString> DiscoveryPhase::setFileRecord(const SyncJournalFileRecord &rec)
+{
+    auto result = _statedb->setFileRecord(rec);
+    if (result && _moveLookupIndexBuilt) {
+        // Stale entries are skipped by the lookups, only the new ones matter
+        if (rec._inode && !_inodeIndex.contains(rec._inode, rec._path))
+            _inodeIndex.insert(rec._inode, rec._path);
+        if (!rec._fileId.isEmpty() && !_fileIdIndex.contains(rec._fileId, rec._path))
+            _fileIdIndex.insert(rec._fileId, rec._path);
+    }
+    return result;
+}
+
 void DiscoveryPhase::startJob(ProcessDirectoryJob *job)
 {
     ENFORCE(!_currentRootJob);
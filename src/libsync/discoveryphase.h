@@ -19,12 +19,14 @@
 #include <QStringList>
 #include <csync.h>
 #include <QMap>
+#include <QHash>
 #include <QSet>
 #include "networkjobs.h"
 #include <QMutex>
 #include <QWaitCondition>
 #include <QRunnable>
 #include <deque>
+#include <set>
 #include "syncoptions.h"
 #include "syncfileitem.h"
 
@@ -37,6 +39,28 @@ enum class LocalDiscoveryStyle {
     DatabaseAndFilesystem, //< read from the db, except for listed paths
 };
 
+enum class RemoteDiscoveryStyle {
+    FollowEtags, //< query every folder whose etag changed, starting at the root
+    DatabaseAndServer, //< read from the db, except for listed subtrees
+};
+
+/** How a path relates to a set of discovery paths, see discoveryPathRelation() */
+enum class DiscoveryPathRelation {
+    Unrelated,
+    Parent, //< a parent folder of a listed path
+    Exact, //< a listed path
+    Child, //< inside a listed path
+};
+
+/**
+ * Determines how path relates to the listed paths.
+ *
+ * The paths must be normalized such that none is contained in another, see
+ * SyncEngine::setLocalDiscoveryOptions(). The root path "" is a parent of
+ * every listed path.
+ */
+DiscoveryPathRelation discoveryPathRelation(const std::set<QString> &paths, const QString &path);
+
 
 class Account;
 class SyncJournalDb;
@@ -211,6 +235,31 @@ class DiscoveryPhase : public QObject
 
     int _currentlyActiveJobs = 0;
 
+    /** In-memory lookup tables for move detection, see getFileRecordByInode().
+     *
+     * Built from a single journal scan once a sync needs more than
+     * moveLookupIndexThreshold move candidate lookups. Discovery writes to the
+     * journal in a few places: records found through the tables are re-read
+     * and checked, so deleted ones are skipped, and setFileRecord() adds the
+     * written record.
+     */
+    QMultiHash<quint64, QByteArray> _inodeIndex;
+    QMultiHash<QByteArray, QByteArray> _fileIdIndex;
+    bool _moveLookupIndexBuilt = false;
+    int _moveLookupCount = 0;
+
+    /** Builds the move lookup tables if enough lookups happened. Returns false on db error. */
+    bool maybeBuildMoveLookupIndex();
+
+    /** Same as SyncJournalDb::getFileRecordByInode(), served from _inodeIndex if available */
+    bool getFileRecordByInode(quint64 inode, SyncJournalFileRecord *rec);
+
+    /** Same as SyncJournalDb::getFileRecordsByFileId(), served from _fileIdIndex if available */
+    bool getFileRecordsByFileId(const QByteArray &fileId, const std::function<void(const SyncJournalFileRecord &)> &rowCallback);
+
+    /** SyncJournalDb::setFileRecord() that keeps the move lookup tables up to date */
+    Result<void, QString> setFileRecord(const SyncJournalFileRecord &rec);
+
     // both must contain a sorted list
     QStringList _selectiveSyncBlackList;
     QStringList _selectiveSyncWhiteList;
@@ -257,6 +306,18 @@ public:
     bool _ignoreHiddenFiles = false;
     std::function<bool(const QString &)> _shouldDiscoverLocaly;
 
+    /** Set if remote discovery is restricted to some subtrees, see SyncEngine::setRemoteDiscoveryOptions() */
+    std::function<DiscoveryPathRelation(const QString &)> _remoteDiscoveryRelation;
+
+    /** Relation to the local discovery paths, even when all local files are discovered.
+     *
+     * Directories related to these paths are never pruned, see SyncOptions::_pruneUnchangedLocalDirectories.
+     */
+    std::function<DiscoveryPathRelation(const QString &)> _localDiscoveryRelation;
+
+    /// Local files still being written, see SyncEngine::setStabilizingLocalPaths()
+    std::set<QString> _stabilizingLocalPaths;
+
     void startJob(ProcessDirectoryJob *);
 
     void setSelectiveSyncBlackList(const QStringList &list);
@@ -266,6 +327,12 @@ public:
     QByteArray _dataFingerprint;
     bool _anotherSyncNeeded = false;
 
+    /** Directories that were listed locally, with their mtime from before the listing.
+     *
+     * Only filled when SyncOptions::_pruneUnchangedLocalDirectories is set.
+     */
+    QHash<QString, time_t> _listedLocalDirectories;
+
 signals:
     void fatalError(const QString &errorString);
     void itemDiscovered(const SyncFileItemPtr &item);
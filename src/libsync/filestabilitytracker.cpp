@@ -0,0 +1,108 @@
+/*
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ * or FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License
+ * for more details.
+ */
+
+#include "filestabilitytracker.h"
+
+#include "syncengine.h"
+#include "csync.h"
+#include "vio/csync_vio_local.h"
+
+#include <QLoggingCategory>
+
+using namespace OCC;
+
+Q_LOGGING_CATEGORY(lcFileStabilityTracker, "sync.filestabilitytracker", QtInfoMsg)
+
+// Bounds the stat calls of every check
+static const int maxTrackedFiles = 500;
+
+FileStabilityTracker::FileStabilityTracker(const QString &localPath, QObject *parent)
+    : QObject(parent)
+    , _localPath(localPath)
+{
+    _checkTimer.setInterval(1000);
+    connect(&_checkTimer, &QTimer::timeout, this, &FileStabilityTracker::slotCheckFiles);
+}
+
+std::chrono::milliseconds FileStabilityTracker::stabilityWindow(qint64 size)
+{
+    // Big files are written in bursts with pauses in between
+    using namespace std::chrono;
+    const auto sizeAllowance = seconds(size / (100 * 1000 * 1000));
+    return qMin(SyncEngine::minimumFileAgeForUpload + duration_cast<milliseconds>(sizeAllowance), milliseconds(seconds(30)));
+}
+
+void FileStabilityTracker::fileChanged(const QString &relativePath)
+{
+    csync_file_stat_t stat;
+    if (csync_vio_local_stat(_localPath + relativePath, &stat) == -1 || stat.type == ItemTypeDirectory) {
+        if (_files.remove(relativePath))
+            emit stabilizingCountChanged(_files.size());
+        return;
+    }
+
+    const bool added = !_files.contains(relativePath);
+    if (added && _files.size() >= maxTrackedFiles) {
+        qCDebug(lcFileStabilityTracker) << "not tracking" << relativePath << ", too many files are changing";
+        return;
+    }
+    auto &file = _files[relativePath];
+    file.size = stat.size;
+    file.modtime = stat.modtime;
+    file.unchanged.start();
+    if (added) {
+        qCDebug(lcFileStabilityTracker) << "tracking" << relativePath << "with size" << stat.size;
+        emit stabilizingCountChanged(_files.size());
+    }
+    if (!_checkTimer.isActive())
+        _checkTimer.start();
+}
+
+std::set<QString> FileStabilityTracker::stabilizingPaths() const
+{
+    std::set<QString> paths;
+    for (auto it = _files.cbegin(); it != _files.cend(); ++it)
+        paths.insert(it.key());
+    return paths;
+}
+
+void FileStabilityTracker::slotCheckFiles()
+{
+    QStringList stabilized;
+    for (auto it = _files.begin(); it != _files.end();) {
+        csync_file_stat_t stat;
+        if (csync_vio_local_stat(_localPath + it.key(), &stat) == -1) {
+            // Gone, the sync will find out about the deletion
+            stabilized.append(it.key());
+            it = _files.erase(it);
+            continue;
+        }
+        if (stat.size != it->size || stat.modtime != it->modtime) {
+            it->size = stat.size;
+            it->modtime = stat.modtime;
+            it->unchanged.start();
+        } else if (std::chrono::milliseconds(it->unchanged.elapsed()) >= stabilityWindow(stat.size)) {
+            qCInfo(lcFileStabilityTracker) << it.key() << "stopped changing at size" << stat.size;
+            stabilized.append(it.key());
+            it = _files.erase(it);
+            continue;
+        }
+        ++it;
+    }
+
+    if (_files.isEmpty())
+        _checkTimer.stop();
+    if (!stabilized.isEmpty()) {
+        emit stabilizingCountChanged(_files.size());
+        emit pathsStabilized(stabilized);
+    }
+}
@@ -0,0 +1,88 @@
+/*
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ * or FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License
+ * for more details.
+ */
+
+#ifndef FILESTABILITYTRACKER_H
+#define FILESTABILITYTRACKER_H
+
+#include "owncloudlib.h"
+#include <chrono>
+#include <set>
+#include <QElapsedTimer>
+#include <QHash>
+#include <QObject>
+#include <QTimer>
+
+namespace OCC {
+
+/**
+ * @brief Tracks local files that are still being written
+ *
+ * Applications that write large files slowly (video exports, database dumps)
+ * produce a stream of file watcher notifications. Each changed file is kept
+ * here until its size and mtime stayed the same for stabilityWindow(), which
+ * grows with the file size. Until then the file is excluded from syncs with
+ * SyncEngine::setStabilizingLocalPaths() while everything else syncs.
+ *
+ * Files are re-stat'ed once per second while there are any. To keep that
+ * cheap, only a limited number of files is tracked; changes beyond that sync as
+ * usual. On Linux the inotify watcher reports writes when the file is
+ * closed, so a file that's kept open shows no change until it's done.
+ *
+ * Paths are relative to the synced folder, without a starting slash.
+ *
+ * @ingroup libsync
+ */
+class OWNCLOUDSYNC_EXPORT FileStabilityTracker : public QObject
+{
+    Q_OBJECT
+public:
+    /// localPath is the synced folder's absolute path, ending with a slash
+    explicit FileStabilityTracker(const QString &localPath, QObject *parent = nullptr);
+
+    /** A file watcher reported a change of relativePath.
+     *
+     * Directories and vanished files aren't tracked.
+     */
+    void fileChanged(const QString &relativePath);
+
+    /// The files that are still changing
+    std::set<QString> stabilizingPaths() const;
+    int stabilizingCount() const { return _files.size(); }
+
+    /// How long a file of the given size must stay unchanged to be synced
+    static std::chrono::milliseconds stabilityWindow(qint64 size);
+
+signals:
+    /// These files stopped changing and should be synced
+    void pathsStabilized(const QStringList &relativePaths);
+
+    void stabilizingCountChanged(int count);
+
+private slots:
+    void slotCheckFiles();
+
+private:
+    struct File
+    {
+        qint64 size = 0;
+        qint64 modtime = 0;
+        /// Since the last change of size or mtime, or the last notification
+        QElapsedTimer unchanged;
+    };
+
+    QString _localPath;
+    QHash<QString, File> _files;
+    QTimer _checkTimer;
+};
+}
+
+#endif // FILESTABILITYTRACKER_H
@@ -15,23 +15,167 @@
 #include "localdiscoverytracker.h"
 
 #include "syncfileitem.h"
+#include "common/syncjournaldb.h"
+#include "csync.h"
+#include "vio/csync_vio_local.h"
 
+#include <QDir>
+#include <QElapsedTimer>
 #include <QLoggingCategory>
+#include <QtConcurrentRun>
 
 using namespace OCC;
 
 Q_LOGGING_CATEGORY(lcLocalDiscoveryTracker, "sync.localdiscoverytracker", QtInfoMsg)
 
-LocalDiscoveryTracker::LocalDiscoveryTracker() = default;
+// Watched paths are written to the journal at most this often
+static const int journalFlushIntervalMs = 1000;
+
+LocalDiscoveryTracker::LocalDiscoveryTracker()
+{
+    _flushTimer.setSingleShot(true);
+    _flushTimer.setInterval(journalFlushIntervalMs);
+    connect(&_flushTimer, &QTimer::timeout, this, &LocalDiscoveryTracker::flushJournal);
+    connect(&_findWatcher, &QFutureWatcherBase::finished, this, [this] {
+        emit localChangesFound(_findWatcher.result());
+    });
+}
+
+LocalDiscoveryTracker::~LocalDiscoveryTracker()
+{
+    if (_findAborted) {
+        *_findAborted = true;
+        _findWatcher.waitForFinished();
+    }
+    flushJournal();
+}
 
 void LocalDiscoveryTracker::addTouchedPath(const QString &relativePath)
 {
     qCDebug(lcLocalDiscoveryTracker) << "inserted touched" << relativePath;
-    _localDiscoveryPaths.insert(relativePath);
+    if (_localDiscoveryPaths.insert(relativePath).second && _journal) {
+        _unsavedPaths.append(relativePath.toUtf8());
+        if (!_flushTimer.isActive())
+            _flushTimer.start();
+    }
+}
+
+void LocalDiscoveryTracker::addTouchedPaths(const QStringList &relativePaths)
+{
+    for (const auto &path : relativePaths)
+        addTouchedPath(path);
+}
+
+void LocalDiscoveryTracker::flushJournal()
+{
+    _flushTimer.stop();
+    if (!_journal || _unsavedPaths.isEmpty())
+        return;
+    _journal->addLocalChanges(_unsavedPaths);
+    _unsavedPaths.clear();
+    // A running sync commits on its own
+    if (!_syncRunning)
+        _journal->commit(QStringLiteral("local changes"));
+}
+
+void LocalDiscoveryTracker::setJournal(SyncJournalDb *journal)
+{
+    _journal = journal;
+    if (!_journal)
+        return;
+
+    const auto paths = _journal->localChanges();
+    for (const auto &path : paths)
+        _localDiscoveryPaths.insert(QString::fromUtf8(path));
+    if (!paths.isEmpty())
+        qCInfo(lcLocalDiscoveryTracker) << "restored" << paths.size() << "touched paths";
+}
+
+static bool isJournalName(const QString &name)
+{
+    return name.startsWith(QLatin1String("._sync_"))
+        || name.startsWith(QLatin1String(".sync_"))
+        || name.startsWith(QLatin1String(".csync_journal.db"));
+}
+
+// Runs in a worker thread
+static QStringList findLocalChangesSince(SyncJournalDb *journal, const QString &localPath, qint64 since, const std::atomic<bool> &aborted)
+{
+    QElapsedTimer timer;
+    timer.start();
+
+    const auto threshold = static_cast<time_t>(since / 1000) - 1;
+
+    QStringList directories = { QString() };
+    journal->getFilesBelowPath(QByteArray(), [&](const SyncJournalFileRecord &rec) {
+        if (rec.isDirectory())
+            directories.append(rec.path());
+    });
+
+    QStringList changed;
+    int listedDirectories = 0;
+    int checkedFiles = 0;
+    for (const auto &dir : qAsConst(directories)) {
+        if (aborted)
+            return {};
+
+        // Vanished directories show up in the listing of their parent
+        csync_file_stat_t dirStat;
+        if (csync_vio_local_stat(localPath + dir, &dirStat) == -1)
+            continue;
+
+        QVector<SyncJournalFileRecord> records;
+        journal->listFilesInPath(dir.toUtf8(), [&](const SyncJournalFileRecord &rec) {
+            records.append(rec);
+        });
+
+        const auto prefix = dir.isEmpty() ? dir : dir + QLatin1Char('/');
+        const bool listDirectory = dirStat.modtime >= threshold;
+        QSet<QString> onDisk;
+        if (listDirectory) {
+            ++listedDirectories;
+            onDisk = QDir(localPath + dir).entryList(QDir::AllEntries | QDir::NoDotAndDotDot | QDir::Hidden | QDir::System).toSet();
+        }
+        for (const auto &rec : qAsConst(records)) {
+            if (listDirectory && !onDisk.remove(rec.path().mid(prefix.size()))) {
+                changed.append(rec.path()); // vanished
+                continue;
+            }
+            // Edited in place, that doesn't touch the directory's mtime
+            if (!rec.isFile())
+                continue;
+            ++checkedFiles;
+            csync_file_stat_t stat;
+            if (csync_vio_local_stat(localPath + rec.path(), &stat) == -1
+                || stat.modtime != rec._modtime || stat.size != rec._fileSize) {
+                changed.append(rec.path());
+            }
+        }
+        for (const auto &name : qAsConst(onDisk)) {
+            if (!isJournalName(name))
+                changed.append(prefix + name); // appeared
+        }
+    }
+
+    qCInfo(lcLocalDiscoveryTracker) << "checked" << directories.size() << "directories and" << checkedFiles << "files, listed"
+                                    << listedDirectories << "modified directories and found" << changed.size() << "changes in" << timer.elapsed() << "ms";
+    return changed;
+}
+
+void LocalDiscoveryTracker::findLocalChanges(const QString &localPath, qint64 since)
+{
+    if (!_journal || _findWatcher.isRunning())
+        return;
+
+    _findAborted = std::make_shared<std::atomic<bool>>(false);
+    _findWatcher.setFuture(QtConcurrent::run([journal = _journal, localPath, since, aborted = _findAborted] {
+        return findLocalChangesSince(journal, localPath, since, *aborted);
+    }));
 }
 
 void LocalDiscoveryTracker::startSyncFullDiscovery()
 {
+    _syncRunning = true;
     _localDiscoveryPaths.clear();
     _previousLocalDiscoveryPaths.clear();
     qCDebug(lcLocalDiscoveryTracker) << "full discovery";
@@ -46,6 +190,7 @@ void LocalDiscoveryTracker::startSyncPartialDiscovery()
         qCDebug(lcLocalDiscoveryTracker) << "partial discovery with paths: " << paths;
     }
 
+    _syncRunning = true;
     _previousLocalDiscoveryPaths = std::move(_localDiscoveryPaths);
     _localDiscoveryPaths.clear();
 }
@@ -75,6 +220,11 @@ void LocalDiscoveryTracker::slotItemCompleted(const SyncFileItemPtr &item)
             qCDebug(lcLocalDiscoveryTracker) << "wiped successful item" << item->_renameTarget;
     } else {
         _localDiscoveryPaths.insert(item->_file.toUtf8());
+        if (_journal) {
+            _unsavedPaths.append(item->_file.toUtf8());
+            if (!_flushTimer.isActive())
+                _flushTimer.start();
+        }
         qCDebug(lcLocalDiscoveryTracker) << "inserted error item" << item->_file;
     }
 }
@@ -92,4 +242,15 @@ void LocalDiscoveryTracker::slotSyncFinished(bool success)
         qCDebug(lcLocalDiscoveryTracker) << "sync failed, keeping last sync's local discovery path list";
     }
     _previousLocalDiscoveryPaths.clear();
+    _syncRunning = false;
+
+    if (_journal) {
+        // The whole list is written anyway
+        _flushTimer.stop();
+        _unsavedPaths.clear();
+        QByteArrayList paths;
+        for (const auto &path : _localDiscoveryPaths)
+            paths.append(path.toUtf8());
+        _journal->setLocalChanges(paths);
+    }
 }
@@ -16,14 +16,20 @@
 #define LOCALDISCOVERYTRACKER_H
 
 #include "owncloudlib.h"
+#include <atomic>
+#include <memory>
 #include <set>
 #include <QObject>
 #include <QByteArray>
+#include <QFutureWatcher>
 #include <QSharedPointer>
+#include <QStringList>
+#include <QTimer>
 
 namespace OCC {
 
 class SyncFileItem;
+class SyncJournalDb;
 using SyncFileItemPtr = QSharedPointer<SyncFileItem>;
 
 /**
@@ -41,6 +47,11 @@ using SyncFileItemPtr = QSharedPointer<SyncFileItem>;
  * This class is primarily used from Folder and separate primarily for
  * readability and testing purposes.
  *
+ * With setJournal() the paths are also kept in the journal, so they survive
+ * restarts. They are written in batches, not for each notification. Changes
+ * made while the client wasn't running can be looked for with
+ * findLocalChanges().
+ *
  * All paths used in this class are expected to be utf8 encoded byte arrays,
  * relative to the folder that is being synced, without a starting slash.
  *
@@ -51,6 +62,7 @@ class OWNCLOUDSYNC_EXPORT LocalDiscoveryTracker : public QObject
     Q_OBJECT
 public:
     LocalDiscoveryTracker();
+    ~LocalDiscoveryTracker() override;
 
     /** Adds a path that must be locally rediscovered later.
      *
@@ -59,6 +71,25 @@ public:
      */
     void addTouchedPath(const QString &relativePath);
 
+    /** Adds several paths, see addTouchedPath() */
+    void addTouchedPaths(const QStringList &relativePaths);
+
+    /** Persists the tracked paths in journal and loads the ones stored there */
+    void setJournal(SyncJournalDb *journal);
+
+    /**
+     * Looks for local changes made since `since` (msecs since epoch) in a
+     * worker thread, and emits localChangesFound() with them.
+     *
+     * Directories known to the journal whose mtime changed are listed for
+     * entries that appeared or vanished. Files are stat'ed and compared
+     * against the mtime and size of their record, to also find files that
+     * were edited in place. The journal is read one directory at a time.
+     *
+     * The paths aren't added, see addTouchedPaths().
+     */
+    void findLocalChanges(const QString &localPath, qint64 since);
+
     /** Call when a sync run starts that rediscovers all local files */
     void startSyncFullDiscovery();
 
@@ -80,7 +111,24 @@ public slots:
      */
     void slotSyncFinished(bool success);
 
+signals:
+    /// Result of findLocalChanges(), relative paths
+    void localChangesFound(const QStringList &relativePaths);
+
 private:
+    /// Writes the paths added since the last call to the journal
+    void flushJournal();
+
+    SyncJournalDb *_journal = nullptr;
+
+    /// Added paths that aren't in the journal yet, see flushJournal()
+    QByteArrayList _unsavedPaths;
+    QTimer _flushTimer;
+    bool _syncRunning = false;
+
+    QFutureWatcher<QStringList> _findWatcher;
+    std::shared_ptr<std::atomic<bool>> _findAborted;
+
     /**
      * The paths that should be checked by the next local discovery.
      *
@@ -22,6 +22,8 @@
 #include "propagateremotemove.h"
 #include "propagateremotemkdir.h"
 #include "propagatorjobs.h"
+#include "propagateplaceholders.h"
+#include "owncloudpropagator_p.h"
 #include "filesystem.h"
 #include "common/utility.h"
 #include "account.h"
@@ -216,50 +218,46 @@ static void blacklistUpdate(SyncJournalDb *journal, SyncFileItem &item)
     }
 }
 
-void PropagateItemJob::done(SyncFileItem::Status statusArg, const QString &errorString)
+void setPropagatedItemStatus(OwncloudPropagator *propagator, SyncFileItem &item, SyncFileItem::Status status, const QString &errorString)
 {
-    // Duplicate calls to done() are a logic error
-    ENFORCE(_state != Finished);
-    _state = Finished;
-
-    _item->_status = statusArg;
+    item._status = status;
 
-    if (_item->_isRestoration) {
-        if (_item->_status == SyncFileItem::Success
-            || _item->_status == SyncFileItem::Conflict) {
-            _item->_status = SyncFileItem::Restoration;
+    if (item._isRestoration) {
+        if (item._status == SyncFileItem::Success
+            || item._status == SyncFileItem::Conflict) {
+            item._status = SyncFileItem::Restoration;
         } else {
-            _item->_errorString += tr("; Restoration Failed: %1").arg(errorString);
+            item._errorString += PropagateItemJob::tr("; Restoration Failed: %1").arg(errorString);
         }
     } else {
-        if (_item->_errorString.isEmpty()) {
-            _item->_errorString = errorString;
+        if (item._errorString.isEmpty()) {
+            item._errorString = errorString;
         }
     }
 
-    if (propagator()->_abortRequested && (_item->_status == SyncFileItem::NormalError
-                                          || _item->_status == SyncFileItem::FatalError)) {
+    if (propagator->_abortRequested && (item._status == SyncFileItem::NormalError
+                                        || item._status == SyncFileItem::FatalError)) {
         // an abort request is ongoing. Change the status to Soft-Error
-        _item->_status = SyncFileItem::SoftError;
+        item._status = SyncFileItem::SoftError;
     }
 
     // Blacklist handling
-    switch (_item->_status) {
+    switch (item._status) {
     case SyncFileItem::SoftError:
     case SyncFileItem::FatalError:
     case SyncFileItem::NormalError:
     case SyncFileItem::DetailError:
         // Check the blacklist, possibly adjusting the item (including its status)
-        blacklistUpdate(propagator()->_journal, *_item);
+        blacklistUpdate(propagator->_journal, item);
         break;
     case SyncFileItem::Success:
     case SyncFileItem::Restoration:
-        if (_item->_hasBlacklistEntry) {
+        if (item._hasBlacklistEntry) {
             // wipe blacklist entry.
-            propagator()->_journal->wipeErrorBlacklistEntry(_item->_file);
+            propagator->_journal->wipeErrorBlacklistEntry(item._file);
             // remove a blacklist entry in case the file was moved.
-            if (_item->_originalFile != _item->_file) {
-                propagator()->_journal->wipeErrorBlacklistEntry(_item->_originalFile);
+            if (item._originalFile != item._file) {
+                propagator->_journal->wipeErrorBlacklistEntry(item._originalFile);
             }
         }
         break;
@@ -271,6 +269,15 @@ void PropagateItemJob::done(SyncFileItem::Status statusArg, const QString &error
         // nothing
         break;
     }
+}
+
+void PropagateItemJob::done(SyncFileItem::Status statusArg, const QString &errorString)
+{
+    // Duplicate calls to done() are a logic error
+    ENFORCE(_state != Finished);
+    _state = Finished;
+
+    setPropagatedItemStatus(propagator(), *_item, statusArg, errorString);
 
     if (_item->hasErrorStatus())
         qCWarning(lcPropagator) << "Could not complete propagation of" << _item->destination() << "by" << this << "with status" << _item->_status << "and error:" << _item->_errorString;
@@ -402,6 +409,8 @@ void OwncloudPropagator::start(const SyncFileItemVector &items)
     QVector<PropagatorJob *> directoriesToRemove;
     QString removedDirectory;
     QString maybeConflictDirectory;
+    // Null where the directory's placeholders can't be created in bulk
+    QHash<PropagateDirectory *, PropagatePlaceholders *> placeholderJobs;
     foreach (const SyncFileItemPtr &item, items) {
         if (!removedDirectory.isEmpty() && item->_file.startsWith(removedDirectory)) {
             // this is an item in a directory which is going to be removed.
@@ -492,6 +501,22 @@ void OwncloudPropagator::start(const SyncFileItemVector &items)
                 // will delete directories, so defer execution
                 directoriesToRemove.prepend(createJob(item));
                 removedDirectory = item->_file + "/";
+            } else if (isPlainNewPlaceholder(*item)) {
+                auto *dirJob = directories.top().second;
+                auto it = placeholderJobs.find(dirJob);
+                if (it == placeholderJobs.end()) {
+                    PropagatePlaceholders *placeholders = nullptr;
+                    if (!isInEncryptedFolder(*dirJob->_item)) {
+                        placeholders = new PropagatePlaceholders(this);
+                        dirJob->appendJob(placeholders);
+                    }
+                    it = placeholderJobs.insert(dirJob, placeholders);
+                }
+                if (*it) {
+                    (*it)->appendItem(item);
+                } else {
+                    dirJob->appendTask(item);
+                }
             } else {
                 directories.top().second->appendTask(item);
             }
@@ -514,6 +539,37 @@ void OwncloudPropagator::start(const SyncFileItemVector &items)
     scheduleNextJob();
 }
 
+bool OwncloudPropagator::isPlainNewPlaceholder(const SyncFileItem &item) const
+{
+    return item._instruction == CSYNC_INSTRUCTION_NEW
+        && item._direction == SyncFileItem::Down
+        && item._type == ItemTypeVirtualFile
+        && _syncOptions._vfs->mode() != Vfs::Off
+        && !item._isRestoration
+        && !item._isEncrypted
+        && item._encryptedFileName.isEmpty()
+        && !item._file.endsWith(QLatin1String(".sys.admin#recall#"));
+}
+
+bool OwncloudPropagator::isInEncryptedFolder(const SyncFileItem &directory) const
+{
+    if (directory._isEncrypted)
+        return true;
+    if (!_account->capabilities().clientSideEncryptionAvailable())
+        return false;
+
+    auto pathComponents = directory._file.split('/', QString::SkipEmptyParts);
+    while (!pathComponents.isEmpty()) {
+        SyncJournalFileRecord rec;
+        _journal->getFileRecord(pathComponents.join('/'), &rec);
+        if (rec.isValid() && rec._isE2eEncrypted) {
+            return true;
+        }
+        pathComponents.removeLast();
+    }
+    return false;
+}
+
 const SyncOptions &OwncloudPropagator::syncOptions() const
 {
     return _syncOptions;
@@ -525,6 +581,14 @@ void OwncloudPropagator::setSyncOptions(const SyncOptions &syncOptions)
     _chunkSize = syncOptions._initialChunkSize;
 }
 
+void OwncloudPropagator::setParallelNetworkJobs(int jobs)
+{
+    _syncOptions._parallelNetworkJobs = jobs;
+    // A larger budget can be used right away, a smaller one as jobs finish
+    if (_rootJob)
+        scheduleNextJob();
+}
+
 bool OwncloudPropagator::localFileNameClash(const QString &relFile)
 {
     const QString file(_localDir + relFile);
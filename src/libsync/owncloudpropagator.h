@@ -426,6 +426,12 @@ public:
     const SyncOptions &syncOptions() const;
     void setSyncOptions(const SyncOptions &syncOptions);
 
+    /** Changes the parallel network job limit of a running propagation.
+     *
+     * Unlike setSyncOptions() this leaves the dynamic chunk size alone.
+     */
+    void setParallelNetworkJobs(int jobs);
+
     int _downloadLimit = 0;
     int _uploadLimit = 0;
     BandwidthManager _bandwidthManager;
@@ -611,6 +617,10 @@ signals:
     void insufficientRemoteStorage();
 
 private:
+    /// Whether a PropagatePlaceholders may create the item's placeholder
+    bool isPlainNewPlaceholder(const SyncFileItem &item) const;
+    bool isInEncryptedFolder(const SyncFileItem &directory) const;
+
     AccountPtr _account;
     QScopedPointer<PropagateRootDirectory> _rootJob;
     SyncOptions _syncOptions;
@@ -23,6 +23,14 @@
 
 namespace OCC {
 
+/** Sets the final status of a propagated item like PropagateItemJob::done()
+ *
+ * Includes the restoration and blacklist handling. For jobs that propagate
+ * more than one item.
+ */
+void setPropagatedItemStatus(OwncloudPropagator *propagator, SyncFileItem &item,
+    SyncFileItem::Status status, const QString &errorString = QString());
+
 inline QByteArray getEtagFromReply(QNetworkReply *reply)
 {
     QByteArray ocEtag = parseEtag(reply->rawHeader("OC-ETag"));
@@ -113,7 +113,8 @@ GETFileJob::GETFileJob(AccountPtr account, const QUrl &url, QIODevice *device,
 
 void GETFileJob::start()
 {
-    if (_resumeStart > 0) {
+    // Callers fetching a bounded range set the header themselves
+    if (_resumeStart > 0 && !_headers.contains("Range")) {
         _headers["Range"] = "bytes=" + QByteArray::number(_resumeStart) + '-';
         _headers["Accept-Ranges"] = "bytes";
         qCDebug(lcGetJob) << "Retry with range " << _headers["Range"];
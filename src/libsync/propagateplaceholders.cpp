@@ -0,0 +1,193 @@
+/*
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ * or FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License
+ * for more details.
+ */
+
+#include "propagateplaceholders.h"
+#include "owncloudpropagator_p.h"
+#include "filesystem.h"
+#include "common/vfs.h"
+
+#include <QCoreApplication>
+#include <QDir>
+#include <QLoggingCategory>
+#include <QtConcurrentRun>
+
+namespace OCC {
+
+Q_LOGGING_CATEGORY(lcPropagatePlaceholders, "nextcloud.sync.propagator.placeholders", QtInfoMsg)
+
+int PropagatePlaceholders::batchSize = 500;
+
+// The messages are the ones of PropagateDownloadFile, which creates single placeholders
+static QString downloadFileTr(const char *sourceText)
+{
+    return QCoreApplication::translate("OCC::PropagateDownloadFile", sourceText);
+}
+
+PropagatePlaceholders::PropagatePlaceholders(OwncloudPropagator *propagator)
+    : PropagatorJob(propagator)
+{
+    connect(&_watcher, &QFutureWatcherBase::finished, this, &PropagatePlaceholders::slotBatchDone);
+}
+
+PropagatePlaceholders::~PropagatePlaceholders()
+{
+    // The running batch uses our items
+    _abortRequested = true;
+    _watcher.waitForFinished();
+}
+
+bool PropagatePlaceholders::scheduleSelfOrChild()
+{
+    if (_state != NotYetStarted) {
+        return false;
+    }
+    qCInfo(lcPropagatePlaceholders) << "Starting creation of" << _items.size() << "placeholders by" << this;
+
+    _state = Running;
+    startNextBatch();
+    return true;
+}
+
+PropagatePlaceholders::Outcome PropagatePlaceholders::createPlaceholder(OwncloudPropagator *propagator, Vfs *vfs, const SyncFileItem &item)
+{
+    Outcome outcome;
+    auto fail = [&outcome](SyncFileItem::Status status, const QString &error) {
+        outcome.status = status;
+        outcome.error = error;
+        return outcome;
+    };
+
+    if (propagator->localFileNameClash(item._file)) {
+        return fail(SyncFileItem::NormalError,
+            downloadFileTr("File %1 cannot be downloaded because of a local file name clash!").arg(QDir::toNativeSeparators(item._file)));
+    }
+    const auto created = vfs->createPlaceholder(item);
+    if (!created) {
+        return fail(SyncFileItem::NormalError, created.error());
+    }
+
+    const auto fsPath = propagator->fullLocalPath(item.destination());
+    const auto converted = vfs->convertToPlaceholder(fsPath, item);
+    if (!converted) {
+        return fail(SyncFileItem::FatalError, downloadFileTr("Error updating metadata: %1").arg(converted.error()));
+    } else if (*converted == Vfs::ConvertToPlaceholderResult::Locked) {
+        return fail(SyncFileItem::SoftError, downloadFileTr("The file %1 is currently in use").arg(item._file));
+    }
+    outcome.record = item.toSyncJournalFileRecordWithInode(fsPath);
+
+    if (!item._remotePerm.isNull() && !item._remotePerm.hasPermission(RemotePermissions::CanWrite)) {
+        // make sure ReadOnly flag is preserved for placeholder, similarly to regular files
+        FileSystem::setFileReadOnly(fsPath, true);
+    }
+    return outcome;
+}
+
+void PropagatePlaceholders::startNextBatch()
+{
+    const auto batch = _items.mid(_batchStart, batchSize);
+    const auto vfs = propagator()->syncOptions()._vfs;
+    const auto propagator = this->propagator();
+    const auto abortRequested = &_abortRequested;
+    _batchRunning = true;
+    _watcher.setFuture(QtConcurrent::run([batch, vfs, propagator, abortRequested] {
+        QVector<Outcome> outcomes;
+        outcomes.reserve(batch.size());
+        for (const auto &item : batch) {
+            if (*abortRequested)
+                break;
+            outcomes.append(createPlaceholder(propagator, vfs.data(), *item));
+        }
+        return outcomes;
+    }));
+}
+
+void PropagatePlaceholders::slotBatchDone()
+{
+    // A synchronous abort already handled the batch
+    if (!_batchRunning)
+        return;
+    _batchRunning = false;
+
+    auto outcomes = _watcher.result();
+    auto journal = propagator()->_journal;
+    for (int i = 0; i < outcomes.size(); ++i) {
+        auto &outcome = outcomes[i];
+        if (outcome.status != SyncFileItem::Success)
+            continue;
+        const auto result = journal->setFileRecord(outcome.record);
+        if (!result) {
+            outcome.status = SyncFileItem::FatalError;
+            outcome.error = downloadFileTr("Error updating metadata: %1").arg(result.error());
+            continue;
+        }
+        journal->setDownloadInfo(_items.at(_batchStart + i)->_file, SyncJournalDb::DownloadInfo());
+    }
+    journal->commit("placeholder batch");
+
+    bool fatalError = false;
+    for (int i = 0; i < outcomes.size(); ++i) {
+        const auto &item = _items.at(_batchStart + i);
+        setPropagatedItemStatus(propagator(), *item, outcomes[i].status, outcomes[i].error);
+        if (item->hasErrorStatus()) {
+            qCWarning(lcPropagatePlaceholders) << "Could not create placeholder" << item->destination()
+                                               << "with status" << item->_status << "and error:" << item->_errorString;
+        }
+        // Like PropagatorCompositeJob, so the directory's etag isn't updated
+        switch (item->_status) {
+        case SyncFileItem::FatalError:
+        case SyncFileItem::NormalError:
+        case SyncFileItem::SoftError:
+        case SyncFileItem::DetailError:
+        case SyncFileItem::BlacklistedError:
+            _hasError = item->_status;
+            break;
+        default:
+            break;
+        }
+        fatalError |= item->_status == SyncFileItem::FatalError;
+        emit propagator()->itemCompleted(item);
+    }
+    _batchStart += outcomes.size();
+    qCInfo(lcPropagatePlaceholders) << "Created" << outcomes.size() << "placeholders," << _items.size() - _batchStart << "left";
+
+    if (_abortRequested) {
+        if (_emitAbortFinished)
+            emit abortFinished();
+        return;
+    }
+    if (_batchStart < _items.size() && !fatalError) {
+        startNextBatch();
+        return;
+    }
+
+    _state = Finished;
+    emit finished(_hasError == SyncFileItem::NoStatus ? SyncFileItem::Success : _hasError);
+    if (fatalError) {
+        // Abort all remaining jobs.
+        propagator()->abort();
+    }
+}
+
+void PropagatePlaceholders::abort(PropagatorJob::AbortType abortType)
+{
+    _abortRequested = true;
+    if (abortType == AbortType::Synchronous) {
+        // Nothing may touch the files after this returns, record what the batch created
+        _watcher.waitForFinished();
+        slotBatchDone();
+    } else if (_batchRunning) {
+        _emitAbortFinished = true;
+    } else {
+        emit abortFinished();
+    }
+}
+}
@@ -0,0 +1,78 @@
+/*
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ * or FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License
+ * for more details.
+ */
+#pragma once
+
+#include "owncloudpropagator.h"
+#include "common/syncjournalfilerecord.h"
+
+#include <QFutureWatcher>
+
+#include <atomic>
+
+namespace OCC {
+
+class Vfs;
+
+/**
+ * @brief Creates the placeholders for new virtual files of a directory
+ *
+ * The initial sync of a huge share with virtual files is little more than
+ * placeholder creations. Going through a PropagateDownloadFile for each
+ * costs a scheduling round trip and a journal commit per file.
+ *
+ * This job creates the placeholders of all its items on a worker thread,
+ * batchSize at a time. Each batch's journal records are written on the
+ * main thread in one transaction before the next batch starts.
+ *
+ * OwncloudPropagator::start() collects the items that need nothing but
+ * the placeholder, everything else still gets its own job.
+ *
+ * @ingroup libsync
+ */
+class PropagatePlaceholders : public PropagatorJob
+{
+    Q_OBJECT
+public:
+    explicit PropagatePlaceholders(OwncloudPropagator *propagator);
+    ~PropagatePlaceholders() override;
+
+    void appendItem(const SyncFileItemPtr &item) { _items.append(item); }
+
+    bool scheduleSelfOrChild() override;
+    void abort(PropagatorJob::AbortType abortType) override;
+
+    static int batchSize;
+
+private slots:
+    void slotBatchDone();
+
+private:
+    struct Outcome
+    {
+        SyncFileItem::Status status = SyncFileItem::Success;
+        QString error;
+        SyncJournalFileRecord record;
+    };
+
+    /// Runs on the worker thread
+    static Outcome createPlaceholder(OwncloudPropagator *propagator, Vfs *vfs, const SyncFileItem &item);
+    void startNextBatch();
+
+    SyncFileItemVector _items;
+    int _batchStart = 0;
+    QFutureWatcher<QVector<Outcome>> _watcher;
+    bool _batchRunning = false;
+    std::atomic<bool> _abortRequested{ false };
+    bool _emitAbortFinished = false;
+    SyncFileItem::Status _hasError = SyncFileItem::NoStatus;
+};
+}
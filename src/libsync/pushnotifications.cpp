@@ -16,6 +16,9 @@
 #include "creds/abstractcredentials.h"
 #include "account.h"
 
+#include <QJsonArray>
+#include <QJsonDocument>
+
 namespace {
 static constexpr int MAX_ALLOWED_FAILED_AUTHENTICATION_ATTEMPTS = 3;
 static constexpr int PING_INTERVAL = 30 * 1000;
@@ -110,6 +113,8 @@ void PushNotifications::onWebSocketTextMessageReceived(const QString &message)
 
     if (message == "notify_file") {
         handleNotifyFile();
+    } else if (message.startsWith("notify_file_id ")) {
+        handleNotifyFileId(message.mid(15));
     } else if (message == "notify_activity") {
         handleNotifyActivity();
     } else if (message == "notify_notification") {
@@ -190,6 +195,10 @@ void PushNotifications::handleAuthenticated()
     _failedAuthenticationAttemptsCount = 0;
     _isReady = true;
     startPingTimer();
+
+    // Ask for the ids of changed files. Servers that don't know about it
+    // ignore the request and keep sending plain notify_file messages.
+    _webSocket->sendTextMessage("listen notify_file_id");
     emit ready();
 
     // We maybe reconnected to websocket while being offline for a
@@ -206,6 +215,23 @@ void PushNotifications::handleNotifyFile()
     emitFilesChanged();
 }
 
+void PushNotifications::handleNotifyFileId(const QString &payload)
+{
+    QVector<qint64> fileIds;
+    const auto ids = QJsonDocument::fromJson(payload.toUtf8()).array();
+    for (const auto &id : ids) {
+        if (id.isDouble())
+            fileIds.append(static_cast<qint64>(id.toDouble()));
+    }
+    qCInfo(lcPushNotifications) << "Files push notification arrived for" << fileIds.size() << "file ids";
+
+    if (fileIds.isEmpty()) {
+        emitFilesChanged();
+        return;
+    }
+    emit fileIdsChanged(_account, fileIds);
+}
+
 void PushNotifications::handleInvalidCredentials()
 {
     qCInfo(lcPushNotifications) << "Invalid credentials submitted to websocket";
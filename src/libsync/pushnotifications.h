@@ -16,6 +16,7 @@
 
 #include <QWebSocket>
 #include <QTimer>
+#include <QVector>
 
 #include "capabilities.h"
 
@@ -74,6 +75,12 @@ signals:
      */
     void filesChanged(Account *account);
 
+    /**
+     * Will be emitted instead of filesChanged() if the server said which
+     * files changed, by their numeric file ids
+     */
+    void fileIdsChanged(Account *account, const QVector<qint64> &fileIds);
+
     /**
      * Will be emitted if activities have been changed on the server
      */
@@ -120,6 +127,7 @@ private:
 
     void handleAuthenticated();
     void handleNotifyFile();
+    void handleNotifyFileId(const QString &payload);
     void handleInvalidCredentials();
     void handleNotifyNotification();
     void handleNotifyActivity();
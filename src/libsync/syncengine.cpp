@@ -59,8 +59,6 @@ namespace OCC {
 
 Q_LOGGING_CATEGORY(lcEngine, "nextcloud.sync.engine", QtInfoMsg)
 
-bool SyncEngine::s_anySyncRunning = false;
-
 /** When the client touches a file, block change notifications for this duration (ms)
  *
  * On Linux and Windows the file watcher can't distinguish a change that originates
@@ -433,12 +431,11 @@ void SyncEngine::startSync()
         }
     }
 
-    if (s_anySyncRunning || _syncRunning) {
+    if (_syncRunning) {
         ASSERT(false);
         return;
     }
 
-    s_anySyncRunning = true;
     _syncRunning = true;
     _anotherSyncNeeded = NoFollowUpSync;
     _clearTouchedFilesTimer.stop();
@@ -512,6 +509,9 @@ void SyncEngine::startSync()
     _excludedFiles->setExcludeConflictFiles(!_account->capabilities().uploadConflictFiles());
 
     _lastLocalDiscoveryStyle = _localDiscoveryStyle;
+    _lastLocalDiscoveryPruned = _syncOptions._pruneUnchangedLocalDirectories;
+    _lastRemoteDiscoveryStyle = _remoteDiscoveryStyle;
+    _syncStartTime = QDateTime::currentMSecsSinceEpoch();
 
     if (_syncOptions._vfs->mode() == Vfs::WithSuffix && _syncOptions._vfs->fileSuffix().isEmpty()) {
         syncError(tr("Using virtual files with suffix, but suffix is not set"));
@@ -541,6 +541,9 @@ void SyncEngine::startSync()
     _progressInfo->_status = ProgressInfo::Discovery;
     emit transmissionProgress(*_progressInfo);
 
+    // Every discovered item is checked against the blacklist
+    _journal->loadErrorBlacklistCache();
+
     _discoveryPhase.reset(new DiscoveryPhase);
     _discoveryPhase->_account = _account;
     _discoveryPhase->_excludes = _excludedFiles.data();
@@ -553,6 +556,12 @@ void SyncEngine::startSync()
         _discoveryPhase->_remoteFolder+='/';
     _discoveryPhase->_syncOptions = _syncOptions;
     _discoveryPhase->_shouldDiscoverLocaly = [this](const QString &s) { return shouldDiscoverLocally(s); };
+    _discoveryPhase->_localDiscoveryRelation = [this](const QString &s) { return discoveryPathRelation(_localDiscoveryPaths, s); };
+    _discoveryPhase->_stabilizingLocalPaths = _stabilizingLocalPaths;
+    if (_remoteDiscoveryStyle == RemoteDiscoveryStyle::DatabaseAndServer) {
+        qCInfo(lcEngine) << "Remote discovery restricted to" << _remoteDiscoveryPaths.size() << "subtrees";
+        _discoveryPhase->_remoteDiscoveryRelation = [this](const QString &s) { return remoteDiscoveryRelation(s); };
+    }
     _discoveryPhase->setSelectiveSyncBlackList(selectiveSyncBlackList);
     _discoveryPhase->setSelectiveSyncWhiteList(_journal->getSelectiveSyncList(SyncJournalDb::SelectiveSyncWhiteList, &ok));
     if (!ok) {
@@ -616,6 +625,12 @@ void SyncEngine::slotFolderDiscovered(bool local, const QString &folder)
 
 void SyncEngine::slotRootEtagReceived(const QString &e, const QDateTime &time)
 {
+    // The etags of parents of the discovered subtrees are kept outdated on
+    // purpose, the root etag must not make the unchanged tree look verified.
+    if (_lastRemoteDiscoveryStyle == RemoteDiscoveryStyle::DatabaseAndServer) {
+        qCDebug(lcEngine) << "Ignoring root etag of restricted remote discovery:" << e;
+        return;
+    }
     if (_remoteRootEtag.isEmpty()) {
         qCDebug(lcEngine) << "Root etag:" << e;
         _remoteRootEtag = e;
@@ -785,6 +800,13 @@ void SyncEngine::setNetworkLimits(int upload, int download)
     }
 }
 
+void SyncEngine::setParallelNetworkJobs(int jobs)
+{
+    _syncOptions._parallelNetworkJobs = jobs;
+    if (_propagator)
+        _propagator->setParallelNetworkJobs(jobs);
+}
+
 void SyncEngine::slotItemCompleted(const SyncFileItemPtr &item)
 {
     _progressInfo->setProgressComplete(*item);
@@ -845,6 +867,28 @@ void SyncEngine::slotPropagationFinished(bool success)
 
     if (success && _discoveryPhase) {
         _journal->setDataFingerprint(_discoveryPhase->_dataFingerprint);
+
+        QByteArrayList verifiedSubtrees;
+        if (_lastRemoteDiscoveryStyle == RemoteDiscoveryStyle::FollowEtags) {
+            verifiedSubtrees.append(QByteArray());
+        } else {
+            for (const auto &path : _remoteDiscoveryPaths)
+                verifiedSubtrees.append(path.toUtf8());
+        }
+        _journal->setRemoteSubtreesVerified(verifiedSubtrees, _syncStartTime);
+
+        // Everything found in these listings is synced now, except for entries
+        // that failed or were blacklisted: they must show up again next time
+        QSet<QString> failedDirectories;
+        for (const auto &item : qAsConst(_syncItems)) {
+            if (item->hasErrorStatus() && item->_status != SyncFileItem::FileIgnored)
+                failedDirectories.insert(item->_file.left(qMax(0, item->_file.lastIndexOf(QLatin1Char('/')))));
+        }
+        const auto &listedDirectories = _discoveryPhase->_listedLocalDirectories;
+        for (auto it = listedDirectories.cbegin(); it != listedDirectories.cend(); ++it) {
+            if (!failedDirectories.contains(it.key()))
+                _journal->setLocalDirModtime(it.key().toUtf8(), it.value());
+        }
     } else if (_discoveryPhase) {
         // TODO: Remove this when the file restoration problem is fixed for a user
         checkAndOverrideSetDataFingerprint();
@@ -879,7 +923,7 @@ void SyncEngine::finalize(bool success)
     if (_discoveryPhase) {
         _discoveryPhase.take()->deleteLater();
     }
-    s_anySyncRunning = false;
+    _journal->dropErrorBlacklistCache();
     _syncRunning = false;
     emit finished(success);
 
@@ -889,6 +933,9 @@ void SyncEngine::finalize(bool success)
     _uniqueErrors.clear();
     _localDiscoveryPaths.clear();
     _localDiscoveryStyle = LocalDiscoveryStyle::FilesystemOnly;
+    _remoteDiscoveryPaths.clear();
+    _remoteDiscoveryStyle = RemoteDiscoveryStyle::FollowEtags;
+    _stabilizingLocalPaths.clear();
 
     _clearTouchedFilesTimer.start();
 }
@@ -979,21 +1026,18 @@ AccountPtr SyncEngine::account() const
     return _account;
 }
 
-void SyncEngine::setLocalDiscoveryOptions(LocalDiscoveryStyle style, std::set<QString> paths)
+// Normalize to make sure that no path is a contained in another.
+// Note: for simplicity, this code consider anything less than '/' as a path separator, so for
+// example, this will remove "foo.bar" if "foo" is in the list. This will mean we might have
+// some false positive, but that's Ok.
+// This invariant is used in discoveryPathRelation()
+static void normalizeDiscoveryPaths(std::set<QString> &paths)
 {
-    _localDiscoveryStyle = style;
-    _localDiscoveryPaths = std::move(paths);
-
-    // Normalize to make sure that no path is a contained in another.
-    // Note: for simplicity, this code consider anything less than '/' as a path separator, so for
-    // example, this will remove "foo.bar" if "foo" is in the list. This will mean we might have
-    // some false positive, but that's Ok.
-    // This invariant is used in SyncEngine::shouldDiscoverLocally
     QString prev;
-    auto it = _localDiscoveryPaths.begin();
-    while(it != _localDiscoveryPaths.end()) {
+    auto it = paths.begin();
+    while(it != paths.end()) {
         if (!prev.isNull() && it->startsWith(prev) && (prev.endsWith('/') || *it == prev || it->at(prev.size()) <= '/')) {
-            it = _localDiscoveryPaths.erase(it);
+            it = paths.erase(it);
         } else {
             prev = *it;
             ++it;
@@ -1001,6 +1045,13 @@ void SyncEngine::setLocalDiscoveryOptions(LocalDiscoveryStyle style, std::set<QS
     }
 }
 
+void SyncEngine::setLocalDiscoveryOptions(LocalDiscoveryStyle style, std::set<QString> paths)
+{
+    _localDiscoveryStyle = style;
+    _localDiscoveryPaths = std::move(paths);
+    normalizeDiscoveryPaths(_localDiscoveryPaths);
+}
+
 bool SyncEngine::shouldDiscoverLocally(const QString &path) const
 {
     if (_localDiscoveryStyle == LocalDiscoveryStyle::FilesystemOnly)
@@ -1013,30 +1064,27 @@ bool SyncEngine::shouldDiscoverLocally(const QString &path) const
     // - subfolders like "A/X/Y" will be discovered (so data inside a new or renamed folder will be
     //   discovered in full)
     // Check out TestLocalDiscovery::testLocalDiscoveryDecision()
+    return discoveryPathRelation(_localDiscoveryPaths, path) != DiscoveryPathRelation::Unrelated;
+}
 
-    auto it = _localDiscoveryPaths.lower_bound(path);
-    if (it == _localDiscoveryPaths.end() || !it->startsWith(path)) {
-        // Maybe a subfolder of something in the list?
-        if (it != _localDiscoveryPaths.begin() && path.startsWith(*(--it))) {
-            return it->endsWith('/') || (path.size() > it->size() && path.at(it->size()) <= '/');
-        }
-        return false;
+void SyncEngine::setRemoteDiscoveryOptions(RemoteDiscoveryStyle style, std::set<QString> paths)
+{
+    _remoteDiscoveryStyle = style;
+    _remoteDiscoveryPaths = std::move(paths);
+    normalizeDiscoveryPaths(_remoteDiscoveryPaths);
+
+    // The root being scheduled means everything needs to be looked at
+    if (_remoteDiscoveryPaths.count(QString())) {
+        _remoteDiscoveryStyle = RemoteDiscoveryStyle::FollowEtags;
+        _remoteDiscoveryPaths.clear();
     }
+}
 
-    // maybe an exact match or an empty path?
-    if (it->size() == path.size() || path.isEmpty())
-        return true;
-
-    // Maybe a parent folder of something in the list?
-    // check for a prefix + / match
-    forever {
-        if (it->size() > path.size() && it->at(path.size()) == '/')
-            return true;
-        ++it;
-        if (it == _localDiscoveryPaths.end() || !it->startsWith(path))
-            return false;
-    }
-    return false;
+DiscoveryPathRelation SyncEngine::remoteDiscoveryRelation(const QString &path) const
+{
+    if (_remoteDiscoveryStyle == RemoteDiscoveryStyle::FollowEtags)
+        return DiscoveryPathRelation::Child;
+    return discoveryPathRelation(_remoteDiscoveryPaths, path);
 }
 
 void SyncEngine::wipeVirtualFiles(const QString &localPath, SyncJournalDb &journal, Vfs &vfs)
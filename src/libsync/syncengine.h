@@ -64,6 +64,12 @@ public:
     Q_INVOKABLE void startSync();
     void setNetworkLimits(int upload, int download);
 
+    /** Changes the number of parallel network jobs, also while a sync is running.
+     *
+     * Used to share the network budget between folders syncing at the same time.
+     */
+    void setParallelNetworkJobs(int jobs);
+
     /* Abort the sync.  Called from the main thread */
     void abort();
 
@@ -124,6 +130,50 @@ public:
     /** Access the last sync run's local discovery style */
     LocalDiscoveryStyle lastLocalDiscoveryStyle() const { return _lastLocalDiscoveryStyle; }
 
+    /** Whether the last sync run may have pruned unchanged local directories
+     *
+     * Such a run only sees in-place changes to files that were passed as
+     * local discovery paths, it's only a full local discovery if the file
+     * watcher reported all of them.
+     */
+    bool lastLocalDiscoveryPruned() const { return _lastLocalDiscoveryPruned; }
+
+    /**
+     * Control whether remote discovery should follow the etags from the root
+     * or be restricted to subtrees known to have changed.
+     *
+     * If style is DatabaseAndServer, paths is a set of folder paths relative to
+     * the synced folder, typically from SyncJournalDb::scheduledRemoteSubtrees().
+     * Their parent folders are queried without storing their new etags, the
+     * listed folders are discovered as usual and everything else is read from
+     * the db. The root etag isn't reported for such syncs, the next discovery
+     * that follows the etags will pick up any change that was skipped.
+     *
+     * A successful sync marks the discovered subtrees as verified in the journal.
+     * Like the local discovery options, these are reset after each sync.
+     */
+    void setRemoteDiscoveryOptions(RemoteDiscoveryStyle style, std::set<QString> paths = {});
+
+    /**
+     * Returns how the given folder-relative path relates to the remote discovery options.
+     *
+     * Child means that the usual etag comparison applies, which is always the
+     * case for RemoteDiscoveryStyle::FollowEtags.
+     */
+    DiscoveryPathRelation remoteDiscoveryRelation(const QString &path) const;
+
+    /** Access the last sync run's remote discovery style */
+    RemoteDiscoveryStyle lastRemoteDiscoveryStyle() const { return _lastRemoteDiscoveryStyle; }
+
+    /**
+     * Local files that are still being written, typically from
+     * FileStabilityTracker::stabilizingPaths().
+     *
+     * The next sync leaves them alone unless they changed on the server too.
+     * Like the discovery options, this is reset after each sync.
+     */
+    void setStabilizingLocalPaths(std::set<QString> paths) { _stabilizingLocalPaths = std::move(paths); }
+
     /** Removes all virtual file db entries and dehydrated local placeholders.
      *
      * Particularly useful when switching off vfs mode or switching to a
@@ -224,8 +274,6 @@ private:
     // cleanup and emit the finished signal
     void finalize(bool success);
 
-    static bool s_anySyncRunning; //true when one sync is running somewhere (for debugging)
-
     // Must only be acessed during update and reconcile
     QVector<SyncFileItemPtr> _syncItems;
 
@@ -289,9 +337,20 @@ private:
 
     /** The kind of local discovery the last sync run used */
     LocalDiscoveryStyle _lastLocalDiscoveryStyle = LocalDiscoveryStyle::FilesystemOnly;
+    bool _lastLocalDiscoveryPruned = false;
     LocalDiscoveryStyle _localDiscoveryStyle = LocalDiscoveryStyle::FilesystemOnly;
     std::set<QString> _localDiscoveryPaths;
 
+    /** The kind of remote discovery the last sync run used */
+    RemoteDiscoveryStyle _lastRemoteDiscoveryStyle = RemoteDiscoveryStyle::FollowEtags;
+    RemoteDiscoveryStyle _remoteDiscoveryStyle = RemoteDiscoveryStyle::FollowEtags;
+    std::set<QString> _remoteDiscoveryPaths;
+
+    std::set<QString> _stabilizingLocalPaths;
+
+    /** When the current sync run started, in milliseconds since the epoch */
+    qint64 _syncStartTime = 0;
+
     // TODO: Remove this when the file restoration problem is fixed for a user
     int _dataFingerprintSetFailCount = 0;
 };
@@ -26,58 +26,105 @@ namespace OCC {
 
 Q_LOGGING_CATEGORY(lcStatusTracker, "nextcloud.sync.statustracker", QtInfoMsg)
 
-static int pathCompare( const QString& lhs, const QString& rhs )
+static QString pathKey(const QStringRef &component)
 {
-    // Should match Utility::fsCasePreserving, we want don't want to pay for the runtime check on every comparison.
-    return lhs.compare(rhs,
+    // Should match Utility::fsCasePreserving, we want don't want to pay for the runtime check on every lookup.
 #if defined(Q_OS_WIN) || defined(Q_OS_MAC)
-        Qt::CaseInsensitive
+    return component.toString().toCaseFolded();
 #else
-        Qt::CaseSensitive
+    return component.toString();
 #endif
-        );
 }
 
-static bool pathStartsWith( const QString& lhs, const QString& rhs )
+static QString parentPath(const QString &relativePath)
 {
-    return lhs.startsWith(rhs,
-#if defined(Q_OS_WIN) || defined(Q_OS_MAC)
-        Qt::CaseInsensitive
-#else
-        Qt::CaseSensitive
-#endif
-        );
+    int lastSlashIndex = relativePath.lastIndexOf(QLatin1Char('/'));
+    return lastSlashIndex == -1 ? QString() : relativePath.left(lastSlashIndex);
 }
 
-bool SyncFileStatusTracker::PathComparator::operator()( const QString& lhs, const QString& rhs ) const
+SyncFileStatusTracker::PathNode *SyncFileStatusTracker::findNode(const QString &relativePath)
 {
-    // This will make sure that the std::map is ordered and queried case-insensitively on macOS and Windows.
-    return pathCompare(lhs, rhs) < 0;
+    PathNode *node = &_root;
+    const auto components = relativePath.splitRef(QLatin1Char('/'), QString::SkipEmptyParts);
+    for (const auto &component : components) {
+        auto it = node->children.find(pathKey(component));
+        if (it == node->children.end())
+            return nullptr;
+        node = it->second.get();
+    }
+    return node;
 }
 
-SyncFileStatus::SyncFileStatusTag SyncFileStatusTracker::lookupProblem(const QString &pathToMatch, const SyncFileStatusTracker::ProblemsMap &problemMap)
+SyncFileStatusTracker::PathNode *SyncFileStatusTracker::findOrCreateNode(const QString &relativePath)
 {
-    auto lower = problemMap.lower_bound(pathToMatch);
-    for (auto it = lower; it != problemMap.cend(); ++it) {
-        const QString &problemPath = it->first;
-        SyncFileStatus::SyncFileStatusTag severity = it->second;
-
-        if (pathCompare(problemPath, pathToMatch) == 0) {
-            return severity;
-        } else if (severity == SyncFileStatus::StatusError
-            && pathStartsWith(problemPath, pathToMatch)
-            && (pathToMatch.isEmpty() || problemPath.at(pathToMatch.size()) == '/')) {
-            return SyncFileStatus::StatusWarning;
-        } else if (!pathStartsWith(problemPath, pathToMatch)) {
-            // Starting at lower_bound we get the first path that is not smaller,
-            // since: "a/" < "a/aa" < "a/aa/aaa" < "a/ab/aba"
-            // If problemMap keys are ["a/aa/aaa", "a/ab/aba"] and pathToMatch == "a/aa",
-            // lower_bound(pathToMatch) will point to "a/aa/aaa", and the moment that
-            // problemPath.startsWith(pathToMatch) == false, we know that we've looked
-            // at everything that interest us.
-            break;
+    PathNode *node = &_root;
+    const auto components = relativePath.splitRef(QLatin1Char('/'), QString::SkipEmptyParts);
+    for (const auto &component : components) {
+        auto &child = node->children[pathKey(component)];
+        if (!child) {
+            child.reset(new PathNode);
+            child->parent = node;
+            child->name = component.toString();
         }
+        node = child.get();
+    }
+    return node;
+}
+
+void SyncFileStatusTracker::pruneNode(PathNode *node)
+{
+    while (node != &_root && node->isEmpty()) {
+        PathNode *parent = node->parent;
+        parent->children.erase(pathKey(QStringRef(&node->name)));
+        node = parent;
+    }
+}
+
+void SyncFileStatusTracker::pruneChildren(PathNode &node)
+{
+    for (auto it = node.children.begin(); it != node.children.end();) {
+        pruneChildren(*it->second);
+        if (it->second->isEmpty())
+            it = node.children.erase(it);
+        else
+            ++it;
     }
+}
+
+void SyncFileStatusTracker::visitNodes(PathNode &node, const QString &path, const std::function<void(const QString &, PathNode &)> &visitor)
+{
+    for (auto &child : node.children) {
+        visitNodes(*child.second, path.isEmpty() ? child.second->name : path + QLatin1Char('/') + child.second->name, visitor);
+    }
+    visitor(path, node);
+}
+
+void SyncFileStatusTracker::setProblem(const QString &relativePath, SyncFileStatus::SyncFileStatusTag problem)
+{
+    PathNode *node = problem == SyncFileStatus::StatusNone ? findNode(relativePath) : findOrCreateNode(relativePath);
+    if (!node)
+        return;
+
+    const bool wasError = node->problem == SyncFileStatus::StatusError;
+    const bool isError = problem == SyncFileStatus::StatusError;
+    node->problem = problem;
+    if (wasError != isError) {
+        for (PathNode *parent = node->parent; parent; parent = parent->parent)
+            parent->errorDescendants += isError ? 1 : -1;
+    }
+    pruneNode(node);
+}
+
+SyncFileStatus::SyncFileStatusTag SyncFileStatusTracker::lookupProblem(const QString &pathToMatch)
+{
+    const PathNode *node = findNode(pathToMatch);
+    if (!node)
+        return SyncFileStatus::StatusNone;
+    if (node->problem != SyncFileStatus::StatusNone)
+        return node->problem;
+    // An error deeper in the tree is shown as a warning on all of its parents
+    if (node->errorDescendants)
+        return SyncFileStatus::StatusWarning;
     return SyncFileStatus::StatusNone;
 }
 
@@ -158,6 +205,38 @@ SyncFileStatus SyncFileStatusTracker::fileStatus(const QString &relativePath)
     return resolveSyncAndErrorStatus(relativePath, NotShared, PathUnknown);
 }
 
+QVector<SyncFileStatus> SyncFileStatusTracker::directoryEntryStatuses(const QString &relativeDirectory, const QStringList &names)
+{
+    ASSERT(!relativeDirectory.endsWith(QLatin1Char('/')));
+    const QString prefix = relativeDirectory.isEmpty() ? QString() : relativeDirectory + QLatin1Char('/');
+
+    // Entries without a record are new files that aren't in the database yet
+    QHash<QString, SharedFlag> knownEntries;
+    _syncEngine->journal()->listFilesInPath(relativeDirectory.toUtf8(), [&](const SyncJournalFileRecord &rec) {
+        knownEntries.insert(rec.path().mid(prefix.size()),
+            rec._remotePerm.hasPermission(RemotePermissions::IsShared) ? Shared : NotShared);
+    });
+
+    QVector<SyncFileStatus> statuses;
+    statuses.reserve(names.size());
+    for (const auto &name : names) {
+        const QString relativePath = prefix + name;
+        if (_syncEngine->excludedFiles().isExcluded(_syncEngine->localPath() + relativePath,
+                _syncEngine->localPath(),
+                _syncEngine->ignoreHiddenFiles())) {
+            statuses.append(SyncFileStatus::StatusExcluded);
+        } else if (_dirtyPaths.contains(relativePath)) {
+            statuses.append(SyncFileStatus::StatusSync);
+        } else {
+            auto it = knownEntries.constFind(name);
+            statuses.append(it != knownEntries.constEnd()
+                    ? resolveSyncAndErrorStatus(relativePath, *it)
+                    : resolveSyncAndErrorStatus(relativePath, NotShared, PathUnknown));
+        }
+    }
+    return statuses;
+}
+
 void SyncFileStatusTracker::slotPathTouched(const QString &fileName)
 {
     QString folderPath = _syncEngine->localPath();
@@ -171,69 +250,98 @@ void SyncFileStatusTracker::slotPathTouched(const QString &fileName)
 
 void SyncFileStatusTracker::slotAddSilentlyExcluded(const QString &folderPath)
 {
-    _syncProblems[folderPath] = SyncFileStatus::StatusExcluded;
+    setProblem(folderPath, SyncFileStatus::StatusExcluded);
     emit fileStatusChanged(getSystemDestination(folderPath), resolveSyncAndErrorStatus(folderPath, NotShared));
 }
 
 void SyncFileStatusTracker::incSyncCountAndEmitStatusChanged(const QString &relativePath, SharedFlag sharedFlag)
 {
-    // Will return 0 (and increase to 1) if the path wasn't in the map yet
-    int count = _syncCount[relativePath]++;
-    if (!count) {
-        SyncFileStatus status = sharedFlag == UnknownShared
-            ? fileStatus(relativePath)
-            : resolveSyncAndErrorStatus(relativePath, sharedFlag);
-        emit fileStatusChanged(getSystemDestination(relativePath), status);
-
-        // We passed from OK to SYNC, increment the parent to keep it marked as
-        // SYNC while we propagate ourselves and our own children.
-        ASSERT(!relativePath.endsWith('/'));
-        int lastSlashIndex = relativePath.lastIndexOf('/');
-        if (lastSlashIndex != -1)
-            incSyncCountAndEmitStatusChanged(relativePath.left(lastSlashIndex), UnknownShared);
-        else if (!relativePath.isEmpty())
-            incSyncCountAndEmitStatusChanged(QString(), UnknownShared);
+    ASSERT(!relativePath.endsWith('/'));
+    QString path = relativePath;
+    // Passing from OK to SYNC increments the parent to keep it marked as
+    // SYNC while we propagate ourselves and our own children.
+    for (PathNode *node = findOrCreateNode(relativePath); node && node->syncCount++ == 0; node = node->parent) {
+        queueStatusChanged(path, sharedFlag);
+        sharedFlag = UnknownShared;
+        path = parentPath(path);
     }
 }
 
 void SyncFileStatusTracker::decSyncCountAndEmitStatusChanged(const QString &relativePath, SharedFlag sharedFlag)
 {
-    int count = --_syncCount[relativePath];
-    if (!count) {
-        // Remove from the map, same as 0
-        _syncCount.remove(relativePath);
+    ASSERT(!relativePath.endsWith('/'));
+    PathNode *itemNode = findNode(relativePath);
+    QString path = relativePath;
+    // Passing from SYNC to OK decrements our parent.
+    for (PathNode *node = itemNode; node && node->syncCount > 0 && --node->syncCount == 0; node = node->parent) {
+        queueStatusChanged(path, sharedFlag);
+        sharedFlag = UnknownShared;
+        path = parentPath(path);
+    }
+    if (itemNode)
+        pruneNode(itemNode);
+}
+
+void SyncFileStatusTracker::queueStatusChanged(const QString &relativePath, SharedFlag sharedFlag)
+{
+    _pendingStatusPaths.append(relativePath);
+    auto it = _pendingStatusShared.find(relativePath);
+    if (it == _pendingStatusShared.end())
+        _pendingStatusShared.insert(relativePath, sharedFlag);
+    else if (sharedFlag != UnknownShared)
+        *it = sharedFlag;
+}
 
+void SyncFileStatusTracker::emitPendingStatusChanges()
+{
+    QStringList queuedPaths;
+    QHash<QString, SharedFlag> sharedFlags;
+    std::swap(_pendingStatusPaths, queuedPaths);
+    std::swap(_pendingStatusShared, sharedFlags);
+
+    // A path queued several times is emitted once at its last position,
+    // which keeps children before their parents.
+    QStringList paths;
+    QSet<QString> seen;
+    for (auto it = queuedPaths.crbegin(); it != queuedPaths.crend(); ++it) {
+        if (seen.contains(*it))
+            continue;
+        seen.insert(*it);
+        paths.prepend(*it);
+    }
+
+    for (const auto &path : qAsConst(paths)) {
+        SharedFlag sharedFlag = sharedFlags.value(path);
         SyncFileStatus status = sharedFlag == UnknownShared
-            ? fileStatus(relativePath)
-            : resolveSyncAndErrorStatus(relativePath, sharedFlag);
-        emit fileStatusChanged(getSystemDestination(relativePath), status);
-
-        // We passed from SYNC to OK, decrement our parent.
-        ASSERT(!relativePath.endsWith('/'));
-        int lastSlashIndex = relativePath.lastIndexOf('/');
-        if (lastSlashIndex != -1)
-            decSyncCountAndEmitStatusChanged(relativePath.left(lastSlashIndex), UnknownShared);
-        else if (!relativePath.isEmpty())
-            decSyncCountAndEmitStatusChanged(QString(), UnknownShared);
+            ? fileStatus(path)
+            : resolveSyncAndErrorStatus(path, sharedFlag);
+        emit fileStatusChanged(getSystemDestination(path), status);
     }
 }
 
 void SyncFileStatusTracker::slotAboutToPropagate(SyncFileItemVector &items)
 {
-    ASSERT(_syncCount.isEmpty());
-
-    ProblemsMap oldProblems;
-    std::swap(_syncProblems, oldProblems);
+    ASSERT(_root.syncCount == 0);
+
+    // Take the problems of the last sync out of the tree
+    std::vector<std::pair<QString, SyncFileStatus::SyncFileStatusTag>> oldProblems;
+    visitNodes(_root, QString(), [&oldProblems](const QString &path, PathNode &node) {
+        if (node.problem != SyncFileStatus::StatusNone)
+            oldProblems.emplace_back(path, node.problem);
+        node.problem = SyncFileStatus::StatusNone;
+        node.errorDescendants = 0;
+    });
+    pruneChildren(_root);
 
     foreach (const SyncFileItemPtr &item, items) {
         qCDebug(lcStatusTracker) << "Investigating" << item->destination() << item->_status << item->_instruction;
         _dirtyPaths.remove(item->destination());
 
         if (hasErrorStatus(*item)) {
-            _syncProblems[item->destination()] = SyncFileStatus::StatusError;
+            setProblem(item->destination(), SyncFileStatus::StatusError);
             invalidateParentPaths(item->destination());
         } else if (hasExcludedStatus(*item)) {
-            _syncProblems[item->destination()] = SyncFileStatus::StatusExcluded;
+            setProblem(item->destination(), SyncFileStatus::StatusExcluded);
         }
 
         SharedFlag sharedFlag = item->_remotePerm.hasPermission(RemotePermissions::IsShared) ? Shared : NotShared;
@@ -244,7 +352,7 @@ void SyncFileStatusTracker::slotAboutToPropagate(SyncFileItemVector &items)
             // Mark this path as syncing for instructions that will result in propagation.
             incSyncCountAndEmitStatusChanged(item->destination(), sharedFlag);
         } else {
-            emit fileStatusChanged(getSystemDestination(item->destination()), resolveSyncAndErrorStatus(item->destination(), sharedFlag));
+            queueStatusChanged(item->destination(), sharedFlag);
         }
     }
 
@@ -254,19 +362,21 @@ void SyncFileStatusTracker::slotAboutToPropagate(SyncFileItemVector &items)
     QSet<QString> oldDirtyPaths;
     std::swap(_dirtyPaths, oldDirtyPaths);
     for (const auto &oldDirtyPath : qAsConst(oldDirtyPaths))
-        emit fileStatusChanged(getSystemDestination(oldDirtyPath), fileStatus(oldDirtyPath));
+        queueStatusChanged(oldDirtyPath, UnknownShared);
 
     // Make sure to push any status that might have been resolved indirectly since the last sync
     // (like an error file being deleted from disk)
-    for (const auto &syncProblem : _syncProblems)
-        oldProblems.erase(syncProblem.first);
     for (const auto &oldProblem : oldProblems) {
         const QString &path = oldProblem.first;
-        SyncFileStatus::SyncFileStatusTag severity = oldProblem.second;
-        if (severity == SyncFileStatus::StatusError)
+        const PathNode *node = findNode(path);
+        if (node && node->problem != SyncFileStatus::StatusNone)
+            continue;
+        if (oldProblem.second == SyncFileStatus::StatusError)
             invalidateParentPaths(path);
-        emit fileStatusChanged(getSystemDestination(path), fileStatus(path));
+        queueStatusChanged(path, UnknownShared);
     }
+
+    emitPendingStatusChanges();
 }
 
 void SyncFileStatusTracker::slotItemCompleted(const SyncFileItemPtr &item)
@@ -274,12 +384,12 @@ void SyncFileStatusTracker::slotItemCompleted(const SyncFileItemPtr &item)
     qCDebug(lcStatusTracker) << "Item completed" << item->destination() << item->_status << item->_instruction;
 
     if (hasErrorStatus(*item)) {
-        _syncProblems[item->destination()] = SyncFileStatus::StatusError;
+        setProblem(item->destination(), SyncFileStatus::StatusError);
         invalidateParentPaths(item->destination());
     } else if (hasExcludedStatus(*item)) {
-        _syncProblems[item->destination()] = SyncFileStatus::StatusExcluded;
+        setProblem(item->destination(), SyncFileStatus::StatusExcluded);
     } else {
-        _syncProblems.erase(item->destination());
+        setProblem(item->destination(), SyncFileStatus::StatusNone);
     }
 
     SharedFlag sharedFlag = item->_remotePerm.hasPermission(RemotePermissions::IsShared) ? Shared : NotShared;
@@ -290,23 +400,24 @@ void SyncFileStatusTracker::slotItemCompleted(const SyncFileItemPtr &item)
         // decSyncCount calls *must* be symetric with incSyncCount calls in slotAboutToPropagate
         decSyncCountAndEmitStatusChanged(item->destination(), sharedFlag);
     } else {
-        emit fileStatusChanged(getSystemDestination(item->destination()), resolveSyncAndErrorStatus(item->destination(), sharedFlag));
+        queueStatusChanged(item->destination(), sharedFlag);
     }
+
+    emitPendingStatusChanges();
 }
 
 void SyncFileStatusTracker::slotSyncFinished()
 {
     // Clear the sync counts to reduce the impact of unsymetrical inc/dec calls (e.g. when directory job abort)
-    QHash<QString, int> oldSyncCount;
-    std::swap(_syncCount, oldSyncCount);
-    for (auto it = oldSyncCount.begin(); it != oldSyncCount.end(); ++it) {
-        // Don't announce folders, fileStatus expect only paths without '/', otherwise it asserts
-        if (it.key().endsWith('/')) {
-            continue;
-        }
-
-        emit fileStatusChanged(getSystemDestination(it.key()), fileStatus(it.key()));
-    }
+    visitNodes(_root, QString(), [this](const QString &path, PathNode &node) {
+        if (!node.syncCount)
+            return;
+        node.syncCount = 0;
+        queueStatusChanged(path, UnknownShared);
+    });
+    pruneChildren(_root);
+
+    emitPendingStatusChanges();
 }
 
 void SyncFileStatusTracker::slotSyncEngineRunningChanged()
@@ -319,12 +430,13 @@ SyncFileStatus SyncFileStatusTracker::resolveSyncAndErrorStatus(const QString &r
     // If it's a new file and that we're not syncing it yet,
     // don't show any icon and wait for the filesystem watcher to trigger a sync.
     SyncFileStatus status(isPathKnown ? SyncFileStatus::StatusUpToDate : SyncFileStatus::StatusNone);
-    if (_syncCount.value(relativePath)) {
+    const PathNode *node = findNode(relativePath);
+    if (node && node->syncCount) {
         status.set(SyncFileStatus::StatusSync);
     } else {
         // After a sync finished, we need to show the users issues from that last sync like the activity list does.
         // Also used for parent directories showing a warning for an error child.
-        SyncFileStatus::SyncFileStatusTag problemStatus = lookupProblem(relativePath, _syncProblems);
+        SyncFileStatus::SyncFileStatusTag problemStatus = lookupProblem(relativePath);
         if (problemStatus != SyncFileStatus::StatusNone)
             status.set(problemStatus);
     }
@@ -342,7 +454,7 @@ void SyncFileStatusTracker::invalidateParentPaths(const QString &path)
     QStringList splitPath = path.split('/', QString::SkipEmptyParts);
     for (int i = 0; i < splitPath.size(); ++i) {
         QString parentPath = QStringList(splitPath.mid(0, i)).join(QLatin1String("/"));
-        emit fileStatusChanged(getSystemDestination(parentPath), fileStatus(parentPath));
+        queueStatusChanged(parentPath, UnknownShared);
     }
 }
 
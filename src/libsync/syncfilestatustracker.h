@@ -19,7 +19,9 @@
 // #include "ownsql.h"
 #include "syncfileitem.h"
 #include "common/syncfilestatus.h"
+#include <functional>
 #include <map>
+#include <memory>
 #include <QSet>
 
 namespace OCC {
@@ -38,6 +40,13 @@ public:
     explicit SyncFileStatusTracker(SyncEngine *syncEngine);
     SyncFileStatus fileStatus(const QString &relativePath);
 
+    /** The statuses of entries of a directory, the same as fileStatus() for each of them.
+     *
+     * names are the entries of the local directory. The journal is read with
+     * one listing of the directory instead of one lookup per entry.
+     */
+    QVector<SyncFileStatus> directoryEntryStatuses(const QString &relativeDirectory, const QStringList &names);
+
 public slots:
     void slotPathTouched(const QString &fileName);
     // path relative to folder
@@ -53,11 +62,42 @@ private slots:
     void slotSyncEngineRunningChanged();
 
 private:
-    struct PathComparator {
-        bool operator()( const QString& lhs, const QString& rhs ) const;
+    /** One path component in the tree of paths that are syncing or have problems.
+     *
+     * Nodes only exist while they or one of their descendants have something to
+     * report, so the tree stays as small as the set of those paths. The status of
+     * any path is known after walking down its components.
+     */
+    struct PathNode
+    {
+        PathNode *parent = nullptr;
+        // The component as it was first seen, the key in the parent is case folded
+        // where the file system is case preserving
+        QString name;
+        std::map<QString, std::unique_ptr<PathNode>> children;
+
+        // Counts the number direct children currently being synced (has unfinished propagation jobs).
+        // We'll show a file/directory as SYNC as long as its sync count is > 0.
+        // A directory that starts/ends propagation will in turn increase/decrease its own parent by 1.
+        int syncCount = 0;
+        SyncFileStatus::SyncFileStatusTag problem = SyncFileStatus::StatusNone;
+        // Number of descendants with a StatusError problem, they make this path a warning
+        int errorDescendants = 0;
+
+        bool isEmpty() const
+        {
+            return !syncCount && problem == SyncFileStatus::StatusNone && !errorDescendants && children.empty();
+        }
     };
-    using ProblemsMap = std::map<QString, SyncFileStatus::SyncFileStatusTag, PathComparator>;
-    SyncFileStatus::SyncFileStatusTag lookupProblem(const QString &pathToMatch, const ProblemsMap &problemMap);
+    PathNode *findNode(const QString &relativePath);
+    PathNode *findOrCreateNode(const QString &relativePath);
+    void pruneNode(PathNode *node);
+    void pruneChildren(PathNode &node);
+    // Children are visited before their parents
+    void visitNodes(PathNode &node, const QString &path, const std::function<void(const QString &, PathNode &)> &visitor);
+
+    void setProblem(const QString &relativePath, SyncFileStatus::SyncFileStatusTag problem);
+    SyncFileStatus::SyncFileStatusTag lookupProblem(const QString &pathToMatch);
 
     enum SharedFlag { UnknownShared,
         NotShared,
@@ -71,14 +111,19 @@ private:
     void incSyncCountAndEmitStatusChanged(const QString &relativePath, SharedFlag sharedState);
     void decSyncCountAndEmitStatusChanged(const QString &relativePath, SharedFlag sharedState);
 
+    /** Status changes are collected while handling one engine notification and
+     * emitted once per path, with the final status, by emitPendingStatusChanges().
+     */
+    void queueStatusChanged(const QString &relativePath, SharedFlag sharedState);
+    void emitPendingStatusChanges();
+
     SyncEngine *_syncEngine;
 
-    ProblemsMap _syncProblems;
+    PathNode _root;
     QSet<QString> _dirtyPaths;
-    // Counts the number direct children currently being synced (has unfinished propagation jobs).
-    // We'll show a file/directory as SYNC as long as its sync count is > 0.
-    // A directory that starts/ends propagation will in turn increase/decrease its own parent by 1.
-    QHash<QString, int> _syncCount;
+
+    QStringList _pendingStatusPaths;
+    QHash<QString, SharedFlag> _pendingStatusShared;
 };
 }
 
@@ -67,6 +67,16 @@ struct OWNCLOUDSYNC_EXPORT SyncOptions
 
     /** The maximum number of active jobs in parallel  */
     int _parallelNetworkJobs = 6;
+
+    /** Whether local discovery may skip listing directories whose mtime and
+     * inode didn't change since their listing was last synced.
+     *
+     * The entries of such directories are taken from the database, only
+     * subdirectories are stat'ed. Changes to the contents of existing files
+     * don't touch the directory mtime: unless they are reported through the
+     * local discovery paths, they are only found by a later unpruned run.
+     */
+    bool _pruneUnchangedLocalDirectories = false;
 };
 
 
@@ -380,6 +380,7 @@ void VfsCfApi::scheduleHydrationJob(const QString &requestId, const QString &fol
     d->hydrationJobs << job;
     job->start();
     emit hydrationRequestReady(requestId);
+    emit hydrationRequested(folderPath);
 }
 
 void VfsCfApi::onHydrationJobFinished(HydrationJob *job)
@@ -0,0 +1,219 @@
+/*
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ * or FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License
+ * for more details.
+ */
+
+#include "hydrationprefetcher.h"
+
+#include "common/syncjournaldb.h"
+#include "common/syncjournalfilerecord.h"
+
+#include <QDateTime>
+#include <QFileInfo>
+#include <QLoggingCategory>
+
+#include <algorithm>
+
+using namespace OCC;
+
+Q_LOGGING_CATEGORY(lcHydrationPrefetcher, "nextcloud.sync.vfs.prefetcher", QtInfoMsg)
+
+std::chrono::seconds HydrationPrefetcher::coAccessWindow(2 * 60);
+std::chrono::seconds HydrationPrefetcher::budgetWindow(60 * 60);
+std::chrono::seconds HydrationPrefetcher::hitWindow(30 * 60);
+
+// Each request adds at most this many files
+static const int maxFilesPerRequest = 8;
+// Forget the co-access history rather than growing without bound
+static const int maxCoAccessEntries = 10000;
+
+static QString parentPath(const QString &path)
+{
+    const auto slash = path.lastIndexOf(QLatin1Char('/'));
+    return slash == -1 ? QString() : path.left(slash);
+}
+
+static QString extension(const QString &path)
+{
+    const auto dot = path.lastIndexOf(QLatin1Char('.'));
+    if (dot == -1 || dot < path.lastIndexOf(QLatin1Char('/')))
+        return QString();
+    return path.mid(dot + 1).toLower();
+}
+
+HydrationPrefetcher::HydrationPrefetcher(const QString &localPath, SyncJournalDb *journal, QObject *parent)
+    : QObject(parent)
+    , _localPath(localPath)
+    , _journal(journal)
+{
+    _budgetWindowStart.start();
+}
+
+QString HydrationPrefetcher::withoutVirtualFileSuffix(const QString &path) const
+{
+    if (!_virtualFileSuffix.isEmpty() && path.endsWith(_virtualFileSuffix))
+        return path.left(path.size() - _virtualFileSuffix.size());
+    return path;
+}
+
+QStringList HydrationPrefetcher::hydrationRequested(const QString &folderPath)
+{
+    const auto now = QDateTime::currentMSecsSinceEpoch();
+    resolvePrefetches(now);
+    countHit(folderPath);
+    noteCoAccess(folderPath, now);
+
+    if (_budget <= 0)
+        return {};
+    if (_budgetWindowStart.hasExpired(std::chrono::milliseconds(budgetWindow).count())) {
+        _budgetSpent = 0;
+        _budgetWindowStart.restart();
+    }
+
+    struct Candidate
+    {
+        int score = 0;
+        SyncJournalFileRecord record;
+    };
+    QHash<QString, Candidate> candidates;
+    auto consider = [&](const SyncJournalFileRecord &record, int score) {
+        const auto path = QString::fromUtf8(record._path);
+        if (!record.isVirtualFile() || path == folderPath || _prefetched.contains(path)
+            || record._fileSize > _maxFileSize)
+            return;
+        auto &candidate = candidates[path];
+        candidate.score += score;
+        candidate.record = record;
+    };
+
+    const auto coAccesses = _coAccesses.value(folderPath);
+    for (auto it = coAccesses.cbegin(); it != coAccesses.cend(); ++it) {
+        SyncJournalFileRecord record;
+        if (_journal->getFileRecord(it.key(), &record) && record.isValid())
+            consider(record, 4 * it.value());
+    }
+
+    const auto requestedExtension = extension(withoutVirtualFileSuffix(folderPath));
+    _journal->listFilesInPath(parentPath(folderPath).toUtf8(), [&](const SyncJournalFileRecord &record) {
+        const auto sameExtension = extension(withoutVirtualFileSuffix(QString::fromUtf8(record._path))) == requestedExtension;
+        consider(record, sameExtension ? 2 : 1);
+    });
+
+    std::vector<Candidate> sorted;
+    sorted.reserve(candidates.size());
+    for (const auto &candidate : qAsConst(candidates))
+        sorted.push_back(candidate);
+    std::sort(sorted.begin(), sorted.end(), [](const Candidate &a, const Candidate &b) {
+        if (a.score != b.score)
+            return a.score > b.score;
+        return a.record._path < b.record._path;
+    });
+
+    QStringList prefetch;
+    for (const auto &candidate : sorted) {
+        if (prefetch.size() >= maxFilesPerRequest)
+            break;
+        if (_budgetSpent + candidate.record._fileSize > _budget)
+            continue;
+        const auto path = QString::fromUtf8(candidate.record._path);
+        _budgetSpent += candidate.record._fileSize;
+        _prefetched.insert(path, { now });
+        prefetch.append(path);
+    }
+
+    if (!prefetch.isEmpty()) {
+        qCInfo(lcHydrationPrefetcher) << "Prefetching" << prefetch << "after" << folderPath
+                                      << "- spent" << _budgetSpent << "of" << _budget << "bytes";
+    }
+    return prefetch;
+}
+
+void HydrationPrefetcher::fileAccessed(const QString &folderPath)
+{
+    countHit(folderPath);
+}
+
+void HydrationPrefetcher::itemCompleted(const SyncFileItemPtr &item)
+{
+    if (_prefetched.isEmpty() || item->_status != SyncFileItem::Success
+        || item->_instruction == CSYNC_INSTRUCTION_REMOVE || item->isDirectory())
+        return;
+    // With suffix virtual files the hydrated file lost the suffix
+    auto it = _prefetched.find(item->_originalFile);
+    if (it == _prefetched.end() && !_virtualFileSuffix.isEmpty())
+        it = _prefetched.find(item->_file + _virtualFileSuffix);
+    if (it == _prefetched.end())
+        return;
+    const QFileInfo info(_localPath + item->destination());
+    if (info.exists())
+        it->hydratedAccessTime = info.lastRead().toMSecsSinceEpoch();
+}
+
+void HydrationPrefetcher::noteCoAccess(const QString &path, qint64 now)
+{
+    const auto window = std::chrono::milliseconds(coAccessWindow).count();
+    while (!_recentRequests.empty() && now - _recentRequests.front().time > window)
+        _recentRequests.pop_front();
+
+    if (_coAccesses.size() > maxCoAccessEntries)
+        _coAccesses.clear();
+    for (const auto &request : _recentRequests) {
+        if (request.path == path)
+            continue;
+        ++_coAccesses[request.path][path];
+        ++_coAccesses[path][request.path];
+    }
+    _recentRequests.push_back({ path, now });
+}
+
+void HydrationPrefetcher::countHit(const QString &path)
+{
+    // With suffix virtual files the hydrated file lost the suffix
+    auto it = _prefetched.find(path);
+    if (it == _prefetched.end() && !_virtualFileSuffix.isEmpty())
+        it = _prefetched.find(path + _virtualFileSuffix);
+    if (it == _prefetched.end())
+        return;
+    _prefetched.erase(it);
+    ++_hits;
+    logHitRate();
+}
+
+void HydrationPrefetcher::resolvePrefetches(qint64 now)
+{
+    const auto window = std::chrono::milliseconds(hitWindow).count();
+    bool resolved = false;
+    for (auto it = _prefetched.begin(); it != _prefetched.end();) {
+        if (now - it->time <= window) {
+            ++it;
+            continue;
+        }
+        // Not every backend reports accesses, fall back to the access time.
+        // Writing the file during the hydration set it, only a later one counts.
+        const QFileInfo info(_localPath + withoutVirtualFileSuffix(it.key()));
+        if (it->hydratedAccessTime >= 0 && info.exists()
+            && info.lastRead().toMSecsSinceEpoch() > it->hydratedAccessTime) {
+            ++_hits;
+        } else {
+            ++_misses;
+        }
+        it = _prefetched.erase(it);
+        resolved = true;
+    }
+    if (resolved)
+        logHitRate();
+}
+
+void HydrationPrefetcher::logHitRate() const
+{
+    const auto total = _hits + _misses;
+    qCInfo(lcHydrationPrefetcher) << "Prefetch hit rate" << _hits << "of" << total
+                                  << "resolved," << _prefetched.size() << "pending";
+}
@@ -0,0 +1,128 @@
+/*
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ * or FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License
+ * for more details.
+ */
+
+#ifndef HYDRATIONPREFETCHER_H
+#define HYDRATIONPREFETCHER_H
+
+#include "owncloudlib.h"
+#include "syncfileitem.h"
+
+#include <chrono>
+#include <deque>
+#include <QElapsedTimer>
+#include <QHash>
+#include <QObject>
+#include <QStringList>
+
+namespace OCC {
+
+class SyncJournalDb;
+
+/**
+ * @brief Guesses which virtual files are needed after one was opened
+ *
+ * Somebody opening a file of a dehydrated project directory usually opens
+ * its siblings next. For every hydration request this suggests virtual files
+ * to hydrate in the background, best first:
+ *  - files that were requested within coAccessWindow of this one before,
+ *  - files in the same directory with the same extension,
+ *  - the other files in the same directory.
+ *
+ * Suggestions stay within a budget of bytes per budgetWindow and skip files
+ * bigger than maxFileSize. A suggestion counts as a hit when the file is
+ * requested or accessed within hitWindow, the hit rate is logged. Where the
+ * backend doesn't report accesses, the file's access time has to change
+ * after the sync hydrated it, see itemCompleted().
+ *
+ * Paths are relative to the synced folder, without a starting slash. With
+ * suffix virtual files they include the suffix, like the journal's.
+ *
+ * @ingroup libsync
+ */
+class OWNCLOUDSYNC_EXPORT HydrationPrefetcher : public QObject
+{
+    Q_OBJECT
+public:
+    /// localPath is the synced folder's absolute path, ending with a slash
+    HydrationPrefetcher(const QString &localPath, SyncJournalDb *journal, QObject *parent = nullptr);
+
+    /// Bytes that may be prefetched per budgetWindow, 0 disables prefetching
+    void setBudget(qint64 bytes) { _budget = bytes; }
+    qint64 budget() const { return _budget; }
+
+    void setMaxFileSize(qint64 bytes) { _maxFileSize = bytes; }
+
+    /// Stripped from paths before comparing extensions, see Vfs::fileSuffix()
+    void setVirtualFileSuffix(const QString &suffix) { _virtualFileSuffix = suffix; }
+
+    /** An application needs the contents of the virtual file folderPath
+     *
+     * Returns the virtual files that should be hydrated along with it.
+     */
+    QStringList hydrationRequested(const QString &folderPath);
+
+    int hitCount() const { return _hits; }
+    int missCount() const { return _misses; }
+
+    static std::chrono::seconds coAccessWindow;
+    static std::chrono::seconds budgetWindow;
+    static std::chrono::seconds hitWindow;
+
+public slots:
+    /// An application opened the file, counts prefetched files as hits
+    void fileAccessed(const QString &folderPath);
+
+    /// Remembers the access time of hydrated prefetches, hydrating doesn't count as a use
+    void itemCompleted(const SyncFileItemPtr &item);
+
+private:
+    struct Request
+    {
+        QString path;
+        qint64 time;
+    };
+
+    struct Prefetch
+    {
+        /// msecs since epoch of the prefetch
+        qint64 time;
+        /// The file's access time right after the hydration, -1 until it's hydrated
+        qint64 hydratedAccessTime = -1;
+    };
+
+    QString withoutVirtualFileSuffix(const QString &path) const;
+    void noteCoAccess(const QString &path, qint64 now);
+    void resolvePrefetches(qint64 now);
+    void countHit(const QString &path);
+    void logHitRate() const;
+
+    QString _localPath;
+    SyncJournalDb *_journal;
+    QString _virtualFileSuffix;
+    qint64 _budget = 0;
+    qint64 _maxFileSize = 100 * 1000 * 1000;
+
+    qint64 _budgetSpent = 0;
+    QElapsedTimer _budgetWindowStart;
+
+    std::deque<Request> _recentRequests;
+    /// How often two files were requested close to each other
+    QHash<QString, QHash<QString, int>> _coAccesses;
+
+    /// Prefetched files that weren't used yet
+    QHash<QString, Prefetch> _prefetched;
+    int _hits = 0;
+    int _misses = 0;
+};
+}
+
+#endif // HYDRATIONPREFETCHER_H
@@ -0,0 +1,436 @@
+/*
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ * or FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License
+ * for more details.
+ */
+
+#include "streaminghydration.h"
+
+#include "account.h"
+#include "filesystem.h"
+#include "propagatedownload.h"
+
+#include <QLoggingCategory>
+
+namespace OCC {
+
+Q_LOGGING_CATEGORY(lcStreamingHydration, "nextcloud.sync.vfs.streaminghydration", QtInfoMsg)
+
+QString createDownloadTmpFileName(const QString &previous);
+
+std::chrono::milliseconds StreamingHydration::stallTimeout = std::chrono::minutes(1);
+
+static const int maxChunkRetries = 3;
+
+/**
+ * The device a GETFileJob of one chunk writes into
+ *
+ * GETFileJob reopens the device when the server ignored the range and sent
+ * the whole file, the data then goes to the start of the file. For the first
+ * chunk that shows as data beyond the chunk's end instead.
+ */
+class StreamingHydrationWriter : public QIODevice
+{
+public:
+    StreamingHydrationWriter(StreamingHydration *hydration, int chunk, QObject *parent)
+        : QIODevice(parent)
+        , _hydration(hydration)
+        , _chunk(chunk)
+        , _start(chunk * hydration->_chunkSize)
+        , _end(qMin(_start + hydration->_chunkSize, hydration->_size))
+    {
+    }
+
+    bool open(OpenMode mode) override
+    {
+        if (_opened) {
+            _start = 0;
+            _written = 0;
+            _hydration->switchToSingleStream(_chunk);
+        }
+        _opened = true;
+        return QIODevice::open(mode);
+    }
+
+    bool isSequential() const override { return true; }
+
+protected:
+    qint64 readData(char *, qint64) override { return -1; }
+
+    qint64 writeData(const char *data, qint64 length) override
+    {
+        const auto offset = _start + _written;
+        if (offset + length > _hydration->_size) {
+            setErrorString(QStringLiteral("Server sent more data than expected"));
+            return -1;
+        }
+        if (offset + length > _end)
+            _hydration->switchToSingleStream(_chunk);
+        if (!_hydration->writeAt(offset, data, length)) {
+            setErrorString(_hydration->_writeFile.errorString());
+            return -1;
+        }
+        _hydration->markAvailable(offset, length);
+        _written += length;
+        return length;
+    }
+
+private:
+    StreamingHydration *_hydration;
+    int _chunk;
+    qint64 _start;
+    qint64 _end;
+    qint64 _written = 0;
+    bool _opened = false;
+};
+
+StreamingHydration::StreamingHydration(AccountPtr account, const QString &remotePath, const QString &localPath,
+    qint64 size, time_t modtime, const QByteArray &etag, QObject *parent)
+    : QObject(parent)
+    , _account(account)
+    , _remotePath(remotePath)
+    , _localPath(localPath)
+    , _size(size)
+    , _modtime(modtime)
+    , _etag(etag)
+{
+}
+
+StreamingHydration::~StreamingHydration()
+{
+    if (!_done && !_tmpPath.isEmpty()) {
+        _writeFile.close();
+        _readFile.close();
+        QFile::remove(_tmpPath);
+    }
+}
+
+Result<void, QString> StreamingHydration::open()
+{
+    _tmpPath = createDownloadTmpFileName(_localPath);
+    _writeFile.setFileName(_tmpPath);
+    if (!_writeFile.open(QIODevice::ReadWrite | QIODevice::Truncate)) {
+        return _writeFile.errorString();
+    }
+    // Leaves a hole for what wasn't downloaded yet where the file system supports it
+    if (!_writeFile.resize(_size)) {
+        const auto error = _writeFile.errorString();
+        _writeFile.close();
+        QFile::remove(_tmpPath);
+        return error;
+    }
+    _readFile.setFileName(_tmpPath);
+    if (!_readFile.open(QIODevice::ReadOnly)) {
+        const auto error = _readFile.errorString();
+        _writeFile.close();
+        QFile::remove(_tmpPath);
+        return error;
+    }
+
+    const auto chunkCount = int((_size + _chunkSize - 1) / _chunkSize);
+    _chunks.fill(Missing, chunkCount);
+    _retries.fill(0, chunkCount);
+    return {};
+}
+
+void StreamingHydration::start()
+{
+    Q_ASSERT(_writeFile.isOpen());
+    qCInfo(lcStreamingHydration) << "Hydrating" << _localPath << "in" << _chunks.size() << "chunks";
+    if (_chunks.isEmpty()) {
+        complete();
+        return;
+    }
+    scheduleRequests();
+}
+
+qint64 StreamingHydration::read(char *data, qint64 offset, qint64 length)
+{
+    if (offset >= _size)
+        return 0;
+    length = qMin(length, _size - offset);
+    if (!waitForRange(offset, length))
+        return -1;
+
+    QMutexLocker lock(&_readMutex);
+    if (!_readFile.seek(offset))
+        return -1;
+    return _readFile.read(data, length);
+}
+
+bool StreamingHydration::waitForRange(qint64 offset, qint64 length)
+{
+    length = qMin(length, _size - offset);
+    QMutexLocker lock(&_mutex);
+    _readerOffset = offset;
+    if (isAvailable(offset, length))
+        return true;
+
+    if (_state == Running && length > 0) {
+        for (auto chunk = int(offset / _chunkSize); chunk <= int((offset + length - 1) / _chunkSize); ++chunk) {
+            if (!_wantedChunks.contains(chunk))
+                _wantedChunks.append(chunk);
+        }
+        QMetaObject::invokeMethod(this, "scheduleRequests", Qt::QueuedConnection);
+    }
+
+    while (_state == Running && !isAvailable(offset, length)) {
+        if (!_progressed.wait(&_mutex, static_cast<unsigned long>(stallTimeout.count()))
+            && _state == Running && !isAvailable(offset, length)) {
+            qCWarning(lcStreamingHydration) << "Download of" << _localPath << "stalled, giving up on reading at" << offset;
+            return false;
+        }
+    }
+    return _state != Failed && isAvailable(offset, length);
+}
+
+bool StreamingHydration::waitUntilFinished()
+{
+    QMutexLocker lock(&_mutex);
+    while (_state == Running)
+        _progressed.wait(&_mutex);
+    return _state == Succeeded;
+}
+
+void StreamingHydration::abort()
+{
+    {
+        QMutexLocker lock(&_mutex);
+        if (_state != Running)
+            return;
+        _state = Failed;
+        _progressed.wakeAll();
+    }
+    QMetaObject::invokeMethod(this, [this] { fail(QStringLiteral("Aborted")); }, Qt::QueuedConnection);
+}
+
+StreamingHydration::State StreamingHydration::state() const
+{
+    QMutexLocker lock(&_mutex);
+    return _state;
+}
+
+// _mutex must be locked
+bool StreamingHydration::isAvailable(qint64 offset, qint64 length) const
+{
+    if (length <= 0)
+        return true;
+    auto it = _ranges.upperBound(offset);
+    if (it == _ranges.begin())
+        return false;
+    --it;
+    return it.value() >= offset + length;
+}
+
+void StreamingHydration::markAvailable(qint64 offset, qint64 length)
+{
+    QMutexLocker lock(&_mutex);
+    auto start = offset;
+    auto end = offset + length;
+    auto it = _ranges.upperBound(start);
+    if (it != _ranges.begin()) {
+        const auto previous = std::prev(it);
+        if (previous.value() >= start) {
+            start = previous.key();
+            end = qMax(end, previous.value());
+            it = _ranges.erase(previous);
+        }
+    }
+    while (it != _ranges.end() && it.key() <= end) {
+        end = qMax(end, it.value());
+        it = _ranges.erase(it);
+    }
+    _ranges.insert(start, end);
+    _progressed.wakeAll();
+}
+
+bool StreamingHydration::writeAt(qint64 offset, const char *data, qint64 length)
+{
+    return _writeFile.seek(offset) && _writeFile.write(data, length) == length;
+}
+
+int StreamingHydration::nextMissingChunk(int from) const
+{
+    for (int i = 0; i < _chunks.size(); ++i) {
+        const auto chunk = (from + i) % _chunks.size();
+        if (_chunks[chunk] == Missing)
+            return chunk;
+    }
+    return -1;
+}
+
+void StreamingHydration::scheduleRequests()
+{
+    QVector<int> wanted;
+    qint64 readerOffset = 0;
+    {
+        QMutexLocker lock(&_mutex);
+        if (_state != Running)
+            return;
+        wanted.swap(_wantedChunks);
+        readerOffset = _readerOffset;
+    }
+
+    // Every request would download the whole file again
+    if (_singleStream) {
+        const auto chunk = nextMissingChunk(0);
+        if (_jobs.isEmpty() && chunk != -1)
+            requestChunk(chunk);
+        return;
+    }
+
+    // Chunks that readers are blocked on don't wait for a free slot
+    for (const auto chunk : qAsConst(wanted)) {
+        if (_chunks[chunk] == Missing)
+            requestChunk(chunk);
+    }
+
+    auto from = int(readerOffset / _chunkSize);
+    while (_jobs.size() < _maxParallelRequests) {
+        const auto chunk = nextMissingChunk(from);
+        if (chunk == -1)
+            break;
+        requestChunk(chunk);
+        from = chunk;
+    }
+}
+
+void StreamingHydration::requestChunk(int chunk)
+{
+    const auto start = chunk * _chunkSize;
+    const auto end = qMin(start + _chunkSize, _size);
+    QMap<QByteArray, QByteArray> headers;
+    if (start > 0 || end < _size)
+        headers["Range"] = "bytes=" + QByteArray::number(start) + '-' + QByteArray::number(end - 1);
+
+    auto device = new StreamingHydrationWriter(this, chunk, nullptr);
+    device->open(QIODevice::WriteOnly);
+    auto job = new GETFileJob(_account, _remotePath, device, headers, _etag, start, this);
+    device->setParent(job);
+    connect(job, &GETFileJob::finishedSignal, this, [this, job, chunk] { slotChunkFinished(job, chunk); });
+    _chunks[chunk] = Requested;
+    _jobs.insert(job, chunk);
+    qCDebug(lcStreamingHydration) << "Requesting" << _localPath << "bytes" << start << "to" << end;
+    job->start();
+}
+
+void StreamingHydration::slotChunkFinished(GETFileJob *job, int chunk)
+{
+    if (!_jobs.remove(job))
+        return;
+
+    // A server without range support may have sent more than the chunk
+    {
+        QMutexLocker lock(&_mutex);
+        for (int i = 0; i < _chunks.size(); ++i) {
+            if (_chunks[i] != Done && isAvailable(i * _chunkSize, qMin(_chunkSize, _size - i * _chunkSize))) {
+                _chunks[i] = Done;
+                ++_doneChunks;
+            }
+        }
+    }
+
+    if (_chunks[chunk] != Done) {
+        _chunks[chunk] = Missing;
+        if (!job->etag().isEmpty() && job->etag() != _etag) {
+            fail(QStringLiteral("The file changed on the server"));
+            return;
+        }
+        qCWarning(lcStreamingHydration) << "Chunk" << chunk << "of" << _localPath << "failed" << job->errorString();
+        if (++_retries[chunk] > maxChunkRetries) {
+            fail(job->errorString());
+            return;
+        }
+    }
+
+    if (_doneChunks == _chunks.size()) {
+        complete();
+        return;
+    }
+    scheduleRequests();
+}
+
+void StreamingHydration::switchToSingleStream(int chunk)
+{
+    if (_singleStream)
+        return;
+    qCInfo(lcStreamingHydration) << "Server ignored the range request for" << _localPath << "continuing with a single download";
+    _singleStream = true;
+
+    // The other requests are getting the whole file as well
+    for (auto it = _jobs.begin(); it != _jobs.end();) {
+        if (it.value() == chunk) {
+            ++it;
+            continue;
+        }
+        if (_chunks[it.value()] == Requested)
+            _chunks[it.value()] = Missing;
+        const auto job = it.key();
+        it = _jobs.erase(it);
+        job->cancel();
+    }
+}
+
+void StreamingHydration::complete()
+{
+    if (state() == Failed) {
+        fail(QStringLiteral("Aborted"));
+        return;
+    }
+    _done = true;
+    _writeFile.close();
+    {
+        QMutexLocker lock(&_readMutex);
+        _readFile.close();
+        FileSystem::setModTime(_tmpPath, _modtime);
+        QString error;
+        if (!FileSystem::uncheckedRenameReplace(_tmpPath, _localPath, &error)) {
+            _done = false;
+            lock.unlock();
+            fail(error);
+            return;
+        }
+        // Readers continue with the hydrated file
+        _readFile.setFileName(_localPath);
+        _readFile.open(QIODevice::ReadOnly);
+    }
+    qCInfo(lcStreamingHydration) << "Hydrated" << _localPath;
+
+    emit finished(true);
+    QMutexLocker lock(&_mutex);
+    _state = Succeeded;
+    _progressed.wakeAll();
+}
+
+void StreamingHydration::fail(const QString &reason)
+{
+    if (_done)
+        return;
+    _done = true;
+    qCWarning(lcStreamingHydration) << "Hydration of" << _localPath << "failed:" << reason;
+
+    const auto jobs = _jobs.keys();
+    _jobs.clear();
+    for (const auto job : jobs)
+        job->cancel();
+
+    _writeFile.close();
+    {
+        QMutexLocker lock(&_readMutex);
+        _readFile.close();
+    }
+    QFile::remove(_tmpPath);
+
+    emit finished(false);
+    QMutexLocker lock(&_mutex);
+    _state = Failed;
+    _progressed.wakeAll();
+}
+
+} // namespace OCC
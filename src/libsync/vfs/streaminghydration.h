@@ -0,0 +1,160 @@
+/*
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ * or FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License
+ * for more details.
+ */
+
+#ifndef STREAMINGHYDRATION_H
+#define STREAMINGHYDRATION_H
+
+#include "owncloudlib.h"
+#include "accountfwd.h"
+#include "common/result.h"
+
+#include <chrono>
+#include <QFile>
+#include <QHash>
+#include <QMap>
+#include <QMutex>
+#include <QObject>
+#include <QVector>
+#include <QWaitCondition>
+
+namespace OCC {
+
+class GETFileJob;
+
+/**
+ * @brief Downloads a virtual file while applications already read it
+ *
+ * The file is fetched in chunks with range requests into a sparse temporary
+ * file next to the placeholder. The ranges that arrived are tracked, and
+ * read() blocks only until the requested range is there. Chunks at the
+ * offsets readers asked for are requested first, even beyond the limit of
+ * parallel requests, then the download continues in order from the last
+ * reader's offset so sequential readers find the next chunk ready. If the
+ * server ignores the ranges, a single request downloads the whole file.
+ *
+ * Once everything arrived the temporary file gets the modification time of
+ * the server's file and replaces the placeholder. finished() is emitted
+ * before waiting readers are released, so slots can update the journal
+ * before anybody sees the file as hydrated.
+ *
+ * Use it from its own thread, except for read(), waitForRange(),
+ * waitUntilFinished() and abort() which can be called from any thread.
+ *
+ * @ingroup libsync
+ */
+class OWNCLOUDSYNC_EXPORT StreamingHydration : public QObject
+{
+    Q_OBJECT
+public:
+    enum State { Running, Succeeded, Failed };
+
+    /** remotePath is relative to the account's dav root, localPath is the placeholder.
+     *
+     * The download must match etag, the size and modtime are the server's.
+     */
+    StreamingHydration(AccountPtr account, const QString &remotePath, const QString &localPath,
+        qint64 size, time_t modtime, const QByteArray &etag, QObject *parent = nullptr);
+    ~StreamingHydration() override;
+
+    /** Creates the sparse temporary file
+     *
+     * Can be called from any thread, before moving the object to the thread
+     * that runs the downloads.
+     */
+    Result<void, QString> open();
+
+    /// Starts the downloads, call after open()
+    void start();
+
+    /** Reads length bytes at offset, waiting until they were downloaded
+     *
+     * Returns the number of bytes read, or -1 if the download failed or made
+     * no progress for stallTimeout.
+     */
+    qint64 read(char *data, qint64 offset, qint64 length);
+
+    /// Like read() without reading, true once the range is there
+    bool waitForRange(qint64 offset, qint64 length);
+
+    /// Blocks until the file replaced the placeholder or the download failed
+    bool waitUntilFinished();
+
+    /// Stops the downloads and releases all readers, safe from any thread
+    void abort();
+
+    State state() const;
+    qint64 size() const { return _size; }
+    QString localPath() const { return _localPath; }
+    QString tmpPath() const { return _tmpPath; }
+
+    /// For tests, must be called before start()
+    void setChunkSize(qint64 chunkSize) { _chunkSize = chunkSize; }
+    void setMaxParallelRequests(int count) { _maxParallelRequests = count; }
+
+    static std::chrono::milliseconds stallTimeout;
+
+signals:
+    /// Emitted on the object's thread before waiting readers see the result
+    void finished(bool success);
+
+private slots:
+    void scheduleRequests();
+
+private:
+    friend class StreamingHydrationWriter;
+
+    enum ChunkState : quint8 { Missing, Requested, Done };
+
+    bool isAvailable(qint64 offset, qint64 length) const;
+    void markAvailable(qint64 offset, qint64 length);
+    bool writeAt(qint64 offset, const char *data, qint64 length);
+    int nextMissingChunk(int from) const;
+    void requestChunk(int chunk);
+    void slotChunkFinished(GETFileJob *job, int chunk);
+    /// The server sent the whole file for a range request, stops the other requests
+    void switchToSingleStream(int chunk);
+    void complete();
+    void fail(const QString &reason);
+
+    AccountPtr _account;
+    QString _remotePath;
+    QString _localPath;
+    QString _tmpPath;
+    qint64 _size;
+    time_t _modtime;
+    QByteArray _etag;
+    qint64 _chunkSize = 1024 * 1024;
+    int _maxParallelRequests = 3;
+
+    // Used on the object's thread only
+    QFile _writeFile;
+    QVector<ChunkState> _chunks;
+    QHash<GETFileJob *, int> _jobs;
+    QVector<int> _retries;
+    int _doneChunks = 0;
+    bool _done = false;
+    bool _singleStream = false;
+
+    // Shared with the readers, protected by _mutex
+    mutable QMutex _mutex;
+    QWaitCondition _progressed;
+    QMap<qint64, qint64> _ranges; // start -> end, merged
+    QVector<int> _wantedChunks;
+    qint64 _readerOffset = 0;
+    State _state = Running;
+
+    QMutex _readMutex;
+    QFile _readFile;
+};
+}
+
+#endif // STREAMINGHYDRATION_H
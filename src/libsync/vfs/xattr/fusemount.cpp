@@ -0,0 +1,423 @@
+/*
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ * or FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License
+ * for more details.
+ */
+
+#define FUSE_USE_VERSION 31
+
+#include "fusemount.h"
+
+#include <QFile>
+#include <QLoggingCategory>
+
+#include "filesystem.h"
+#include "vfs/streaminghydration.h"
+#include "common/syncjournaldb.h"
+#include "common/syncjournalfilerecord.h"
+
+#include "xattrwrapper.h"
+
+#include <fuse.h>
+
+#include <dirent.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <sys/statvfs.h>
+#include <unistd.h>
+
+Q_LOGGING_CATEGORY(lcFuseMount, "nextcloud.sync.vfs.xattr.fuse", QtInfoMsg)
+
+namespace OCC {
+
+namespace {
+
+    /// What a FUSE file handle points to
+    struct OpenFile
+    {
+        ~OpenFile()
+        {
+            if (fd != -1)
+                ::close(fd);
+        }
+
+        // The file in the sync folder, -1 while reading from a hydration
+        int fd = -1;
+        std::shared_ptr<StreamingHydration> hydration;
+    };
+
+    bool isHiddenFromView(const char *name)
+    {
+        // Journal and the temporary files of downloads
+        const auto n = QByteArray::fromRawData(name, qstrlen(name));
+        return n.startsWith(".sync_") || n.startsWith("._sync_")
+            || (n.startsWith('.') && n.contains(".~"));
+    }
+}
+
+struct FuseOperations
+{
+    static FuseMount *mount()
+    {
+        return static_cast<FuseMount *>(fuse_get_context()->private_data);
+    }
+
+    static QByteArray realPath(const char *path)
+    {
+        return mount()->_root + QByteArray(path + 1);
+    }
+
+    static OpenFile *openFile(struct fuse_file_info *fi)
+    {
+        return reinterpret_cast<OpenFile *>(fi->fh);
+    }
+
+    /// The placeholder's record, or nothing if path is no placeholder
+    static bool placeholderRecord(const char *path, SyncJournalFileRecord *record)
+    {
+        const auto real = realPath(path);
+        if (!XAttrWrapper::hasNextcloudPlaceholderAttributes(QString::fromUtf8(real)))
+            return false;
+        return mount()->_params.journal->getFileRecord(QByteArray(path + 1), record)
+            && record->isValid() && record->isVirtualFile();
+    }
+
+    /// Makes the placeholder a regular file before it's modified
+    static int hydrateFully(const char *path)
+    {
+        int error = 0;
+        const auto hydration = mount()->hydrationFor(QByteArray(path + 1), &error);
+        if (!hydration)
+            return error;
+        return hydration->waitUntilFinished() ? 0 : -EIO;
+    }
+
+    static int getattr(const char *path, struct stat *st, struct fuse_file_info *fi)
+    {
+        if (fi && fi->fh && openFile(fi)->fd != -1) {
+            if (fstat(openFile(fi)->fd, st) == -1)
+                return -errno;
+            return 0;
+        }
+        if (lstat(realPath(path).constData(), st) == -1)
+            return -errno;
+        SyncJournalFileRecord record;
+        if (S_ISREG(st->st_mode) && placeholderRecord(path, &record)) {
+            st->st_size = record._fileSize;
+            st->st_mtime = record._modtime;
+            st->st_blocks = 0;
+        }
+        return 0;
+    }
+
+    static int readdir(const char *path, void *buf, fuse_fill_dir_t filler, off_t, struct fuse_file_info *, enum fuse_readdir_flags)
+    {
+        auto dir = opendir(realPath(path).constData());
+        if (!dir)
+            return -errno;
+        while (auto entry = ::readdir(dir)) {
+            if (isHiddenFromView(entry->d_name))
+                continue;
+            struct stat st = {};
+            st.st_ino = entry->d_ino;
+            st.st_mode = DTTOIF(entry->d_type);
+            if (filler(buf, entry->d_name, &st, 0, fuse_fill_dir_flags(0)))
+                break;
+        }
+        closedir(dir);
+        return 0;
+    }
+
+    static int open(const char *path, struct fuse_file_info *fi)
+    {
+        emit mount()->fileAccessed(QString::fromUtf8(path + 1));
+
+        SyncJournalFileRecord record;
+        if (placeholderRecord(path, &record)) {
+            if ((fi->flags & O_ACCMODE) == O_RDONLY) {
+                int error = 0;
+                auto hydration = mount()->hydrationFor(QByteArray(path + 1), &error);
+                if (!hydration)
+                    return error;
+                auto file = new OpenFile;
+                file->hydration = std::move(hydration);
+                fi->fh = reinterpret_cast<uint64_t>(file);
+                fi->keep_cache = 0;
+                return 0;
+            }
+            if (const auto error = hydrateFully(path))
+                return error;
+        }
+
+        const auto fd = ::open(realPath(path).constData(), fi->flags);
+        if (fd == -1)
+            return -errno;
+        auto file = new OpenFile;
+        file->fd = fd;
+        fi->fh = reinterpret_cast<uint64_t>(file);
+        return 0;
+    }
+
+    static int create(const char *path, mode_t mode, struct fuse_file_info *fi)
+    {
+        const auto fd = ::open(realPath(path).constData(), fi->flags, mode);
+        if (fd == -1)
+            return -errno;
+        auto file = new OpenFile;
+        file->fd = fd;
+        fi->fh = reinterpret_cast<uint64_t>(file);
+        return 0;
+    }
+
+    static int read(const char *, char *buf, size_t size, off_t offset, struct fuse_file_info *fi)
+    {
+        const auto file = openFile(fi);
+        if (file->hydration) {
+            const auto result = file->hydration->read(buf, offset, size);
+            return result == -1 ? -EIO : int(result);
+        }
+        const auto result = pread(file->fd, buf, size, offset);
+        return result == -1 ? -errno : int(result);
+    }
+
+    static int write(const char *, const char *buf, size_t size, off_t offset, struct fuse_file_info *fi)
+    {
+        const auto result = pwrite(openFile(fi)->fd, buf, size, offset);
+        return result == -1 ? -errno : int(result);
+    }
+
+    static int truncate(const char *path, off_t size, struct fuse_file_info *fi)
+    {
+        if (fi && fi->fh && openFile(fi)->fd != -1)
+            return ftruncate(openFile(fi)->fd, size) == -1 ? -errno : 0;
+        SyncJournalFileRecord record;
+        if (placeholderRecord(path, &record) && size != 0) {
+            if (const auto error = hydrateFully(path))
+                return error;
+        }
+        return ::truncate(realPath(path).constData(), size) == -1 ? -errno : 0;
+    }
+
+    static int fsync(const char *, int datasync, struct fuse_file_info *fi)
+    {
+        const auto fd = openFile(fi)->fd;
+        if (fd == -1)
+            return 0;
+        return (datasync ? fdatasync(fd) : ::fsync(fd)) == -1 ? -errno : 0;
+    }
+
+    static int release(const char *, struct fuse_file_info *fi)
+    {
+        delete openFile(fi);
+        return 0;
+    }
+
+    static int unlink(const char *path)
+    {
+        return ::unlink(realPath(path).constData()) == -1 ? -errno : 0;
+    }
+
+    static int rename(const char *from, const char *to, unsigned int flags)
+    {
+        if (flags)
+            return -EINVAL;
+        return ::rename(realPath(from).constData(), realPath(to).constData()) == -1 ? -errno : 0;
+    }
+
+    static int mkdir(const char *path, mode_t mode)
+    {
+        return ::mkdir(realPath(path).constData(), mode) == -1 ? -errno : 0;
+    }
+
+    static int rmdir(const char *path)
+    {
+        return ::rmdir(realPath(path).constData()) == -1 ? -errno : 0;
+    }
+
+    static int chmod(const char *path, mode_t mode, struct fuse_file_info *)
+    {
+        return ::chmod(realPath(path).constData(), mode) == -1 ? -errno : 0;
+    }
+
+    static int utimens(const char *path, const struct timespec tv[2], struct fuse_file_info *)
+    {
+        return utimensat(AT_FDCWD, realPath(path).constData(), tv, AT_SYMLINK_NOFOLLOW) == -1 ? -errno : 0;
+    }
+
+    static int statfs(const char *path, struct statvfs *st)
+    {
+        return ::statvfs(realPath(path).constData(), st) == -1 ? -errno : 0;
+    }
+
+    static fuse_operations operations()
+    {
+        fuse_operations ops = {};
+        ops.getattr = &getattr;
+        ops.readdir = &readdir;
+        ops.open = &open;
+        ops.create = &create;
+        ops.read = &read;
+        ops.write = &write;
+        ops.truncate = &truncate;
+        ops.fsync = &fsync;
+        ops.release = &release;
+        ops.unlink = &unlink;
+        ops.rename = &rename;
+        ops.mkdir = &mkdir;
+        ops.rmdir = &rmdir;
+        ops.chmod = &chmod;
+        ops.utimens = &utimens;
+        ops.statfs = &statfs;
+        return ops;
+    }
+};
+
+FuseMount::FuseMount(const VfsSetupParams &params, QObject *parent)
+    : QObject(parent)
+    , _params(params)
+    , _root(params.filesystemPath.toUtf8())
+{
+    // FUSE paths start with a slash
+    _root.chop(1);
+}
+
+FuseMount::~FuseMount()
+{
+    unmount();
+}
+
+Result<void, QString> FuseMount::mount(const QString &mountPoint)
+{
+    Q_ASSERT(!_fuse);
+    QByteArray programName = "nextcloud";
+    char *argv[] = { programName.data() };
+    struct fuse_args args = FUSE_ARGS_INIT(1, argv);
+    const auto ops = FuseOperations::operations();
+    _fuse = fuse_new(&args, &ops, sizeof(ops), this);
+    fuse_opt_free_args(&args);
+    if (!_fuse)
+        return tr("Could not set up the file system view");
+
+    if (fuse_mount(_fuse, QFile::encodeName(mountPoint).constData()) != 0) {
+        fuse_destroy(_fuse);
+        _fuse = nullptr;
+        return tr("Could not mount the file system view at %1").arg(mountPoint);
+    }
+
+    _mountPoint = mountPoint;
+    _loopThread = std::thread([fuse = _fuse] {
+        fuse_loop_mt(fuse, 0);
+    });
+    qCInfo(lcFuseMount) << "Mounted" << _params.filesystemPath << "at" << mountPoint;
+    return {};
+}
+
+void FuseMount::unmount()
+{
+    if (!_fuse)
+        return;
+
+    // Readers blocked on a download would keep the loop from finishing
+    {
+        QMutexLocker lock(&_hydrationsMutex);
+        for (const auto &hydration : qAsConst(_hydrations))
+            hydration->abort();
+    }
+
+    fuse_exit(_fuse);
+    fuse_unmount(_fuse);
+    if (_loopThread.joinable())
+        _loopThread.join();
+    fuse_destroy(_fuse);
+    _fuse = nullptr;
+    qCInfo(lcFuseMount) << "Unmounted" << _mountPoint;
+    _mountPoint.clear();
+}
+
+bool FuseMount::isHydrating() const
+{
+    QMutexLocker lock(&_hydrationsMutex);
+    return !_hydrations.isEmpty();
+}
+
+std::shared_ptr<StreamingHydration> FuseMount::hydrationFor(const QByteArray &folderPath, int *error)
+{
+    QMutexLocker lock(&_hydrationsMutex);
+    if (const auto running = _hydrations.value(folderPath))
+        return running;
+
+    SyncJournalFileRecord record;
+    if (!_params.journal->getFileRecord(folderPath, &record) || !record.isValid() || !record.isVirtualFile()) {
+        *error = -ENOENT;
+        return nullptr;
+    }
+    if (record._isE2eEncrypted || !record._e2eMangledName.isEmpty()) {
+        qCWarning(lcFuseMount) << "Can't hydrate encrypted file" << folderPath;
+        *error = -EACCES;
+        return nullptr;
+    }
+
+    // Created on this FUSE thread, the downloads run on ours
+    const auto hydration = std::shared_ptr<StreamingHydration>(
+        new StreamingHydration(_params.account, _params.remotePath + QString::fromUtf8(folderPath),
+            _params.filesystemPath + QString::fromUtf8(folderPath), record._fileSize, record._modtime, record._etag),
+        [](StreamingHydration *hydration) { hydration->deleteLater(); });
+    const auto result = hydration->open();
+    if (!result) {
+        qCWarning(lcFuseMount) << "Could not hydrate" << folderPath << result.error();
+        *error = -EIO;
+        return nullptr;
+    }
+    hydration->moveToThread(thread());
+    connect(hydration.get(), &StreamingHydration::finished, this, [this, folderPath](bool success) {
+        finishHydration(folderPath, success);
+    });
+
+    const auto first = _hydrations.isEmpty();
+    _hydrations.insert(folderPath, hydration);
+    QMetaObject::invokeMethod(this, [this, first, hydration, folderPath] {
+        qCInfo(lcFuseMount) << "Hydrating" << hydration->localPath() << "on open";
+        if (first)
+            emit beginHydrating();
+        hydration->start();
+        emit hydrationRequested(QString::fromUtf8(folderPath));
+    }, Qt::QueuedConnection);
+    return hydration;
+}
+
+void FuseMount::finishHydration(const QByteArray &folderPath, bool success)
+{
+    if (success) {
+        SyncJournalFileRecord record;
+        _params.journal->getFileRecord(folderPath, &record);
+        quint64 inode = 0;
+        FileSystem::getInode(_params.filesystemPath + QString::fromUtf8(folderPath), &inode);
+        record._type = ItemTypeFile;
+        record._inode = inode;
+        _params.journal->setFileRecord(record);
+
+        // Like Folder::implicitlyHydrateFile(), or the next sync would
+        // dehydrate it again
+        auto pinStates = _params.journal->internalPinStates();
+        const auto pin = pinStates.effectiveForPath(folderPath);
+        if (pin && *pin == PinState::OnlineOnly)
+            pinStates.setForPath(folderPath, PinState::Unspecified);
+    }
+
+    bool last = false;
+    {
+        QMutexLocker lock(&_hydrationsMutex);
+        _hydrations.remove(folderPath);
+        last = _hydrations.isEmpty();
+    }
+    if (last)
+        emit doneHydrating();
+}
+
+} // namespace OCC
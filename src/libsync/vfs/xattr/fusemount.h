@@ -0,0 +1,86 @@
+/*
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ * or FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License
+ * for more details.
+ */
+#pragma once
+
+#include <QObject>
+#include <QHash>
+#include <QMutex>
+
+#include <memory>
+#include <thread>
+
+#include "common/vfs.h"
+#include "xattrexport.h"
+
+struct fuse;
+
+namespace OCC {
+
+struct FuseOperations;
+class StreamingHydration;
+
+/**
+ * @brief Shows a sync folder with virtual files through FUSE
+ *
+ * Linux has no way to hydrate a placeholder when an application opens it.
+ * This mounts a view of the sync folder where that happens: placeholders get
+ * the size and modification time of the server's file from the journal, and
+ * the first open hydrates the file with a StreamingHydration. Reads are
+ * answered as soon as their range was downloaded. The complete download
+ * replaces the placeholder in the sync folder and its journal record becomes
+ * a regular file.
+ *
+ * Everything else is passed through to the sync folder. FUSE requests are
+ * handled on worker threads, the downloads run on the thread of this object.
+ *
+ * @ingroup libsync
+ */
+class NEXTCLOUD_XATTR_EXPORT FuseMount : public QObject
+{
+    Q_OBJECT
+public:
+    explicit FuseMount(const VfsSetupParams &params, QObject *parent = nullptr);
+    ~FuseMount() override;
+
+    /// mountPoint must be an existing empty directory
+    Result<void, QString> mount(const QString &mountPoint);
+    void unmount();
+
+    QString mountPoint() const { return _mountPoint; }
+    bool isHydrating() const;
+
+signals:
+    void beginHydrating();
+    void doneHydrating();
+    /// Emitted on a FUSE thread for every file opened through the view
+    void fileAccessed(const QString &folderPath);
+    void hydrationRequested(const QString &folderPath);
+
+private:
+    friend struct FuseOperations;
+
+    /// Called on FUSE threads, returns the running download or starts one
+    std::shared_ptr<StreamingHydration> hydrationFor(const QByteArray &folderPath, int *error);
+
+    void finishHydration(const QByteArray &folderPath, bool success);
+
+    VfsSetupParams _params;
+    QByteArray _root;
+    QString _mountPoint;
+    struct fuse *_fuse = nullptr;
+    std::thread _loopThread;
+
+    mutable QMutex _hydrationsMutex;
+    QHash<QByteArray, std::shared_ptr<StreamingHydration>> _hydrations;
+};
+
+} // namespace OCC
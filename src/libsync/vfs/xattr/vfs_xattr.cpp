@@ -14,14 +14,24 @@
 
 #include "vfs_xattr.h"
 
+#include <QDir>
 #include <QFile>
+#include <QLoggingCategory>
 
 #include "syncfileitem.h"
 #include "filesystem.h"
 #include "common/syncjournaldb.h"
+#include "configfile.h"
+#include "vio/csync_vio_local.h"
 
 #include "xattrwrapper.h"
 
+#ifdef WITH_FUSE3
+#include "fusemount.h"
+#endif
+
+Q_LOGGING_CATEGORY(lcVfsXAttr, "nextcloud.sync.vfs.xattr", QtInfoMsg)
+
 namespace xattr {
 using namespace OCC::XAttrWrapper;
 }
@@ -45,16 +55,49 @@ QString VfsXAttr::fileSuffix() const
     return QString();
 }
 
-void VfsXAttr::startImpl(const VfsSetupParams &)
+void VfsXAttr::startImpl(const VfsSetupParams &params)
+{
+#ifdef WITH_FUSE3
+    const auto mountDirectory = ConfigFile().fuseMountDirectory();
+    if (mountDirectory.isEmpty()) {
+        return;
+    }
+    const auto mountPoint = QDir(mountDirectory).filePath(params.alias);
+    if (!QDir().mkpath(mountPoint)) {
+        qCWarning(lcVfsXAttr) << "Could not create the mount point" << mountPoint;
+        return;
+    }
+
+    _fuseMount.reset(new FuseMount(params));
+    connect(_fuseMount.data(), &FuseMount::beginHydrating, this, &Vfs::beginHydrating);
+    connect(_fuseMount.data(), &FuseMount::doneHydrating, this, &Vfs::doneHydrating);
+    connect(_fuseMount.data(), &FuseMount::fileAccessed, this, &Vfs::fileAccessed);
+    connect(_fuseMount.data(), &FuseMount::hydrationRequested, this, &Vfs::hydrationRequested);
+    const auto result = _fuseMount->mount(mountPoint);
+    if (!result) {
+        qCWarning(lcVfsXAttr) << result.error();
+        _fuseMount.reset();
+    }
+#else
+    Q_UNUSED(params)
+#endif
+}
+
+void VfsXAttr::unmount()
 {
+#ifdef WITH_FUSE3
+    _fuseMount.reset();
+#endif
 }
 
 void VfsXAttr::stop()
 {
+    unmount();
 }
 
 void VfsXAttr::unregisterFolder()
 {
+    unmount();
 }
 
 bool VfsXAttr::socketApiPinStateActionsShown() const
@@ -64,7 +107,11 @@ bool VfsXAttr::socketApiPinStateActionsShown() const
 
 bool VfsXAttr::isHydrating() const
 {
+#ifdef WITH_FUSE3
+    return _fuseMount && _fuseMount->isHydrating();
+#else
     return false;
+#endif
 }
 
 Result<void, QString> VfsXAttr::updateMetadata(const QString &filePath, time_t modtime, qint64, const QByteArray &)
@@ -89,7 +136,23 @@ Result<void, QString> VfsXAttr::createPlaceholder(const SyncFileItem &item)
     file.write(" ");
     file.close();
     FileSystem::setModTime(path, item._modtime);
-    return xattr::addNextcloudPlaceholderAttributes(path);
+    const auto result = xattr::addNextcloudPlaceholderAttributes(path);
+    if (!result) {
+        return result;
+    }
+    writePlaceholderRecord(path, true, xattr::placeholderVersionHash(item._fileId, item._etag));
+    return {};
+}
+
+void VfsXAttr::writePlaceholderRecord(const QString &path, bool dehydrated, quint32 versionHash)
+{
+    xattr::PlaceholderRecord record;
+    record.dehydrated = dehydrated;
+    record.versionHash = versionHash;
+    const auto result = xattr::setPlaceholderRecord(path, record);
+    if (!result) {
+        qCWarning(lcVfsXAttr) << "Could not write the placeholder record of" << path << result.error();
+    }
 }
 
 Result<void, QString> VfsXAttr::dehydratePlaceholder(const SyncFileItem &item)
@@ -112,9 +175,20 @@ Result<void, QString> VfsXAttr::dehydratePlaceholder(const SyncFileItem &item)
     return {};
 }
 
-Result<Vfs::ConvertToPlaceholderResult, QString> VfsXAttr::convertToPlaceholder(const QString &, const SyncFileItem &, const QString &)
+Result<Vfs::ConvertToPlaceholderResult, QString> VfsXAttr::convertToPlaceholder(const QString &filename, const SyncFileItem &item, const QString &)
 {
-    // Nothing necessary
+    if (item.isDirectory()) {
+        return {ConvertToPlaceholderResult::Ok};
+    }
+
+    // Only the record needs to follow the server version, unchanged ones are left alone
+    const auto versionHash = xattr::placeholderVersionHash(item._fileId, item._etag);
+    const auto record = xattr::placeholderRecord(filename);
+    if (record && record->versionHash == versionHash) {
+        return {ConvertToPlaceholderResult::Ok};
+    }
+    const auto dehydrated = record ? record->dehydrated : xattr::hasNextcloudPlaceholderAttributes(filename);
+    writePlaceholderRecord(filename, dehydrated, versionHash);
     return {ConvertToPlaceholderResult::Ok};
 }
 
@@ -136,19 +210,26 @@ bool VfsXAttr::statTypeVirtualFile(csync_file_stat_t *stat, void *statData)
         return false;
     }
 
-    const auto parentPath = static_cast<QByteArray *>(statData);
-    Q_ASSERT(!parentPath->endsWith('/'));
+    const auto parent = static_cast<const csync_vio_local_parent_t *>(statData);
+    const auto &parentPath = *parent->path;
+    Q_ASSERT(!parentPath.endsWith('/'));
     Q_ASSERT(!stat->path.startsWith('/'));
 
-    const auto path = QByteArray(*parentPath + '/' + stat->path);
-    const auto pin = [=] {
+    const auto path = QByteArray(parentPath + '/' + stat->path);
+    const auto folderPath = [&] {
         const auto absolutePath = QString::fromUtf8(path);
         Q_ASSERT(absolutePath.startsWith(params().filesystemPath.toUtf8()));
-        const auto folderPath = absolutePath.mid(params().filesystemPath.length());
-        return pinState(folderPath);
+        return absolutePath.mid(params().filesystemPath.length());
     }();
 
-    if (xattr::hasNextcloudPlaceholderAttributes(path)) {
+    // Files of older versions have no record until they are synced next.
+    // Nothing is written here, that would wake up the folder watcher.
+    const auto record = xattr::placeholderRecordAt(parent->dirfd, parentPath, stat->path);
+    const auto dehydrated = record ? record->dehydrated : xattr::hasNextcloudPlaceholderAttributes(path);
+    // The journal keeps the pin states in memory, this doesn't query it
+    const auto pin = pinState(folderPath);
+
+    if (dehydrated) {
         const auto shouldDownload = pin && (*pin == PinState::AlwaysLocal);
         stat->type = shouldDownload ? ItemTypeVirtualFileDownload : ItemTypeVirtualFile;
         return true;
@@ -21,6 +21,10 @@
 
 namespace OCC {
 
+#ifdef WITH_FUSE3
+class FuseMount;
+#endif
+
 class VfsXAttr : public Vfs
 {
     Q_OBJECT
@@ -57,6 +61,15 @@ public slots:
 
 protected:
     void startImpl(const VfsSetupParams &params) override;
+
+private:
+    void unmount();
+    void writePlaceholderRecord(const QString &path, bool dehydrated, quint32 versionHash);
+
+#ifdef WITH_FUSE3
+    // Hydrates placeholders on open, see ConfigFile::fuseMountDirectory()
+    QScopedPointer<FuseMount> _fuseMount;
+#endif
 };
 
 class XattrVfsPluginFactory : public QObject, public DefaultPluginFactory<VfsXAttr>
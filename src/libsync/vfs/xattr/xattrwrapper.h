@@ -28,6 +28,41 @@ namespace XAttrWrapper
 OWNCLOUDSYNC_EXPORT bool hasNextcloudPlaceholderAttributes(const QString &path);
 OWNCLOUDSYNC_EXPORT Result<void, QString> addNextcloudPlaceholderAttributes(const QString &path);
 
+/**
+ * What the xattr vfs knows about a file, packed into a single attribute
+ *
+ * Local discovery reads the hydration state from this with one getxattr,
+ * relative to the directory it lists where possible. Only propagation
+ * writes it, discovery never does.
+ */
+struct PlaceholderRecord
+{
+    bool dehydrated = false;
+    /// See placeholderVersionHash()
+    quint32 versionHash = 0;
+
+    bool operator==(const PlaceholderRecord &other) const
+    {
+        return dehydrated == other.dehydrated && versionHash == other.versionHash;
+    }
+    bool operator!=(const PlaceholderRecord &other) const { return !(*this == other); }
+};
+
+OWNCLOUDSYNC_EXPORT Optional<PlaceholderRecord> placeholderRecord(const QString &path);
+
+/**
+ * Like placeholderRecord() for the entry name of the directory dirPath
+ *
+ * dirfd is that directory opened for reading or -1. Where the kernel
+ * has getxattrat() the lookup is relative to it and skips the path walk.
+ */
+OWNCLOUDSYNC_EXPORT Optional<PlaceholderRecord> placeholderRecordAt(int dirfd, const QByteArray &dirPath, const QByteArray &name);
+
+OWNCLOUDSYNC_EXPORT Result<void, QString> setPlaceholderRecord(const QString &path, const PlaceholderRecord &record);
+
+/// Hash of a server version, unlike qHash() the same in every process
+OWNCLOUDSYNC_EXPORT quint32 placeholderVersionHash(const QByteArray &fileId, const QByteArray &etag);
+
 }
 
 } // namespace OCC
@@ -17,13 +17,39 @@
 #include "config.h"
 
 #include <QLoggingCategory>
+#include <QtEndian>
 
+#include <atomic>
+#include <cerrno>
+
+#include <sys/syscall.h>
 #include <sys/xattr.h>
+#include <unistd.h>
 
 Q_LOGGING_CATEGORY(lcXAttrWrapper, "nextcloud.sync.vfs.xattr.wrapper", QtInfoMsg)
 
 namespace {
 constexpr auto hydrateExecAttributeName = "user.nextcloud.hydrate_exec";
+constexpr auto placeholderRecordAttributeName = "user.nextcloud.vfs";
+
+// Layout of placeholderRecordAttributeName: version, flags, two reserved
+// bytes, then the version hash as a little endian 32 bit integer
+constexpr char placeholderRecordVersion = 2;
+constexpr char placeholderRecordDehydratedFlag = 0x1;
+constexpr int placeholderRecordSize = 8;
+
+#ifdef SYS_getxattrat
+// Older kernels only return ENOSYS, don't keep asking them
+std::atomic<bool> getxattratUnavailable{ false };
+
+// struct xattr_args of linux/xattr.h, which older headers lack
+struct XAttrArgs
+{
+    quint64 value;
+    quint32 size;
+    quint32 flags;
+};
+#endif
 
 OCC::Optional<QByteArray> xattrGet(const QByteArray &path, const QByteArray &name)
 {
@@ -39,6 +65,27 @@ OCC::Optional<QByteArray> xattrGet(const QByteArray &path, const QByteArray &nam
     }
 }
 
+// 32 bit FNV-1a
+quint32 fnv1a(const QByteArray &bytes, quint32 hash = 2166136261u)
+{
+    for (const auto byte : bytes) {
+        hash ^= static_cast<quint8>(byte);
+        hash *= 16777619u;
+    }
+    return hash;
+}
+
+OCC::Optional<OCC::XAttrWrapper::PlaceholderRecord> decodePlaceholderRecord(const char *data, ssize_t size)
+{
+    if (size != placeholderRecordSize || data[0] != placeholderRecordVersion) {
+        return {};
+    }
+    OCC::XAttrWrapper::PlaceholderRecord record;
+    record.dehydrated = data[1] & placeholderRecordDehydratedFlag;
+    record.versionHash = qFromLittleEndian<quint32>(data + 4);
+    return record;
+}
+
 bool xattrSet(const QByteArray &path, const QByteArray &name, const QByteArray &value)
 {
     const auto returnCode = setxattr(path.constData(), name.constData(), value.constData(), value.size() + 1, 0);
@@ -67,3 +114,49 @@ OCC::Result<void, QString> OCC::XAttrWrapper::addNextcloudPlaceholderAttributes(
         return {};
     }
 }
+
+OCC::Optional<OCC::XAttrWrapper::PlaceholderRecord> OCC::XAttrWrapper::placeholderRecord(const QString &path)
+{
+    char data[placeholderRecordSize];
+    const auto count = getxattr(path.toUtf8().constData(), placeholderRecordAttributeName, data, sizeof(data));
+    return decodePlaceholderRecord(data, count);
+}
+
+OCC::Optional<OCC::XAttrWrapper::PlaceholderRecord> OCC::XAttrWrapper::placeholderRecordAt(int dirfd, const QByteArray &dirPath, const QByteArray &name)
+{
+    char data[placeholderRecordSize];
+#ifdef SYS_getxattrat
+    if (dirfd >= 0 && !getxattratUnavailable.load(std::memory_order_relaxed)) {
+        XAttrArgs args{ reinterpret_cast<quintptr>(data), sizeof(data), 0 };
+        const auto count = syscall(SYS_getxattrat, dirfd, name.constData(), 0, placeholderRecordAttributeName, &args, sizeof(args));
+        if (count >= 0 || errno != ENOSYS) {
+            return decodePlaceholderRecord(data, count);
+        }
+        qCInfo(lcXAttrWrapper) << "getxattrat is unavailable, falling back to getxattr";
+        getxattratUnavailable = true;
+    }
+#else
+    Q_UNUSED(dirfd)
+#endif
+    const auto path = QByteArray(dirPath + '/' + name);
+    const auto count = getxattr(path.constData(), placeholderRecordAttributeName, data, sizeof(data));
+    return decodePlaceholderRecord(data, count);
+}
+
+OCC::Result<void, QString> OCC::XAttrWrapper::setPlaceholderRecord(const QString &path, const PlaceholderRecord &record)
+{
+    char data[placeholderRecordSize] = {};
+    data[0] = placeholderRecordVersion;
+    data[1] = record.dehydrated ? placeholderRecordDehydratedFlag : 0;
+    qToLittleEndian(record.versionHash, data + 4);
+    if (setxattr(path.toUtf8().constData(), placeholderRecordAttributeName, data, sizeof(data), 0) != 0) {
+        return QStringLiteral("Failed to set the extended attribute");
+    }
+    return {};
+}
+
+quint32 OCC::XAttrWrapper::placeholderVersionHash(const QByteArray &fileId, const QByteArray &etag)
+{
+    // With a separator so the two can't run into each other
+    return fnv1a(etag, fnv1a(QByteArray(1, '\0'), fnv1a(fileId)));
+}
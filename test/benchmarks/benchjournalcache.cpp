@@ -0,0 +1,126 @@
+/*
+ *    This software is in the public domain, furnished "as is", without technical
+ *    support, and with no warranty, express or implied, as to its usefulness for
+ *    any purpose.
+ *
+ */
+
+#include <QtCore>
+#include <random>
+
+#include "common/syncjournaldb.h"
+#include "common/syncjournalfilerecord.h"
+
+using namespace OCC;
+
+static const int filesPerDir = 100;
+
+static QByteArray dirName(int dirNum)
+{
+    return "dir" + QByteArray::number(dirNum / 100) + "/sub" + QByteArray::number(dirNum);
+}
+
+static void fillJournal(SyncJournalDb &db, int numFiles)
+{
+    SyncJournalFileRecord record;
+    record._type = ItemTypeFile;
+    record._remotePerm = RemotePermissions::fromDbValue("RW");
+    record._checksumHeader = "SHA1:da39a3ee5e6b4b0d3255bfef95601890afd80709";
+    for (int i = 0; i < numFiles; ++i) {
+        const auto num = QByteArray::number(i);
+        record._path = dirName(i / filesPerDir) + "/file" + num;
+        record._inode = i + 1;
+        record._modtime = 1600000000 + i;
+        record._etag = "etag" + num;
+        record._fileId = "0000" + num + "ocidfakeid";
+        record._fileSize = i;
+        db.setFileRecord(record);
+        if (i % 10000 == 0)
+            db.commit(QStringLiteral("fill"));
+    }
+    db.commit(QStringLiteral("fill"));
+}
+
+static void runQueries(SyncJournalDb &db, int numFiles, const char *label)
+{
+    std::mt19937 rng(42);
+    std::uniform_int_distribution<int> fileDist(0, numFiles - 1);
+    std::uniform_int_distribution<int> dirDist(0, numFiles / filesPerDir - 1);
+
+    QElapsedTimer timer;
+    timer.start();
+    db.open();
+    qDebug() << label << "OPEN:" << timer.restart() << "ms";
+
+    SyncJournalFileRecord record;
+    for (int i = 0; i < 100000; ++i) {
+        const int num = fileDist(rng);
+        db.getFileRecord(dirName(num / filesPerDir) + "/file" + QByteArray::number(num), &record);
+    }
+    qDebug() << label << "100k RANDOM getFileRecord:" << timer.restart() << "ms";
+
+    int listed = 0;
+    for (int i = 0; i < 2000; ++i) {
+        db.listFilesInPath(dirName(dirDist(rng)), [&](const SyncJournalFileRecord &) { ++listed; });
+    }
+    qDebug() << label << "2k RANDOM listFilesInPath:" << timer.restart() << "ms," << listed << "records";
+
+    for (int i = 0; i < 10000; ++i) {
+        db.getFileRecordByInode(fileDist(rng) + 1, &record);
+    }
+    qDebug() << label << "10k RANDOM getFileRecordByInode:" << timer.restart() << "ms";
+
+    int walked = 0;
+    db.getFilesBelowPath("", [&](const SyncJournalFileRecord &) { ++walked; });
+    qDebug() << label << "FULL WALK:" << timer.restart() << "ms," << walked << "records";
+
+    db.close();
+}
+
+int main(int argc, char *argv[])
+{
+    QCoreApplication app(argc, argv);
+
+    // A million entries gives a journal of roughly 300 MB
+    int numFiles = qEnvironmentVariableIntValue("OWNCLOUD_BENCH_JOURNAL_FILES");
+    if (numFiles <= 0)
+        numFiles = 1000000;
+
+    QTemporaryDir tempDir;
+    const QString dbPath = tempDir.path() + QStringLiteral("/.sync_bench.db");
+    {
+        SyncJournalDb db(dbPath);
+        QElapsedTimer timer;
+        timer.start();
+        fillJournal(db, numFiles);
+        db.close();
+        qDebug() << "CREATED" << numFiles << "records in" << timer.elapsed() << "ms, size"
+                 << QFileInfo(dbPath).size() / (1024 * 1024) << "MB";
+    }
+
+    // Each configuration gets its own copy, and the order alternates, so
+    // neither profits from caches the other one warmed up.
+    const QString defaultsPath = tempDir.path() + QStringLiteral("/.sync_bench_defaults.db");
+    const QString tunedPath = tempDir.path() + QStringLiteral("/.sync_bench_tuned.db");
+    QFile::copy(dbPath, defaultsPath);
+    QFile::copy(dbPath, tunedPath);
+
+    const auto runDefaults = [&] {
+        SyncJournalDb db(defaultsPath);
+        runQueries(db, numFiles, "SQLITE DEFAULTS");
+    };
+    const auto runTuned = [&] {
+        SyncJournalDb db(tunedPath);
+        SyncJournalDb::CacheLimits limits;
+        limits.mmapSize = 1024 * 1024 * 1024;
+        limits.cacheSize = 128 * 1024 * 1024;
+        db.setCacheLimits(limits);
+        runQueries(db, numFiles, "TUNED");
+    };
+    runDefaults();
+    runTuned();
+    runTuned();
+    runDefaults();
+
+    return 0;
+}
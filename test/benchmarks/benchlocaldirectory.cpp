@@ -0,0 +1,98 @@
+/*
+ *    This software is in the public domain, furnished "as is", without technical
+ *    support, and with no warranty, express or implied, as to its usefulness for
+ *    any purpose.
+ *
+ */
+
+#include <QtCore>
+
+#include <dirent.h>
+#include <sys/stat.h>
+
+#include "csync.h"
+#include "vio/csync_vio_local.h"
+
+static const int filesPerDir = 1000;
+
+static void createTree(const QString &root, int numFiles)
+{
+    for (int i = 0; i < numFiles; ++i) {
+        const QString dir = root + QStringLiteral("/dir") + QString::number(i / filesPerDir / 100)
+            + QStringLiteral("/sub") + QString::number(i / filesPerDir);
+        if (i % filesPerDir == 0)
+            QDir().mkpath(dir);
+        QFile file(dir + QStringLiteral("/file") + QString::number(i));
+        file.open(QIODevice::WriteOnly);
+        file.write("x");
+    }
+}
+
+// What csync_vio_local_readdir() used to do: readdir() and lstat() of the full path
+static int walkReaddirLstat(const QByteArray &path)
+{
+    DIR *dh = opendir(path.constData());
+    if (!dh)
+        return 0;
+    int entries = 0;
+    while (auto dirent = readdir(dh)) {
+        if (qstrcmp(dirent->d_name, ".") == 0 || qstrcmp(dirent->d_name, "..") == 0)
+            continue;
+        const QByteArray name = QFile::decodeName(dirent->d_name).toUtf8();
+        Q_UNUSED(name)
+        const QByteArray fullPath = path + '/' + QByteArray(dirent->d_name);
+        struct stat sb;
+        if (lstat(fullPath.constData(), &sb) < 0)
+            continue;
+        ++entries;
+        if (S_ISDIR(sb.st_mode))
+            entries += walkReaddirLstat(fullPath);
+    }
+    closedir(dh);
+    return entries;
+}
+
+static int walkVio(const QString &path)
+{
+    auto dh = csync_vio_local_opendir(path);
+    if (!dh)
+        return 0;
+    int entries = 0;
+    while (auto dirent = csync_vio_local_readdir(dh, nullptr)) {
+        if (dirent->type == ItemTypeSkip)
+            continue;
+        ++entries;
+        if (dirent->type == ItemTypeDirectory)
+            entries += walkVio(path + QLatin1Char('/') + QString::fromUtf8(dirent->path));
+    }
+    csync_vio_local_closedir(dh);
+    return entries;
+}
+
+int main(int argc, char *argv[])
+{
+    QCoreApplication app(argc, argv);
+
+    // The tree is created in the temporary directory, use a smaller one for quick runs
+    int numFiles = qEnvironmentVariableIntValue("OWNCLOUD_BENCH_LOCAL_FILES");
+    if (numFiles <= 0)
+        numFiles = 1000000;
+
+    QTemporaryDir tempDir;
+    const QString root = tempDir.path();
+    QElapsedTimer timer;
+    timer.start();
+    createTree(root, numFiles);
+    qDebug() << "CREATED" << numFiles << "files in" << timer.elapsed() << "ms";
+
+    // The first round warms the caches
+    for (int round = 0; round < 3; ++round) {
+        timer.restart();
+        const int oldEntries = walkReaddirLstat(QFile::encodeName(root));
+        qDebug() << "READDIR + LSTAT:" << timer.restart() << "ms," << oldEntries << "entries";
+        const int vioEntries = walkVio(root);
+        qDebug() << "CSYNC_VIO_LOCAL_READDIR:" << timer.restart() << "ms," << vioEntries << "entries";
+    }
+
+    return 0;
+}
@@ -28,6 +28,12 @@
 #include "vio/csync_vio_local.h"
 
 #include <QDir>
+#include <QMap>
+#include <QSet>
+
+#ifndef Q_OS_WIN
+#include <unistd.h>
+#endif
 
 static const auto CSYNC_TEST_DIR = []{ return QStringLiteral("%1/csync_test").arg(QDir::tempPath());}();
 
@@ -353,6 +359,57 @@ static void check_readdir_bigunicode(void **state)
     assert_int_equal(files_cnt, 0);
 }
 
+// More entries than one batch of the directory reader holds
+static void check_readdir_manyentries(void **state)
+{
+    (void) state;
+
+    const int count = 10000;
+    const auto prefix = QStringLiteral("a_rather_long_file_name_to_fill_the_buffer_quickly_");
+    for (int i = 0; i < count; ++i)
+        create_file("", (prefix + QString::number(i)).toUtf8().constData(), "x");
+
+    auto dh = csync_vio_local_opendir(CSYNC_TEST_DIR);
+    assert_non_null(dh);
+    QSet<QByteArray> seen;
+    while (auto dirent = csync_vio_local_readdir(dh, nullptr)) {
+        assert_int_equal(dirent->type, ItemTypeFile);
+        assert_int_equal(dirent->size, 1);
+
+        // Same as what a stat of the full path says
+        csync_file_stat_t buf;
+        assert_int_equal(csync_vio_local_stat(CSYNC_TEST_DIR + QLatin1Char('/') + QString::fromUtf8(dirent->path), &buf), 0);
+        assert_int_equal(dirent->inode, buf.inode);
+        assert_int_equal(dirent->modtime, buf.modtime);
+        seen.insert(dirent->path);
+    }
+    assert_int_equal(csync_vio_local_closedir(dh), 0);
+    assert_int_equal(seen.size(), count);
+}
+
+#ifndef Q_OS_WIN
+static void check_readdir_special(void **state)
+{
+    (void) state;
+
+    create_file("", "file", "content");
+    assert_int_equal(symlink("file", QFile::encodeName(CSYNC_TEST_DIR + QStringLiteral("/link")).constData()), 0);
+    assert_int_equal(mkfifo(QFile::encodeName(CSYNC_TEST_DIR + QStringLiteral("/fifo")).constData(), 0600), 0);
+
+    auto dh = csync_vio_local_opendir(CSYNC_TEST_DIR);
+    assert_non_null(dh);
+    QMap<QByteArray, ItemType> types;
+    while (auto dirent = csync_vio_local_readdir(dh, nullptr))
+        types[dirent->path] = dirent->type;
+    assert_int_equal(csync_vio_local_closedir(dh), 0);
+
+    assert_int_equal(types.size(), 3);
+    assert_int_equal(types.value("file"), ItemTypeFile);
+    assert_int_equal(types.value("link"), ItemTypeSoftLink);
+    assert_int_equal(types.value("fifo"), ItemTypeSkip);
+}
+#endif
+
 int torture_run_tests(void)
 {
     const struct CMUnitTest tests[] = {
@@ -360,6 +417,10 @@ int torture_run_tests(void)
         cmocka_unit_test_setup_teardown(check_readdir_with_content, setup_testenv, teardown),
         cmocka_unit_test_setup_teardown(check_readdir_longtree, setup_testenv, teardown),
         cmocka_unit_test_setup_teardown(check_readdir_bigunicode, setup_testenv, teardown),
+        cmocka_unit_test_setup_teardown(check_readdir_manyentries, setup_testenv, teardown),
+#ifndef Q_OS_WIN
+        cmocka_unit_test_setup_teardown(check_readdir_special, setup_testenv, teardown),
+#endif
     };
 
     return cmocka_run_group_tests(tests, nullptr, nullptr);
@@ -80,6 +80,10 @@ void FakeWebSocketServer::close()
 void FakeWebSocketServer::processTextMessageInternal(const QString &message)
 {
     auto client = qobject_cast<QWebSocket *>(sender());
+    if (message.startsWith(QStringLiteral("listen "))) {
+        _listenMessages.append(message);
+        return;
+    }
     emit processTextMessage(client, message);
 }
 
@@ -46,6 +46,9 @@ public:
 
     void clearTextMessages();
 
+    /// The "listen ..." subscriptions the clients sent, not counted as text messages
+    QStringList listenMessages() const { return _listenMessages; }
+
     static OCC::AccountPtr createAccount(const QString &username = "user", const QString &password = "password");
 
 signals:
@@ -62,6 +65,7 @@ private:
     QList<QWebSocket *> _clients;
 
     std::unique_ptr<QSignalSpy> _processTextMessageSpy;
+    QStringList _listenMessages;
 };
 
 class CredentialsStub : public OCC::AbstractCredentials
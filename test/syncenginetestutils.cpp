@@ -503,8 +503,19 @@ void FakeGetReply::respond()
     }
     payload = fileInfo->contentChar;
     size = fileInfo->size;
+    int status = 200;
+    // Like a real server, answer "bytes=start-" and "bytes=start-end" with the partial content
+    const QRegularExpression rangePattern(QStringLiteral("^bytes=(\\d+)-(\\d*)$"));
+    const auto range = rangePattern.match(QString::fromLatin1(request().rawHeader("Range")));
+    if (range.hasMatch() && range.captured(1).toInt() < fileInfo->size) {
+        const int start = range.captured(1).toInt();
+        const int end = range.captured(2).isEmpty() ? fileInfo->size - 1 : qMin(range.captured(2).toInt(), fileInfo->size - 1);
+        size = end - start + 1;
+        status = 206;
+        setRawHeader("Content-Range", "bytes " + QByteArray::number(start) + '-' + QByteArray::number(end) + '/' + QByteArray::number(fileInfo->size));
+    }
     setHeader(QNetworkRequest::ContentLengthHeader, size);
-    setAttribute(QNetworkRequest::HttpStatusCodeAttribute, 200);
+    setAttribute(QNetworkRequest::HttpStatusCodeAttribute, status);
     setRawHeader("OC-ETag", fileInfo->etag);
     setRawHeader("ETag", fileInfo->etag);
     setRawHeader("OC-FileId", fileInfo->fileId);
@@ -261,7 +261,7 @@ public:
 
     FakeGetReply(FileInfo &remoteRootFileInfo, QNetworkAccessManager::Operation op, const QNetworkRequest &request, QObject *parent);
 
-    Q_INVOKABLE void respond();
+    Q_INVOKABLE virtual void respond();
 
     void abort() override;
     qint64 bytesAvailable() const override;
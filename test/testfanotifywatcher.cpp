@@ -0,0 +1,139 @@
+/*
+ *    This software is in the public domain, furnished "as is", without technical
+ *       support, and with no warranty, express or implied, as to its usefulness for
+ *          any purpose.
+ *          */
+
+#include <QtTest>
+
+#include "folderwatcher_fanotify.h"
+#include "common/utility.h"
+
+using namespace OCC;
+
+class TestFanotifyWatcher : public QObject
+{
+    Q_OBJECT
+
+    QTemporaryDir _root;
+    QTemporaryDir _outside;
+    QString _rootPath;
+    QScopedPointer<FanotifyWatcher> _watcher;
+    QScopedPointer<QSignalSpy> _changedSpy;
+
+    bool waitForChange(const QString &path)
+    {
+        QElapsedTimer t;
+        t.start();
+        while (t.elapsed() < 5000) {
+            for (int i = 0; i < _changedSpy->size(); ++i) {
+                if (_changedSpy->at(i).first().toStringList().contains(path))
+                    return true;
+            }
+            _changedSpy->wait(200);
+        }
+        return false;
+    }
+
+private slots:
+    void initTestCase()
+    {
+        _rootPath = QDir(_root.path()).canonicalPath();
+        QDir rootDir(_rootPath);
+        rootDir.mkpath("a1/b1/c1");
+        rootDir.mkpath("a2/b2");
+        QVERIFY(Utility::writeRandomFile(_rootPath + "/a1/b1/c1/file"));
+        QVERIFY(Utility::writeRandomFile(_rootPath + "/a2/tomove"));
+
+        _watcher.reset(new FanotifyWatcher(_rootPath));
+        if (!_watcher->isValid())
+            QSKIP("fanotify file system marks are not permitted here");
+        _changedSpy.reset(new QSignalSpy(_watcher.data(), &FanotifyWatcher::changesDetected));
+    }
+
+    void init()
+    {
+        _changedSpy->clear();
+    }
+
+    // No registration per directory: changes deep in the tree are seen right away
+    void testDeepChange()
+    {
+        const QString file = _rootPath + "/a1/b1/c1/file";
+        QVERIFY(Utility::writeRandomFile(file));
+        QVERIFY(waitForChange(file));
+    }
+
+    void testCreateInNewDirectory()
+    {
+        const QString dir = _rootPath + "/a2/new/sub";
+        QVERIFY(QDir().mkpath(dir));
+        QVERIFY(Utility::writeRandomFile(dir + "/created"));
+        QVERIFY(waitForChange(_rootPath + "/a2/new"));
+        QVERIFY(waitForChange(dir + "/created"));
+    }
+
+    void testMoveAndDelete()
+    {
+        QVERIFY(QFile::rename(_rootPath + "/a2/tomove", _rootPath + "/a1/moved"));
+        QVERIFY(waitForChange(_rootPath + "/a2/tomove"));
+        QVERIFY(waitForChange(_rootPath + "/a1/moved"));
+
+        QVERIFY(QFile::remove(_rootPath + "/a1/moved"));
+        _changedSpy->clear();
+        QVERIFY(waitForChange(_rootPath + "/a1/moved"));
+    }
+
+    // The mark covers the whole file system, only the root's changes are reported
+    void testOutsideOfRootIgnored()
+    {
+        QVERIFY(Utility::writeRandomFile(_outside.path() + "/elsewhere"));
+        const QString marker = _rootPath + "/marker";
+        QVERIFY(Utility::writeRandomFile(marker));
+        QVERIFY(waitForChange(marker));
+        for (const auto &args : *_changedSpy) {
+            for (const auto &path : args.first().toStringList())
+                QVERIFY(path.startsWith(_rootPath + "/"));
+        }
+    }
+
+    void testJournalIgnored()
+    {
+        QVERIFY(Utility::writeRandomFile(_rootPath + "/.sync_1234.db"));
+        const QString marker = _rootPath + "/marker2";
+        QVERIFY(Utility::writeRandomFile(marker));
+        QVERIFY(waitForChange(marker));
+        for (const auto &args : *_changedSpy) {
+            for (const auto &path : args.first().toStringList())
+                QVERIFY(!path.contains(".sync_"));
+        }
+    }
+
+    // Watchers on one file system read the same events, each gets its own paths
+    void testSharedGroup()
+    {
+        const QString otherRoot = QDir(_outside.path()).canonicalPath();
+        FanotifyWatcher other(otherRoot);
+        QVERIFY(other.isValid());
+        if (!other.testSharesGroupWith(*_watcher))
+            QSKIP("the temporary directories are on different file systems");
+        QSignalSpy otherSpy(&other, &FanotifyWatcher::changesDetected);
+
+        QVERIFY(Utility::writeRandomFile(otherRoot + "/shared"));
+        const QString marker = _rootPath + "/marker3";
+        QVERIFY(Utility::writeRandomFile(marker));
+        QVERIFY(waitForChange(marker));
+        QTRY_VERIFY(!otherSpy.isEmpty());
+        for (const auto &args : otherSpy) {
+            for (const auto &path : args.first().toStringList())
+                QVERIFY(path.startsWith(otherRoot + "/"));
+        }
+        for (const auto &args : *_changedSpy) {
+            for (const auto &path : args.first().toStringList())
+                QVERIFY(path.startsWith(_rootPath + "/"));
+        }
+    }
+};
+
+QTEST_GUILESS_MAIN(TestFanotifyWatcher)
+#include "testfanotifywatcher.moc"
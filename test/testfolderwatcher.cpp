@@ -97,7 +97,7 @@ class TestFolderWatcher : public QObject
     }
 
 #ifdef Q_OS_LINUX
-#define CHECK_WATCH_COUNT(n) QCOMPARE(_watcher->testLinuxWatchCount(), (n))
+#define CHECK_WATCH_COUNT(n) QTRY_COMPARE(_watcher->testLinuxWatchCount(), (n))
 #else
 #define CHECK_WATCH_COUNT(n) do {} while (false)
 #endif
@@ -119,6 +119,8 @@ public:
         Utility::writeRandomFile( _rootPath+"/a2/renamefile");
         Utility::writeRandomFile( _rootPath+"/a1/movefile");
 
+        // The watch count checks are about the inotify backend
+        qputenv("OWNCLOUD_FOLDERWATCHER_BACKEND", "inotify");
         _watcher.reset(new FolderWatcher);
         _watcher->init(_rootPath);
         _pathChangedSpy.reset(new QSignalSpy(_watcher.data(), SIGNAL(pathChanged(QString))));
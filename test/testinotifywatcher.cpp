@@ -62,6 +62,58 @@ private slots:
         QVERIFY2(ok, "findFoldersBelow failed.");
     }
 
+    // Changes are coalesced and delivered in one batch a little later
+    void testWorkerBatchesChanges() {
+        InotifyWorker worker;
+        connect(&worker, &InotifyWorker::foldersFound, &worker, &InotifyWorker::registerFolders);
+        QSignalSpy changesSpy(&worker, &InotifyWorker::changesDetected);
+        worker.start(_root);
+        QVERIFY(worker.watchCount() > 0);
+
+        for (int i = 0; i < 3; ++i)
+            QVERIFY(Utility::writeRandomFile(_root + "/a1/batched.dat"));
+        QVERIFY(Utility::writeRandomFile(_root + "/a2/b3/batched.dat"));
+
+        // Not right away
+        QVERIFY(!changesSpy.wait(50));
+        QVERIFY(changesSpy.wait());
+        QCOMPARE(changesSpy.size(), 1);
+        const auto paths = changesSpy[0][0].toStringList();
+        QCOMPARE(paths.count(_root + "/a1/batched.dat"), 1);
+        QCOMPARE(paths.count(_root + "/a2/b3/batched.dat"), 1);
+    }
+
+    // Too many changes at once are dropped and reported as lost
+    void testWorkerOverflow() {
+        // A directory with many files is moved in, they're all reported
+        const QString outside = _root + "_outside";
+        QVERIFY(QDir().mkpath(outside + "/many"));
+        for (int i = 0; i <= 10000; ++i) {
+            QFile file(outside + "/many/" + QString::number(i));
+            QVERIFY(file.open(QFile::WriteOnly));
+        }
+
+        InotifyWorker worker;
+        connect(&worker, &InotifyWorker::foldersFound, &worker, &InotifyWorker::registerFolders);
+        QSignalSpy changesSpy(&worker, &InotifyWorker::changesDetected);
+        QSignalSpy lostSpy(&worker, &InotifyWorker::lostChanges);
+        worker.start(_root);
+
+        QVERIFY(QDir().rename(outside + "/many", _root + "/many"));
+        QVERIFY(lostSpy.wait());
+        QCOMPARE(lostSpy.size(), 1);
+        QVERIFY(!changesSpy.wait(500));
+
+        // Later changes are reported again
+        QVERIFY(Utility::writeRandomFile(_root + "/a1/after.dat"));
+        QVERIFY(changesSpy.wait());
+        QCOMPARE(changesSpy[0][0].toStringList().count(_root + "/a1/after.dat"), 1);
+        QCOMPARE(lostSpy.size(), 1);
+
+        QVERIFY(QDir(_root + "/many").removeRecursively());
+        QVERIFY(QDir(outside).removeRecursively());
+    }
+
     void cleanupTestCase() {
         if( _root.startsWith(QDir::tempPath() )) {
            system( QString("rm -rf %1").arg(_root).toLocal8Bit() );
@@ -69,5 +121,5 @@ private slots:
     }
 };
 
-QTEST_APPLESS_MAIN(TestInotifyWatcher)
+QTEST_GUILESS_MAIN(TestInotifyWatcher)
 #include "testinotifywatcher.moc"
@@ -9,6 +9,8 @@
 #include "syncenginetestutils.h"
 #include <syncengine.h>
 #include <localdiscoverytracker.h>
+#include <filestabilitytracker.h>
+#include <filesystem.h>
 
 using namespace OCC;
 
@@ -204,6 +206,207 @@ private slots:
         QVERIFY(!fakeFolder.currentRemoteState().find("C/.foo"));
         QVERIFY(!fakeFolder.currentRemoteState().find("C/bar"));
     }
+
+    // Touched paths survive restarts, changes while not running are looked for
+    void testPersistedLocalChanges()
+    {
+        FakeFolder fakeFolder{ FileInfo::A12_B12_C12_S12() };
+        QVERIFY(fakeFolder.syncOnce());
+
+        {
+            LocalDiscoveryTracker tracker;
+            tracker.setJournal(&fakeFolder.syncJournal());
+            tracker.addTouchedPath("A/a1");
+            tracker.addTouchedPath("B");
+        }
+
+        LocalDiscoveryTracker tracker;
+        connect(&fakeFolder.syncEngine(), &SyncEngine::itemCompleted, &tracker, &LocalDiscoveryTracker::slotItemCompleted);
+        connect(&fakeFolder.syncEngine(), &SyncEngine::finished, &tracker, &LocalDiscoveryTracker::slotSyncFinished);
+        tracker.setJournal(&fakeFolder.syncJournal());
+        QCOMPARE(tracker.localDiscoveryPaths(), (std::set<QString>{ "A/a1", "B" }));
+
+        fakeFolder.syncEngine().setLocalDiscoveryOptions(LocalDiscoveryStyle::DatabaseAndFilesystem, tracker.localDiscoveryPaths());
+        tracker.startSyncPartialDiscovery();
+        QVERIFY(fakeFolder.syncOnce());
+        QVERIFY(fakeFolder.syncJournal().localChanges().isEmpty());
+
+        // Pretend nothing changed for an hour, then change things "while not running"
+        const auto anHourAgo = QDateTime::currentSecsSinceEpoch() - 3600;
+        for (const auto &dir : { "", "A", "B", "C", "S" })
+            QVERIFY(FileSystem::setModTime(fakeFolder.localPath() + dir, anHourAgo));
+        const auto since = (anHourAgo + 60) * 1000;
+
+        fakeFolder.localModifier().insert("A/a3");
+        fakeFolder.localModifier().remove("B/b1");
+        fakeFolder.localModifier().appendByte("C/c1"); // in place, C's mtime stays
+        QSignalSpy foundSpy(&tracker, &LocalDiscoveryTracker::localChangesFound);
+        tracker.findLocalChanges(fakeFolder.localPath(), since);
+        QVERIFY(foundSpy.wait());
+        auto found = foundSpy[0][0].toStringList();
+        found.sort();
+        QCOMPARE(found, (QStringList{ "A/a3", "B/b1", "C/c1" }));
+        tracker.addTouchedPaths(found);
+        QCOMPARE(tracker.localDiscoveryPaths(), (std::set<QString>{ "A/a3", "B/b1", "C/c1" }));
+
+        fakeFolder.syncEngine().setLocalDiscoveryOptions(LocalDiscoveryStyle::DatabaseAndFilesystem, tracker.localDiscoveryPaths());
+        tracker.startSyncPartialDiscovery();
+        QVERIFY(fakeFolder.syncOnce());
+        QVERIFY(fakeFolder.currentRemoteState().find("A/a3"));
+        QVERIFY(!fakeFolder.currentRemoteState().find("B/b1"));
+        QCOMPARE(fakeFolder.currentLocalState(), fakeFolder.currentRemoteState());
+    }
+
+    // Directories whose mtime didn't change are not listed again
+    void testPruneUnchangedDirectories()
+    {
+        FakeFolder fakeFolder{ FileInfo::A12_B12_C12_S12() };
+        auto options = fakeFolder.syncEngine().syncOptions();
+        options._pruneUnchangedLocalDirectories = true;
+        fakeFolder.syncEngine().setSyncOptions(options);
+        fakeFolder.localModifier().mkdir("A/sub");
+        fakeFolder.localModifier().insert("A/sub/s1");
+        QVERIFY(fakeFolder.syncOnce());
+
+        // Directory mtimes have a resolution of seconds, move them out of the way
+        const auto anHourAgo = QDateTime::currentSecsSinceEpoch() - 3600;
+        for (const auto &dir : { "", "A", "A/sub", "B" })
+            QVERIFY(FileSystem::setModTime(fakeFolder.localPath() + dir, anHourAgo));
+        QVERIFY(fakeFolder.syncOnce());
+        SyncJournalFileRecord rec;
+        QVERIFY(fakeFolder.syncJournal().getFileRecord(QByteArrayLiteral("A"), &rec));
+        QCOMPARE(rec._localDirModtime, anHourAgo);
+
+        // In-place changes don't touch the directory: only found through the touched paths
+        fakeFolder.localModifier().appendByte("A/a1");
+        QVERIFY(fakeFolder.syncOnce());
+        QVERIFY(fakeFolder.currentLocalState() != fakeFolder.currentRemoteState());
+        fakeFolder.syncEngine().setLocalDiscoveryOptions(LocalDiscoveryStyle::FilesystemOnly, { "A/a1" });
+        QVERIFY(fakeFolder.syncOnce());
+        QCOMPARE(fakeFolder.currentLocalState(), fakeFolder.currentRemoteState());
+        fakeFolder.syncEngine().setLocalDiscoveryOptions(LocalDiscoveryStyle::FilesystemOnly);
+
+        // New entries change the mtime of their directory
+        fakeFolder.localModifier().insert("B/b3");
+        QVERIFY(fakeFolder.syncOnce());
+        QVERIFY(fakeFolder.currentRemoteState().find("B/b3"));
+
+        // Subdirectories of pruned directories are still checked
+        fakeFolder.localModifier().insert("A/sub/s2");
+        QVERIFY(fakeFolder.syncOnce());
+        QVERIFY(fakeFolder.currentRemoteState().find("A/sub/s2"));
+        QCOMPARE(fakeFolder.currentLocalState(), fakeFolder.currentRemoteState());
+
+        // A stored record doesn't lose the listed mtime
+        QVERIFY(fakeFolder.syncJournal().getFileRecord(QByteArrayLiteral("A"), &rec));
+        rec._localDirModtime = 0;
+        QVERIFY(fakeFolder.syncJournal().setFileRecord(rec));
+        QVERIFY(fakeFolder.syncJournal().getFileRecord(QByteArrayLiteral("A"), &rec));
+        QCOMPARE(rec._localDirModtime, anHourAgo);
+    }
+
+    // A pruned discovery doesn't see files edited in place, an unpruned one does
+    void testInPlaceEditUnderUnchangedDirectory()
+    {
+        FakeFolder fakeFolder{ FileInfo::A12_B12_C12_S12() };
+        auto options = fakeFolder.syncEngine().syncOptions();
+        options._pruneUnchangedLocalDirectories = true;
+        fakeFolder.syncEngine().setSyncOptions(options);
+        QVERIFY(fakeFolder.syncOnce());
+        const auto anHourAgo = QDateTime::currentSecsSinceEpoch() - 3600;
+        for (const auto &dir : { "", "A" })
+            QVERIFY(FileSystem::setModTime(fakeFolder.localPath() + dir, anHourAgo));
+        QVERIFY(fakeFolder.syncOnce());
+
+        // Edited while the client wasn't watching
+        fakeFolder.localModifier().appendByte("A/a1");
+        QVERIFY(FileSystem::setModTime(fakeFolder.localPath() + "A", anHourAgo));
+        QVERIFY(fakeFolder.syncOnce());
+        QVERIFY(fakeFolder.syncEngine().lastLocalDiscoveryPruned());
+        QCOMPARE(fakeFolder.syncEngine().lastLocalDiscoveryStyle(), LocalDiscoveryStyle::FilesystemOnly);
+        QVERIFY(fakeFolder.currentLocalState() != fakeFolder.currentRemoteState());
+
+        // Not a full discovery for the folder, the next unpruned one finds the edit
+        options._pruneUnchangedLocalDirectories = false;
+        fakeFolder.syncEngine().setSyncOptions(options);
+        QVERIFY(fakeFolder.syncOnce());
+        QVERIFY(!fakeFolder.syncEngine().lastLocalDiscoveryPruned());
+        QCOMPARE(fakeFolder.currentLocalState(), fakeFolder.currentRemoteState());
+    }
+
+    // With the watcher reporting the edited file, a pruned discovery syncs it
+    void testInPlaceEditReportedByWatcher()
+    {
+        FakeFolder fakeFolder{ FileInfo::A12_B12_C12_S12() };
+        auto options = fakeFolder.syncEngine().syncOptions();
+        options._pruneUnchangedLocalDirectories = true;
+        fakeFolder.syncEngine().setSyncOptions(options);
+        QVERIFY(fakeFolder.syncOnce());
+        const auto anHourAgo = QDateTime::currentSecsSinceEpoch() - 3600;
+        for (const auto &dir : { "", "A" })
+            QVERIFY(FileSystem::setModTime(fakeFolder.localPath() + dir, anHourAgo));
+        QVERIFY(fakeFolder.syncOnce());
+
+        // A's listing is unchanged, only the touched path tells about the edit
+        fakeFolder.localModifier().appendByte("A/a1");
+        QVERIFY(FileSystem::setModTime(fakeFolder.localPath() + "A", anHourAgo));
+        fakeFolder.syncEngine().setLocalDiscoveryOptions(LocalDiscoveryStyle::FilesystemOnly, { "A/a1" });
+        QVERIFY(fakeFolder.syncOnce());
+        QVERIFY(fakeFolder.syncEngine().lastLocalDiscoveryPruned());
+        QCOMPARE(fakeFolder.currentLocalState(), fakeFolder.currentRemoteState());
+    }
+
+    // Files that are still being written don't hold up the rest of the sync
+    void testStabilizingFiles()
+    {
+        FakeFolder fakeFolder{ FileInfo::A12_B12_C12_S12() };
+        fakeFolder.localModifier().insert("A/growing", 100);
+        fakeFolder.localModifier().appendByte("A/a1");
+        fakeFolder.remoteModifier().appendByte("A/a2");
+
+        fakeFolder.syncEngine().setStabilizingLocalPaths({ "A/growing" });
+        QVERIFY(fakeFolder.syncOnce());
+        QVERIFY(!fakeFolder.currentRemoteState().find("A/growing"));
+        QCOMPARE(fakeFolder.currentRemoteState().find("A/a1")->size, fakeFolder.currentLocalState().find("A/a1")->size);
+        QCOMPARE(fakeFolder.currentRemoteState().find("A/a2")->size, fakeFolder.currentLocalState().find("A/a2")->size);
+
+        // Changes on the server aren't postponed
+        fakeFolder.localModifier().appendByte("A/a3");
+        fakeFolder.remoteModifier().appendByte("A/a3");
+        fakeFolder.syncEngine().setStabilizingLocalPaths({ "A/a3" });
+        QVERIFY(fakeFolder.syncOnce());
+        QCOMPARE(fakeFolder.syncJournal().conflictRecordPaths().size(), 1);
+
+        // The postponing is only for the next sync
+        QVERIFY(fakeFolder.syncOnce());
+        QVERIFY(fakeFolder.currentRemoteState().find("A/growing"));
+
+        // The destination of a local move isn't postponed, or the source would be deleted
+        int uploads = 0;
+        fakeFolder.setServerOverride([&](QNetworkAccessManager::Operation op, const QNetworkRequest &, QIODevice *) -> QNetworkReply * {
+            if (op == QNetworkAccessManager::PutOperation)
+                ++uploads;
+            return nullptr;
+        });
+        fakeFolder.localModifier().rename("B/b1", "B/moved");
+        fakeFolder.syncEngine().setStabilizingLocalPaths({ "B/moved" });
+        QVERIFY(fakeFolder.syncOnce());
+        QCOMPARE(fakeFolder.currentLocalState(), fakeFolder.currentRemoteState());
+        QCOMPARE(uploads, 0);
+
+        // The tracker reports files once they stopped changing
+        FileStabilityTracker tracker(fakeFolder.localPath());
+        QSignalSpy stabilizedSpy(&tracker, &FileStabilityTracker::pathsStabilized);
+        tracker.fileChanged("A/a1");
+        tracker.fileChanged("A");
+        tracker.fileChanged("A/nonexistent");
+        QCOMPARE(tracker.stabilizingCount(), 1);
+        QVERIFY(stabilizedSpy.wait());
+        QCOMPARE(stabilizedSpy[0][0].toStringList(), QStringList{ "A/a1" });
+        QCOMPARE(tracker.stabilizingCount(), 0);
+
+        QVERIFY(FileStabilityTracker::stabilityWindow(1000 * 1000 * 1000) > FileStabilityTracker::stabilityWindow(1000));
+    }
 };
 
 QTEST_GUILESS_MAIN(TestLocalDiscovery)
@@ -101,6 +101,30 @@ private slots:
         QVERIFY(verifyCalledOnceWithAccount(filesChangedSpy, account));
     }
 
+    void testOnWebSocketTextMessageReceived_notifyFileIdMessage_emitFileIdsChanged()
+    {
+        FakeWebSocketServer fakeServer;
+        auto account = FakeWebSocketServer::createAccount();
+        const auto socket = fakeServer.authenticateAccount(account);
+        QVERIFY(socket);
+        QTRY_VERIFY(fakeServer.listenMessages().contains(QStringLiteral("listen notify_file_id")));
+        QSignalSpy filesChangedSpy(account->pushNotifications(), &OCC::PushNotifications::filesChanged);
+        QSignalSpy fileIdsChangedSpy(account->pushNotifications(), &OCC::PushNotifications::fileIdsChanged);
+
+        socket->sendTextMessage("notify_file_id [12,3456789012]");
+
+        QVERIFY(fileIdsChangedSpy.wait());
+        QCOMPARE(fileIdsChangedSpy.count(), 1);
+        QCOMPARE(fileIdsChangedSpy.at(0).at(0).value<OCC::Account *>(), account.data());
+        QCOMPARE(fileIdsChangedSpy.at(0).at(1).value<QVector<qint64>>(), (QVector<qint64>{ 12, 3456789012 }));
+        QCOMPARE(filesChangedSpy.count(), 0);
+
+        // Without usable ids it's a plain files notification
+        socket->sendTextMessage("notify_file_id garbage");
+        QVERIFY(filesChangedSpy.wait());
+        QVERIFY(verifyCalledOnceWithAccount(filesChangedSpy, account));
+    }
+
     void testOnWebSocketTextMessageReceived_notifyActivityMessage_emitNotification()
     {
         FakeWebSocketServer fakeServer;
@@ -171,6 +171,80 @@ private slots:
         QVERIFY(completeSpy.findItem("nofileid")->_errorString.contains("file id"));
         QVERIFY(completeSpy.findItem("nopermissions/A")->_errorString.contains("permissions"));
     }
+
+    // Check that a restricted remote discovery only lists the scheduled subtrees
+    void testRestrictedRemoteDiscovery()
+    {
+        FakeFolder fakeFolder{ FileInfo::A12_B12_C12_S12() };
+        fakeFolder.remoteModifier().mkdir("A/X");
+        fakeFolder.remoteModifier().insert("A/X/x1");
+        QVERIFY(fakeFolder.syncOnce());
+        QCOMPARE(fakeFolder.currentLocalState(), fakeFolder.currentRemoteState());
+        const auto firstFullDiscovery = fakeFolder.syncJournal().lastFullRemoteDiscoveryTime();
+        QVERIFY(firstFullDiscovery > 0);
+
+        QStringList propfinds;
+        fakeFolder.setServerOverride([&](QNetworkAccessManager::Operation, const QNetworkRequest &req, QIODevice *) -> QNetworkReply * {
+            if (req.attribute(QNetworkRequest::CustomVerbAttribute) == "PROPFIND")
+                propfinds.append(req.url().path());
+            return nullptr;
+        });
+
+        fakeFolder.remoteModifier().insert("A/X/x2");
+        fakeFolder.remoteModifier().insert("B/b3");
+        fakeFolder.syncJournal().scheduleRemoteSubtreeDiscovery("A/X");
+        QCOMPARE(fakeFolder.syncJournal().scheduledRemoteSubtrees(), QByteArrayList{ "A/X" });
+
+        fakeFolder.syncEngine().setRemoteDiscoveryOptions(RemoteDiscoveryStyle::DatabaseAndServer, { "A/X" });
+        QVERIFY(fakeFolder.syncOnce());
+        QVERIFY(fakeFolder.currentLocalState().find("A/X/x2"));
+        QVERIFY(!fakeFolder.currentLocalState().find("B/b3"));
+        QCOMPARE(propfinds.size(), 3); // root, A and A/X
+        QVERIFY(fakeFolder.syncJournal().scheduledRemoteSubtrees().isEmpty());
+        QCOMPARE(fakeFolder.syncJournal().lastFullRemoteDiscoveryTime(), firstFullDiscovery);
+
+        // The etags of B and the parents were kept so the next full discovery gets the rest
+        propfinds.clear();
+        QVERIFY(fakeFolder.syncOnce());
+        QCOMPARE(fakeFolder.currentLocalState(), fakeFolder.currentRemoteState());
+        QVERIFY(fakeFolder.syncJournal().lastFullRemoteDiscoveryTime() >= firstFullDiscovery);
+
+        // Nothing changed: nothing but the root is listed
+        propfinds.clear();
+        fakeFolder.syncEngine().setRemoteDiscoveryOptions(RemoteDiscoveryStyle::DatabaseAndServer, {});
+        QVERIFY(fakeFolder.syncOnce());
+        QCOMPARE(propfinds.size(), 1);
+        QCOMPARE(fakeFolder.currentLocalState(), fakeFolder.currentRemoteState());
+    }
+
+    // A file moved out of the listed subtree must not be deleted locally
+    void testRestrictedRemoteDiscoveryMove()
+    {
+        FakeFolder fakeFolder{ FileInfo::A12_B12_C12_S12() };
+        QVERIFY(fakeFolder.syncOnce());
+
+        int downloads = 0;
+        fakeFolder.setServerOverride([&](QNetworkAccessManager::Operation op, const QNetworkRequest &, QIODevice *) -> QNetworkReply * {
+            if (op == QNetworkAccessManager::GetOperation)
+                ++downloads;
+            return nullptr;
+        });
+
+        fakeFolder.remoteModifier().rename("A/a1", "B/a1");
+        fakeFolder.syncJournal().scheduleRemoteSubtreeDiscovery("A");
+        fakeFolder.syncEngine().setRemoteDiscoveryOptions(RemoteDiscoveryStyle::DatabaseAndServer, { "A" });
+        QVERIFY(fakeFolder.syncOnce());
+        QVERIFY(fakeFolder.currentLocalState().find("A/a1"));
+        QVERIFY(!fakeFolder.currentLocalState().find("B/a1"));
+        QCOMPARE(fakeFolder.syncEngine().isAnotherSyncNeeded(), ImmediateFollowUp);
+        QVERIFY(fakeFolder.syncJournal().scheduledRemoteSubtrees().contains(QByteArray()));
+
+        // The follow-up discovers everything and finds the move
+        QVERIFY(fakeFolder.syncOnce());
+        QCOMPARE(fakeFolder.currentLocalState(), fakeFolder.currentRemoteState());
+        QCOMPARE(downloads, 0);
+        QVERIFY(fakeFolder.syncJournal().scheduledRemoteSubtrees().isEmpty());
+    }
 };
 
 QTEST_GUILESS_MAIN(TestRemoteDiscovery)
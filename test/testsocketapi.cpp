@@ -0,0 +1,182 @@
+/*
+ *    This software is in the public domain, furnished "as is", without technical
+ *    support, and with no warranty, express or implied, as to its usefulness for
+ *    any purpose.
+ *
+ */
+
+#include <QtTest>
+#include <QBuffer>
+
+#include "socketapi.h"
+#include "socketapi_p.h"
+#include "common/syncfilestatus.h"
+
+using namespace OCC;
+
+namespace {
+
+/// Records what the SocketApi writes and pretends to hold unsent data on demand
+class FakeSocket : public QBuffer
+{
+public:
+    FakeSocket() { open(QIODevice::ReadWrite); }
+
+    qint64 bytesToWrite() const override { return unsentBytes; }
+
+    /// Returns the lines written since the last call
+    QByteArrayList takeLines()
+    {
+        auto lines = buffer().split('\n');
+        lines.removeAll(QByteArray());
+        buffer().clear();
+        seek(0);
+        return lines;
+    }
+
+    qint64 unsentBytes = 0;
+};
+
+}
+
+class TestSocketApi : public QObject
+{
+    Q_OBJECT
+
+    SocketListener *addListener(SocketApi &api, FakeSocket &socket)
+    {
+        api._listeners.append(SocketListener(&socket));
+        return &api._listeners.last();
+    }
+
+    // What the push timer does when it fires
+    void flush(SocketApi &api)
+    {
+        api._statusPushTimer.stop();
+        api.slotFlushStatusPushes();
+    }
+
+    bool flushPending(const SocketApi &api) { return api._statusPushTimer.isActive(); }
+
+private slots:
+    void testSubscribedStatusesAreBatched()
+    {
+        SocketApi api;
+        FakeSocket socket;
+        auto listener = addListener(api, socket);
+
+        api.command_SUBSCRIBE_STATUS(QStringLiteral("/sync/A/"), listener);
+        api.broadcastStatusPushMessage(QStringLiteral("/sync/A/a1"), SyncFileStatus(SyncFileStatus::StatusSync));
+        api.broadcastStatusPushMessage(QStringLiteral("/sync/A/a2"), SyncFileStatus(SyncFileStatus::StatusSync));
+        // Other directories aren't pushed at all
+        api.broadcastStatusPushMessage(QStringLiteral("/sync/B/b1"), SyncFileStatus(SyncFileStatus::StatusSync));
+
+        // Nothing is written before the batch is flushed
+        QVERIFY(socket.takeLines().isEmpty());
+        QVERIFY(flushPending(api));
+
+        flush(api);
+        QCOMPARE(socket.takeLines(), QByteArrayList({ "STATUS_BATCH:BEGIN",
+                                         "STATUS:SYNC:/sync/A/a1",
+                                         "STATUS:SYNC:/sync/A/a2",
+                                         "STATUS_BATCH:END" }));
+
+        // Nothing is left to send
+        flush(api);
+        QVERIFY(socket.takeLines().isEmpty());
+    }
+
+    void testStatusesAreCoalesced()
+    {
+        SocketApi api;
+        FakeSocket socket;
+        auto listener = addListener(api, socket);
+
+        api.command_SUBSCRIBE_STATUS(QStringLiteral("/sync/A"), listener);
+        api.broadcastStatusPushMessage(QStringLiteral("/sync/A/a1"), SyncFileStatus(SyncFileStatus::StatusSync));
+        api.broadcastStatusPushMessage(QStringLiteral("/sync/A/a2"), SyncFileStatus(SyncFileStatus::StatusSync));
+        api.broadcastStatusPushMessage(QStringLiteral("/sync/A/a1"), SyncFileStatus(SyncFileStatus::StatusUpToDate));
+
+        // Only the last status of a1 is sent, in the order the files first changed
+        flush(api);
+        QCOMPARE(socket.takeLines(), QByteArrayList({ "STATUS_BATCH:BEGIN",
+                                         "STATUS:OK:/sync/A/a1",
+                                         "STATUS:SYNC:/sync/A/a2",
+                                         "STATUS_BATCH:END" }));
+    }
+
+    void testUnsubscribe()
+    {
+        SocketApi api;
+        FakeSocket socket;
+        auto listener = addListener(api, socket);
+
+        api.command_SUBSCRIBE_STATUS(QStringLiteral("/sync/A"), listener);
+        api.command_SUBSCRIBE_STATUS(QStringLiteral("/sync/B"), listener);
+        api.command_UNSUBSCRIBE_STATUS(QStringLiteral("/sync/A/"), listener);
+        api.broadcastStatusPushMessage(QStringLiteral("/sync/A/a1"), SyncFileStatus(SyncFileStatus::StatusSync));
+        api.broadcastStatusPushMessage(QStringLiteral("/sync/B/b1"), SyncFileStatus(SyncFileStatus::StatusSync));
+
+        flush(api);
+        QCOMPARE(socket.takeLines(), QByteArrayList({ "STATUS_BATCH:BEGIN",
+                                         "STATUS:SYNC:/sync/B/b1",
+                                         "STATUS_BATCH:END" }));
+    }
+
+    void testMonitoredDirectoriesKeepSingleLines()
+    {
+        SocketApi api;
+        FakeSocket socket;
+        auto listener = addListener(api, socket);
+
+        // A was only asked about with RETRIEVE_FILE_STATUS, B is subscribed
+        listener->registerMonitoredDirectory(qHash(QStringLiteral("/sync/A")));
+        listener->registerMonitoredDirectory(qHash(QStringLiteral("/sync/B")));
+        api.command_SUBSCRIBE_STATUS(QStringLiteral("/sync/B"), listener);
+
+        api.broadcastStatusPushMessage(QStringLiteral("/sync/A/a1"), SyncFileStatus(SyncFileStatus::StatusSync));
+        api.broadcastStatusPushMessage(QStringLiteral("/sync/B/b1"), SyncFileStatus(SyncFileStatus::StatusSync));
+        QCOMPARE(socket.takeLines(), QByteArrayList({ "STATUS:SYNC:/sync/A/a1" }));
+
+        // b1 is only sent in the batch
+        flush(api);
+        QCOMPARE(socket.takeLines(), QByteArrayList({ "STATUS_BATCH:BEGIN",
+                                         "STATUS:SYNC:/sync/B/b1",
+                                         "STATUS_BATCH:END" }));
+    }
+
+    void testSlowListenerIsHeldBack()
+    {
+        SocketApi api;
+        FakeSocket slowSocket;
+        FakeSocket socket;
+        auto slowListener = addListener(api, slowSocket);
+        auto listener = addListener(api, socket);
+
+        api.command_SUBSCRIBE_STATUS(QStringLiteral("/sync/A"), slowListener);
+        api.command_SUBSCRIBE_STATUS(QStringLiteral("/sync/A"), listener);
+        slowSocket.unsentBytes = 64 * 1024 + 1;
+
+        api.broadcastStatusPushMessage(QStringLiteral("/sync/A/a1"), SyncFileStatus(SyncFileStatus::StatusSync));
+        flush(api);
+        QVERIFY(slowSocket.takeLines().isEmpty());
+        QCOMPARE(socket.takeLines().size(), 3);
+        // The held back batch is retried
+        QVERIFY(flushPending(api));
+
+        // Changes keep being coalesced while the file manager catches up
+        api.broadcastStatusPushMessage(QStringLiteral("/sync/A/a1"), SyncFileStatus(SyncFileStatus::StatusUpToDate));
+        flush(api);
+        QVERIFY(slowSocket.takeLines().isEmpty());
+
+        slowSocket.unsentBytes = 64 * 1024;
+        flush(api);
+        QCOMPARE(slowSocket.takeLines(), QByteArrayList({ "STATUS_BATCH:BEGIN",
+                                             "STATUS:OK:/sync/A/a1",
+                                             "STATUS_BATCH:END" }));
+        QVERIFY(!flushPending(api));
+    }
+};
+
+QTEST_GUILESS_MAIN(TestSocketApi)
+#include "testsocketapi.moc"
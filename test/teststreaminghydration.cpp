@@ -0,0 +1,138 @@
+/*
+ *    This software is in the public domain, furnished "as is", without technical
+ *    support, and with no warranty, express or implied, as to its usefulness for
+ *    any purpose.
+ *
+ */
+
+#include <QtTest>
+#include "syncenginetestutils.h"
+#include "vfs/streaminghydration.h"
+
+#include <atomic>
+#include <thread>
+
+using namespace OCC;
+
+static const int fileSize = 1024 * 1024;
+static const qint64 chunkSize = 64 * 1024;
+static const time_t modtime = 1000000000;
+
+class TestStreamingHydration : public QObject
+{
+    Q_OBJECT
+
+private slots:
+    void testReadBeforeDownloadCompletes()
+    {
+        FakeFolder fakeFolder{ FileInfo() };
+        fakeFolder.remoteModifier().insert("big", fileSize);
+        const auto etag = fakeFolder.remoteModifier().find("big")->etag;
+
+        // A slow server, so the reader's request competes with the ones already running
+        QVector<qint64> requestedOffsets;
+        fakeFolder.setServerOverride([&](QNetworkAccessManager::Operation op, const QNetworkRequest &request, QIODevice *) -> QNetworkReply * {
+            if (op != QNetworkAccessManager::GetOperation)
+                return nullptr;
+            const auto range = request.rawHeader("Range");
+            requestedOffsets.append(range.mid(6, range.indexOf('-') - 6).toLongLong());
+            return new DelayedReply<FakeGetReply>(100, fakeFolder.remoteModifier(), op, request, &fakeFolder.syncEngine());
+        });
+
+        const auto localPath = fakeFolder.localPath() + "big";
+        StreamingHydration hydration(fakeFolder.account(), "big", localPath, fileSize, modtime, etag);
+        hydration.setChunkSize(chunkSize);
+        hydration.setMaxParallelRequests(2);
+        QVERIFY(hydration.open());
+        QCOMPARE(QFileInfo(hydration.tmpPath()).size(), qint64(fileSize));
+        hydration.start();
+
+        // Read the end of the file while the start is being downloaded
+        const qint64 readOffset = fileSize - chunkSize / 2;
+        QByteArray data(100, '\0');
+        std::atomic<qint64> readResult(0);
+        std::atomic<bool> done(false);
+        std::thread reader([&] {
+            readResult = hydration.read(data.data(), readOffset, data.size());
+            done = true;
+        });
+        QTRY_VERIFY(done);
+        reader.join();
+        QCOMPARE(readResult.load(), qint64(data.size()));
+        QCOMPARE(data, QByteArray(data.size(), 'W'));
+        QCOMPARE(hydration.state(), StreamingHydration::Running);
+        QVERIFY(requestedOffsets.indexOf(fileSize - chunkSize) < 4);
+
+        QSignalSpy finishedSpy(&hydration, &StreamingHydration::finished);
+        QTRY_COMPARE(hydration.state(), StreamingHydration::Succeeded);
+        QCOMPARE(finishedSpy.count(), 1);
+        QCOMPARE(finishedSpy[0][0].toBool(), true);
+        QCOMPARE(requestedOffsets.size(), fileSize / chunkSize);
+
+        QVERIFY(!QFile::exists(hydration.tmpPath()));
+        QFile file(localPath);
+        QVERIFY(file.open(QIODevice::ReadOnly));
+        QCOMPARE(file.readAll(), QByteArray(fileSize, 'W'));
+        QCOMPARE(QFileInfo(localPath).lastModified().toSecsSinceEpoch(), qint64(modtime));
+
+        // Readers continue on the hydrated file
+        QCOMPARE(hydration.read(data.data(), 0, data.size()), qint64(data.size()));
+    }
+
+    void testServerIgnoresRange()
+    {
+        FakeFolder fakeFolder{ FileInfo() };
+        fakeFolder.remoteModifier().insert("big", fileSize);
+        const auto etag = fakeFolder.remoteModifier().find("big")->etag;
+
+        int requestCount = 0;
+        fakeFolder.setServerOverride([&](QNetworkAccessManager::Operation op, const QNetworkRequest &request, QIODevice *) -> QNetworkReply * {
+            if (op != QNetworkAccessManager::GetOperation)
+                return nullptr;
+            ++requestCount;
+            auto withoutRange = request;
+            withoutRange.setRawHeader("Range", QByteArray());
+            return new DelayedReply<FakeGetReply>(100, fakeFolder.remoteModifier(), op, withoutRange, &fakeFolder.syncEngine());
+        });
+
+        const auto localPath = fakeFolder.localPath() + "big";
+        StreamingHydration hydration(fakeFolder.account(), "big", localPath, fileSize, modtime, etag);
+        hydration.setChunkSize(chunkSize);
+        hydration.setMaxParallelRequests(3);
+        QVERIFY(hydration.open());
+        hydration.start();
+
+        // The first full reply stops the others, no more chunks are requested
+        QTRY_COMPARE(hydration.state(), StreamingHydration::Succeeded);
+        QCOMPARE(requestCount, 3);
+        QFile file(localPath);
+        QVERIFY(file.open(QIODevice::ReadOnly));
+        QCOMPARE(file.readAll(), QByteArray(fileSize, 'W'));
+    }
+
+    void testChangedOnServer()
+    {
+        FakeFolder fakeFolder{ FileInfo() };
+        fakeFolder.remoteModifier().insert("big", fileSize);
+
+        const auto localPath = fakeFolder.localPath() + "big";
+        StreamingHydration hydration(fakeFolder.account(), "big", localPath, fileSize, modtime, "outdated");
+        hydration.setChunkSize(chunkSize);
+        QSignalSpy finishedSpy(&hydration, &StreamingHydration::finished);
+        QVERIFY(hydration.open());
+        hydration.start();
+
+        QTRY_COMPARE(hydration.state(), StreamingHydration::Failed);
+        QCOMPARE(finishedSpy.count(), 1);
+        QCOMPARE(finishedSpy[0][0].toBool(), false);
+        QVERIFY(!QFile::exists(hydration.tmpPath()));
+        QVERIFY(!QFile::exists(localPath));
+
+        char data[10];
+        QCOMPARE(hydration.read(data, 0, sizeof(data)), qint64(-1));
+        QVERIFY(!hydration.waitUntilFinished());
+    }
+};
+
+QTEST_GUILESS_MAIN(TestStreamingHydration)
+#include "teststreaminghydration.moc"
@@ -745,6 +745,30 @@ private slots:
 
         QCOMPARE(QFileInfo(fakeFolder.localPath() + "foo").lastModified(), datetime);
     }
+
+    // Two folders sync at the same time, one of them with a budget changed mid-sync
+    void testConcurrentSyncs()
+    {
+        FakeFolder fakeFolder1{ FileInfo::A12_B12_C12_S12() };
+        FakeFolder fakeFolder2{ FileInfo::A12_B12_C12_S12() };
+        for (int i = 0; i < 10; ++i) {
+            fakeFolder1.remoteModifier().insert(QString("A/new%1").arg(i));
+            fakeFolder2.localModifier().insert(QString("B/new%1").arg(i));
+        }
+
+        QSignalSpy finished1(&fakeFolder1.syncEngine(), &SyncEngine::finished);
+        QSignalSpy finished2(&fakeFolder2.syncEngine(), &SyncEngine::finished);
+        fakeFolder1.scheduleSync();
+        fakeFolder2.scheduleSync();
+        fakeFolder2.execUntilBeforePropagation();
+        fakeFolder2.syncEngine().setParallelNetworkJobs(1);
+
+        QTRY_VERIFY(finished1.count() == 1 && finished2.count() == 1);
+        QVERIFY(finished1[0][0].toBool());
+        QVERIFY(finished2[0][0].toBool());
+        QCOMPARE(fakeFolder1.currentLocalState(), fakeFolder1.currentRemoteState());
+        QCOMPARE(fakeFolder2.currentLocalState(), fakeFolder2.currentRemoteState());
+    }
 };
 
 QTEST_GUILESS_MAIN(TestSyncEngine)
@@ -30,6 +30,11 @@ public:
         return {};
     }
 
+    int statusCount(const QString &relativePath) const {
+        QFileInfo file(_syncEngine.localPath(), relativePath);
+        return std::count_if(begin(), end(), [&](const QList<QVariant> &args) { return QFileInfo(args[0].toString()) == file; });
+    }
+
     bool statusEmittedBefore(const QString &firstPath, const QString &secondPath) const {
         QFileInfo firstFile(_syncEngine.localPath(), firstPath);
         QFileInfo secondFile(_syncEngine.localPath(), secondPath);
@@ -428,6 +433,57 @@ private slots:
         QCOMPARE(statusSpy.statusOf("C/c1"), SyncFileStatus(SyncFileStatus::StatusUpToDate));
     }
 
+    // Each path is pushed once per engine notification, with its final status
+    void statusPushedOncePerPath() {
+        FakeFolder fakeFolder{FileInfo::A12_B12_C12_S12()};
+        fakeFolder.remoteModifier().mkdir("A/x");
+        fakeFolder.remoteModifier().mkdir("A/x/y");
+        for (int i = 0; i < 10; ++i)
+            fakeFolder.remoteModifier().insert(QStringLiteral("A/x/y/f%1").arg(i));
+        fakeFolder.localModifier().appendByte("A/a1");
+        fakeFolder.localModifier().appendByte("A/a2");
+        StatusPushSpy statusSpy(fakeFolder.syncEngine());
+
+        fakeFolder.scheduleSync();
+        fakeFolder.execUntilBeforePropagation();
+        verifyThatPushMatchesPull(fakeFolder, statusSpy);
+        QCOMPARE(statusSpy.statusCount("A"), 1);
+        QCOMPARE(statusSpy.statusCount("A/x/y"), 1);
+        QCOMPARE(statusSpy.statusOf("A"), SyncFileStatus(SyncFileStatus::StatusSync));
+        QCOMPARE(statusSpy.statusOf("A/x/y/f9"), SyncFileStatus(SyncFileStatus::StatusSync));
+        statusSpy.clear();
+
+        fakeFolder.execUntilFinished();
+        verifyThatPushMatchesPull(fakeFolder, statusSpy);
+        QCOMPARE(statusSpy.statusOf(""), SyncFileStatus(SyncFileStatus::StatusUpToDate));
+        QCOMPARE(statusSpy.statusOf("A/x"), SyncFileStatus(SyncFileStatus::StatusUpToDate));
+        QCOMPARE(statusSpy.statusOf("A/x/y/f0"), SyncFileStatus(SyncFileStatus::StatusUpToDate));
+        QVERIFY(statusSpy.statusEmittedBefore("A/x/y", "A/x"));
+        QCOMPARE(fakeFolder.currentLocalState(), fakeFolder.currentRemoteState());
+    }
+
+    void directoryEntryStatuses() {
+        FakeFolder fakeFolder{FileInfo::A12_B12_C12_S12()};
+        fakeFolder.remoteModifier().find("A/a1")->isShared = true;
+        fakeFolder.serverErrorPaths().append("A/a2");
+        fakeFolder.localModifier().appendByte("A/a2");
+        fakeFolder.syncOnce();
+        fakeFolder.syncEngine().excludedFiles().addManualExclude("A/excluded");
+        fakeFolder.localModifier().insert("A/excluded");
+        fakeFolder.localModifier().insert("A/new");
+
+        auto &tracker = fakeFolder.syncEngine().syncFileStatusTracker();
+        for (const QString &directory : { QString(), QStringLiteral("A") }) {
+            const QStringList names = QDir(fakeFolder.localPath() + directory).entryList(QDir::AllEntries | QDir::NoDotAndDotDot);
+            const auto statuses = tracker.directoryEntryStatuses(directory, names);
+            QCOMPARE(statuses.size(), names.size());
+            for (int i = 0; i < names.size(); ++i)
+                QCOMPARE(statuses[i], tracker.fileStatus(directory.isEmpty() ? names[i] : directory + '/' + names[i]));
+        }
+        QCOMPARE(tracker.fileStatus("A/a2"), SyncFileStatus(SyncFileStatus::StatusError));
+        QCOMPARE(tracker.fileStatus("A/excluded"), SyncFileStatus(SyncFileStatus::StatusExcluded));
+    }
+
     void sharedStatus() {
         SyncFileStatus sharedUpToDateStatus(SyncFileStatus::StatusUpToDate);
         sharedUpToDateStatus.setShared(true);
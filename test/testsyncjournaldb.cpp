@@ -183,6 +183,31 @@ private slots:
         QCOMPARE(record.numericFileId(), QByteArray("123456789"));
     }
 
+    void testFileRecordsByNumericFileId()
+    {
+        const auto insert = [this](const QByteArray &path, const QByteArray &fileId) {
+            SyncJournalFileRecord record;
+            record._path = path;
+            record._fileId = fileId;
+            record._remotePerm = RemotePermissions::fromDbValue("RW");
+            QVERIFY(_db.setFileRecord(record));
+        };
+        insert("numeric/a", "00000042ocinstance");
+        insert("numeric/b", "00000421ocinstance");
+        insert("numeric/c", "123456789ocinstance");
+
+        const auto pathsFor = [this](qint64 id) {
+            QByteArrayList paths;
+            _db.getFileRecordsByNumericFileId(id, [&](const SyncJournalFileRecord &rec) { paths.append(rec._path); });
+            return paths;
+        };
+        QCOMPARE(pathsFor(42), QByteArrayList{ "numeric/a" });
+        QCOMPARE(pathsFor(421), QByteArrayList{ "numeric/b" });
+        QCOMPARE(pathsFor(123456789), QByteArrayList{ "numeric/c" });
+        QVERIFY(pathsFor(4).isEmpty());
+        QVERIFY(pathsFor(12345678).isEmpty());
+    }
+
     void testConflictRecord()
     {
         ConflictRecord record;
@@ -444,6 +469,19 @@ private slots:
         list = _db.internalPinStates().rawList();
         QCOMPARE(list->size(), 4 + 9 + 27 - 4);
 
+        // Setting a subtree
+        _db.internalPinStates().setForPathAndBelow("online", PinState::AlwaysLocal);
+        QCOMPARE(getRaw("online"), PinState::AlwaysLocal);
+        QCOMPARE(getRaw("online/online"), PinState::Inherited);
+        QCOMPARE(get("online/online/online"), PinState::AlwaysLocal);
+        QCOMPARE(getRaw("local/online"), PinState::OnlineOnly);
+        list = _db.internalPinStates().rawList();
+        QCOMPARE(list->size(), 4 + 9 + 27 - 4 - 12);
+        _db.internalPinStates().setForPathAndBelow("inherit", PinState::Inherited);
+        QCOMPARE(getRaw("inherit/online"), PinState::Inherited);
+        list = _db.internalPinStates().rawList();
+        QCOMPARE(list->size(), 4 + 9 + 27 - 4 - 12 - 13);
+
         // Wiping everything
         _db.internalPinStates().wipeForPathAndBelow("");
         QCOMPARE(getRaw(""), PinState::Inherited);
@@ -453,6 +491,50 @@ private slots:
         QCOMPARE(list->size(), 0);
     }
 
+    void testErrorBlacklistCache()
+    {
+        auto makeEntry = [](const QString &file, SyncJournalErrorBlacklistRecord::Category category) {
+            SyncJournalErrorBlacklistRecord entry;
+            entry._file = file;
+            entry._errorString = "error";
+            entry._lastTryEtag = "etag";
+            entry._lastTryTime = 1000;
+            entry._ignoreDuration = 100;
+            entry._errorCategory = category;
+            return entry;
+        };
+
+        _db.wipeErrorBlacklist();
+        _db.setErrorBlacklistEntry(makeEntry("foo/bar", SyncJournalErrorBlacklistRecord::Normal));
+        _db.setErrorBlacklistEntry(makeEntry("foo/baz", SyncJournalErrorBlacklistRecord::InsufficientRemoteStorage));
+
+        _db.loadErrorBlacklistCache();
+        QVERIFY(_db.errorBlacklistEntry("foo/bar").isValid());
+        QCOMPARE(_db.errorBlacklistEntry("foo/bar")._file, QString("foo/bar"));
+        QCOMPARE(_db.errorBlacklistEntry("foo/bar")._lastTryEtag, QByteArray("etag"));
+        QCOMPARE(_db.errorBlacklistEntry("FOO/BAR").isValid(), Utility::fsCasePreserving());
+        QVERIFY(!_db.errorBlacklistEntry("foo/nope").isValid());
+
+        // Changes go to the cache and the database
+        _db.setErrorBlacklistEntry(makeEntry("foo/new", SyncJournalErrorBlacklistRecord::Normal));
+        _db.wipeErrorBlacklistEntry("foo/bar");
+        _db.wipeErrorBlacklistCategory(SyncJournalErrorBlacklistRecord::InsufficientRemoteStorage);
+        QVERIFY(_db.errorBlacklistEntry("foo/new").isValid());
+        QVERIFY(!_db.errorBlacklistEntry("foo/bar").isValid());
+        QVERIFY(!_db.errorBlacklistEntry("foo/baz").isValid());
+
+        _db.setErrorBlacklistEntry(makeEntry("foo/stale", SyncJournalErrorBlacklistRecord::Normal));
+        QVERIFY(_db.deleteStaleErrorBlacklistEntries({ "foo/new" }));
+        QVERIFY(!_db.errorBlacklistEntry("foo/stale").isValid());
+
+        _db.dropErrorBlacklistCache();
+        QCOMPARE(_db.errorBlackListEntryCount(), 1);
+        QVERIFY(_db.errorBlacklistEntry("foo/new").isValid());
+        QVERIFY(!_db.errorBlacklistEntry("foo/bar").isValid());
+        QVERIFY(!_db.errorBlacklistEntry("foo/stale").isValid());
+        _db.wipeErrorBlacklist();
+    }
+
 private:
     SyncJournalDb _db;
 };
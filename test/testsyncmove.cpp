@@ -890,6 +890,45 @@ private slots:
         QCOMPARE(fakeFolder.currentLocalState(), fakeFolder.currentRemoteState());
     }
 
+    // Many individual moves switch move detection to the in-memory index
+    void testManyMoves()
+    {
+        FakeFolder fakeFolder{ FileInfo{} };
+        OperationCounter counter;
+        fakeFolder.setServerOverride(counter.functor());
+
+        const int count = 600;
+        fakeFolder.localModifier().mkdir("A");
+        fakeFolder.localModifier().mkdir("B");
+        for (int i = 0; i < count; ++i)
+            fakeFolder.localModifier().insert(QStringLiteral("A/file%1").arg(i));
+        QVERIFY(fakeFolder.syncOnce());
+        QCOMPARE(fakeFolder.currentLocalState(), fakeFolder.currentRemoteState());
+
+        // Local moves, detected by inode
+        counter.reset();
+        for (int i = 0; i < count; ++i)
+            fakeFolder.localModifier().rename(QStringLiteral("A/file%1").arg(i), QStringLiteral("B/file%1").arg(i));
+        QVERIFY(fakeFolder.syncOnce());
+        QCOMPARE(fakeFolder.currentLocalState(), fakeFolder.currentRemoteState());
+        QCOMPARE(counter.nMOVE, count);
+        QCOMPARE(counter.nPUT, 0);
+        QCOMPARE(counter.nDELETE, 0);
+
+        // Remote moves, detected by file id
+        counter.reset();
+        for (int i = 0; i < count; ++i)
+            fakeFolder.remoteModifier().rename(QStringLiteral("B/file%1").arg(i), QStringLiteral("A/file%1").arg(i));
+        QVERIFY(fakeFolder.syncOnce());
+        QCOMPARE(fakeFolder.currentLocalState(), fakeFolder.currentRemoteState());
+        QCOMPARE(counter.nGET, 0);
+        QCOMPARE(counter.nPUT, 0);
+        QCOMPARE(counter.nMOVE, 0);
+        QCOMPARE(counter.nDELETE, 0);
+        QVERIFY(fakeFolder.currentLocalState().find("A/file0"));
+        QVERIFY(!fakeFolder.currentLocalState().find("B/file0"));
+    }
+
     void testMovedWithError_data()
     {
         QTest::addColumn<Vfs::Mode>("vfsMode");
@@ -10,6 +10,9 @@
 #include "common/vfs.h"
 #include "config.h"
 #include <syncengine.h>
+#include "dehydrationpolicy.h"
+#include "vfs/hydrationprefetcher.h"
+#include "propagateplaceholders.h"
 
 using namespace OCC;
 
@@ -856,6 +859,165 @@ private slots:
         QCOMPARE(fakeFolder.currentRemoteState(), expectedRemoteState);
     }
 
+    void testDehydrationPolicy()
+    {
+        FakeFolder fakeFolder{ FileInfo::A12_B12_C12_S12() };
+        auto vfs = setupVfs(fakeFolder);
+        const QStringList paths = { "A/a1", "A/a2", "B/b1", "B/b2", "C/c1", "C/c2", "S/s1", "S/s2" };
+        // Modified before any of the accesses below, so only those decide
+        const auto modTime = QDateTime::currentDateTimeUtc().addDays(-60);
+        for (const auto &path : paths) {
+            fakeFolder.localModifier().setModTime(path, modTime);
+            fakeFolder.remoteModifier().setModTime(path, modTime);
+        }
+        QVERIFY(fakeFolder.syncOnce());
+
+        DehydrationPolicy policy(fakeFolder.localPath(), &fakeFolder.syncJournal());
+        connect(&fakeFolder.syncEngine(), &SyncEngine::itemCompleted, &policy, &DehydrationPolicy::itemCompleted);
+        QSignalSpy checkedSpy(&policy, &DehydrationPolicy::quotaChecked);
+        auto checkQuota = [&]() -> QStringList {
+            checkedSpy.clear();
+            policy.checkQuota(vfs.data());
+            if (checkedSpy.isEmpty() && !checkedSpy.wait())
+                return { "timeout" };
+            return checkedSpy.first().first().toStringList();
+        };
+
+        const auto fileSize = dbRecord(fakeFolder, "A/a1")._fileSize;
+        policy.setQuota(8 * fileSize);
+        QCOMPARE(checkQuota(), QStringList());
+        QCOMPARE(policy.hydratedSize(), 8 * fileSize);
+
+        // A/a1 was used longest ago, S/s2 most recently
+        int daysAgo = 30;
+        for (const auto &path : paths) {
+            QFile file(fakeFolder.localPath() + path);
+            QVERIFY(file.open(QIODevice::ReadWrite));
+            QVERIFY(file.setFileTime(QDateTime::currentDateTimeUtc().addDays(-daysAgo--), QFileDevice::FileAccessTime));
+        }
+        // The backend saw A/a2 being opened, B/b1 is pinned, B/b2 has local changes
+        policy.fileAccessed("A/a2");
+        QVERIFY(vfs->setPinState("B/b1", PinState::AlwaysLocal));
+        fakeFolder.localModifier().appendByte("B/b2");
+
+        policy.setQuota(5 * fileSize);
+        QCOMPARE(checkQuota(), QStringList({ "A/a1", "C/c1", "C/c2" }));
+        QCOMPARE(dbRecord(fakeFolder, "A/a1")._type, ItemTypeVirtualFileDehydration);
+
+        QVERIFY(fakeFolder.syncOnce());
+        for (const auto path : { "A/a1", "C/c1", "C/c2" }) {
+            QVERIFY(!fakeFolder.currentLocalState().find(path));
+            QVERIFY(fakeFolder.currentLocalState().find(path + QStringLiteral(DVSUFFIX)));
+        }
+        QVERIFY(fakeFolder.currentLocalState().find("B/b1"));
+        QCOMPARE(fakeFolder.currentRemoteState().find("B/b2")->size, fileSize + 1);
+
+        // The sync's items were tracked: the upload made B/b2 bigger, the
+        // next least recently used file goes
+        QCOMPARE(checkQuota(), QStringList({ "S/s1" }));
+        QCOMPARE(policy.hydratedSize(), 5 * fileSize + 1);
+    }
+
+    void testBulkPlaceholderCreation()
+    {
+        FakeFolder fakeFolder{ FileInfo() };
+        setupVfs(fakeFolder);
+        QVERIFY(fakeFolder.syncOnce());
+
+        QStringList paths;
+        fakeFolder.remoteModifier().mkdir("A");
+        fakeFolder.remoteModifier().mkdir("A/B");
+        for (int i = 0; i < 20; ++i)
+            paths.append(QStringLiteral("A/a%1").arg(i));
+        for (int i = 0; i < 3; ++i)
+            paths.append(QStringLiteral("A/B/b%1").arg(i));
+        paths.append("f1");
+        for (const auto &path : qAsConst(paths))
+            fakeFolder.remoteModifier().insert(path, 64);
+
+        // Several batches per directory
+        const auto batchSize = PropagatePlaceholders::batchSize;
+        PropagatePlaceholders::batchSize = 7;
+        ItemCompletedSpy completeSpy(fakeFolder);
+        const bool synced = fakeFolder.syncOnce();
+        PropagatePlaceholders::batchSize = batchSize;
+        QVERIFY(synced);
+
+        for (const auto &path : qAsConst(paths)) {
+            const auto placeholder = path + QStringLiteral(DVSUFFIX);
+            QVERIFY(fakeFolder.currentLocalState().find(placeholder));
+            QVERIFY(!fakeFolder.currentLocalState().find(path));
+            QCOMPARE(dbRecord(fakeFolder, placeholder)._type, ItemTypeVirtualFile);
+            QCOMPARE(dbRecord(fakeFolder, placeholder)._fileSize, qint64(64));
+            QVERIFY(itemInstruction(completeSpy, placeholder, CSYNC_INSTRUCTION_NEW));
+            QCOMPARE(completeSpy.findItem(placeholder)->_status, SyncFileItem::Success);
+        }
+        QCOMPARE(completeSpy.count(), paths.size() + 2);
+
+        // The journal knows all of them
+        completeSpy.clear();
+        QVERIFY(fakeFolder.syncOnce());
+        for (const auto &args : qAsConst(completeSpy))
+            QVERIFY(args[0].value<SyncFileItemPtr>()->_instruction != CSYNC_INSTRUCTION_NEW);
+    }
+
+    void testHydrationPrefetcher()
+    {
+        FakeFolder fakeFolder{ FileInfo() };
+        auto vfs = setupVfs(fakeFolder);
+        fakeFolder.remoteModifier().mkdir("P");
+        fakeFolder.remoteModifier().mkdir("Q");
+        for (const auto path : { "P/a.txt", "P/b.txt", "P/c.png", "P/d.txt", "Q/x.txt" })
+            fakeFolder.remoteModifier().insert(path, 64);
+        QVERIFY(fakeFolder.syncOnce());
+        auto virtualPath = [](const char *path) { return QString::fromUtf8(path) + QStringLiteral(DVSUFFIX); };
+
+        HydrationPrefetcher prefetcher(fakeFolder.localPath(), &fakeFolder.syncJournal());
+        prefetcher.setVirtualFileSuffix(vfs->fileSuffix());
+        connect(&fakeFolder.syncEngine(), &SyncEngine::itemCompleted, &prefetcher, &HydrationPrefetcher::itemCompleted);
+        auto resolvePrefetches = [&](const char *requestedPath) {
+            const auto hitWindow = HydrationPrefetcher::hitWindow;
+            HydrationPrefetcher::hitWindow = std::chrono::seconds(-1);
+            const auto prefetched = prefetcher.hydrationRequested(virtualPath(requestedPath));
+            HydrationPrefetcher::hitWindow = hitWindow;
+            return prefetched;
+        };
+        QVERIFY(prefetcher.hydrationRequested(virtualPath("P/a.txt")).isEmpty());
+
+        // Same extension first and only one file fits the budget
+        prefetcher.setBudget(100);
+        QCOMPARE(prefetcher.hydrationRequested(virtualPath("P/a.txt")), QStringList({ virtualPath("P/b.txt") }));
+
+        // Files requested together before win, even from other directories
+        prefetcher.setBudget(1000);
+        QCOMPARE(prefetcher.hydrationRequested(virtualPath("Q/x.txt")), QStringList({ virtualPath("P/a.txt") }));
+
+        // Both get hydrated, P/b.txt is opened and P/a.txt never is
+        triggerDownload(fakeFolder, "P/a.txt");
+        triggerDownload(fakeFolder, "P/b.txt");
+        QVERIFY(fakeFolder.syncOnce());
+        QCOMPARE(dbRecord(fakeFolder, "P/a.txt")._type, ItemTypeFile);
+        prefetcher.fileAccessed("P/b.txt");
+        QCOMPARE(prefetcher.hitCount(), 1);
+        QCOMPARE(prefetcher.missCount(), 0);
+
+        // Writing P/a.txt during the hydration doesn't count as a use
+        QCOMPARE(resolvePrefetches("P/c.png"), QStringList({ virtualPath("Q/x.txt"), virtualPath("P/d.txt") }));
+        QCOMPARE(prefetcher.hitCount(), 1);
+        QCOMPARE(prefetcher.missCount(), 1);
+
+        // Without a report from the backend, an access after the hydration counts
+        triggerDownload(fakeFolder, "P/d.txt");
+        QVERIFY(fakeFolder.syncOnce());
+        QFile file(fakeFolder.localPath() + "P/d.txt");
+        QVERIFY(file.open(QIODevice::ReadOnly));
+        QVERIFY(file.setFileTime(QDateTime::currentDateTimeUtc().addSecs(3600), QFileDevice::FileAccessTime));
+        resolvePrefetches("P/c.png");
+        // Q/x.txt was never hydrated
+        QCOMPARE(prefetcher.hitCount(), 2);
+        QCOMPARE(prefetcher.missCount(), 2);
+    }
+
     void testWipeVirtualSuffixFiles()
     {
         FakeFolder fakeFolder{ FileInfo{} };
@@ -13,6 +13,13 @@
 
 #include "vfs/xattr/xattrwrapper.h"
 
+#ifdef WITH_FUSE3
+#include "vfs/xattr/fusemount.h"
+
+#include <sys/stat.h>
+#include <thread>
+#endif
+
 namespace xattr {
 using namespace OCC::XAttrWrapper;
 }
@@ -1089,6 +1096,108 @@ private slots:
         XAVERIFY_NONVIRTUAL(fakeFolder, "online/file1");
         XAVERIFY_VIRTUAL(fakeFolder, "local/file1");
     }
+
+    void testPlaceholderRecord()
+    {
+        FakeFolder fakeFolder{ FileInfo() };
+        auto vfs = setupVfs(fakeFolder);
+
+        fakeFolder.remoteModifier().mkdir("A");
+        fakeFolder.remoteModifier().insert("A/a1");
+        fakeFolder.remoteModifier().insert("A/a2");
+        QVERIFY(fakeFolder.syncOnce());
+        XAVERIFY_VIRTUAL(fakeFolder, "A/a1");
+
+        // Placeholders get a record of the server version
+        auto record = xattr::placeholderRecord(fakeFolder.localPath() + "A/a1");
+        QVERIFY(record);
+        QVERIFY(record->dehydrated);
+        auto db = dbRecord(fakeFolder, "A/a1");
+        QCOMPARE(record->versionHash, xattr::placeholderVersionHash(db._fileId, db._etag));
+
+        // Pin state changes don't touch the placeholders during discovery
+        const auto changeTime = QFileInfo(fakeFolder.localPath() + "A/a2").metadataChangeTime();
+        QTest::qWait(1100);
+        vfs->setPinState("A", PinState::OnlineOnly);
+        QVERIFY(fakeFolder.syncOnce());
+        XAVERIFY_VIRTUAL(fakeFolder, "A/a2");
+        QCOMPARE(QFileInfo(fakeFolder.localPath() + "A/a2").metadataChangeTime(), changeTime);
+
+        // The propagation refreshes the records of hydrated files
+        vfs->setPinState("A", PinState::AlwaysLocal);
+        QVERIFY(fakeFolder.syncOnce());
+        XAVERIFY_NONVIRTUAL(fakeFolder, "A/a1");
+        XAVERIFY_NONVIRTUAL(fakeFolder, "A/a2");
+        record = xattr::placeholderRecord(fakeFolder.localPath() + "A/a1");
+        QVERIFY(record);
+        QVERIFY(!record->dehydrated);
+
+        // A server change updates the version hash
+        fakeFolder.remoteModifier().appendByte("A/a1");
+        QVERIFY(fakeFolder.syncOnce());
+        record = xattr::placeholderRecord(fakeFolder.localPath() + "A/a1");
+        QVERIFY(record);
+        QVERIFY(!record->dehydrated);
+        db = dbRecord(fakeFolder, "A/a1");
+        QCOMPARE(record->versionHash, xattr::placeholderVersionHash(db._fileId, db._etag));
+
+        // And dehydrating writes a dehydrated record again
+        vfs->setPinState("A", PinState::OnlineOnly);
+        QVERIFY(fakeFolder.syncOnce());
+        XAVERIFY_VIRTUAL(fakeFolder, "A/a1");
+        record = xattr::placeholderRecord(fakeFolder.localPath() + "A/a1");
+        QVERIFY(record);
+        QVERIFY(record->dehydrated);
+    }
+
+#ifdef WITH_FUSE3
+    void testFuseHydration()
+    {
+        FakeFolder fakeFolder{ FileInfo() };
+        auto vfs = setupVfs(fakeFolder);
+        fakeFolder.remoteModifier().mkdir("A");
+        fakeFolder.remoteModifier().insert("A/a1", 64);
+        fakeFolder.remoteModifier().insert("A/a2", 64);
+        QVERIFY(fakeFolder.syncOnce());
+        XAVERIFY_VIRTUAL(fakeFolder, "A/a1");
+
+        // The default for new folders, unlike setupVfs()
+        fakeFolder.syncJournal().internalPinStates().setForPath(QByteArray(), PinState::OnlineOnly);
+
+        QTemporaryDir mountDir;
+        FuseMount mount(vfs->params());
+        if (!mount.mount(mountDir.path()))
+            QSKIP("FUSE is not available");
+
+        // Placeholders show the size of the server's file
+        struct stat st;
+        QCOMPARE(stat(QFile::encodeName(mountDir.path() + "/A/a2").constData(), &st), 0);
+        QCOMPARE(st.st_size, 64);
+        XAVERIFY_VIRTUAL(fakeFolder, "A/a2");
+
+        // Reading blocks while the event loop runs the download
+        QByteArray content;
+        std::atomic<bool> done(false);
+        std::thread reader([&] {
+            QFile file(mountDir.path() + "/A/a1");
+            if (file.open(QIODevice::ReadOnly))
+                content = file.readAll();
+            done = true;
+        });
+        QTRY_VERIFY(done);
+        reader.join();
+        QCOMPARE(content, QByteArray(64, 'W'));
+        QTRY_VERIFY(!mount.isHydrating());
+        XAVERIFY_NONVIRTUAL(fakeFolder, "A/a1");
+        QCOMPARE(*vfs->pinState("A/a1"), PinState::Unspecified);
+        QCOMPARE(*vfs->pinState("A/a2"), PinState::OnlineOnly);
+
+        mount.unmount();
+        QVERIFY(fakeFolder.syncOnce());
+        XAVERIFY_NONVIRTUAL(fakeFolder, "A/a1");
+        XAVERIFY_VIRTUAL(fakeFolder, "A/a2");
+    }
+#endif
 };
 
 QTEST_GUILESS_MAIN(TestSyncXAttr)